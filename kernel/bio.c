@@ -1,10 +1,15 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
 //
+// Each hash bucket has its own lock and its own LRU list, so
+// lookups of different blocks rarely contend.  A bucket with no
+// free buffer steals the least recently used free buffer of
+// another bucket; at most one bucket lock is held at a time.
+//
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
 // * After changing buffer data, call bwrite to write it to disk.
@@ -12,6 +17,8 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * bprefetch starts reading a block into the cache
+//     without waiting; a later bread waits for it.
 
 
 #include "types.h"
@@ -23,69 +30,160 @@
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define NBUCKET 13
+#define BHASH(dev, blockno) ((((dev) << 27) | (blockno)) % NBUCKET)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
 
-  // Linked list of all buffers, through prev/next.
+  // Linked list of the bucket's buffers, through prev/next.
   // Sorted by how recently the buffer was used.
   // head.next is most recent, head.prev is least.
   struct buf head;
+
+  uint nhit;     // bget()s of blocks that were cached
+  uint nmiss;    // and of blocks that weren't
+};
+
+struct {
+  struct buf buf[NBUF];
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Insert b at the most recently used end of bkt.
+// Caller must hold bkt->lock.
+static void
+bpush(struct bucket *bkt, struct buf *b)
+{
+  b->next = bkt->head.next;
+  b->prev = &bkt->head;
+  bkt->head.next->prev = b;
+  bkt->head.next = b;
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Least recently used unused buffer in bkt, or 0.
+// A buffer that the disk is still reading into by
+// prefetch is not unused.
+// Caller must hold bkt->lock.
+static struct buf*
+blru(struct bucket *bkt)
+{
+  struct buf *b;
+
+  for(b = bkt->head.prev; b != &bkt->head; b = b->prev){
+    if(b->refcnt == 0 && b->disk == 0)
+      return b;
+  }
+  return 0;
+}
+
+// Cached buffer for the block in bkt, or 0.
+// Caller must hold bkt->lock.
+static struct buf*
+blookup(struct bucket *bkt, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bkt->head.next; b != &bkt->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno)
+      return b;
+  }
+  return 0;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  struct bucket *bkt;
 
-  initlock(&bcache.lock, "bcache");
+  for(bkt = bcache.bucket; bkt < bcache.bucket+NBUCKET; bkt++){
+    initlock(&bkt->lock, "bcache.bucket");
+    bkt->head.prev = &bkt->head;
+    bkt->head.next = &bkt->head;
+  }
 
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
+  // Spread the buffers over the buckets.
   for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
     initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bpush(&bcache.bucket[(b - bcache.buf) % NBUCKET], b);
   }
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// If ifnew is set, return 0 instead if the block is cached.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int ifnew)
 {
-  struct buf *b;
+  struct buf *b, *victim;
+  struct bucket *bkt, *other;
+  int id, i;
 
-  acquire(&bcache.lock);
+  id = BHASH(dev, blockno);
+  bkt = &bcache.bucket[id];
+  acquire(&bkt->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
-  }
+  if((b = blookup(bkt, dev, blockno)) != 0)
+    goto cached;
 
   // Not cached.
   // Recycle the least recently used (LRU) unused buffer.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->valid = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
-    }
+  if((b = blru(bkt)) != 0)
+    goto found;
+  release(&bkt->lock);
+
+  // This bucket is full; steal from the others.  Holding
+  // only one bucket lock at a time avoids lock-order deadlocks.
+  victim = 0;
+  for(i = 1; i < NBUCKET && victim == 0; i++){
+    other = &bcache.bucket[(id + i) % NBUCKET];
+    acquire(&other->lock);
+    if((victim = blru(other)) != 0)
+      bunlink(victim);
+    release(&other->lock);
+  }
+  if(victim == 0)
+    panic("bget: no buffers");
+
+  acquire(&bkt->lock);
+  victim->valid = 0;
+  bpush(bkt, victim);
+
+  // Someone may have cached the block while no lock was held.
+  if((b = blookup(bkt, dev, blockno)) != 0)
+    goto cached;
+  b = victim;
+
+found:
+  bkt->nmiss++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->valid = 0;
+  b->refcnt = 1;
+  release(&bkt->lock);
+  acquiresleep(&b->lock);
+  return b;
+
+cached:
+  if(ifnew){
+    release(&bkt->lock);
+    return 0;
   }
-  panic("bget: no buffers");
+  bkt->nhit++;
+  b->refcnt++;
+  release(&bkt->lock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -94,60 +192,138 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if(!b->valid) {
-    virtio_disk_rw(b, 0);
+    blkrw(b, IO_READ);
     b->valid = 1;
+  } else if(b->disk) {
+    // a prefetch is still reading it.
+    blkwait(b, IO_READ);
   }
   return b;
 }
 
+// Return a locked buf for a block that the caller is about to
+// overwrite completely, without reading it from disk.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if(b->valid && b->disk)
+    blkwait(b, IO_READ);  // don't race a prefetch
+  b->valid = 1;
+  return b;
+}
+
+// Start reading a block into the cache, unless it
+// is already there, and return without waiting.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  // valid now means the data will be there once
+  // b->disk is clear; blru() won't recycle b before.
+  b->valid = 1;
+  blksubmit(&b, 1, 0);
+  brelse(b);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("bwrite");
-  virtio_disk_rw(b, 1);
+  blkrw(b, IO_WRITE);
+}
+
+// Write b like bwrite(), for a caller that has nothing to do
+// until it is on disk, so blk.c may poll for it.
+void
+bwritesync(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritesync");
+  blkrw(b, IO_SYNC);
+}
+
+// Write n locked buffers, keeping all the writes in
+// flight at once, and wait for all of them.
+void
+bwritev(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+  }
+  blksubmit(bufs, n, 1);
+  for(i = 0; i < n; i++)
+    blkwait(bufs[i], IO_WRITE);
 }
 
 // Release a locked buffer.
-// Move to the head of the most-recently-used list.
+// Move to the head of its bucket's most-recently-used list.
 void
 brelse(struct buf *b)
 {
+  struct bucket *bkt;
+
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
   releasesleep(&b->lock);
 
-  acquire(&bcache.lock);
+  bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&bkt->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    bunlink(b);
+    bpush(bkt, b);
   }
   
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
 void
 bpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bkt->lock);
   b->refcnt++;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
 void
 bunpin(struct buf *b) {
-  acquire(&bcache.lock);
+  struct bucket *bkt = &bcache.bucket[BHASH(b->dev, b->blockno)];
+
+  acquire(&bkt->lock);
   b->refcnt--;
-  release(&bcache.lock);
+  release(&bkt->lock);
 }
 
+// Report how often bget() found the block cached.
+int
+statsbcache(char *buf, int sz)
+{
+  struct bucket *bkt;
+  uint nhit, nmiss;
 
+  nhit = nmiss = 0;
+  for(bkt = bcache.bucket; bkt < bcache.bucket+NBUCKET; bkt++){
+    acquire(&bkt->lock);
+    nhit += bkt->nhit;
+    nmiss += bkt->nmiss;
+    release(&bkt->lock);
+  }
+  return snprintf(buf, sz, "bcache: %d hits, %d misses, %d%% hit\n", nhit, nmiss,
+                  nhit + nmiss ? (int)((uint64)nhit * 100 / (nhit + nmiss)) : 0);
+}
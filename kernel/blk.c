@@ -0,0 +1,323 @@
+// Block request queue.
+//
+// bio.c hands disk reads and writes to blksubmit(), which
+// queues them rather than giving each to the disk driver at
+// once.  blkdispatch() starts queued blocks whenever the driver
+// has room, taking runs of adjacent blocks going the same way
+// as one disk request.
+//
+// Reads and writes wait in separate queues sorted by block
+// number.  Reads go first, since someone is usually waiting
+// for them, while most writes are the logger installing
+// transactions in the background.  Within a queue, blocks are
+// started in one sweep up the disk from the last block started,
+// then back to the lowest (C-SCAN), except that a block that
+// has waited past its deadline goes next, so neither a stream
+// of reads nor a crowd of nearby blocks can starve it.
+//
+// No caller depends on the order of the writes it has in the
+// queue: bwritev() waits for all of them before the log writes
+// anything that depends on them.
+//
+// A wait for a kind of request in blkpoll[] first spins for up
+// to DISKPOLL on the used ring, to save an interrupt and a trip
+// through the scheduler on a request the commit path is stuck
+// behind, and only then sleeps.  blkspin() never sleeps, for
+// swap.c's reads under a spinlock.
+//
+// The disk interrupt only acknowledges the device; retiring
+// what it finished, with the wakeups that go with that, and
+// starting more waits for softirq(), so a burst of completions
+// neither holds a queue lock with interrupts off for long nor
+// keeps the PLIC from delivering the next interrupt.
+//
+// Each disk has its queues, lock and statistics to itself, so
+// one disk's traffic never waits behind another's.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "buf.h"
+#include "proc.h"
+#include "defs.h"
+
+#define READEXPIRE  (TIMEFREQ/20)  // 50 ms in r_time() units
+#define WRITEEXPIRE (TIMEFREQ/2)   // 500 ms
+
+// Which kinds of request (IO_*) blkwait() polls for.
+static int blkpoll[NIOKIND] = {
+  [IO_READ]  0,
+  [IO_WRITE] 0,
+  [IO_SYNC]  1,
+};
+
+struct blkq {
+  struct spinlock lock;
+  struct buf *q[2];     // waiting reads and writes, by blockno
+  uint pos;             // block after the last one started
+
+  // Statistics.
+  uint nblock[2];       // blocks read and written
+  uint nreq;            // disk requests
+  uint depth;           // blocks queued or on the disk
+  uint maxdepth;
+  uint64 depthsum;      // of depth as each block is queued
+  uint64 wait[2];       // r_time() from queueing to done, summed
+  uint npoll;           // polled waits that didn't have to sleep
+  uint nslept;          // polled waits that did
+  int intr;             // interrupted since blkcomplete() looked
+};
+static struct blkq blkq[NDISK];
+
+static void blkcomplete(void);
+static struct work blkwork = { blkcomplete };
+
+void
+blkinit(void)
+{
+  int i;
+
+  for(i = 0; i < NDISK; i++)
+    initlock(&blkq[i].lock, "blkq");
+}
+
+// The block in non-empty queue q that has waited past
+// expire, or 0.  Caller must hold its disk's lock.
+static struct buf*
+blkexpired(struct buf *q, uint64 expire)
+{
+  struct buf *b, *oldest;
+
+  oldest = q;
+  for(b = q; b; b = b->qnext)
+    if(b->qtime < oldest->qtime)
+      oldest = b;
+  return r_time() - oldest->qtime > expire ? oldest : 0;
+}
+
+// The block in non-empty queue q of disk d to start first.
+// Caller must hold d->lock.
+static struct buf*
+blknext(struct blkq *d, struct buf *q, uint64 expire)
+{
+  struct buf *b;
+
+  if((b = blkexpired(q, expire)) != 0)
+    return b;
+  for(b = q; b; b = b->qnext)
+    if(b->blockno >= d->pos)
+      return b;
+  return q;
+}
+
+// Start as much of disk n's queues as the driver has room for.
+// Caller must hold its lock.
+static void
+blkdispatch(int disk)
+{
+  struct blkq *d = &blkq[disk];
+  struct buf *first, *last, **pp;
+  int w, n, max, started;
+
+  started = 0;
+  max = virtio_disk_max(disk);
+  while(d->q[0] || d->q[1]){
+    w = d->q[0] == 0 || (d->q[1] && blkexpired(d->q[1], WRITEEXPIRE));
+    first = blknext(d, d->q[w], w ? WRITEEXPIRE : READEXPIRE);
+    for(last = first, n = 1; n < max && last->qnext; last = last->qnext, n++){
+      if(last->qnext->blockno != last->blockno + 1)
+        break;
+    }
+    if(virtio_disk_start(first, n, w) < 0)
+      break;
+    for(pp = &d->q[w]; *pp != first; pp = &(*pp)->qnext)
+      ;
+    *pp = last->qnext;
+    d->pos = last->blockno + 1;
+    d->nreq++;
+    started = 1;
+  }
+  if(started)
+    virtio_disk_notify(disk);
+}
+
+// Queue reads (write == 0) or writes of the n buffers in
+// bufs[] and return without waiting for them to finish.
+// blkdone() clears b->disk when b is done.
+void
+blksubmit(struct buf **bufs, int n, int write)
+{
+  struct buf *b, **pp;
+  struct blkq *d;
+  struct proc *p;
+  int i, disk;
+
+  if((p = myproc()) != 0)
+    p->nblk[write] += n;
+  for(i = 0; i < n; ){
+    // the run of bufs[] that are on one disk.
+    disk = DISK(bufs[i]->dev);
+    d = &blkq[disk];
+    acquire(&d->lock);
+    for(; i < n && DISK(bufs[i]->dev) == disk; i++){
+      b = bufs[i];
+      b->disk = 1;
+      b->qtime = r_time();
+      for(pp = &d->q[write]; *pp && (*pp)->blockno < b->blockno; pp = &(*pp)->qnext)
+        ;
+      b->qnext = *pp;
+      *pp = b;
+      d->nblock[write]++;
+      d->depth++;
+      d->depthsum += d->depth;
+      if(d->depth > d->maxdepth)
+        d->maxdepth = d->depth;
+    }
+    blkdispatch(disk);
+    release(&d->lock);
+  }
+}
+
+// Wait for a submitted request of the given kind for b to
+// finish.
+void
+blkwait(struct buf *b, int kind)
+{
+  int disk = DISK(b->dev);
+  struct blkq *d = &blkq[disk];
+  uint64 start;
+
+  acquire(&d->lock);
+  if(blkpoll[kind] && b->disk == 1){
+    start = r_time();
+    while(b->disk == 1 && r_time() - start < DISKPOLL){
+      virtio_disk_poll(disk);
+      blkdispatch(disk);
+      // let the interrupt and other CPUs in.
+      release(&d->lock);
+      acquire(&d->lock);
+    }
+    if(b->disk == 1)
+      d->nslept++;
+    else
+      d->npoll++;
+  }
+  while(b->disk == 1)
+    sleep(b, &d->lock);
+  release(&d->lock);
+}
+
+// Wait for a submitted request for b to finish without
+// sleeping, for a caller that holds a spinlock, by polling
+// the used ring until it has.
+void
+blkspin(struct buf *b)
+{
+  int disk = DISK(b->dev);
+  struct blkq *d = &blkq[disk];
+
+  acquire(&d->lock);
+  while(b->disk == 1){
+    virtio_disk_poll(disk);
+    blkdispatch(disk);
+    release(&d->lock);
+    acquire(&d->lock);
+  }
+  release(&d->lock);
+}
+
+void
+blkrw(struct buf *b, int kind)
+{
+  blksubmit(&b, 1, kind != IO_READ);
+  blkwait(b, kind);
+}
+
+// The driver has finished the n blocks from b on, linked
+// through qnext.  Caller must hold their disk's lock.
+void
+blkdone(struct buf *b, int n, int write)
+{
+  struct blkq *d = &blkq[DISK(b->dev)];
+  uint64 now = r_time();
+  struct buf *next;
+
+  for(; n > 0; n--, b = next){
+    // once b->disk is clear, b may be reused.
+    next = b->qnext;
+    d->wait[write] += now - b->qtime;
+    d->depth--;
+    b->disk = 0;   // disk is done with buf
+    wakeup(b);
+  }
+}
+
+// Disk n's interrupt.
+void
+blkintr(int disk)
+{
+  virtio_disk_ack(disk);
+  __atomic_store_n(&blkq[disk].intr, 1, __ATOMIC_RELEASE);
+  defer(&blkwork);
+}
+
+// After disk interrupts: retire finished requests and start
+// more on each disk that interrupted.
+static void
+blkcomplete(void)
+{
+  struct blkq *d;
+  int disk;
+
+  for(disk = 0; disk < NDISK; disk++){
+    d = &blkq[disk];
+    if(__atomic_exchange_n(&d->intr, 0, __ATOMIC_ACQUIRE) == 0)
+      continue;
+    acquire(&d->lock);
+    virtio_disk_intr(disk);
+    blkdispatch(disk);
+    release(&d->lock);
+  }
+}
+
+// Report each disk's traffic, queue depth and latency.  The
+// root disk's line is "disk:", disk n's "diskn:".
+int
+statsblk(char *buf, int sz)
+{
+  uint nr, nw, nreq, maxdepth, avgdepth, npoll, nslept;
+  uint64 rlat, wlat;
+  struct blkq *d;
+  char name[8];
+  int disk, n;
+
+  n = 0;
+  for(disk = 0; disk < NDISK; disk++){
+    if(!virtio_disk_present(disk))
+      continue;
+    d = &blkq[disk];
+    acquire(&d->lock);
+    nr = d->nblock[0];
+    nw = d->nblock[1];
+    nreq = d->nreq;
+    maxdepth = d->maxdepth;
+    avgdepth = nr + nw ? d->depthsum / (nr + nw) : 0;
+    // in microseconds.
+    rlat = nr ? d->wait[0] / nr / (TIMEFREQ / 1000000) : 0;
+    wlat = nw ? d->wait[1] / nw / (TIMEFREQ / 1000000) : 0;
+    npoll = d->npoll;
+    nslept = d->nslept;
+    release(&d->lock);
+
+    if(disk == 0)
+      snprintf(name, sizeof(name), "disk");
+    else
+      snprintf(name, sizeof(name), "disk%d", disk);
+    n += snprintf(buf+n, sz-n, "%s: %d reads, %d writes, %d requests, depth %d avg %d max, latency %d us read %d us write, %d polled %d slept\n",
+                  name, nr, nw, nreq, avgdepth, maxdepth, (int)rlat, (int)wlat, npoll, nslept);
+  }
+  return n;
+}
@@ -7,6 +7,17 @@ struct buf {
   uint refcnt;
   struct buf *prev; // LRU cache list
   struct buf *next;
+  struct buf *qnext; // blk.c's queue, or the rest of a disk request
+  uint64 qtime;     // r_time() when queued
   uchar data[BSIZE];
 };
 
+// Kinds of disk request, for blk.c, which may poll for some.
+#define IO_READ   0
+#define IO_WRITE  1
+#define IO_SYNC   2  // a write someone is waiting on, like a commit
+#define NIOKIND   3
+
+
+// The virtio disk, counting from 0, that device dev is.
+#define DISK(dev) ((dev) - ROOTDEV)
@@ -17,6 +17,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "fcntl.h"
 #include "memlayout.h"
 #include "riscv.h"
 #include "defs.h"
@@ -58,13 +59,14 @@ struct {
 int
 consolewrite(int user_src, uint64 src, int n)
 {
-  int i;
+  char buf[128];
+  int i, m;
 
-  for(i = 0; i < n; i++){
-    char c;
-    if(either_copyin(&c, user_src, src+i, 1) == -1)
+  for(i = 0; i < n; i += m){
+    m = n - i < sizeof(buf) ? n - i : sizeof(buf);
+    if(either_copyin(buf, user_src, src+i, m) == -1)
       break;
-    uartputc(c);
+    uartwrite(buf, m);
   }
 
   return i;
@@ -80,12 +82,13 @@ int
 consoleread(int user_dst, uint64 dst, int n)
 {
   uint target;
-  int c;
-  char cbuf;
+  int c, m, done;
+  char buf[INPUT_BUF];
 
   target = n;
-  acquire(&cons.lock);
-  while(n > 0){
+  done = 0;
+  while(n > 0 && !done){
+    acquire(&cons.lock);
     // wait until interrupt handler has put some
     // input into cons.buffer.
     while(cons.r == cons.w){
@@ -96,32 +99,38 @@ consoleread(int user_dst, uint64 dst, int n)
       sleep(&cons.r, &cons.lock);
     }
 
-    c = cons.buf[cons.r++ % INPUT_BUF];
-
-    if(c == C('D')){  // end-of-file
-      if(n < target){
-        // Save ^D for next time, to make sure
-        // caller gets a 0-byte result.
-        cons.r--;
+    // take what has arrived, as far as the end of a line.
+    for(m = 0; m < n && m < sizeof(buf) && cons.r != cons.w; ){
+      c = cons.buf[cons.r++ % INPUT_BUF];
+
+      if(c == C('D')){  // end-of-file
+        if(m > 0 || n < target){
+          // Save ^D for next time, to make sure
+          // caller gets a 0-byte result.
+          cons.r--;
+        }
+        done = 1;
+        break;
       }
-      break;
-    }
 
-    // copy the input byte to the user-space buffer.
-    cbuf = c;
-    if(either_copyout(user_dst, dst, &cbuf, 1) == -1)
-      break;
+      buf[m++] = c;
 
-    dst++;
-    --n;
+      if(c == '\n'){
+        // a whole line has arrived, return to
+        // the user-level read().
+        done = 1;
+        break;
+      }
+    }
+    release(&cons.lock);
 
-    if(c == '\n'){
-      // a whole line has arrived, return to
-      // the user-level read().
+    // copy to the user-space buffer without cons.lock,
+    // since a page of it may have to be read from a file.
+    if(either_copyout(user_dst, dst, buf, m) == -1)
       break;
-    }
+    dst += m;
+    n -= m;
   }
-  release(&cons.lock);
 
   return target - n;
 }
@@ -170,6 +179,7 @@ consoleintr(int c)
         // has arrived.
         cons.w = cons.e;
         wakeup(&cons.r);
+        pollwakeup();
       }
     }
     break;
@@ -178,6 +188,19 @@ consoleintr(int c)
   release(&cons.lock);
 }
 
+// Whether a read() would find input waiting, for poll().
+int
+consolepoll(void)
+{
+  int r = POLLOUT;
+
+  acquire(&cons.lock);
+  if(cons.r != cons.w)
+    r |= POLLIN;
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -189,4 +212,5 @@ consoleinit(void)
   // to consoleread and consolewrite.
   devsw[CONSOLE].read = consoleread;
   devsw[CONSOLE].write = consolewrite;
+  devsw[CONSOLE].poll = consolepoll;
 }
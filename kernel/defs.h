@@ -1,21 +1,45 @@
 struct buf;
 struct context;
+struct cpu;
 struct file;
 struct inode;
+struct iovec;
+struct kmcache;
+struct lockclass;
 struct pipe;
+struct pollfd;
 struct proc;
+struct rcuhead;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct ushared;
+struct vma;
+struct work;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bnew(uint, uint);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritesync(struct buf*);
 void            bpin(struct buf*);
 void            bunpin(struct buf*);
+void            bwritev(struct buf**, int);
+void            bprefetch(uint, uint);
+int             statsbcache(char*, int);
+
+// blk.c
+void            blkinit(void);
+void            blksubmit(struct buf **, int, int);
+void            blkwait(struct buf *, int);
+void            blkspin(struct buf *);
+void            blkrw(struct buf *, int);
+void            blkdone(struct buf *, int, int);
+void            blkintr(int);
+int             statsblk(char*, int);
 
 // console.c
 void            consoleinit(void);
@@ -23,7 +47,7 @@ void            consoleintr(int);
 void            consputc(int);
 
 // exec.c
-int             exec(char*, char**);
+int             exec(struct proc*, char*, uint64, uint64);
 
 // file.c
 struct file*    filealloc(void);
@@ -33,9 +57,15 @@ void            fileinit(void);
 int             fileread(struct file*, uint64, int n);
 int             filestat(struct file*, uint64 addr);
 int             filewrite(struct file*, uint64, int n);
+int             filereadv(struct file*, struct iovec*, int, int);
+int             filewritev(struct file*, struct iovec*, int, int);
+int             filesplice(struct file*, struct file*, int n);
+int             filepoll(struct file**, struct pollfd*, int, int);
+void            pollwakeup(void);
 
 // fs.c
 void            fsinit(int);
+void            dcremove(struct inode*, char*);
 int             dirlink(struct inode*, char*, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
@@ -49,32 +79,94 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+struct inode*   fsroot(int);
+int             mount(struct inode*, struct inode*);
+int             mntcovers(struct inode*);
 int             readi(struct inode*, int, uint64, uint, uint);
+int             readblk(struct inode*, int, uint64, uint, uint);
+int             writeblk(struct inode*, int, uint64, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, int, uint64, uint, uint);
 void            itrunc(struct inode*);
+int             statsfs(char*, int);
 
 // ramdisk.c
 void            ramdiskinit(void);
 void            ramdiskintr(void);
 void            ramdiskrw(struct buf*);
 
+// ipi.c
+void            ipi(int);
+void            ipirecv(void);
+void            smpcall(uint, void (*)(void*), void*);
+
 // kalloc.c
 void*           kalloc(void);
 void            kfree(void *);
+void            kfreen(void **, int);
 void            kinit(void);
+void            kincref(void*);
+int             kgetref(void*);
+int             kfreepages(void);
+int             statsmem(char*, int);
+
+// ksm.c
+void            ksminit(void);
+int             statsksm(char*, int);
 
 // log.c
 void            initlog(int, struct superblock*);
+int             statslog(char*, int);
 void            log_write(struct buf*);
+void            log_ordered(struct buf*);
+void            log_writeback(struct buf*);
+void            log_free(int);
 void            begin_op(void);
 void            end_op(void);
+void            begin_opn(int, int);
+void            end_opn(int, int);
+
+// main.c
+void            bootmark(char*);
+int             statsboot(char*, int);
+
+// mmap.c
+uint64          mmap(uint64, int, int, struct file*, uint);
+int             munmap(uint64, uint64);
+void            munmapall(struct proc*);
+int             mmapfork(pagetable_t, pagetable_t, struct vma*);
+
+// pcache.c
+void            pcinit(void);
+int             pcread(struct inode*, char*, uint, uint);
+char*           pcget(struct inode*, uint);
+char*           pcgetshared(struct inode*, uint);
+void            pcinval(struct inode*);
+void            pcinvalrange(struct inode*, uint, uint);
+int             pcshrink(void);
+int             pcwrite(struct inode*, int, uint64, uint, uint);
+void            pcundirty(struct inode*);
+void            pcwriteback(struct inode*);
+void            pcsync(void);
+void            pcthrottle(void);
+void            flusher(void);
+int             statspcache(char*, int);
+
+// perf.c
+void            perfin(struct cpu*);
+void            perfout(struct proc*, struct cpu*);
+void            perfreset(void);
+void            perfget(uint64*);
 
 // pipe.c
+void            pipeinit(void);
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
-int             piperead(struct pipe*, uint64, int);
-int             pipewrite(struct pipe*, uint64, int);
+int             piperead(struct pipe*, uint64, int, int);
+int             pipewrite(struct pipe*, uint64, int, int);
+int             pipepoll(struct pipe*, int);
+int             pipesplicein(struct pipe*, struct inode*, uint*, int);
+int             pipespliceout(struct pipe*, struct inode*, uint*, int);
 
 // printf.c
 void            printf(char*, ...);
@@ -82,11 +174,27 @@ void            panic(char*) __attribute__((noreturn));
 void            printfinit(void);
 void            backtrace(void);
 
+// prof.c
+extern int      profon;
+void            profinit(void);
+void            proftrap(int, uint64, uint64);
+int             statsprof(char*, int);
+
 // proc.c
 int             cpuid(void);
 void            exit(int);
 int             fork(void);
-int             growproc(int);
+int             vfork(void);
+int             spawn(char*, uint64, int*, int);
+void            vforkdone(struct proc*);
+uint64          growproc(int);
+int             clone(uint64, uint64, uint64);
+int             join(int, uint64);
+int             futexwait(uint64, int);
+void            preempt(void);
+int             setaffinity(int, int);
+int             futexwake(uint64, int);
+void            tlbshootdown(struct proc*, uint64, uint64);
 void            proc_mapstacks(pagetable_t);
 pagetable_t     proc_pagetable(struct proc *);
 void            proc_freepagetable(pagetable_t, uint64);
@@ -101,28 +209,74 @@ void            sleep(void*, struct spinlock*);
 void            userinit(void);
 int             wait(uint64);
 void            wakeup(void*);
+int             wakeupone(void*);
 void            yield(void);
 int             either_copyout(int user_dst, uint64 dst, void *src, uint64 len);
 int             either_copyin(void *dst, int user_src, uint64 src, uint64 len);
 void            procdump(void);
+int             statsproc(char*, int);
+void            kthread(char*, void (*)(void));
 void            sigalarm(int, void (*handler)(void));
 void            sigreturn(void);
+
+// rcu.c
+void            rcuinit(void);
+void            rcureadlock(void);
+void            rcureadunlock(void);
+void            rcuqs(void);
+void            rcusync(void);
+void            rcucall(struct rcuhead*, void (*)(void*), void*);
+int             statsrcu(char*, int);
+
+// start.c
+int             timertick(void);
+
+// swap.c
+void            swapinit(int, uint, uint);
+void            swapdup(uint);
+void            swapfree(uint);
+int             swapin(struct proc*, uint64);
+int             reclaim(int);
+int             statsswap(char*, int);
+
 // swtch.S
 void            swtch(struct context*, struct context*);
 
 // spinlock.c
 void            acquire(struct spinlock*);
 int             holding(struct spinlock*);
+int             holdingany(void);
 void            initlock(struct spinlock*, char*);
+void            freelock(struct spinlock*);
 void            release(struct spinlock*);
+int             tryacquire(struct spinlock*);
 void            push_off(void);
 void            pop_off(void);
+int             statslock(char*, int);
+#ifdef LOCKBENCH
+void            lockbench(void);
+#endif
+struct lockclass* lockclass(struct lockclass*, int*, int, char*, int);
 
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
+void            freesleeplock(struct sleeplock*);
+void            statssleeplock(struct lockclass*, int*, int);
+
+// slab.c
+void            kminit(struct kmcache*, char*, uint, void (*)(void*), void (*)(void*));
+void*           kmalloc(struct kmcache*);
+void            kmfree(void*);
+int             statskmcache(char*, int);
+
+// sprintf.c
+int             snprintf(char*, int, char*, ...);
+
+// stats.c
+void            statsinit(void);
 
 // string.c
 int             memcmp(const void*, const void*, uint);
@@ -130,6 +284,7 @@ void*           memmove(void*, const void*, uint);
 void*           memset(void*, int, uint);
 char*           safestrcpy(char*, const char*, int);
 int             strlen(const char*);
+int             strnlen(const char*, uint);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
@@ -137,21 +292,47 @@ char*           strncpy(char*, const char*, int);
 int             argint(int, int*);
 int             argstr(int, char*, int);
 int             argaddr(int, uint64 *);
+int             statssyscall(char*, int);
 int             fetchstr(uint64, char*, int);
 int             fetchaddr(uint64, uint64*);
 void            syscall();
+int             syscallfast(void);
+
+// timer.c
+void            timerinithart(void);
+int             timerintr(void);
+void            timeridle(int);
+int             sleepuntil(uint64);
+void            timerpoll(uint64);
+void            timerpollcancel(void);
+
+// tmpfs.c
+void            tmpfsinit(void);
+uint            tmpinum(void);
+void            tmpifree(uint);
+void            tmpupdate(struct inode*);
+void            tmptrunc(struct inode*);
+int             tmpread(struct inode*, int, uint64, uint, uint);
+int             tmpwrite(struct inode*, int, uint64, uint, uint);
+int             statstmp(char*, int);
 
 // trap.c
 extern uint     ticks;
 void            trapinit(void);
 void            trapinithart(void);
 extern struct spinlock tickslock;
+extern struct ushared *ushared;
+void            usertrap(void);
 void            usertrapret(void);
+void            defer(struct work*);
+void            softirq(void);
 
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
-void            uartputc(int);
+void            uartwrite(char*, int);
+void            uartputs(char*, int);
+void            uartflush(void);
 void            uartputc_sync(int);
 int             uartgetc(void);
 
@@ -165,9 +346,20 @@ void            uvminit(pagetable_t, uchar *, uint);
 uint64          uvmalloc(pagetable_t, uint64, uint64);
 uint64          uvmdealloc(pagetable_t, uint64, uint64);
 int             uvmcopy(pagetable_t, pagetable_t, uint64);
+int             uvmcow(pagetable_t, uint64);
+int             uvmlazy(pagetable_t, uint64, uint64, int);
+int             uvmfile(struct proc*, uint64);
+int             uvmfault(struct proc*, uint64, int);
+void            uvmprefault(uint64, int, int);
+uint64          uvmasid(struct proc*);
+struct vma*     vmafind(struct proc*, uint64);
+void            vmaclear(struct vma*);
+void            vmadup(struct vma*, struct vma*);
+void            vmaput(struct vma*);
 void            uvmfree(pagetable_t, uint64);
 void            uvmunmap(pagetable_t, uint64, uint64, int);
 void            uvmclear(pagetable_t, uint64);
+pte_t *         walk(pagetable_t, uint64, int);
 uint64          walkaddr(pagetable_t, uint64);
 int             copyout(pagetable_t, uint64, char *, uint64);
 int             copyin(pagetable_t, char *, uint64, uint64);
@@ -178,11 +370,17 @@ void            plicinit(void);
 void            plicinithart(void);
 int             plic_claim(void);
 void            plic_complete(int);
+void            plicsteer(void);
 
 // virtio_disk.c
 void            virtio_disk_init(void);
-void            virtio_disk_rw(struct buf *, int);
-void            virtio_disk_intr(void);
+int             virtio_disk_present(int);
+int             virtio_disk_max(int);
+int             virtio_disk_start(struct buf *, int, int);
+void            virtio_disk_notify(int);
+void            virtio_disk_poll(int);
+void            virtio_disk_ack(int);
+void            virtio_disk_intr(int);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
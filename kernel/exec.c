@@ -7,19 +7,54 @@
 #include "defs.h"
 #include "elf.h"
 
-static int loadseg(pde_t *pgdir, uint64 addr, struct inode *ip, uint offset, uint sz);
+// Copy the strings of the null-terminated list at user address
+// ulist, if it isn't 0, to dst, one after another, in at most
+// max bytes.  Sets *count and returns the bytes used, or -1.
+static int
+fetchlist(uint64 ulist, char *dst, int max, int *count)
+{
+  uint64 u;
+  int n, len;
+
+  *count = 0;
+  if(ulist == 0)
+    return 0;
+  for(n = 0;; (*count)++){
+    if(fetchaddr(ulist + *count * sizeof(uint64), &u) < 0)
+      return -1;
+    if(u == 0)
+      return n;
+    if((len = fetchstr(u, dst + n, max - n)) < 0)
+      return -1;
+    n += len + 1;
+  }
+}
 
+// Replace p's user image with the program at path.  p is the
+// current process, or one spawn() is building that hasn't run
+// yet.  uargv and uenvp are the null-terminated argument and
+// environment lists in the current process's memory; uenvp
+// may be 0.  The program starts as main(argc, argv, envp).
 int
-exec(char *path, char **argv)
+exec(struct proc *p, char *path, uint64 uargv, uint64 uenvp)
 {
-  char *s, *last;
-  int i, off;
-  uint64 argc, sz = 0, sp, ustack[MAXARG], stackbase;
+  char *s, *last, *stack;
+  int i, off, n, m, argc, envc;
+  uint64 sz = 0, sp, stackbase, *uv;
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], *v, tmp;
   pagetable_t pagetable = 0, oldpagetable;
-  struct proc *p = myproc();
+  uint64 oldsz;
+
+  // the other threads would be left running in the old image.
+  // Only p could start another, so the count can't go up.
+  if(p->group != p || p->nthread > 1)
+    return -1;
+
+  memset(vma, 0, sizeof(vma));
+  v = vma;
 
   begin_op();
 
@@ -38,32 +73,45 @@ exec(char *path, char **argv)
   if((pagetable = proc_pagetable(p)) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Describe the program's segments; uvmfile() pages
+  // them in as the program touches them.
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, 0, (uint64)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
-    if(ph.type != ELF_PROG_LOAD)
+    if(ph.type != ELF_PROG_LOAD || ph.memsz == 0)
       continue;
     if(ph.memsz < ph.filesz)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    uint64 sz1;
-    if((sz1 = uvmalloc(pagetable, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz > MMAPBASE - 2*PGSIZE)  // room for the stack
       goto bad;
-    sz = sz1;
-    if((ph.vaddr % PGSIZE) != 0)
+    if((ph.vaddr % PGSIZE) != 0 || ph.vaddr < PGROUNDUP(sz))
       goto bad;
-    if(loadseg(pagetable, ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.off + ph.filesz < ph.off)
       goto bad;
+    if(v == &vma[NVMA])
+      goto bad;
+    v->start = ph.vaddr;
+    v->end = PGROUNDUP(ph.vaddr + ph.memsz);
+    v->ip = idup(ip);
+    v->off = ph.off;
+    v->filesz = ph.filesz;
+    // a segment with no flags is never mapped; see uvmfile().
+    v->perm = 0;
+    if(ph.flags & (ELF_PROG_FLAG_READ|ELF_PROG_FLAG_WRITE))
+      v->perm |= PTE_R;  // RISC-V has no write-only pages
+    if(ph.flags & ELF_PROG_FLAG_WRITE)
+      v->perm |= PTE_W;
+    if(ph.flags & ELF_PROG_FLAG_EXEC)
+      v->perm |= PTE_X;
+    v++;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  p = myproc();
-  uint64 oldsz = p->sz;
-
   // Allocate two pages at the next page boundary.
   // Use the second as the user stack.
   sz = PGROUNDUP(sz);
@@ -75,46 +123,70 @@ exec(char *path, char **argv)
   sp = sz;
   stackbase = sp - PGSIZE;
 
-  // Push argument strings, prepare rest of stack in ustack.
-  for(argc = 0; argv[argc]; argc++) {
-    if(argc >= MAXARG)
-      goto bad;
-    sp -= strlen(argv[argc]) + 1;
-    sp -= sp % 16; // riscv sp must be 16-byte aligned
-    if(sp < stackbase)
-      goto bad;
-    if(copyout(pagetable, sp, argv[argc], strlen(argv[argc]) + 1) < 0)
-      goto bad;
-    ustack[argc] = sp;
-  }
-  ustack[argc] = 0;
-
-  // push the array of argv[] pointers.
-  sp -= (argc+1) * sizeof(uint64);
-  sp -= sp % 16;
-  if(sp < stackbase)
+  // Copy the argument and environment strings from the
+  // caller straight into the bottom of the stack page, move
+  // them up to its top, and put the argv[] and envp[] arrays
+  // under them.  All of it must fit in the page.
+  stack = (char*)walkaddr(pagetable, stackbase);
+  if((n = fetchlist(uargv, stack, PGSIZE, &argc)) < 0 ||
+     (m = fetchlist(uenvp, stack + n, PGSIZE - n, &envc)) < 0)
     goto bad;
-  if(copyout(pagetable, sp, (char *)ustack, (argc+1)*sizeof(uint64)) < 0)
+  n += m;
+  off = PGSIZE - n;
+  i = (off - (argc + 1 + envc + 1) * (int)sizeof(uint64)) & ~15;  // riscv sp must be 16-byte aligned
+  if(i < 0)
     goto bad;
-
-  // arguments to user main(argc, argv)
+  memmove(stack + off, stack, n);
+  sp = stackbase + i;
+  uv = (uint64*)(stack + i);
+  s = stack + off;
+  for(m = 0; m < argc; m++, s += strlen(s) + 1)
+    uv[m] = stackbase + (s - stack);
+  uv[m++] = 0;
+  for(; m < argc + 1 + envc; m++, s += strlen(s) + 1)
+    uv[m] = stackbase + (s - stack);
+  uv[m] = 0;
+
+  // arguments to user main(argc, argv, envp)
   // argc is returned via the system call return
   // value, which goes in a0.
   p->trapframe->a1 = sp;
+  p->trapframe->a2 = sp + (argc + 1) * sizeof(uint64);
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
   safestrcpy(p->name, last, sizeof(p->name));
+  bootmark(p->name);
     
-  // Commit to the user image.
+  // Commit to the user image.  A vfork() child gives its
+  // parent's memory back instead of unmapping it.
+  if(p->vfork)
+    vforkdone(p);
+  else
+    munmapall(p);
+  // against reclaim() scanning p's memory.
+  acquire(&p->slock);
   oldpagetable = p->pagetable;
+  oldsz = p->sz;
   p->pagetable = pagetable;
+  p->asid = 0;  // the old table's ASID may be in TLBs
   p->sz = sz;
   p->trapframe->epc = elf.entry;  // initial program counter = main
   p->trapframe->sp = sp; // initial stack pointer
-  proc_freepagetable(oldpagetable, oldsz);
+  p->syscallret = 0;     // argc and argv are in a0 and a1
+  for(i = 0; i < NVMA; i++){
+    tmp = p->vma[i];
+    p->vma[i] = vma[i];
+    vma[i] = tmp;
+  }
+  release(&p->slock);
+  if(oldpagetable)
+    proc_freepagetable(oldpagetable, oldsz);
+  begin_op();
+  vmaput(vma);
+  end_op();
 
   return argc; // this ends up in a0, the first argument to main(argc, argv)
 
@@ -125,30 +197,8 @@ exec(char *path, char **argv)
     iunlockput(ip);
     end_op();
   }
+  begin_op();
+  vmaput(vma);
+  end_op();
   return -1;
 }
-
-// Load a program segment into pagetable at virtual address va.
-// va must be page-aligned
-// and the pages from va to va+sz must already be mapped.
-// Returns 0 on success, -1 on failure.
-static int
-loadseg(pagetable_t pagetable, uint64 va, struct inode *ip, uint offset, uint sz)
-{
-  uint i, n;
-  uint64 pa;
-
-  for(i = 0; i < sz; i += PGSIZE){
-    pa = walkaddr(pagetable, va + i);
-    if(pa == 0)
-      panic("loadseg: address should exist");
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, 0, (uint64)pa, offset+i, n) != n)
-      return -1;
-  }
-  
-  return 0;
-}
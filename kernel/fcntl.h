@@ -1,5 +1,37 @@
 #define O_RDONLY  0x000
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
+#define O_NONBLOCK 0x004
 #define O_CREATE  0x200
 #define O_TRUNC   0x400
+
+#define PROT_NONE       0x0
+#define PROT_READ       0x1
+#define PROT_WRITE      0x2
+#define PROT_EXEC       0x4
+
+#define MAP_SHARED      0x01
+#define MAP_PRIVATE     0x02
+#define MAP_ANONYMOUS   0x20
+
+// fcntl() commands.
+#define F_GETFL   1   // return the open mode and O_NONBLOCK
+#define F_SETFL   2   // set O_NONBLOCK from the argument
+
+// A file descriptor for poll() to watch.
+struct pollfd {
+  int fd;
+  short events;   // POLLIN and POLLOUT to wait for
+  short revents;  // set by poll(): those that hold, and POLLHUP, POLLNVAL
+};
+
+#define POLLIN    0x01  // can read without blocking
+#define POLLOUT   0x04  // can write without blocking
+#define POLLHUP   0x10  // the other end of a pipe is closed
+#define POLLNVAL  0x20  // fd is not open
+
+// A buffer for readv() and writev().
+struct iovec {
+  void *iov_base;
+  int iov_len;
+};
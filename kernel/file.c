@@ -12,17 +12,34 @@
 #include "file.h"
 #include "stat.h"
 #include "proc.h"
+#include "fcntl.h"
+#include "slab.h"
 
 struct devsw devsw[NDEV];
+
+// Open files come from filecache; ftable.lock protects
+// their reference counts.
 struct {
   struct spinlock lock;
-  struct file file[NFILE];
 } ftable;
 
+static struct kmcache filecache;
+
+// poll() sleeps on pollq.seq, which pollwakeup() bumps whenever
+// a file may have become ready.  nwait counts the sleepers, so
+// that pollwakeup() costs no lock while no one is polling.
+static struct {
+  struct spinlock lock;
+  uint seq;
+  int nwait;
+} pollq;
+
 void
 fileinit(void)
 {
   initlock(&ftable.lock, "ftable");
+  initlock(&pollq.lock, "pollq");
+  kminit(&filecache, "file", sizeof(struct file), 0, 0);
 }
 
 // Allocate a file structure.
@@ -31,16 +48,11 @@ filealloc(void)
 {
   struct file *f;
 
-  acquire(&ftable.lock);
-  for(f = ftable.file; f < ftable.file + NFILE; f++){
-    if(f->ref == 0){
-      f->ref = 1;
-      release(&ftable.lock);
-      return f;
-    }
-  }
-  release(&ftable.lock);
-  return 0;
+  if((f = kmalloc(&filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -69,9 +81,8 @@ fileclose(struct file *f)
     return;
   }
   ff = *f;
-  f->ref = 0;
-  f->type = FD_NONE;
   release(&ftable.lock);
+  kmfree(f);
 
   if(ff.type == FD_PIPE){
     pipeclose(ff.pipe, ff.writable);
@@ -106,27 +117,68 @@ filestat(struct file *f, uint64 addr)
 int
 fileread(struct file *f, uint64 addr, int n)
 {
-  int r = 0;
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, -1);
+}
+
+// Read from file f into the niov user buffers of iov, in order,
+// at offset off, or at f->off and advancing it if off is -1.
+// An inode is locked once for all of them.  A pipe or device
+// read stops at the first buffer it puts anything in, as a
+// single read() would return then.
+int
+filereadv(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r = 0, tot = 0;
+  uint o;
 
   if(f->readable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;  // no offset to read at
+  if(f->type == FD_DEVICE &&
+     (f->major < 0 || f->major >= NDEV || !devsw[f->major].read))
+    return -1;
+  if(f->type == FD_DEVICE && f->nonblock && devsw[f->major].poll &&
+     (devsw[f->major].poll() & POLLIN) == 0)
+    return -1;  // would wait for input
 
-  if(f->type == FD_PIPE){
-    r = piperead(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].read)
-      return -1;
-    r = devsw[f->major].read(1, addr, n);
-  } else if(f->type == FD_INODE){
+  if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, 1, addr, f->off, n)) > 0)
-      f->off += r;
+    o = off < 0 ? f->off : off;
+    for(i = 0; i < niov; i++){
+      if((r = readi(f->ip, 1, (uint64)iov[i].iov_base, o, iov[i].iov_len)) < 0)
+        break;
+      o += r;
+      tot += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    if(off < 0)
+      f->off = o;
     iunlock(f->ip);
+  } else if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    for(i = 0; i < niov; i++){
+      if(iov[i].iov_len == 0)
+        continue;
+      if(f->type == FD_PIPE)
+        r = piperead(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len, f->nonblock);
+      else
+        r = devsw[f->major].read(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r > 0)
+        tot += r;
+      break;
+    }
   } else {
     panic("fileread");
   }
 
-  return r;
+  return (r < 0 && tot == 0) ? -1 : tot;
 }
 
 // Write to file f.
@@ -134,49 +186,297 @@ fileread(struct file *f, uint64 addr, int n)
 int
 filewrite(struct file *f, uint64 addr, int n)
 {
-  int r, ret = 0;
+  struct iovec iov;
+
+  if(n < 0)
+    return -1;
+  iov.iov_base = (void*)addr;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, -1);
+}
+
+// Write the niov user buffers of iov to file f, in order, at
+// offset off, or at f->off and advancing it if off is -1.
+// Returns the total length, or -1 if any of it fails.
+int
+filewritev(struct file *f, struct iovec *iov, int niov, int off)
+{
+  int i, r, n, m, done, tot, want, inmem;
+  uint o;
 
   if(f->writable == 0)
     return -1;
+  if(off >= 0 && f->type != FD_INODE)
+    return -1;  // no offset to write at
+  if(f->type == FD_DEVICE &&
+     (f->major < 0 || f->major >= NDEV || !devsw[f->major].write))
+    return -1;
 
-  if(f->type == FD_PIPE){
-    ret = pipewrite(f->pipe, addr, n);
-  } else if(f->type == FD_DEVICE){
-    if(f->major < 0 || f->major >= NDEV || !devsw[f->major].write)
-      return -1;
-    ret = devsw[f->major].write(1, addr, n);
+  want = 0;
+  for(i = 0; i < niov; i++)
+    want += iov[i].iov_len;
+
+  tot = 0;
+  if(f->type == FD_PIPE || f->type == FD_DEVICE){
+    for(i = 0; i < niov; i++){
+      if(f->type == FD_PIPE)
+        r = pipewrite(f->pipe, (uint64)iov[i].iov_base, iov[i].iov_len, f->nonblock);
+      else
+        r = devsw[f->major].write(1, (uint64)iov[i].iov_base, iov[i].iov_len);
+      if(r > 0)
+        tot += r;
+      if(r != iov[i].iov_len)
+        break;
+    }
   } else if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // write MAXOPBYTES at a time to avoid exceeding
+    // the maximum log transaction size, filling each
+    // transaction from as many buffers as fit.
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
+    // tmpfs needs no transactions.
+    inmem = f->ip->dev == TMPDEV;
+    i = 0;
+    done = 0;  // bytes of iov[i] written
+    r = 0;
+    while(i < niov && r >= 0){
+      if(!inmem)
+        begin_opn(f->ip->dev, BULKOPBLOCKS);
       ilock(f->ip);
-      if ((r = writei(f->ip, 1, addr + i, f->off, n1)) > 0)
-        f->off += r;
+      o = off < 0 ? f->off : off + tot;
+      for(n = 0; i < niov && n < MAXOPBYTES; ){
+        m = iov[i].iov_len - done;
+        if(m > MAXOPBYTES - n)
+          m = MAXOPBYTES - n;
+        if(m > 0 && (r = writei(f->ip, 1, (uint64)iov[i].iov_base + done, o, m)) != m){
+          // error from writei
+          if(r > 0){
+            o += r;
+            tot += r;
+          }
+          r = -1;
+          break;
+        }
+        o += m;
+        n += m;
+        tot += m;
+        if((done += m) == iov[i].iov_len){
+          i++;
+          done = 0;
+        }
+      }
+      if(off < 0)
+        f->off = o;
       iunlock(f->ip);
-      end_op();
-
-      if(r != n1){
-        // error from writei
-        break;
+      if(!inmem){
+        end_opn(f->ip->dev, BULKOPBLOCKS);
+        pcthrottle();
       }
-      i += r;
     }
-    ret = (i == n ? n : -1);
   } else {
     panic("filewrite");
   }
 
-  return ret;
+  if(f->nonblock && f->type == FD_PIPE && tot > 0)
+    return tot;  // as much as there was room for
+  return tot == want ? tot : -1;
 }
 
+// A page with ip's bytes at offset off, up to n of them and
+// none past the page off is in, with a reference for the
+// caller: the page cache's, or for tmpfs, which has none, a
+// copy.  Returns 0 if out of memory or the read fails.
+// Caller must hold ip->lock.
+static char*
+filepage(struct inode *ip, uint off, int n)
+{
+  char *mem;
+
+  if(ip->dev != TMPDEV)
+    return pcget(ip, PGROUNDDOWN(off));
+  if((mem = kalloc()) == 0)
+    return 0;
+  if(readi(ip, 0, (uint64)mem + off % PGSIZE, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+  return mem;
+}
+
+// Copy up to n bytes from inode file in to inode file out,
+// from in's pages in the page cache straight into out's, a
+// transaction of up to MAXOPBYTES at a time.  in's pages are
+// gathered before out is locked, so the two inodes are never
+// locked together and may be the same one.
+static int
+filecopy(struct file *in, struct file *out, int n)
+{
+  char *pages[MAXOPBYTES/PGSIZE + 2];
+  struct inode *ip = in->ip, *op = out->ip;
+  int tot, i, m, k, got, np, r;
+  uint off;
+
+  if(in == out)
+    return -1;  // one offset to read and write at
+  tot = 0;
+  r = 0;
+  while(tot < n && r >= 0){
+    ilock(ip);
+    off = in->off;
+    got = n - tot;
+    if(got > MAXOPBYTES)
+      got = MAXOPBYTES;
+    if(off >= ip->size)
+      got = 0;
+    else if(got > ip->size - off)
+      got = ip->size - off;
+    for(np = 0, m = 0; m < got; np++, m += k){
+      k = PGSIZE - (off + m) % PGSIZE;
+      if(k > got - m)
+        k = got - m;
+      if((pages[np] = filepage(ip, off + m, k)) == 0){
+        r = -1;
+        break;
+      }
+    }
+    iunlock(ip);
+    if((got = m) == 0)
+      break;  // end of file, or an error
+
+    if(op->dev != TMPDEV)
+      begin_opn(op->dev, BULKOPBLOCKS);
+    ilock(op);
+    for(i = 0, m = 0; m < got; i++, m += k){
+      k = PGSIZE - (off + m) % PGSIZE;
+      if(k > got - m)
+        k = got - m;
+      if((r = writei(op, 0, (uint64)pages[i] + (off + m) % PGSIZE, out->off, k)) > 0)
+        out->off += r;
+      if(r != k){
+        m += r > 0 ? r : 0;
+        r = -1;
+        break;
+      }
+    }
+    iunlock(op);
+    if(op->dev != TMPDEV){
+      end_opn(op->dev, BULKOPBLOCKS);
+      pcthrottle();
+    }
+    for(i = 0; i < np; i++)
+      kfree(pages[i]);
+    in->off += m;
+    tot += m;
+  }
+  return (tot == 0 && r < 0) ? -1 : tot;
+}
+
+// Move up to n bytes from in to out inside the kernel,
+// without copying through user memory.  Each of in and out
+// is a pipe or an inode, but not both pipes.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+
+  if(in->type == FD_INODE && out->type == FD_PIPE)
+    return pipesplicein(out->pipe, in->ip, &in->off, n);
+  if(in->type == FD_PIPE && out->type == FD_INODE)
+    return pipespliceout(in->pipe, out->ip, &out->off, n);
+  if(in->type == FD_INODE && out->type == FD_INODE)
+    return filecopy(in, out, n);
+  return -1;
+}
+
+// Something may have made a file ready to read or write;
+// wake any poll() to look again.
+void
+pollwakeup(void)
+{
+  if(pollq.nwait == 0)
+    return;
+  acquire(&pollq.lock);
+  pollq.seq++;
+  wakeup(&pollq.seq);
+  release(&pollq.lock);
+}
+
+// The POLL* flags that hold for f now.
+static int
+fileready(struct file *f)
+{
+  int r;
+
+  if(f->type == FD_PIPE)
+    r = pipepoll(f->pipe, f->writable);
+  else if(f->type == FD_DEVICE && f->major >= 0 && f->major < NDEV &&
+          devsw[f->major].poll)
+    r = devsw[f->major].poll();
+  else
+    r = POLLIN | POLLOUT;  // inodes don't make readers wait
+  if(!f->readable)
+    r &= ~POLLIN;
+  if(!f->writable)
+    r &= ~POLLOUT;
+  return r;
+}
+
+// Wait until one of the n files f[i] (0 for one not open) is
+// ready for fds[i].events, or for timeout milliseconds if it
+// is not negative.  Sets each fds[i].revents and returns how
+// many are non-zero, or -1 if killed.
+int
+filepoll(struct file **f, struct pollfd *fds, int n, int timeout)
+{
+  struct proc *p = myproc();
+  int i, nready;
+  uint seq;
+
+  acquire(&pollq.lock);
+  pollq.nwait++;
+  release(&pollq.lock);
+  if(timeout > 0)
+    timerpoll(r_time() + (uint64)timeout * (TIMEFREQ/1000));
+
+  for(;;){
+    // take seq before looking, so a change made while we
+    // look stops us from sleeping past it.
+    acquire(&pollq.lock);
+    seq = pollq.seq;
+    release(&pollq.lock);
+
+    nready = 0;
+    for(i = 0; i < n; i++){
+      if(f[i])
+        fds[i].revents = fileready(f[i]) & (fds[i].events | POLLHUP);
+      else
+        fds[i].revents = POLLNVAL;
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready > 0 || timeout == 0)
+      break;
+
+    acquire(&pollq.lock);
+    if(p->killed){
+      nready = -1;
+    } else if(timeout > 0 && p->tidx < 0){
+      // timed out.
+    } else {
+      if(pollq.seq == seq)
+        sleep(&pollq.seq, &pollq.lock);
+      release(&pollq.lock);
+      continue;
+    }
+    release(&pollq.lock);
+    break;
+  }
+
+  if(timeout > 0)
+    timerpollcancel();
+  acquire(&pollq.lock);
+  pollq.nwait--;
+  release(&pollq.lock);
+  return nready;
+}
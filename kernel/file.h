@@ -3,12 +3,20 @@ struct file {
   int ref; // reference count
   char readable;
   char writable;
+  char nonblock;     // O_NONBLOCK: return -1 rather than wait
   struct pipe *pipe; // FD_PIPE
   struct inode *ip;  // FD_INODE and FD_DEVICE
   uint off;          // FD_INODE
   short major;       // FD_DEVICE
 };
 
+// Writes to an inode reserve BULKOPBLOCKS of the log with
+// begin_opn() and write at most MAXOPBYTES per transaction,
+// leaving MAXOPBLOCKS for the i-node, indirect blocks,
+// allocation blocks, and a block of slop for non-aligned writes.
+#define BULKOPBLOCKS (LOGSIZE - MAXOPBLOCKS)
+#define MAXOPBYTES ((BULKOPBLOCKS - MAXOPBLOCKS) * BSIZE)
+
 #define major(dev)  ((dev) >> 16 & 0xFFFF)
 #define minor(dev)  ((dev) & 0xFFFF)
 #define	mkdev(m,n)  ((uint)((m)<<16| (n)))
@@ -18,23 +26,45 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *next; // on its itable hash chain
+  struct inode *lnext; // on the itable LRU list while ref == 0
+  struct inode *lprev;
+  struct pcpage *pages; // its pages in the page cache, under pcache.lock
+  int npage;
+  int nodd;           // of them, at offsets that aren't page aligned
+  struct inode *dnext; // on the page cache's dirty list, under pcache.lock
+  uint64 dirtied;     // r_time() it went on the list
+  int dirty;          // on the list, holding a reference? set with lock held
+  struct rcuhead rcu; // frees it once iget()'s lock-free lookups are done
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint nextbn;        // block a sequential read would read next
+  uint raend;         // blocks before this have been read ahead
+  uint lastblk;       // disk block most recently allocated to it
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint dsize;         // size on disk; size counts data still in the page cache
+  int inlined;        // data in addrs[] (DI_INLINE)?
+  uint addrs[NDIRECT+NLEVEL];
+
+  void *tmap;         // tmpfs: map of its pages
+  int tmpheld;        // tmpfs: the file system holds a reference
 };
 
 // map major device number to device functions.
 struct devsw {
   int (*read)(int, uint64, int);
   int (*write)(int, uint64, int);
+  int (*poll)(void);  // POLLIN|POLLOUT that hold now; 0 means both always do
 };
 
 extern struct devsw devsw[];
 
 #define CONSOLE 1
+#define STATS   2
+#define PROF    3
+#define PROCS   4
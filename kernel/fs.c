@@ -20,11 +20,26 @@
 #include "fs.h"
 #include "buf.h"
 #include "file.h"
+#include "slab.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
-// there should be one superblock per disk device, but we run with
-// only one device
-struct superblock sb; 
+// one superblock per disk; magic is 0 if the disk has no
+// file system.
+struct superblock sb[NDISK];
+#define SB(dev) sb[DISK(dev)]
+
+// Free space on each disk, counted by fscount() at boot and
+// kept up to date by balloc(), bfree(), ialloc() and iput(), so
+// that balloc() can skip bitmap blocks with nothing free without
+// reading them, and ialloc() can start past inodes known to be
+// in use.
+static struct fsfree {
+  struct spinlock lock;
+  uint nblock;                    // free blocks
+  ushort bfree[FSSIZE/BPB + 1];   // free blocks in each bitmap block
+  uint ninode;                    // free inodes
+  uint ihint;                     // no inode below this is free
+} fsfree[NDISK];
 
 // Read the super block.
 static void
@@ -32,18 +47,112 @@ readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
 
-  bp = bread(dev, 1);
-  memmove(sb, bp->data, sizeof(*sb));
+  bp = bread(dev, SBOFF / BSIZE);
+  memmove(sb, bp->data + SBOFF % BSIZE, sizeof(*sb));
   brelse(bp);
 }
 
-// Init fs
+static void fscount(int);
+
+// What is wrong with superblock sb, or 0 if it will do.
+static char*
+sbcheck(struct superblock *sb)
+{
+  if(sb->magic != FSMAGIC)
+    return "invalid file system";
+  if(sb->bsize != BSIZE)
+    return "file system block size";
+  if(sb->logmode > LOG_WRITEBACK)
+    return "invalid log mode";
+  if(sb->features & ~(FS_DIRINDEX|FS_INLINE))
+    return "unknown file system features";
+  if(sb->size > FSSIZE)
+    return "file system too big";
+  return 0;
+}
+
+// Init the fs on disk device dev, for mount() to mount.  A disk
+// other than the root may have none, or one this kernel can't
+// use, and is then left unmountable.  Swap is on the root disk.
 void
 fsinit(int dev) {
-  readsb(dev, &sb);
-  if(sb.magic != FSMAGIC)
-    panic("invalid file system");
-  initlog(dev, &sb);
+  struct superblock *s = &SB(dev);
+  char *err;
+
+  readsb(dev, s);
+  if((err = sbcheck(s)) != 0){
+    if(dev == ROOTDEV)
+      panic(err);
+    s->magic = 0;
+    return;
+  }
+  initlog(dev, s);
+  fscount(dev);
+  if(dev == ROOTDEV){
+    kthread("flusher", flusher);
+    swapinit(dev, s->swapstart, s->nswap);
+  }
+}
+
+// Count the free blocks and inodes, once the log has been
+// recovered.
+static void
+fscount(int dev)
+{
+  struct fsfree *f = &fsfree[DISK(dev)];
+  struct buf *bp;
+  struct dinode *dip;
+  uint b, bi, inum;
+
+  initlock(&f->lock, "fsfree");
+  for(b = 0; b < SB(dev).size; b += BPB){
+    bp = bread(dev, BBLOCK(b, SB(dev)));
+    for(bi = 0; bi < BPB && b + bi < SB(dev).size; bi++){
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0){
+        f->bfree[b / BPB]++;
+        f->nblock++;
+      }
+    }
+    brelse(bp);
+  }
+
+  f->ihint = SB(dev).ninodes;
+  for(inum = 1; inum < SB(dev).ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, SB(dev)));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type == 0){
+      f->ninode++;
+      if(inum < f->ihint)
+        f->ihint = inum;
+    }
+    brelse(bp);
+  }
+}
+
+// Report free space on each file system, the root's as "fs:"
+// and disk n's as "fsn:".
+int
+statsfs(char *buf, int sz)
+{
+  uint nblock, ninode;
+  char name[8];
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < NDISK; i++){
+    if(sb[i].magic != FSMAGIC)
+      continue;
+    acquire(&fsfree[i].lock);
+    nblock = fsfree[i].nblock;
+    ninode = fsfree[i].ninode;
+    release(&fsfree[i].lock);
+    if(i == 0)
+      snprintf(name, sizeof(name), "fs");
+    else
+      snprintf(name, sizeof(name), "fs%d", i);
+    n += snprintf(buf+n, sz-n, "%s: %d free blocks, %d free inodes\n", name, nblock, ninode);
+  }
+  return n;
 }
 
 // Zero a block.
@@ -52,7 +161,7 @@ bzero(int dev, int bno)
 {
   struct buf *bp;
 
-  bp = bread(dev, bno);
+  bp = bnew(dev, bno);
   memset(bp->data, 0, BSIZE);
   log_write(bp);
   brelse(bp);
@@ -60,27 +169,56 @@ bzero(int dev, int bno)
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a disk block, taking the first free block at or
+// after goal, so that blocks allocated one after another for
+// a file end up next to each other.  If zero is set, zero
+// it; otherwise the caller must write all of it.
 static uint
-balloc(uint dev)
+balloc(uint dev, uint goal, int zero)
 {
-  int b, bi, m;
+  struct fsfree *f = &fsfree[DISK(dev)];
+  uint b, bi, base, n, m;
   struct buf *bp;
 
-  bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+  if(goal >= SB(dev).size)
+    goal = 0;
+  b = goal;
+  for(n = 0; n < SB(dev).size; ){
+    base = b - b % BPB;
+    // only a hint; the bitmap block itself decides.
+    if(f->bfree[base / BPB] == 0){
+      n += BPB - b % BPB;
+      b = base + BPB;
+      if(b >= SB(dev).size)
+        b = 0;
+      continue;
+    }
+    bp = bread(dev, BBLOCK(b, SB(dev)));
+    for(bi = b % BPB; bi < BPB && base + bi < SB(dev).size && n < SB(dev).size; bi++, n++){
+      if(bi % 8 == 0 && bp->data[bi/8] == 0xff){
+        // all 8 in use.
+        bi += 7;
+        n += 7;
+        continue;
+      }
       m = 1 << (bi % 8);
       if((bp->data[bi/8] & m) == 0){  // Is block free?
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
+        acquire(&f->lock);
+        f->nblock--;
+        f->bfree[base / BPB]--;
+        release(&f->lock);
         brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
+        if(zero)
+          bzero(dev, base + bi);
+        return base + bi;
       }
     }
     brelse(bp);
+    b = base + bi;
+    if(b >= SB(dev).size)
+      b = 0;
   }
   panic("balloc: out of blocks");
 }
@@ -89,17 +227,23 @@ balloc(uint dev)
 static void
 bfree(int dev, uint b)
 {
+  struct fsfree *f = &fsfree[DISK(dev)];
   struct buf *bp;
   int bi, m;
 
-  bp = bread(dev, BBLOCK(b, sb));
+  bp = bread(dev, BBLOCK(b, SB(dev)));
   bi = b % BPB;
   m = 1 << (bi % 8);
   if((bp->data[bi/8] & m) == 0)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  acquire(&f->lock);
+  f->nblock++;
+  f->bfree[b / BPB]++;
+  release(&f->lock);
   brelse(bp);
+  log_free(dev);
 }
 
 // Inodes.
@@ -162,50 +306,206 @@ bfree(int dev, uint b)
 // have locked the inodes involved; this lets callers create
 // multi-step atomic operations.
 //
-// The itable.lock spin-lock protects the allocation of itable
-// entries. Since ip->ref indicates whether an entry is free,
-// and ip->dev and ip->inum indicate which i-node an entry
-// holds, one must hold itable.lock while using any of those fields.
+// In-memory inodes come from inodecache and are on itable.hash[],
+// chained through ip->next.  When iput() drops the last reference
+// to an inode, the inode stays cached, contents and all, on an LRU
+// list of unreferenced inodes, so the next iget() of it need not
+// read the disk; once more than NICACHE are cached the least
+// recently used is freed.  The itable.lock spin-lock protects the
+// hash chains and the LRU list; ip->ref changes atomically, and
+// the 0 to 1 change, which takes ip off the LRU list, only with
+// itable.lock held.
+//
+// iget() first looks an inode up without itable.lock, in an RCU
+// read section (see rcu.c), and takes a reference if it finds
+// one that has some already, as the root and working directories
+// nearly always do.  An inode with references is on its hash
+// chain, and ip->dev and ip->inum never change, so the lookup
+// can trust them.  That means inserting an inode on a chain only
+// once it is set up, and freeing one taken off its chain only
+// after a grace period.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define NIHASH 61
+#define IHASH(dev, inum) (((dev) * 31 + (inum)) % NIHASH)
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode *hash[NIHASH];
+  struct inode *lru;       // least recently used unreferenced inode
+  struct inode *lrutail;   // most recently used
+  int nlru;
 } itable;
 
+static struct kmcache inodecache;
+
+// Caller holds itable.lock.
+static void
+lruadd(struct inode *ip)
+{
+  ip->lprev = itable.lrutail;
+  ip->lnext = 0;
+  if(itable.lrutail)
+    itable.lrutail->lnext = ip;
+  else
+    itable.lru = ip;
+  itable.lrutail = ip;
+  itable.nlru++;
+}
+
+// Caller holds itable.lock.
+static void
+lrudel(struct inode *ip)
+{
+  if(ip->lprev)
+    ip->lprev->lnext = ip->lnext;
+  else
+    itable.lru = ip->lnext;
+  if(ip->lnext)
+    ip->lnext->lprev = ip->lprev;
+  else
+    itable.lrutail = ip->lprev;
+  itable.nlru--;
+}
+
+// Take ip off its hash chain.  Caller holds itable.lock.
+static void
+unhash(struct inode *ip)
+{
+  struct inode **pp;
+
+  for(pp = &itable.hash[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->next)
+    ;
+  // lookups at ip go on to ip->next.
+  __atomic_store_n(pp, ip->next, __ATOMIC_RELEASE);
+}
+
+// Name cache.
+//
+// The name cache remembers the result of looking up a name
+// in a directory, (dev, directory inum, name) -> inum, so that
+// namex() need not lock the directory and read its entries.
+// An inum of 0 records that the name is not present.
+//
+// Entries for a directory are only added and changed while
+// the directory is locked, by namex() after dirlookup(), by
+// dirlink(), and by sys_unlink() through dcremove().  When an
+// inode is freed, iput() drops the entries naming it and the
+// entries for names in it, so a recycled inum never hits.
+//
+// dclookup() does the iget() while holding dcache.lock, so an
+// inode it finds cannot be freed before the caller holds a
+// reference.  Lock order: dcache.lock, then itable.lock.
+
+#define DCWAYS 4   // entries per hash set
+
+struct dcent {
+  uint dev;
+  uint dinum;        // directory inum; 0 if the entry is free
+  uint inum;         // inum of the name; 0 if not present
+  char name[DIRSIZ];
+};
+
+struct {
+  struct spinlock lock;
+  struct dcent ent[NDCACHE];
+  uint hand;         // next way to replace
+} dcache;
+
+static struct {
+  struct spinlock lock;
+  int n;
+  struct {
+    struct inode *cover;
+    struct inode *root;
+  } m[NMOUNT];
+} mtab;
+
+static void
+inodector(void *obj)
+{
+  initsleeplock(&((struct inode*)obj)->lock, "inode");
+}
+
+static void
+inodedtor(void *obj)
+{
+  freesleeplock(&((struct inode*)obj)->lock);
+}
+
+static void
+inodefree(void *obj)
+{
+  kmfree(obj);
+}
+
 void
 iinit()
 {
-  int i = 0;
-  
   initlock(&itable.lock, "itable");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&itable.inode[i].lock, "inode");
-  }
+  kminit(&inodecache, "inode", sizeof(struct inode), inodector, inodedtor);
+  initlock(&dcache.lock, "dcache");
+  initlock(&mtab.lock, "mtab");
 }
 
 static struct inode* iget(uint dev, uint inum);
+static void dcpurge(struct inode*);
 
 // Allocate an inode on device dev.
 // Mark it as allocated by  giving it type type.
 // Returns an unlocked but allocated and referenced inode.
+// The search starts at the disk's ihint, and wraps around in case
+// an inode below it was freed while another ialloc() raced
+// past.
 struct inode*
 ialloc(uint dev, short type)
 {
-  int inum;
+  uint inum, start, n;
+  struct fsfree *f;
   struct buf *bp;
   struct dinode *dip;
+  struct inode *ip;
+
+  if(dev == TMPDEV){
+    if((inum = tmpinum()) == 0)
+      panic("ialloc: no inodes");
+    ip = iget(dev, inum);
+    ip->type = type;
+    ip->major = ip->minor = 0;
+    ip->nlink = 0;
+    ip->size = ip->dsize = 0;
+    ip->inlined = 0;
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->tmap = 0;
+    ip->tmpheld = 0;
+    ip->valid = 1;
+    return ip;
+  }
 
-  for(inum = 1; inum < sb.ninodes; inum++){
-    bp = bread(dev, IBLOCK(inum, sb));
+  f = &fsfree[DISK(dev)];
+  acquire(&f->lock);
+  if(f->ninode == 0)
+    panic("ialloc: no inodes");
+  start = f->ihint;
+  release(&f->lock);
+
+  for(n = 1, inum = start; n < SB(dev).ninodes; n++, inum++){
+    if(inum >= SB(dev).ninodes)
+      inum = 1;
+    bp = bread(dev, IBLOCK(inum, SB(dev)));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
       memset(dip, 0, sizeof(*dip));
       dip->type = type;
       log_write(bp);   // mark it allocated on the disk
+      acquire(&f->lock);
+      f->ninode--;
+      if(f->ihint == start && inum >= start)
+        f->ihint = inum + 1;
+      release(&f->lock);
       brelse(bp);
       return iget(dev, inum);
     }
@@ -224,13 +524,18 @@ iupdate(struct inode *ip)
   struct buf *bp;
   struct dinode *dip;
 
-  bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+  if(ip->dev == TMPDEV){
+    tmpupdate(ip);
+    return;
+  }
+
+  bp = bread(ip->dev, IBLOCK(ip->inum, SB(ip->dev)));
   dip = (struct dinode*)bp->data + ip->inum%IPB;
-  dip->type = ip->type;
+  dip->type = ip->type | (ip->inlined ? DI_INLINE : 0);
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
-  dip->size = ip->size;
+  dip->size = ip->dsize;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   log_write(bp);
   brelse(bp);
@@ -242,31 +547,53 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip;
+  int ref;
+
+  // Is the inode in the table, with references?
+  rcureadlock();
+  for(ip = __atomic_load_n(&itable.hash[IHASH(dev, inum)], __ATOMIC_ACQUIRE); ip;
+      ip = __atomic_load_n(&ip->next, __ATOMIC_ACQUIRE)){
+    if(ip->dev == dev && ip->inum == inum){
+      while((ref = __atomic_load_n(&ip->ref, __ATOMIC_RELAXED)) > 0){
+        if(__sync_bool_compare_and_swap(&ip->ref, ref, ref + 1)){
+          rcureadunlock();
+          return ip;
+        }
+      }
+      break;
+    }
+  }
+  rcureadunlock();
 
   acquire(&itable.lock);
 
   // Is the inode already in the table?
-  empty = 0;
-  for(ip = &itable.inode[0]; ip < &itable.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = itable.hash[IHASH(dev, inum)]; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
+      if(__sync_fetch_and_add(&ip->ref, 1) == 0)
+        lrudel(ip);
       release(&itable.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode entry.
-  if(empty == 0)
+  // Make a new entry.
+  if((ip = kmalloc(&inodecache)) == 0)
     panic("iget: no inodes");
-
-  ip = empty;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->nextbn = 0;
+  ip->raend = 0;
+  ip->lastblk = 0;
+  ip->pages = 0;
+  ip->npage = 0;
+  ip->nodd = 0;
+  ip->dirty = 0;
+  ip->next = itable.hash[IHASH(dev, inum)];
+  __atomic_store_n(&itable.hash[IHASH(dev, inum)], ip, __ATOMIC_RELEASE);
   release(&itable.lock);
 
   return ip;
@@ -277,9 +604,7 @@ iget(uint dev, uint inum)
 struct inode*
 idup(struct inode *ip)
 {
-  acquire(&itable.lock);
-  ip->ref++;
-  release(&itable.lock);
+  __sync_fetch_and_add(&ip->ref, 1);
   return ip;
 }
 
@@ -297,13 +622,14 @@ ilock(struct inode *ip)
   acquiresleep(&ip->lock);
 
   if(ip->valid == 0){
-    bp = bread(ip->dev, IBLOCK(ip->inum, sb));
+    bp = bread(ip->dev, IBLOCK(ip->inum, SB(ip->dev)));
     dip = (struct dinode*)bp->data + ip->inum%IPB;
-    ip->type = dip->type;
+    ip->type = dip->type & ~DI_INLINE;
+    ip->inlined = (dip->type & DI_INLINE) != 0;
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
-    ip->size = dip->size;
+    ip->size = ip->dsize = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
     ip->valid = 1;
@@ -323,8 +649,8 @@ iunlock(struct inode *ip)
 }
 
 // Drop a reference to an in-memory inode.
-// If that was the last reference, the inode table entry can
-// be recycled.
+// If that was the last reference, the inode table entry goes
+// on the LRU list, to be reused or freed.
 // If that was the last reference and the inode has no links
 // to it, free the inode (and its content) on disk.
 // All calls to iput() must be inside a transaction in
@@ -332,29 +658,76 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode *victim;
+  struct fsfree *f;
+  int pinned;
+
   acquire(&itable.lock);
 
-  if(ip->ref == 1 && ip->valid && ip->nlink == 0){
-    // inode has no links and no other references: truncate and free.
+  pinned = 0;
+  if(ip->ref == 1 + ip->dirty && ip->valid && ip->nlink == 0){
+    // inode has no links and no other references, but perhaps
+    // the page cache's dirty list's: truncate and free.
 
-    // ip->ref == 1 means no other process can have ip locked,
-    // so this acquiresleep() won't block (or deadlock).
+    // then no other process can have ip locked, so this
+    // acquiresleep() won't block (or deadlock).
     acquiresleep(&ip->lock);
 
     release(&itable.lock);
 
+    // its data needn't ever go to the disk.
+    if(ip->dirty){
+      pcundirty(ip);
+      ip->dirty = 0;
+      pinned = 1;
+    }
+
+    dcpurge(ip);
     itrunc(ip);
     ip->type = 0;
     iupdate(ip);
     ip->valid = 0;
+    if(ip->dev == TMPDEV){
+      tmpifree(ip->inum);
+    } else {
+      f = &fsfree[DISK(ip->dev)];
+      acquire(&f->lock);
+      f->ninode++;
+      if(ip->inum < f->ihint)
+        f->ihint = ip->inum;
+      release(&f->lock);
+    }
 
     releasesleep(&ip->lock);
 
     acquire(&itable.lock);
+    __sync_fetch_and_sub(&ip->ref, pinned);
   }
 
-  ip->ref--;
+  if(__sync_sub_and_fetch(&ip->ref, 1) > 0){
+    release(&itable.lock);
+    return;
+  }
+
+  // Keep it cached, unless it was just freed on disk,
+  // and make room if need be.
+  victim = 0;
+  if(ip->valid == 0){
+    unhash(ip);
+    victim = ip;
+  } else {
+    lruadd(ip);
+    if(itable.nlru > NICACHE){
+      victim = itable.lru;
+      lrudel(victim);
+      unhash(victim);
+    }
+  }
   release(&itable.lock);
+  if(victim){
+    pcinval(victim);
+    rcucall(&victim->rcu, inodefree, victim);
+  }
 }
 
 // Common idiom: unlock, then put.
@@ -370,38 +743,106 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT], the NDINDIRECT after
+// those in the NINDIRECT blocks listed in ip->addrs[NDIRECT+1],
+// and the NTINDIRECT after those one level further down
+// from ip->addrs[NDIRECT+2], except that a directory keeps
+// its index there instead.
+
+// Allocate a block for entry a[i] of ip's block map (a is
+// 0 for the top of an indirect tree), placing it after the
+// block of entry a[i-1] or else after ip's last new block.
+// A file's first block goes in the allocation group, the
+// blocks under one bitmap block, that its i-number picks, so
+// that files written at the same time don't contend for one
+// bitmap block.  zero is as for balloc().
+static uint
+bextend(struct inode *ip, uint *a, uint i, int zero)
+{
+  uint goal;
+
+  if(a != 0 && i > 0 && a[i-1] != 0)
+    goal = a[i-1] + 1;
+  else if(ip->lastblk != 0)
+    goal = ip->lastblk + 1;
+  else
+    goal = ip->inum % (SB(ip->dev).size / BPB + 1) * BPB;
+  ip->lastblk = balloc(ip->dev, goal, zero);
+  return ip->lastblk;
+}
 
 // Return the disk block address of the nth block in inode ip.
-// If there is no such block, bmap allocates one.
+// If there is no such block, bmap allocates one, zeroed unless
+// fresh is set, in which case *fresh says whether the block is
+// new and the caller must write all of it.
 static uint
-bmap(struct inode *ip, uint bn)
+bmap(struct inode *ip, uint bn, int *fresh)
 {
-  uint addr, *a;
+  uint addr, *a, level, n;
   struct buf *bp;
 
+  if(fresh)
+    *fresh = 0;
   if(bn < NDIRECT){
-    if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+    if((addr = ip->addrs[bn]) == 0){
+      ip->addrs[bn] = addr = bextend(ip, ip->addrs, bn, fresh == 0);
+      if(fresh)
+        *fresh = 1;
+    }
     return addr;
   }
   bn -= NDIRECT;
 
-  if(bn < NINDIRECT){
-    // Load indirect block, allocating if necessary.
-    if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+  // Find the indirect tree holding bn; each entry of its
+  // top block covers n data blocks.
+  for(level = 0, n = 1; level < NLEVEL; level++, n *= NINDIRECT){
+    if(bn < n * NINDIRECT)
+      break;
+    bn -= n * NINDIRECT;
+  }
+  if(level == NLEVEL || (ip->type == T_DIR && NDIRECT+level == DXADDR))
+    panic("bmap: out of range");
+
+  if((addr = ip->addrs[NDIRECT+level]) == 0)
+    ip->addrs[NDIRECT+level] = addr = bextend(ip, 0, 0, 1);
+  for(;;){
+    // Load indirect block, allocating the next one down
+    // if necessary.
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+    if((addr = a[bn / n]) == 0){
+      a[bn / n] = addr = bextend(ip, a, bn / n, n > 1 || fresh == 0);
       log_write(bp);
+      if(n == 1 && fresh)
+        *fresh = 1;
     }
     brelse(bp);
-    return addr;
+    if(n == 1)
+      return addr;
+    bn %= n;
+    n /= NINDIRECT;
   }
+}
+
+// Free block addr and, if it is an indirect block with
+// level levels of blocks below it, everything it lists.
+static void
+bfreetree(uint dev, uint addr, int level)
+{
+  int j;
+  struct buf *bp;
+  uint *a;
 
-  panic("bmap: out of range");
+  if(level > 0){
+    bp = bread(dev, addr);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j])
+        bfreetree(dev, a[j], level - 1);
+    }
+    brelse(bp);
+  }
+  bfree(dev, addr);
 }
 
 // Truncate inode (discard contents).
@@ -409,9 +850,18 @@ bmap(struct inode *ip, uint bn)
 void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i;
+
+  if(ip->dev == TMPDEV){
+    tmptrunc(ip);
+    pcinval(ip);
+    return;
+  }
+
+  if(ip->inlined){
+    memset(ip->addrs, 0, sizeof(ip->addrs));
+    ip->inlined = 0;
+  }
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
@@ -420,19 +870,20 @@ itrunc(struct inode *ip)
     }
   }
 
-  if(ip->addrs[NDIRECT]){
-    bp = bread(ip->dev, ip->addrs[NDIRECT]);
-    a = (uint*)bp->data;
-    for(j = 0; j < NINDIRECT; j++){
-      if(a[j])
-        bfree(ip->dev, a[j]);
+  for(i = 0; i < NLEVEL; i++){
+    if(ip->addrs[NDIRECT+i]){
+      if(ip->type == T_DIR && NDIRECT+i == DXADDR)
+        bfree(ip->dev, ip->addrs[NDIRECT+i]);
+      else
+        bfreetree(ip->dev, ip->addrs[NDIRECT+i], i + 1);
+      ip->addrs[NDIRECT+i] = 0;
     }
-    brelse(bp);
-    bfree(ip->dev, ip->addrs[NDIRECT]);
-    ip->addrs[NDIRECT] = 0;
   }
 
-  ip->size = 0;
+  ip->size = ip->dsize = 0;
+  ip->nextbn = ip->raend = 0;
+  ip->lastblk = 0;
+  pcinval(ip);
   iupdate(ip);
 }
 
@@ -448,23 +899,64 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
-// Read data from inode.
+// Start the disk on blocks first+1..last of a read, so
+// that readi() waits for all of them at once.  If the
+// read continues where the previous one ended, also read
+// ahead NPREFETCH blocks beyond it, skipping blocks that
+// an earlier read ahead already covered.
+// Caller must hold ip->lock.
+static void
+readahead(struct inode *ip, uint first, uint last)
+{
+  uint bn, end, nb;
+
+  nb = (ip->dsize + BSIZE - 1) / BSIZE;
+  if(first == ip->nextbn || first + 1 == ip->nextbn){
+    end = last + 1 + NPREFETCH;
+  } else {
+    end = last + 1;
+    if(end > first + 1 + NPREFETCH)
+      end = first + 1 + NPREFETCH;
+    ip->raend = 0;
+  }
+  if(end > nb)
+    end = nb;
+  ip->nextbn = last + 1;
+
+  bn = first + 1;
+  if(bn < ip->raend)
+    bn = ip->raend;
+  for(; bn < end; bn++)
+    bprefetch(ip->dev, bmap(ip, bn, 0));
+  if(end > ip->raend)
+    ip->raend = end;
+}
+
+// Read data from inode's blocks through the buffer cache.
 // Caller must hold ip->lock.
 // If user_dst==1, then dst is a user virtual address;
 // otherwise, dst is a kernel address.
 int
-readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+readblk(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
 
-  if(off > ip->size || off + n < off)
+  if(ip->dev == TMPDEV)
+    return tmpread(ip, user_dst, dst, off, n);
+  if(off > ip->dsize || off + n < off)
     return 0;
-  if(off + n > ip->size)
-    n = ip->size - off;
+  if(off + n > ip->dsize)
+    n = ip->dsize - off;
+
+  if(ip->inlined)
+    return either_copyout(user_dst, dst, (char*)ip->addrs + off, n) == -1 ? -1 : n;
+
+  if(n > 0)
+    readahead(ip, off/BSIZE, (off + n - 1)/BSIZE);
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    bp = bread(ip->dev, bmap(ip, off/BSIZE, 0));
     m = min(n - tot, BSIZE - off%BSIZE);
     if(either_copyout(user_dst, dst, bp->data + (off % BSIZE), m) == -1) {
       brelse(bp);
@@ -476,37 +968,132 @@ readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
   return tot;
 }
 
-// Write data to inode.
+// Read data from inode, a plain file's through the page
+// cache, or straight from the buffer cache if memory is short.
 // Caller must hold ip->lock.
+// If user_dst==1, then dst is a user virtual address;
+// otherwise, dst is a kernel address.
+int
+readi(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m, pgoff;
+  char *mem;
+  int r;
+
+  if(ip->type != T_FILE || ip->dev == TMPDEV)
+    return readblk(ip, user_dst, dst, off, n);
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    pgoff = PGROUNDDOWN(off);
+    m = min(n - tot, PGSIZE - (off - pgoff));
+    if((mem = pcget(ip, pgoff)) == 0){
+      r = readblk(ip, user_dst, dst, off, m) == m ? 0 : -1;
+    } else {
+      r = either_copyout(user_dst, dst, mem + (off - pgoff), m);
+      kfree(mem);
+    }
+    if(r == -1){
+      tot = -1;
+      break;
+    }
+  }
+  return tot;
+}
+
+// Move ip's inline data out to a block of its own, for a
+// write that makes it too big to stay.
+// Caller must hold ip->lock and be in a transaction.
+static int
+uninline(struct inode *ip)
+{
+  char data[NINLINE];
+  uint n;
+
+  n = ip->dsize;
+  memmove(data, ip->addrs, n);
+  memset(ip->addrs, 0, sizeof(ip->addrs));
+  ip->inlined = 0;
+  ip->dsize = 0;
+  return writeblk(ip, 0, (uint64)data, 0, n) == n ? 0 : -1;
+}
+
+// Write data to inode's blocks, allocating any it lacks,
+// through the buffer cache and the log, or to addrs[] if it
+// is a small enough plain file.  Writing inline costs only the
+// inode block, and reading the data back needs nothing else.
+// Caller must hold ip->lock and be in a transaction.
 // If user_src==1, then src is a user virtual address;
 // otherwise, src is a kernel address.
 // Returns the number of bytes successfully written.
 // If the return value is less than the requested n,
 // there was an error of some kind.
 int
-writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+writeblk(struct inode *ip, int user_src, uint64 src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, addr;
   struct buf *bp;
+  int fresh, r;
 
-  if(off > ip->size || off + n < off)
+  if(ip->dev == TMPDEV)
+    return tmpwrite(ip, user_src, src, off, n);
+  if(off > ip->dsize || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
 
+  // dsize 0 means ip has no blocks.
+  if(n > 0 && (ip->inlined ||
+              (ip->dsize == 0 && ip->type == T_FILE && (SB(ip->dev).features & FS_INLINE)))){
+    if(off + n <= NINLINE){
+      if(either_copyin((char*)ip->addrs + off, user_src, src, n) == -1)
+        return -1;
+      ip->inlined = 1;
+      if(off + n > ip->dsize)
+        ip->dsize = off + n;
+      if(ip->dsize > ip->size)
+        ip->size = ip->dsize;
+      iupdate(ip);
+      return n;
+    }
+    if(ip->inlined && uninline(ip) < 0)
+      return -1;
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    // Unless all data is logged, a new block is neither read
+    // nor logged, only written home when the transaction
+    // commits.
+    fresh = 0;
+    addr = bmap(ip, off/BSIZE, SB(ip->dev).logmode == LOG_DATA ? 0 : &fresh);
+    if(fresh){
+      bp = bnew(ip->dev, addr);
+      memset(bp->data, 0, BSIZE);
+    } else {
+      bp = bread(ip->dev, addr);
+    }
     m = min(n - tot, BSIZE - off%BSIZE);
-    if(either_copyin(bp->data + (off % BSIZE), user_src, src, m) == -1) {
-      brelse(bp);
-      break;
+    r = either_copyin(bp->data + (off % BSIZE), user_src, src, m);
+    if(fresh){
+      log_ordered(bp);
+    } else if(r != -1){
+      if(SB(ip->dev).logmode == LOG_WRITEBACK && ip->type != T_DIR)
+        log_writeback(bp);
+      else
+        log_write(bp);
     }
-    log_write(bp);
     brelse(bp);
+    if(r == -1)
+      break;
   }
 
-  if(off > ip->size)
-    ip->size = off;
+  if(off > ip->dsize)
+    ip->dsize = off;
+  if(ip->dsize > ip->size)
+    ip->size = ip->dsize;
 
   // write the i-node back to disk even if the size didn't change
   // because the loop above might have called bmap() and added a new
@@ -516,6 +1103,27 @@ writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
   return tot;
 }
 
+// Write data to inode: a plain file's to the page cache, for
+// the flusher to write home, anything else's to its blocks.
+// Caller must hold ip->lock, and unless ip is a plain file be
+// in a transaction.
+// If user_src==1, then src is a user virtual address;
+// otherwise, src is a kernel address.
+// Returns the number of bytes successfully written.
+int
+writei(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  int r;
+
+  if(ip->type == T_FILE && ip->dev != TMPDEV)
+    return pcwrite(ip, user_src, src, off, n);
+  r = writeblk(ip, user_src, src, off, n);
+  // after the copy, which may have faulted pages of ip in.
+  if(r > 0)
+    pcinvalrange(ip, off, r);
+  return r;
+}
+
 // Directories
 
 int
@@ -524,39 +1132,356 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// The hash set of entries that (dp, name) maps to.
+static struct dcent*
+dcset(struct inode *dp, char *name)
+{
+  uint h;
+  int i;
+
+  h = dp->dev * 31 + dp->inum;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h * 33 + (uchar)name[i];
+  return &dcache.ent[(h % (NDCACHE / DCWAYS)) * DCWAYS];
+}
+
+// Caller must hold dcache.lock.
+static struct dcent*
+dcfind(struct inode *dp, char *name)
+{
+  struct dcent *set, *e;
+
+  set = dcset(dp, name);
+  for(e = set; e < set + DCWAYS; e++){
+    if(e->dinum == dp->inum && e->dev == dp->dev &&
+       namecmp(e->name, name) == 0)
+      return e;
+  }
+  return 0;
+}
+
+// Look up name in directory dp in the name cache.
+// Return 0 if the cache does not know the name.  Otherwise
+// return 1 and set *ipp to the referenced, unlocked inode,
+// or to 0 if dp has no such name.
+// dp need not be locked, only referenced.
+static int
+dclookup(struct inode *dp, char *name, struct inode **ipp)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *ipp = e->inum ? iget(e->dev, e->inum) : 0;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Record that name in dp is inum (0 for absent).
+// Caller must hold dp->lock.
+static void
+dcenter(struct inode *dp, char *name, uint inum)
+{
+  struct dcent *set, *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp, name)) == 0){
+    set = dcset(dp, name);
+    for(e = set; e < set + DCWAYS; e++){
+      if(e->dinum == 0)
+        break;
+    }
+    if(e == set + DCWAYS)
+      e = set + dcache.hand++ % DCWAYS;
+    e->dev = dp->dev;
+    e->dinum = dp->inum;
+    strncpy(e->name, name, DIRSIZ);
+  }
+  e->inum = inum;
+  release(&dcache.lock);
+}
+
+// Forget name in dp, which is being removed.
+// Caller must hold dp->lock.
+void
+dcremove(struct inode *dp, char *name)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  if((e = dcfind(dp, name)) != 0)
+    e->dinum = 0;
+  release(&dcache.lock);
+}
+
+// Forget every entry naming ip or naming something in ip,
+// which is being freed.
+static void
+dcpurge(struct inode *ip)
+{
+  struct dcent *e;
+
+  acquire(&dcache.lock);
+  for(e = dcache.ent; e < dcache.ent + NDCACHE; e++){
+    if(e->dev == ip->dev && (e->dinum == ip->inum || e->inum == ip->inum))
+      e->dinum = 0;
+  }
+  release(&dcache.lock);
+}
+
+// Is name "." or ".."?
+static int
+isdot(char *name)
+{
+  return name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0));
+}
+
+// FNV-1a.  mkfs has a copy.
+static uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+// The index entry for hash h.
+static int
+dxfind(struct dxindex *dx, uint h)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = dx->n - 1;
+  while(lo < hi){
+    mid = (lo + hi + 1) / 2;
+    if(dx->e[mid].hash <= h)
+      lo = mid;
+    else
+      hi = mid - 1;
+  }
+  return lo;
+}
+
+// Set [*start, *end) to the directory bytes that could hold
+// name.  Return 1 if that is the leaf the index gives, 0 if
+// it is all of dp, or for "." and "..", block 0.
+// Caller must hold dp->lock.
+static int
+dirspan(struct inode *dp, char *name, uint *start, uint *end)
+{
+  struct buf *bp;
+  struct dxindex *dx;
+  int leaf;
+
+  *start = 0;
+  *end = dp->size;
+  if(dp->addrs[DXADDR] == 0)
+    return 0;
+  if(isdot(name)){
+    *end = BSIZE;
+    return 0;
+  }
+  bp = bread(dp->dev, dp->addrs[DXADDR]);
+  dx = (struct dxindex*)bp->data;
+  leaf = !dx->linear;
+  if(leaf){
+    *start = dx->e[dxfind(dx, dxhash(name))].blk * BSIZE;
+    *end = *start + BSIZE;
+  }
+  brelse(bp);
+  return leaf;
+}
+
+// Look in bytes [start, end) of dp for the entry for name, or
+// for a free entry if name is 0.  Return its offset, or end.
+// Caller must hold dp->lock.
+static uint
+dirscan(struct inode *dp, char *name, uint start, uint end, struct dirent *dep)
+{
+  struct buf *bp;
+  struct dirent *de;
+  struct dirent d;
+  uint off, bend;
+
+  if(dp->dev == TMPDEV){
+    for(off = start; off < end; off += sizeof(d)){
+      if(readi(dp, 0, (uint64)&d, off, sizeof(d)) != sizeof(d))
+        panic("dirscan");
+      if(name ? d.inum && namecmp(name, d.name) == 0 : d.inum == 0){
+        *dep = d;
+        return off;
+      }
+    }
+    return end;
+  }
+
+  for(off = start; off < end; ){
+    bp = bread(dp->dev, bmap(dp, off/BSIZE, 0));
+    bend = min(end, (off/BSIZE + 1) * BSIZE);
+    for(; off < bend; off += sizeof(*de)){
+      de = (struct dirent*)(bp->data + off % BSIZE);
+      if(name ? de->inum && namecmp(name, de->name) == 0 : de->inum == 0){
+        *dep = *de;
+        brelse(bp);
+        return off;
+      }
+    }
+    brelse(bp);
+  }
+  return end;
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
 dirlookup(struct inode *dp, char *name, uint *poff)
 {
-  uint off, inum;
+  uint start, end, off;
   struct dirent de;
 
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  dirspan(dp, name, &start, &end);
+  if((off = dirscan(dp, name, start, end, &de)) == end)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, de.inum);
+}
+
+// Give dp, whose one block is full, an index with that block
+// as its only leaf.
+static void
+dxcreate(struct inode *dp)
+{
+  struct buf *bp;
+  struct dxindex *dx;
+
+  dp->addrs[DXADDR] = bextend(dp, 0, 0, 0);
+  bp = bnew(dp->dev, dp->addrs[DXADDR]);
+  memset(bp->data, 0, BSIZE);
+  dx = (struct dxindex*)bp->data;
+  dx->n = 1;
+  log_write(bp);
+  brelse(bp);
+  iupdate(dp);
+}
+
+// Split the full leaf of index entry i, moving the entries
+// with the upper half of its hashes to a new leaf at the end
+// of dp.  Return -1 if the index is full or all the entries
+// have the same hash.
+static int
+dxsplit(struct inode *dp, struct dxindex *dx, int i)
+{
+  struct buf *from, *to;
+  struct dirent *de, *nde;
+  uint h[DPB], split, t, blk;
+  int n, j, k;
+
+  if(dx->n == NDXENTRY)
+    return -1;
+
+  from = bread(dp->dev, bmap(dp, dx->e[i].blk, 0));
+  de = (struct dirent*)from->data;
+  n = 0;
+  for(j = 0; j < DPB; j++){
+    if(de[j].inum && !isdot(de[j].name)){
+      t = dxhash(de[j].name);
+      for(k = n++; k > 0 && h[k-1] > t; k--)
+        h[k] = h[k-1];
+      h[k] = t;
     }
   }
 
+  // at the median, or the nearest change of hash to it.
+  for(j = n/2; j > 0 && j < n && h[j] == h[j-1]; j++)
+    ;
+  if(j == 0 || j == n)
+    for(j = n/2; j > 0 && h[j] == h[j-1]; j--)
+      ;
+  if(j == 0){
+    brelse(from);
+    return -1;
+  }
+  split = h[j];
+
+  blk = dp->size / BSIZE;
+  to = bread(dp->dev, bmap(dp, blk, 0));
+  nde = (struct dirent*)to->data;
+  for(j = 0, k = 0; j < DPB; j++){
+    if(de[j].inum && !isdot(de[j].name) && dxhash(de[j].name) >= split){
+      nde[k++] = de[j];
+      memset(&de[j], 0, sizeof(de[j]));
+    }
+  }
+  log_write(from);
+  log_write(to);
+  brelse(from);
+  brelse(to);
+  dp->size += BSIZE;
+  dp->dsize = dp->size;
+  pcinval(dp);
+  iupdate(dp);
+
+  memmove(&dx->e[i+2], &dx->e[i+1], (dx->n - i - 1) * sizeof(dx->e[0]));
+  dx->e[i+1].hash = split;
+  dx->e[i+1].blk = blk;
+  dx->n++;
   return 0;
 }
 
+// Return the offset of a free entry in dp where name can go,
+// splitting a leaf of dp's index if need be.  The offset may
+// be dp->size.
+static uint
+dirslot(struct inode *dp, char *name)
+{
+  struct buf *bp;
+  struct dxindex *dx;
+  struct dirent de;
+  uint start, end, off;
+  int i;
+
+  if(dp->addrs[DXADDR] == 0){
+    if((off = dirscan(dp, 0, 0, dp->size, &de)) < dp->size ||
+       dp->dev == TMPDEV || (SB(dp->dev).features & FS_DIRINDEX) == 0 ||
+       dp->size != BSIZE || isdot(name))
+      return off;
+    dxcreate(dp);
+  }
+
+  for(;;){
+    if(!dirspan(dp, name, &start, &end))
+      return dirscan(dp, 0, 0, dp->size, &de);
+    if((off = dirscan(dp, 0, start, end, &de)) < end)
+      return off;
+    bp = bread(dp->dev, dp->addrs[DXADDR]);
+    dx = (struct dxindex*)bp->data;
+    i = dxfind(dx, dxhash(name));
+    if(dxsplit(dp, dx, i) < 0)
+      dx->linear = 1;
+    log_write(bp);
+    brelse(bp);
+  }
+}
+
 // Write a new directory entry (name, inum) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint inum)
 {
-  int off;
+  uint off;
   struct dirent de;
   struct inode *ip;
 
@@ -566,19 +1491,119 @@ dirlink(struct inode *dp, char *name, uint inum)
     return -1;
   }
 
-  // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlink read");
-    if(de.inum == 0)
-      break;
-  }
-
+  off = dirslot(dp, name);
+  memset(&de, 0, sizeof(de));
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcenter(dp, name, inum);
+
+  return 0;
+}
 
+// Mounts.
+//
+// mtab pairs each directory that has a file system mounted on
+// it, the cover, with the root of that file system, for namex()
+// to cross from the one to the other, and back on "..".  Entries
+// are only added, never removed, and each holds a reference to
+// both inodes, so lookups read the table without a lock once
+// mtab.n counts an entry.
+
+// The root of the file system on disk device dev, referenced,
+// or 0 if dev has none.
+struct inode*
+fsroot(int dev)
+{
+  if(DISK(dev) < 0 || DISK(dev) >= NDISK || SB(dev).magic != FSMAGIC)
+    return 0;
+  return iget(dev, ROOTINO);
+}
+
+// Is ip a mount point, or the root of a mounted file system?
+// Caller must hold mtab.lock.
+static int
+mtabhas(struct inode *ip)
+{
+  int i;
+
+  for(i = 0; i < mtab.n; i++)
+    if(mtab.m[i].cover == ip || mtab.m[i].root == ip)
+      return 1;
+  return 0;
+}
+
+// Mount the file system whose root is root on directory cover,
+// keeping the caller's references to both.  Returns -1 if
+// either is in the table already, so that one file system is
+// mounted once and crossings never chain, or it is full.
+int
+mount(struct inode *cover, struct inode *root)
+{
+  int n;
+
+  acquire(&mtab.lock);
+  n = mtab.n;
+  if(n == NMOUNT || cover == root || mtabhas(cover) || mtabhas(root)){
+    release(&mtab.lock);
+    return -1;
+  }
+  mtab.m[n].cover = cover;
+  mtab.m[n].root = root;
+  __atomic_store_n(&mtab.n, n + 1, __ATOMIC_RELEASE);
+  release(&mtab.lock);
+  return 0;
+}
+
+// ip, referenced, or the root mounted on it if it is a mount
+// point.  Must be called inside a transaction, since it calls
+// iput().
+static struct inode*
+mntcross(struct inode *ip)
+{
+  int i, n;
+
+  n = __atomic_load_n(&mtab.n, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++){
+    if(mtab.m[i].cover == ip){
+      iput(ip);
+      return idup(mtab.m[i].root);
+    }
+  }
+  return ip;
+}
+
+// The directory to look name up in, in place of ip: the mount
+// point if name is ".." and ip the root of a mounted file
+// system.  Must be called inside a transaction.
+static struct inode*
+mntdotdot(struct inode *ip, char *name)
+{
+  int i, n;
+
+  if(namecmp(name, "..") != 0)
+    return ip;
+  n = __atomic_load_n(&mtab.n, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++){
+    if(mtab.m[i].root == ip){
+      iput(ip);
+      return idup(mtab.m[i].cover);
+    }
+  }
+  return ip;
+}
+
+// Is ip a mount point, which must stay?
+int
+mntcovers(struct inode *ip)
+{
+  int i, n;
+
+  n = __atomic_load_n(&mtab.n, __ATOMIC_ACQUIRE);
+  for(i = 0; i < n; i++)
+    if(mtab.m[i].cover == ip)
+      return 1;
   return 0;
 }
 
@@ -629,13 +1654,27 @@ static struct inode*
 namex(char *path, int nameiparent, char *name)
 {
   struct inode *ip, *next;
+  struct proc *g;
 
   if(*path == '/')
     ip = iget(ROOTDEV, ROOTINO);
-  else
-    ip = idup(myproc()->cwd);
+  else {
+    g = myproc()->group;
+    acquire(&g->slock);  // against a chdir() in another thread
+    ip = idup(g->cwd);
+    release(&g->slock);
+  }
 
   while((path = skipelem(path, name)) != 0){
+    ip = mntdotdot(ip, name);
+    // A cached name implies that ip is a directory.
+    if(!(nameiparent && *path == '\0') && dclookup(ip, name, &next)){
+      iput(ip);
+      if(next == 0)
+        return 0;
+      ip = mntcross(next);
+      continue;
+    }
     ilock(ip);
     if(ip->type != T_DIR){
       iunlockput(ip);
@@ -646,12 +1685,14 @@ namex(char *path, int nameiparent, char *name)
       iunlock(ip);
       return ip;
     }
-    if((next = dirlookup(ip, name, 0)) == 0){
+    next = dirlookup(ip, name, 0);
+    dcenter(ip, name, next ? next->inum : 0);
+    if(next == 0){
       iunlockput(ip);
       return 0;
     }
     iunlockput(ip);
-    ip = next;
+    ip = mntcross(next);
   }
   if(nameiparent){
     iput(ip);
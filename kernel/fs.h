@@ -3,14 +3,18 @@
 
 
 #define ROOTINO  1   // root i-number
-#define BSIZE 1024  // block size
+#ifndef BSIZE
+#define BSIZE 1024  // block size; make BSIZE=4096 to change it
+#endif
+#define SBOFF 1024  // byte offset of the super block, whatever BSIZE is
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                          free bit map | swap area | data blocks]
 //
 // mkfs computes the super block and builds an initial file system. The
-// super block describes the disk layout:
+// super block, which is at byte SBOFF so that a kernel can find it
+// whatever block size it was built for, describes the disk layout:
 struct superblock {
   uint magic;        // Must be FSMAGIC
   uint size;         // Size of file system image (blocks)
@@ -20,13 +24,34 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint logmode;      // What the log holds, LOG_*
+  uint features;     // FS_* flags
+  uint bsize;        // BSIZE of the mkfs that made it
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of swap blocks, maybe 0
 };
 
 #define FSMAGIC 0x10203040
 
-#define NDIRECT 12
+// Features.  A kernel must refuse a file system with any it
+// does not know about.
+#define FS_DIRINDEX   0x1  // directories may have a hash index
+#define FS_INLINE     0x2  // small files may keep their data in the inode
+
+// Journaling modes.  All of them log inodes, bitmap blocks and
+// directories.
+#define LOG_ORDERED   0  // new file data goes home before the commit
+#define LOG_DATA      1  // all file data is logged too
+#define LOG_WRITEBACK 2  // file data is never logged
+
+// addrs[] holds NDIRECT direct block numbers, then one
+// singly-, one doubly- and one triply-indirect block.
+#define NDIRECT 10
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define NTINDIRECT (NDINDIRECT * NINDIRECT)
+#define NLEVEL 3
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT + NTINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -35,9 +60,16 @@ struct dinode {
   short minor;          // Minor device number (T_DEVICE only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+NLEVEL];   // Data block addresses
 };
 
+// Inline data.  On a file system with FS_INLINE, a plain file
+// of at most NINLINE bytes may keep them in addrs[] instead of
+// in a block of its own, and then has DI_INLINE set in type.
+// Directories never fit: "." and ".." alone take more.
+#define DI_INLINE 0x1000
+#define NINLINE ((NDIRECT+NLEVEL) * sizeof(uint))
+
 // Inodes per block.
 #define IPB           (BSIZE / sizeof(struct dinode))
 
@@ -51,10 +83,38 @@ struct dinode {
 #define BBLOCK(b, sb) ((b)/BPB + sb.bmapstart)
 
 // Directory is a file containing a sequence of dirent structures.
-#define DIRSIZ 14
+#define DIRSIZ 30
 
 struct dirent {
   ushort inum;
   char name[DIRSIZ];
 };
 
+// Dirents per block.
+#define DPB           (BSIZE / sizeof(struct dirent))
+
+// Directory index.  On a file system with FS_DIRINDEX, a
+// directory that has outgrown one block may have a hash index,
+// in the block that addrs[DXADDR] names; a directory never
+// needs a triply-indirect block.  The directory's blocks are
+// then leaves, and index entry i says that the entries whose
+// names hash to at least e[i].hash, and less than e[i+1].hash,
+// are in leaf e[i].blk.  "." and ".." stay at the start of
+// block 0, outside the index.  If linear is set, the index
+// could not be split any further and the directory is searched
+// from end to end instead.
+#define DXADDR (NDIRECT+NLEVEL-1)
+
+struct dxentry {
+  uint hash;            // least hash in the leaf
+  uint blk;             // leaf's block within the directory
+};
+
+#define NDXENTRY ((BSIZE - 2*sizeof(uint)) / sizeof(struct dxentry))
+
+struct dxindex {
+  uint n;               // entries in use, sorted by hash
+  uint linear;
+  struct dxentry e[NDXENTRY];
+};
+
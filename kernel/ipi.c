@@ -0,0 +1,89 @@
+// Cross-CPU calls.
+//
+// smpcall() has other CPUs run a function.  For each, it puts
+// the call in the slot of the CPU's cpu struct that is this
+// CPU's, and interrupts it: ipi() sets the CPU's machine-mode
+// software interrupt bit in the CLINT, which timervec in
+// kernelvec.S passes on as a supervisor software interrupt,
+// for devintr() to run the calls in ipirecv().
+//
+// The caller waits with interrupts off until every CPU has run
+// the call.  So that a CPU never waits with interrupts off for
+// one that waits for it, so does acquire() while it spins:
+// both run the calls made to their own CPU meanwhile.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct call {
+  void (*fn)(void*);
+  void *arg;
+  uint left;              // CPUs yet to run it
+};
+
+// Interrupt CPU cpu.
+void
+ipi(int cpu)
+{
+  *(uint32*)CLINT_MSIP(cpu) = 1;
+}
+
+// Run the calls other CPUs have made to this one.
+// Interrupts must be off.
+void
+ipirecv(void)
+{
+  struct cpu *c = mycpu();
+  struct call *call;
+  uint m, bit;
+  int i;
+
+  if(c->callmask == 0)
+    return;
+  bit = 1 << cpuid();
+  m = __atomic_exchange_n(&c->callmask, 0, __ATOMIC_ACQUIRE);
+  for(i = 0; i < NCPU; i++){
+    if((m & (1 << i)) == 0)
+      continue;
+    call = c->call[i];
+    call->fn(call->arg);
+    // the caller may return, and its call go, once its bit is clear.
+    __sync_fetch_and_and(&call->left, ~bit);
+  }
+}
+
+// Run fn(arg) on each CPU in mask, this one too if it is in
+// mask, and return once all have.  The CPUs in mask must have
+// started.  The others run fn in an interrupt or while they
+// spin for a lock, with interrupts off and maybe locks held, so
+// it must be short and must neither take locks nor call
+// smpcall().
+void
+smpcall(uint mask, void (*fn)(void*), void *arg)
+{
+  struct call call;
+  int i, me;
+
+  push_off();
+  me = cpuid();
+  call.fn = fn;
+  call.arg = arg;
+  call.left = mask & ALLCPUS & ~(1 << me);
+  for(i = 0; i < NCPU; i++){
+    if((call.left & (1 << i)) == 0)
+      continue;
+    cpus[i].call[me] = &call;
+    __sync_fetch_and_or(&cpus[i].callmask, 1 << me);
+    ipi(i);
+  }
+  if(mask & (1 << me))
+    fn(arg);
+  while(__atomic_load_n(&call.left, __ATOMIC_ACQUIRE) != 0)
+    ipirecv();
+  pop_off();
+}
@@ -1,6 +1,23 @@
 // Physical memory allocator, for user processes,
 // kernel stacks, page-table pages,
 // and pipe buffers. Allocates whole 4096-byte pages.
+//
+// Each CPU has its own free list and lock, so harts allocating
+// at the same time rarely contend.  A CPU whose list is empty
+// steals a batch of pages from another CPU's list.
+//
+// Nothing is freed at boot.  Each CPU gets a slice of physical
+// memory that it hands out from the bottom up, only once its
+// free list is empty, so a page is first touched by the CPU
+// that first uses it, and kinit() costs no time however much
+// memory there is.
+//
+// Freed and allocated pages are filled with junk, to catch
+// dangling references, only in KDEBUG builds.
+//
+// Pages shared copy-on-write are reference counted; kfree()
+// only puts a page back on a free list when its last
+// reference goes away.
 
 #include "types.h"
 #include "param.h"
@@ -9,34 +26,83 @@
 #include "riscv.h"
 #include "defs.h"
 
-void freerange(void *pa_start, void *pa_end);
-
 extern char end[]; // first address after kernel.
                    // defined by kernel.ld.
 
+// Number of pages moved by one steal.
+#define NSTEAL 32
+
 struct run {
   struct run *next;
 };
 
-struct {
+struct kmem {
   struct spinlock lock;
   struct run *freelist;
-} kmem;
+  int nfree;              // pages on freelist
+  char *lazy;             // pages from here to lazyend were never used
+  char *lazyend;
+};
+
+struct kmem kmem[NCPU];
+
+// Reference counts of allocated pages, indexed by physical
+// page number.  Updated with atomic instructions.
+#define PA2REF(pa) (((uint64)(pa) - KERNBASE) / PGSIZE)
+static int refcnt[(PHYSTOP - KERNBASE) / PGSIZE];
+
+// Push pa onto the free list of CPU id.
+static void
+kpush(int id, void *pa)
+{
+  struct run *r = (struct run*)pa;
+
+  acquire(&kmem[id].lock);
+  r->next = kmem[id].freelist;
+  kmem[id].freelist = r;
+  kmem[id].nfree++;
+  release(&kmem[id].lock);
+}
 
 void
 kinit()
 {
-  initlock(&kmem.lock, "kmem");
-  freerange(end, (void*)PHYSTOP);
+  int i;
+  uint64 start, per;
+
+  for(i = 0; i < NCPU; i++)
+    initlock(&kmem[i].lock, "kmem");
+
+  // Give each CPU an equal slice of physical memory.
+  start = PGROUNDUP((uint64)end);
+  per = PGROUNDDOWN((PHYSTOP - start) / NCPU);
+  for(i = 0; i < NCPU; i++){
+    kmem[i].lazy = (char*)(start + i*per);
+    kmem[i].lazyend = (char*)(i == NCPU-1 ? PHYSTOP : start + (i+1)*per);
+  }
 }
 
-void
-freerange(void *pa_start, void *pa_end)
+// Take up to max never-used pages from k's slice, linked as a
+// list ending at *tail.  Returns the number taken.
+// Caller holds k->lock.
+static int
+kcarve(struct kmem *k, int max, struct run **head, struct run **tail)
 {
-  char *p;
-  p = (char*)PGROUNDUP((uint64)pa_start);
-  for(; p + PGSIZE <= (char*)pa_end; p += PGSIZE)
-    kfree(p);
+  struct run *r;
+  int n;
+
+  *head = *tail = 0;
+  for(n = 0; n < max && k->lazy < k->lazyend; n++){
+    r = (struct run*)k->lazy;
+    k->lazy += PGSIZE;
+    r->next = 0;
+    if(*tail)
+      (*tail)->next = r;
+    else
+      *head = r;
+    *tail = r;
+  }
+  return n;
 }
 
 // Free the page of physical memory pointed at by v,
@@ -46,37 +112,189 @@ freerange(void *pa_start, void *pa_end)
 void
 kfree(void *pa)
 {
-  struct run *r;
+  int id;
 
   if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
     panic("kfree");
 
+  if(refcnt[PA2REF(pa)] < 1)
+    panic("kfree: ref");
+  if(__sync_sub_and_fetch(&refcnt[PA2REF(pa)], 1) > 0)
+    return;
+
+#ifdef KDEBUG
   // Fill with junk to catch dangling refs.
   memset(pa, 1, PGSIZE);
+#endif
+
+  push_off();
+  id = cpuid();
+  kpush(id, pa);
+  pop_off();
+}
+
+// Free n pages at once, as kfree() does each, taking this
+// CPU's free list lock only once.
+void
+kfreen(void **pas, int n)
+{
+  struct run *head, *tail, *r;
+  int i, id, nfreed;
 
-  r = (struct run*)pa;
+  head = tail = 0;
+  nfreed = 0;
+  for(i = 0; i < n; i++){
+    void *pa = pas[i];
+    if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+      panic("kfreen");
+    if(refcnt[PA2REF(pa)] < 1)
+      panic("kfreen: ref");
+    if(__sync_sub_and_fetch(&refcnt[PA2REF(pa)], 1) > 0)
+      continue;
+#ifdef KDEBUG
+    memset(pa, 1, PGSIZE);
+#endif
+    r = (struct run*)pa;
+    r->next = head;
+    head = r;
+    if(tail == 0)
+      tail = r;
+    nfreed++;
+  }
+  if(head == 0)
+    return;
 
-  acquire(&kmem.lock);
-  r->next = kmem.freelist;
-  kmem.freelist = r;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  acquire(&kmem[id].lock);
+  tail->next = kmem[id].freelist;
+  kmem[id].freelist = head;
+  kmem[id].nfree += nfreed;
+  release(&kmem[id].lock);
+  pop_off();
+}
+
+// Move up to NSTEAL pages from another CPU's list, or failing
+// that its never-used slice, to CPU id's list.  Holds only one
+// kmem lock at a time.  Returns the number of pages moved.
+static int
+ksteal(int id)
+{
+  struct kmem *victim;
+  struct run *head, *tail;
+  int i, n;
+
+  for(i = 1; i < NCPU; i++){
+    victim = &kmem[(id + i) % NCPU];
+    acquire(&victim->lock);
+    head = tail = victim->freelist;
+    if(head){
+      for(n = 1; n < NSTEAL && tail->next; n++)
+        tail = tail->next;
+      victim->freelist = tail->next;
+      victim->nfree -= n;
+    } else {
+      n = kcarve(victim, NSTEAL, &head, &tail);
+    }
+    release(&victim->lock);
+    if(n == 0)
+      continue;
+
+    acquire(&kmem[id].lock);
+    tail->next = kmem[id].freelist;
+    kmem[id].freelist = head;
+    kmem[id].nfree += n;
+    release(&kmem[id].lock);
+    return n;
+  }
+  return 0;
 }
 
 // Allocate one 4096-byte page of physical memory.
+// When every CPU's list is empty, reclaims the page
+// cache's unmapped pages before giving up.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
 void *
 kalloc(void)
 {
   struct run *r;
+  int id;
 
-  acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  release(&kmem.lock);
+  push_off();
+  id = cpuid();
+  for(;;){
+    acquire(&kmem[id].lock);
+    r = kmem[id].freelist;
+    if(r){
+      kmem[id].freelist = r->next;
+      kmem[id].nfree--;
+    } else if(kmem[id].lazy < kmem[id].lazyend){
+      r = (struct run*)kmem[id].lazy;
+      kmem[id].lazy += PGSIZE;
+    }
+    release(&kmem[id].lock);
+    if(r)
+      break;
+    if(ksteal(id) == 0 && pcshrink() == 0)
+      break;
+  }
+  pop_off();
 
-  if(r)
+  if(r){
+    refcnt[PA2REF(r)] = 1;
+#ifdef KDEBUG
     memset((char*)r, 5, PGSIZE); // fill with junk
+#endif
+  }
   return (void*)r;
 }
+
+// Add a reference to an allocated page, which the matching
+// kfree() will drop.
+void
+kincref(void *pa)
+{
+  if(((uint64)pa % PGSIZE) != 0 || (char*)pa < end || (uint64)pa >= PHYSTOP)
+    panic("kincref");
+  if(__sync_fetch_and_add(&refcnt[PA2REF(pa)], 1) < 1)
+    panic("kincref: free page");
+}
+
+// Return the number of references to an allocated page.
+int
+kgetref(void *pa)
+{
+  return refcnt[PA2REF(pa)];
+}
+
+// Return the number of free pages, never used ones included.
+int
+kfreepages(void)
+{
+  int i, n;
+
+  n = 0;
+  for(i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    n += kmem[i].nfree + (kmem[i].lazyend - kmem[i].lazy) / PGSIZE;
+    release(&kmem[i].lock);
+  }
+  return n;
+}
+
+// Report the free pages, and how many of them were never used.
+int
+statsmem(char *buf, int sz)
+{
+  int i, n, lazy;
+
+  n = lazy = 0;
+  for(i = 0; i < NCPU; i++){
+    acquire(&kmem[i].lock);
+    n += kmem[i].nfree;
+    lazy += (kmem[i].lazyend - kmem[i].lazy) / PGSIZE;
+    release(&kmem[i].lock);
+  }
+  return snprintf(buf, sz, "mem: %d free pages, %d never used\n", n + lazy, lazy);
+}
@@ -0,0 +1,292 @@
+// Same-page merging, in KSM=1 builds.
+//
+// A kernel thread goes round all processes' private pages,
+// NKSMSCAN page table entries a tick, and maps pages with the
+// same contents to one copy-on-write page, so that a pool of
+// processes running the same program with much the same data
+// needs one copy of it.  A page of zeros becomes the zero page
+// that uvmlazy() maps for untouched heap.
+//
+// Each page's contents are hashed.  A merged page sits in the
+// stable table, which holds a reference to it; a page whose
+// hash is already there, and whose contents match, is
+// replaced by it.  Otherwise the hash goes in the unstable
+// table, and a later page that hashes the same is taken into
+// the stable table itself, for the first page to merge with
+// when the scan comes round to it again.  That takes locks on
+// only one process at a time.  A stable page is write
+// protected in every page table that maps it, and has more
+// than one reference, so uvmcow() copies it on a write and it
+// never changes; once the table's is the only reference left,
+// the page goes.
+//
+// A page is write protected, and other CPUs' TLB entries for
+// it flushed, before its contents are compared, so no thread
+// can change it meanwhile.  Like swap.c, a scan puts back what
+// it changed if the kernel started using the process's pages
+// by physical address (see npinned in uvmpin()).
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define NKSMSCAN 256   // PTEs looked at a tick
+#define NKSMBATCH 32   // pages one scan changes
+#define NSTABLE 1024   // stable table slots; a power of two
+#define NUNSTABLE 1024 // and unstable
+
+extern struct proc proc[NPROC];
+extern char *zeropage;
+
+static struct {
+  struct spinlock lock;   // for statsksm()
+  int hand;               // proc[] index of the scan
+  uint64 va;              // and where it is in that memory
+  uint zerohash;
+  struct {
+    uint hash;
+    char *pa;             // a page the table holds a reference to
+  } stable[NSTABLE];
+  struct {
+    uint hash;
+    char *pa;             // the page that hashed so, maybe gone
+  } unstable[NUNSTABLE];
+
+  // Statistics.
+  uint nscan;             // pages hashed
+  uint nmerged;           // replaced by a stable page
+  uint nzero;             // and by the zero page
+  int nstable;
+} ksm;
+
+// What one scan will do to each page it picked.
+struct merge {
+  uint64 va;
+  pte_t *pte;
+  pte_t old;
+  char *to;               // the page to map instead, or 0 to
+  uint hash;              //   move it into the stable table
+};
+
+static void ksmd(void);
+
+void
+ksminit(void)
+{
+  initlock(&ksm.lock, "ksm");
+  kthread("ksm", ksmd);
+}
+
+static uint
+pagehash(char *pa)
+{
+  uint64 *w = (uint64*)pa;
+  uint64 h = 0;
+  int i;
+
+  for(i = 0; i < PGSIZE/8; i++)
+    h = h*31 + w[i];
+  return h ^ (h >> 32);
+}
+
+// Drop stable pages that no page table maps any more.
+static void
+ksmprune(void)
+{
+  int i;
+
+  for(i = 0; i < NSTABLE; i++){
+    if(ksm.stable[i].pa && kgetref(ksm.stable[i].pa) == 1){
+      kfree(ksm.stable[i].pa);
+      ksm.stable[i].pa = 0;
+      ksm.nstable--;
+    }
+  }
+}
+
+// Hash up to NKSMSCAN of g's pages from ksm.va, and pick out
+// those to merge into m.  Returns 1 if the scan has gone past
+// the end of g's memory.
+// Caller must hold g->lock and g->slock.
+static int
+ksmscan(struct proc *g, struct merge *m, int *np)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  struct vma *v;
+  uint64 va, a;
+  char *pa, *sp;
+  uint h;
+  int nscan, n;
+
+  n = 0;
+  va = ksm.va;
+  for(nscan = 0; va < MMAPTOP && nscan < NKSMSCAN && n < NKSMBATCH; ){
+    pte = &g->pagetable[PX(2, va)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va + LEVELSIZE(2)) & ~(LEVELSIZE(2) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(1, va)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(0, va)];
+    a = va;
+    va += PGSIZE;
+    nscan++;
+
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    pa = (char*)PTE2PA(*pte);
+    if(kgetref(pa) != 1)
+      continue;  // shared already, or the page cache's
+    if((v = vmafind(g, a)) != 0 && (v->flags & MAP_SHARED))
+      continue;
+    h = pagehash(pa);
+    ksm.nscan++;
+    sp = ksm.stable[h % NSTABLE].pa;
+    if(h == ksm.zerohash){
+      m[n].to = zeropage;
+    } else if(sp && ksm.stable[h % NSTABLE].hash == h){
+      m[n].to = sp;
+    } else if(ksm.unstable[h % NUNSTABLE].hash == h &&
+              ksm.unstable[h % NUNSTABLE].pa != pa && sp == 0){
+      m[n].to = 0;
+      ksm.unstable[h % NUNSTABLE].pa = 0;
+    } else {
+      ksm.unstable[h % NUNSTABLE].hash = h;
+      ksm.unstable[h % NUNSTABLE].pa = pa;
+      continue;
+    }
+    m[n].va = a;
+    m[n].pte = pte;
+    m[n].old = *pte;
+    m[n].hash = h;
+    n++;
+  }
+  ksm.va = va;
+  *np = n;
+  return va >= MMAPTOP;
+}
+
+// Write protect the pages in m, then merge each whose
+// contents match.  Adds the pages g no longer maps to
+// freed[], and returns how many.
+// Caller must hold g->lock and g->slock.
+static int
+ksmmerge(struct proc *g, struct merge *m, int n, char **freed)
+{
+  char *pa;
+  pte_t flags;
+  int i, nfreed, slot;
+
+  for(i = 0; i < n; i++)
+    if(*m[i].pte & PTE_W)
+      *m[i].pte = (*m[i].pte & ~PTE_W) | PTE_COW;
+  tlbshootdown(g, MAXVA, 0);
+  __sync_synchronize();
+  if(g->npinned){
+    for(i = 0; i < n; i++)
+      *m[i].pte = m[i].old;
+    return 0;
+  }
+
+  nfreed = 0;
+  for(i = 0; i < n; i++){
+    pa = (char*)PTE2PA(m[i].old);
+    flags = PTE_FLAGS(*m[i].pte);
+    if(m[i].to == 0){
+      // later pages with this hash merge with pa.  Another
+      // page of this scan may have taken the slot first.
+      slot = m[i].hash % NSTABLE;
+      if(ksm.stable[slot].pa){
+        kfree(ksm.stable[slot].pa);
+        ksm.nstable--;
+      }
+      kincref(pa);
+      ksm.stable[slot].hash = m[i].hash;
+      ksm.stable[slot].pa = pa;
+      ksm.nstable++;
+    } else if(memcmp(pa, m[i].to, PGSIZE) == 0){
+      kincref(m[i].to);
+      *m[i].pte = PA2PTE(m[i].to) | flags;
+      freed[nfreed++] = pa;
+      if(m[i].to == zeropage)
+        ksm.nzero++;
+      else
+        ksm.nmerged++;
+    }
+  }
+  if(nfreed > 0)
+    tlbshootdown(g, MAXVA, 0);
+  return nfreed;
+}
+
+// The merging kernel thread: every tick, scan on through the
+// next process that has user memory.
+static void
+ksmd(void)
+{
+  struct merge m[NKSMBATCH];
+  char *freed[NKSMBATCH];
+  struct proc *g;
+  int n, nfreed, done, scanned, left;
+
+  ksm.zerohash = pagehash(zeropage);
+  for(;;){
+    sleepuntil(r_time() + TICKINTERVAL);
+    nfreed = 0;
+    acquire(&ksm.lock);
+    for(left = NPROC; left > 0; left--){
+      g = &proc[ksm.hand];
+      done = 1;
+      scanned = 0;
+      acquire(&g->lock);
+      // as in swapout().
+      if(g->state != UNUSED && g->state != USED && g->state != ZOMBIE &&
+         g->group == g && g->kthread == 0 && g->pagetable && g->npinned == 0){
+        acquire(&g->slock);
+        done = ksmscan(g, m, &n);
+        if(n > 0)
+          nfreed = ksmmerge(g, m, n, freed);
+        release(&g->slock);
+        scanned = 1;
+      }
+      release(&g->lock);
+      if(done){
+        ksm.va = 0;
+        if(++ksm.hand == NPROC){
+          ksm.hand = 0;
+          ksmprune();
+        }
+      }
+      if(scanned)
+        break;
+    }
+    release(&ksm.lock);
+    if(nfreed > 0)
+      kfreen((void**)freed, nfreed);
+  }
+}
+
+// Report what merging has saved.
+int
+statsksm(char *buf, int sz)
+{
+  int n;
+
+  acquire(&ksm.lock);
+  n = snprintf(buf, sz, "ksm: %d scanned, %d merged, %d zero, %d stable\n",
+               ksm.nscan, ksm.nmerged, ksm.nzero, ksm.nstable);
+  release(&ksm.lock);
+  return n;
+}
@@ -21,6 +21,41 @@
 // But if it thinks the log is close to running out, it
 // sleeps until the last outstanding end_op() commits.
 //
+// Commits are grouped: end_op() of every system call in a
+// transaction waits until the last one has made the whole
+// transaction durable, so they all share one commit.
+//
+// New system calls are held off only while commit() copies
+// the transaction's blocks from the cache to one of two sets
+// of private buffers, not while it writes them.  So the next
+// transaction fills while this one goes to disk, and while
+// the one before that is installed.
+//
+// An op that writes a lot, like filewrite(), can reserve more
+// than MAXOPBLOCKS with begin_opn().
+//
+// Each disk with a file system has a log of its own, with its
+// own transactions, commits and logger thread, holding only
+// that disk's blocks.  begin_op() joins the transaction of
+// every disk's log, since a system call only learns which file
+// systems it touches as it looks up names, and iput() may free
+// an inode on any of them; these ops are small.  begin_opn(),
+// for the big writes to one file, joins only the log of that
+// file's disk, so writes to a second disk commit on their own.
+//
+// sb.logmode chooses what happens to file data; in every mode
+// inodes, bitmap blocks and directories are logged.  In
+// LOG_DATA mode everything else is too.  Otherwise newly
+// allocated data blocks are not logged: log_ordered()
+// has commit() write them straight to their home locations
+// ahead of the header, so that once the pointers to them
+// commit, the data they point at is on disk too.  A block
+// that was free until this transaction holds nothing anyone
+// could see if the transaction never commits.  In
+// LOG_WRITEBACK mode writeblk() also writes changes to existing
+// data blocks straight home with log_writeback(), so after a
+// crash a file may hold some of a write that never committed.
+//
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
@@ -28,7 +63,10 @@
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Log appends are synchronous.  Once the header is on disk,
+// the logger kernel thread copies the blocks to their home
+// locations in the background, while the next transaction
+// collects updates in the buffer cache.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -42,41 +80,93 @@ struct log {
   int start;
   int size;
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks reserved by outstanding ops.
+  int committing;  // commit() is copying the transaction, please wait.
+  int installing;  // logger is installing hdr[iset].
+  int iset;
   int dev;
+  uint seq;        // number of the transaction being collected.
+  uint done;       // last transaction that is durable.
+  uint fin[2];     // last transaction of each parity to finish commit().
   struct logheader lh;
+  struct logheader olh; // new data blocks to write ahead of lh.
+  int freed;       // has this transaction freed any blocks?
+
+  // Committing transaction seq uses set seq%2 of these, from
+  // when commit() copies it until it is installed.  The private
+  // copies in lbuf[] mean that later updates in the cache are
+  // never logged or installed before they commit.
+  int busy[2];
+  struct logheader hdr[2];   // its logged blocks
+  struct logheader ohdr[2];  // its new data blocks
+  struct buf lbuf[2][LOGSIZE];
+
+  // Statistics.
+  uint ncommit;
+  uint nblocks;
+  uint nordered;
 };
-struct log log;
+// by disk; dev is 0 if the disk has no file system.
+static struct log log[NDISK];
 
-static void recover_from_log(void);
-static void commit();
+static void recover_from_log(struct log*);
+static void commit(struct log*, uint);
+static void logger(void);
 
 void
 initlog(int dev, struct superblock *sb)
 {
+  struct log *l = &log[DISK(dev)];
+  int i, j;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
-  initlock(&log.lock, "log");
-  log.start = sb->logstart;
-  log.size = sb->nlog;
-  log.dev = dev;
-  recover_from_log();
+  initlock(&l->lock, "log");
+  for(i = 0; i < 2; i++)
+    for(j = 0; j < LOGSIZE; j++)
+      initsleeplock(&l->lbuf[i][j].lock, "logbuf");
+  l->start = sb->logstart;
+  l->size = sb->nlog;
+  l->dev = dev;
+  l->seq = 1;
+  recover_from_log(l);
+  kthread("logger", logger);
 }
 
 // Copy committed blocks from log to their home location
 static void
-install_trans(int recovering)
+install_trans(struct log *l, int recovering)
 {
   int tail;
+  struct buf *bufs[LOGSIZE];
+  struct logheader *h = &l->hdr[l->iset];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
+  if(!recovering){
+    // Write the private copies in one batch, then let
+    // the cache evict the home blocks.
+    for (tail = 0; tail < h->n; tail++) {
+      struct buf *lb = &l->lbuf[l->iset][tail];
+      acquiresleep(&lb->lock);
+      lb->dev = l->dev;
+      lb->blockno = h->block[tail];
+      bufs[tail] = lb;
+    }
+    bwritev(bufs, h->n);  // write dst to disk
+    for (tail = 0; tail < h->n; tail++) {
+      releasesleep(&l->lbuf[l->iset][tail].lock);
+      struct buf *dbuf = bread(l->dev, h->block[tail]);
+      bunpin(dbuf);
+      brelse(dbuf);
+    }
+    return;
+  }
+
+  for (tail = 0; tail < l->lh.n; tail++) {
+    struct buf *lbuf = bread(l->dev, l->start+tail+1); // read log block
+    struct buf *dbuf = bread(l->dev, l->lh.block[tail]); // read dst
     memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
     bwrite(dbuf);  // write dst to disk
-    if(recovering == 0)
-      bunpin(dbuf);
     brelse(lbuf);
     brelse(dbuf);
   }
@@ -84,124 +174,340 @@ install_trans(int recovering)
 
 // Read the log header from disk into the in-memory log header
 static void
-read_head(void)
+read_head(struct log *l)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(l->dev, l->start);
   struct logheader *lh = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  l->lh.n = lh->n;
+  for (i = 0; i < l->lh.n; i++) {
+    l->lh.block[i] = lh->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
-// This is the true point at which the
-// current transaction commits.
+// Write a log header to disk.
+// Writing a non-empty header is the true point
+// at which that transaction commits; commit() passes
+// sync so that blk.c polls for it.
 static void
-write_head(void)
+write_head(struct log *l, struct logheader *h, int sync)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = bread(l->dev, l->start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
-  bwrite(buf);
+  if(sync)
+    bwritesync(buf);
+  else
+    bwrite(buf);
   brelse(buf);
 }
 
 static void
-recover_from_log(void)
+recover_from_log(struct log *l)
 {
-  read_head();
-  install_trans(1); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  read_head(l);
+  install_trans(l, 1); // if committed, copy from log to disk
+  l->lh.n = 0;
+  write_head(l, &l->lh, 0); // clear the log
 }
 
-// called at the start of each FS system call.
-void
-begin_op(void)
+// The log a logger thread that has just started is to serve.
+// initlog() starts one for each log, so the kth to start
+// takes the kth log with a file system.
+static struct log*
+logclaim(void)
+{
+  static int nclaimed;
+  struct log *l;
+  int k;
+
+  k = __sync_fetch_and_add(&nclaimed, 1);
+  for(l = log; l < log + NDISK; l++)
+    if(l->dev && k-- == 0)
+      return l;
+  panic("logclaim");
+}
+
+// A logger kernel thread: install each committed
+// transaction of its log, then erase it from the log.
+static void
+logger(void)
+{
+  struct logheader empty;
+  struct log *l = logclaim();
+
+  empty.n = 0;
+  for(;;){
+    acquire(&l->lock);
+    while(!l->installing)
+      sleep(&l->installing, &l->lock);
+    release(&l->lock);
+
+    install_trans(l, 0); // Now install writes to home locations
+    write_head(l, &empty, 0);    // Erase the transaction from the log
+
+    acquire(&l->lock);
+    l->installing = 0;
+    l->busy[l->iset] = 0;
+    wakeup(&l->done);
+    release(&l->lock);
+  }
+}
+
+// Join l's transaction, for an op that writes at most n of
+// its blocks.
+static void
+logbegin(struct log *l, int n)
 {
-  acquire(&log.lock);
+  acquire(&l->lock);
   while(1){
-    if(log.committing){
-      sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    if(l->committing){
+      sleep(l, &l->lock);
+    } else if(l->lh.n + l->olh.n + l->reserved + n > LOGSIZE){
       // this op might exhaust log space; wait for commit.
-      sleep(&log, &log.lock);
+      sleep(l, &l->lock);
     } else {
-      log.outstanding += 1;
-      release(&log.lock);
+      l->outstanding += 1;
+      l->reserved += n;
+      release(&l->lock);
       break;
     }
   }
 }
 
-// called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The log of device dev, or 0 if it has none, like tmpfs.
+static struct log*
+devlog(int dev)
+{
+  if(DISK(dev) < 0 || DISK(dev) >= NDISK || log[DISK(dev)].dev == 0)
+    return 0;
+  return &log[DISK(dev)];
+}
+
+// called at the start of an op that writes at most n blocks,
+// all on device dev.
 void
-end_op(void)
+begin_opn(int dev, int n)
+{
+  struct log *l;
+
+  if((l = devlog(dev)) != 0)
+    logbegin(l, n);
+}
+
+// called at the start of each FS system call, which may write
+// up to MAXOPBLOCKS blocks on every disk.  Joins the logs in
+// order, so that ops waiting for each other's commits can't
+// deadlock.
+void
+begin_op(void)
 {
-  int do_commit = 0;
+  struct log *l;
+
+  for(l = log; l < log + NDISK; l++)
+    if(l->dev)
+      logbegin(l, MAXOPBLOCKS);
+}
 
-  acquire(&log.lock);
-  log.outstanding -= 1;
-  if(log.committing)
+// Leave l's transaction, with the n passed to logbegin().
+// Returns the transaction's number, and sets *do_commit if
+// this was the last outstanding op, which must commit it.
+static uint
+logend(struct log *l, int n, int *do_commit)
+{
+  uint seq;
+
+  *do_commit = 0;
+  acquire(&l->lock);
+  l->outstanding -= 1;
+  l->reserved -= n;
+  if(l->committing)
     panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
+  seq = l->seq;
+  if(l->outstanding == 0){
+    *do_commit = 1;
+    l->committing = 1;
   } else {
     // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
+    // and decrementing l->reserved has decreased
     // the amount of reserved space.
-    wakeup(&log);
+    wakeup(l);
   }
-  release(&log.lock);
+  release(&l->lock);
+  return seq;
+}
 
+// Commit transaction seq of l if do_commit, or else wait for
+// the op that will.
+static void
+logfinish(struct log *l, uint seq, int do_commit)
+{
   if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+    commit(l, seq);
+  } else {
+    // Group commit: return once the last op of this
+    // transaction has made it durable.
+    acquire(&l->lock);
+    while(l->done < seq)
+      sleep(&l->done, &l->lock);
+    release(&l->lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// called at the end of an op, with the dev and n passed to
+// begin_opn().
+// commits if this was the last outstanding operation,
+// otherwise waits for that commit.
+void
+end_opn(int dev, int n)
+{
+  struct log *l;
+  int do_commit;
+  uint seq;
+
+  if((l = devlog(dev)) != 0){
+    seq = logend(l, n, &do_commit);
+    logfinish(l, seq, do_commit);
+  }
+}
+
+// called at the end of each FS system call.  Leaves every
+// log's transaction before waiting on any, so that one disk's
+// commit doesn't hold up the next.
+void
+end_op(void)
+{
+  int do_commit[NDISK];
+  uint seq[NDISK];
+  int i;
+
+  for(i = 0; i < NDISK; i++)
+    if(log[i].dev)
+      seq[i] = logend(&log[i], MAXOPBLOCKS, &do_commit[i]);
+  for(i = 0; i < NDISK; i++)
+    if(log[i].dev)
+      logfinish(&log[i], seq[i], do_commit[i]);
+}
+
+// Copy the blocks of the transaction in lh from the cache to
+// the private buffers of set.
 static void
-write_log(void)
+copy_log(struct log *l, int set)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
+  for (tail = 0; tail < l->lh.n; tail++) {
+    struct buf *to = &l->lbuf[set][tail];
+    struct buf *from = bread(l->dev, l->lh.block[tail]); // cache block
+    acquiresleep(&to->lock);
     memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    releasesleep(&to->lock);
     brelse(from);
-    brelse(to);
   }
 }
 
+// Write the private copies of set to the log, along with
+// its new data blocks to their home locations.
 static void
-commit()
+write_log(struct log *l, int set)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(0); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  int tail, n;
+  struct buf *bufs[LOGSIZE];
+  struct logheader *h = &l->hdr[set], *oh = &l->ohdr[set];
+
+  for (tail = 0; tail < h->n; tail++) {
+    struct buf *to = &l->lbuf[set][tail]; // log block
+    acquiresleep(&to->lock);
+    to->dev = l->dev;
+    to->blockno = l->start+tail+1;
+    bufs[tail] = to;
+  }
+  n = h->n;
+  for (tail = 0; tail < oh->n; tail++)
+    bufs[n++] = bread(l->dev, oh->block[tail]); // pinned, so cached
+  bwritev(bufs, n);  // write the log and the new data
+  for (tail = 0; tail < h->n; tail++)
+    releasesleep(&l->lbuf[set][tail].lock);
+  for (tail = h->n; tail < n; tail++) {
+    bunpin(bufs[tail]);
+    brelse(bufs[tail]);
   }
 }
 
+// Commit transaction seq, which has no outstanding ops and
+// has l->committing set.
+static void
+commit(struct log *l, uint seq)
+{
+  int set = seq % 2, empty;
+
+  // Copy the transaction and start the next one.
+  acquire(&l->lock);
+  empty = l->lh.n == 0 && l->olh.n == 0;
+  while(!empty && l->busy[set])
+    sleep(&l->done, &l->lock);
+  l->busy[set] = !empty;
+  release(&l->lock);
+
+  copy_log(l, set);
+
+  acquire(&l->lock);
+  l->hdr[set] = l->lh;
+  l->ohdr[set] = l->olh;
+  l->lh.n = 0;
+  l->olh.n = 0;
+  l->freed = 0;
+  l->seq++;
+  l->committing = 0;
+  wakeup(l);
+
+  // The log area is busy until the previous transaction is
+  // durable and installed, and installing it must not
+  // overwrite a new data block that it freed.  An empty
+  // transaction needs only a free slot in l->fin[].
+  if(empty){
+    while(l->done + 2 < seq)
+      sleep(&l->done, &l->lock);
+  } else {
+    while(l->done + 1 < seq || l->installing)
+      sleep(&l->done, &l->lock);
+  }
+  release(&l->lock);
+
+  if (!empty) {
+    write_log(l, set);  // Write modified blocks to log
+    if (l->hdr[set].n > 0)
+      write_head(l, &l->hdr[set], 1);    // Write header to disk -- the real commit
+  }
+
+  // Hand the transaction to the logger.
+  acquire(&l->lock);
+  if (!empty)
+    l->ncommit++;
+  l->nblocks += l->hdr[set].n;
+  l->nordered += l->ohdr[set].n;
+  if (l->hdr[set].n > 0) {
+    l->iset = set;
+    l->installing = 1;
+    wakeup(&l->installing);
+  } else {
+    l->busy[set] = 0;
+  }
+  // An empty transaction may finish before the one ahead of it.
+  l->fin[set] = seq;
+  while(l->fin[(l->done + 1) % 2] == l->done + 1)
+    l->done++;
+  wakeup(&l->done);
+  release(&l->lock);
+}
+
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache by increasing refcnt.
 // commit()/write_log() will do the disk write.
@@ -214,23 +520,132 @@ commit()
 void
 log_write(struct buf *b)
 {
+  struct log *l = &log[DISK(b->dev)];
   int i;
 
-  acquire(&log.lock);
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  acquire(&l->lock);
+  if (l->lh.n + l->olh.n >= LOGSIZE || l->lh.n >= l->size - 1)
     panic("too big a transaction");
-  if (log.outstanding < 1)
+  if (l->outstanding < 1)
     panic("log_write outside of trans");
 
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorption
+  for (i = 0; i < l->lh.n; i++) {
+    if (l->lh.block[i] == b->blockno)   // log absorption
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n) {  // Add new block to log?
+  l->lh.block[i] = b->blockno;
+  if (i == l->lh.n) {  // Add new block to log?
     bpin(b);
-    log.lh.n++;
+    l->lh.n++;
   }
-  release(&log.lock);
+  release(&l->lock);
 }
 
+// Like log_write(), for a data block that bmap() has just
+// allocated: commit() writes it home ahead of the header
+// instead of logging it.  If this transaction has freed blocks,
+// b might be one of them, and until the transaction commits
+// the file that had it could still be using it; log it then.
+void
+log_ordered(struct buf *b)
+{
+  struct log *l = &log[DISK(b->dev)];
+  int i;
+
+  acquire(&l->lock);
+  if (l->freed) {
+    release(&l->lock);
+    log_write(b);
+    return;
+  }
+  if (l->lh.n + l->olh.n >= LOGSIZE)
+    panic("too big a transaction");
+  if (l->outstanding < 1)
+    panic("log_ordered outside of trans");
+
+  for (i = 0; i < l->olh.n; i++) {
+    if (l->olh.block[i] == b->blockno)
+      break;
+  }
+  if (i == l->olh.n) {
+    l->olh.block[i] = b->blockno;
+    bpin(b);
+    l->olh.n++;
+  }
+  release(&l->lock);
+}
+
+// For writeblk() in LOG_WRITEBACK mode: write the existing data
+// block b straight home instead of logging it.  If the log
+// holds a copy of b, from this transaction or one still being
+// committed or installed, log b after all, so the older copy
+// can't land on top of this one.
+void
+log_writeback(struct buf *b)
+{
+  struct log *l = &log[DISK(b->dev)];
+  int i, set, logged = 0;
+
+  acquire(&l->lock);
+  if (l->outstanding < 1)
+    panic("log_writeback outside of trans");
+  for (i = 0; i < l->lh.n; i++)
+    if (l->lh.block[i] == b->blockno)
+      logged = 1;
+  for (set = 0; set < 2; set++)
+    for (i = 0; l->busy[set] && i < l->hdr[set].n; i++)
+      if (l->hdr[set].block[i] == b->blockno)
+        logged = 1;
+  release(&l->lock);
+
+  if (logged)
+    log_write(b);
+  else
+    bwrite(b);
+}
+
+// bfree() is freeing a block of dev's in this transaction.
+void
+log_free(int dev)
+{
+  struct log *l = &log[DISK(dev)];
+
+  acquire(&l->lock);
+  l->freed = 1;
+  release(&l->lock);
+}
+
+// Report each log's commit statistics, the root disk's as
+// "log:" and disk n's as "logn:".  ticks advance ten times a
+// second.
+int
+statslog(char *buf, int sz)
+{
+  uint t, ncommit, nblocks, nordered;
+  struct log *l;
+  char name[8];
+  int n;
+
+  n = 0;
+  for(l = log; l < log + NDISK; l++){
+    if(l->dev == 0)
+      continue;
+    acquire(&l->lock);
+    ncommit = l->ncommit;
+    nblocks = l->nblocks;
+    nordered = l->nordered;
+    release(&l->lock);
+    t = ticks;
+    if(t == 0)
+      t = 1;
+
+    if(l == log)
+      snprintf(name, sizeof(name), "log");
+    else
+      snprintf(name, sizeof(name), "log%d", (int)(l - log));
+    n += snprintf(buf+n, sz-n, "%s: %d commits, %d blocks, %d blocks/commit, %d commits/s, %d unlogged data blocks\n",
+                  name, ncommit, nblocks, ncommit ? nblocks / ncommit : 0,
+                  ncommit * 10 / t, nordered);
+  }
+  return n;
+}
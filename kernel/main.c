@@ -6,29 +6,84 @@
 
 volatile static int started = 0;
 
+// Boot trace: when each step of bringing the system up
+// finished, in r_time() units since the machine started, up to
+// the first exec() of sh.
+#define NBOOTMARK 16
+
+static struct {
+  char what[16];
+  uint64 t;
+} bootmarks[NBOOTMARK];
+static int nbootmark;
+static int bootdone;
+
+// Record that boot step what finished now, unless the trace
+// has ended.  exec() records each program it starts.
+void
+bootmark(char *what)
+{
+  int i;
+
+  if(bootdone)
+    return;
+  if((i = __sync_fetch_and_add(&nbootmark, 1)) >= NBOOTMARK)
+    return;
+  safestrcpy(bootmarks[i].what, what, sizeof(bootmarks[i].what));
+  bootmarks[i].t = r_time();
+  if(strncmp(what, "sh", sizeof(bootmarks[i].what)) == 0)
+    bootdone = 1;
+}
+
+// Report the boot trace, in microseconds.
+int
+statsboot(char *buf, int sz)
+{
+  int i, n;
+
+  n = snprintf(buf, sz, "boot:");
+  for(i = 0; i < nbootmark && i < NBOOTMARK; i++)
+    n += snprintf(buf+n, sz-n, " %s %d us", bootmarks[i].what,
+                  (int)(bootmarks[i].t / (TIMEFREQ / 1000000)));
+  return n + snprintf(buf+n, sz-n, "\n");
+}
+
 // start() jumps here in supervisor mode on all CPUs.
 void
 main()
 {
   if(cpuid() == 0){
+    bootmark("main");
     consoleinit();
+    statsinit();
+    profinit();
     printfinit();
     printf("\n");
     printf("xv6 kernel is booting\n");
     printf("\n");
     kinit();         // physical page allocator
+    bootmark("kinit");
     kvminit();       // create kernel page table
     kvminithart();   // turn on paging
     procinit();      // process table
     trapinit();      // trap vectors
     trapinithart();  // install kernel trap vector
+    timerinithart(); // scheduler ticks and sleep deadlines
     plicinit();      // set up interrupt controller
     plicinithart();  // ask PLIC for device interrupts
     binit();         // buffer cache
     iinit();         // inode table
+    pcinit();        // page cache
     fileinit();      // file table
+    pipeinit();      // pipes
+    blkinit();       // disk request queue
     virtio_disk_init(); // emulated hard disk
     userinit();      // first user process
+    rcuinit();       // read-copy update
+#ifdef KSM
+    ksminit();       // same-page merging
+#endif
+    bootmark("userinit");
     __sync_synchronize();
     started = 1;
   } else {
@@ -38,8 +93,12 @@ main()
     printf("hart %d starting\n", cpuid());
     kvminithart();    // turn on paging
     trapinithart();   // install kernel trap vector
+    timerinithart();  // scheduler ticks and sleep deadlines
     plicinithart();   // ask PLIC for device interrupts
   }
 
+#ifdef LOCKBENCH
+  lockbench();
+#endif
   scheduler();        
 }
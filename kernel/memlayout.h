@@ -21,12 +21,15 @@
 #define UART0 0x10000000L
 #define UART0_IRQ 10
 
-// virtio mmio interface
+// virtio mmio interface, one page of registers per disk.
 #define VIRTIO0 0x10001000
 #define VIRTIO0_IRQ 1
+#define VIRTIO1 0x10002000
+#define VIRTIO1_IRQ 2
 
 // core local interruptor (CLINT), which contains the timer.
 #define CLINT 0x2000000L
+#define CLINT_MSIP(hartid) (CLINT + 4*(hartid))
 #define CLINT_MTIMECMP(hartid) (CLINT + 0x4000 + 8*(hartid))
 #define CLINT_MTIME (CLINT + 0xBFF8) // cycles since boot.
 
@@ -60,8 +63,27 @@
 //   text
 //   original data and bss
 //   fixed-size stack
-//   expandable heap
+//   expandable heap, up to MMAPBASE
 //   ...
+//   mmap() regions, from MMAPTOP downward
+//   trapframes of a process's other threads, from THREADTF(1)
+//   USHARED (read-only, the same page in every process)
+//   USYSCALL (read-only, p->usyscall)
 //   TRAPFRAME (p->trapframe, used by the trampoline)
 //   TRAMPOLINE (the same page as in the kernel)
 #define TRAPFRAME (TRAMPOLINE - PGSIZE)
+#define USYSCALL (TRAPFRAME - PGSIZE)
+#define USHARED (USYSCALL - PGSIZE)
+#define THREADTF(i) (USHARED - (uint64)(i)*PGSIZE)
+#define MMAPTOP (THREADTF(NTHREAD))
+#define MMAPBASE (MAXVA / 2)
+
+// Kernel state that user code reads without a system
+// call; see getpid() and uptime() in user/ulib.c.
+struct usyscall {
+  int pid;  // Process ID
+};
+
+struct ushared {
+  uint ticks;  // ticks since boot, as uptime() returns
+};
@@ -0,0 +1,247 @@
+// Memory-mapped files and anonymous memory.
+//
+// mmap() only records a vma; uvmfile() in vm.c pages it in
+// on first touch, through the page cache for files.  Pages
+// of a MAP_SHARED mapping, which must be of a plain file not
+// in tmpfs, are the page cache's own, so stores land in the
+// cache, and processes that map the same file and read() and
+// write() of it share them; munmap() and exit() write dirty
+// ones back to the file through the log.  MAP_PRIVATE pages are
+// copy-on-write.  Mappings are placed top down from MMAPTOP,
+// and the heap may not grow past MMAPBASE.
+//
+// A process's threads share its mappings, which live in the
+// group leader's proc; its slock covers changes to them.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "fcntl.h"
+#include "stat.h"
+#include "defs.h"
+
+// Write the PGSIZE bytes at pa back to ip at offset off,
+// stopping at the end of the file; mmap() never grows one.
+static void
+writeback(struct inode *ip, char *pa, uint off)
+{
+  uint i, n;
+
+  for(i = 0; i < PGSIZE; i += n){
+    begin_opn(ip->dev, BULKOPBLOCKS);
+    ilock(ip);
+    n = 0;
+    if(off + i < ip->size){
+      n = PGSIZE - i;
+      if(n > MAXOPBYTES)
+        n = MAXOPBYTES;
+      if(n > ip->size - (off + i))
+        n = ip->size - (off + i);
+      writei(ip, 0, (uint64)pa + i, off + i, n);
+    }
+    iunlock(ip);
+    end_opn(ip->dev, BULKOPBLOCKS);
+    if(n == 0)
+      break;
+  }
+}
+
+// Remove [start, end) of v from p's address space, writing
+// dirty pages of a shared file mapping back first.  The range
+// must be all of v or one end of it.
+static void
+unmapvma(struct proc *p, struct vma *v, uint64 start, uint64 end)
+{
+  uint64 va;
+  pte_t *pte;
+
+  if(v->ip && (v->flags & MAP_SHARED)){
+    for(va = start; va < end; va += PGSIZE){
+      pte = walk(p->pagetable, va, 0);
+      if(pte && (*pte & PTE_V) && (*pte & PTE_D))
+        writeback(v->ip, (char*)PTE2PA(*pte), v->off + (va - v->start));
+    }
+  }
+  acquire(&p->slock);
+  uvmunmap(p->pagetable, start, (end - start) / PGSIZE, 1);
+  tlbshootdown(p, start, end - start);
+  release(&p->slock);
+
+  if(start == v->start && end == v->end){
+    begin_op();
+    vmaclear(v);
+    end_op();
+  } else if(start == v->start){
+    v->off += end - start;
+    v->filesz = v->filesz > end - start ? v->filesz - (end - start) : 0;
+    v->start = end;
+  } else {
+    v->end = start;
+  }
+}
+
+// Map len bytes of f from offset off, or anonymous memory if
+// flags has MAP_ANONYMOUS.  Returns the address, or -1.
+uint64
+mmap(uint64 len, int prot, int flags, struct file *f, uint off)
+{
+  struct proc *p = myproc()->group;
+  struct vma *v, *free;
+  uint64 start, va;
+  char *mem;
+  int perm, type;
+
+  if(p->vfork)
+    return -1;  // see vfork()
+  if(len == 0 || len > MMAPBASE || (off % PGSIZE) != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0){
+    if(f == 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    // a shared page must be the one read() and write() use,
+    // and only a plain file on disk reads through the cache.
+    ilock(f->ip);
+    type = f->ip->type;
+    iunlock(f->ip);
+    if((flags & MAP_SHARED) && (type != T_FILE || f->ip->dev == TMPDEV))
+      return -1;
+  }
+  len = PGROUNDUP(len);
+
+  // below the lowest existing mapping.
+  acquire(&p->slock);
+  free = 0;
+  start = MMAPTOP;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->end == 0){
+      if(free == 0)
+        free = v;
+    } else if(v->flags && v->start < start){
+      start = v->start;
+    }
+  }
+  if(free == 0 || start - MMAPBASE < len){
+    release(&p->slock);
+    return -1;
+  }
+  start -= len;
+
+  perm = 0;
+  if(prot & (PROT_READ|PROT_WRITE))
+    perm |= PTE_R;  // RISC-V has no write-only pages
+  if(prot & PROT_WRITE)
+    perm |= PTE_W;
+  if(prot & PROT_EXEC)
+    perm |= PTE_X;
+
+  v = free;
+  v->start = start;
+  v->end = start + len;
+  v->ip = (flags & MAP_ANONYMOUS) ? 0 : idup(f->ip);
+  v->off = off;
+  v->filesz = (flags & MAP_ANONYMOUS) ? 0 : len;
+  v->perm = perm;
+  v->flags = flags;
+
+  // fork() shares the pages that are mapped, so shared
+  // anonymous memory must all be mapped from the start,
+  // unless it can't be touched at all.
+  if((flags & (MAP_ANONYMOUS|MAP_SHARED)) == (MAP_ANONYMOUS|MAP_SHARED) &&
+     perm != 0){
+    for(va = start; va < start + len; va += PGSIZE){
+      if((mem = kalloc()) == 0 ||
+         mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm|PTE_U) != 0){
+        if(mem)
+          kfree(mem);
+        release(&p->slock);
+        unmapvma(p, v, v->start, v->end);
+        return -1;
+      }
+      memset(mem, 0, PGSIZE);
+    }
+  }
+  release(&p->slock);
+  return start;
+}
+
+// Unmap [addr, addr+len), which must be all of one mapping
+// or one end of it.  Returns 0, or -1 on a bad range.
+int
+munmap(uint64 addr, uint64 len)
+{
+  struct proc *p = myproc()->group;
+  struct vma *v;
+  uint64 end;
+
+  if(p->vfork)
+    return -1;
+  if((addr % PGSIZE) != 0 || len == 0)
+    return -1;
+  end = addr + PGROUNDUP(len);
+  if((v = vmafind(p, addr)) == 0 || v->flags == 0 || end > v->end)
+    return -1;
+  if(addr != v->start && end != v->end)
+    return -1;
+  unmapvma(p, v, addr, end);
+  return 0;
+}
+
+// Unmap all of p's mappings, for exit() and exec().
+void
+munmapall(struct proc *p)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && v->flags)
+      unmapvma(p, v, v->start, v->end);
+}
+
+// For fork(): give the child the pages the parent's mappings
+// have mapped so far.  Shared pages stay shared; private
+// writable ones become copy-on-write in both.  The vmas
+// themselves are copied by vmadup().  Swapped-out private
+// pages share their slots, as in uvmcopy().  Returns 0, or -1
+// if out of memory.
+int
+mmapfork(pagetable_t old, pagetable_t new, struct vma *vma)
+{
+  struct vma *v;
+  uint64 va, pa;
+  pte_t *pte, *npte;
+
+  for(v = vma; v < &vma[NVMA]; v++){
+    if(v->end == 0 || v->flags == 0)
+      continue;
+    for(va = v->start; va < v->end; va += PGSIZE){
+      if((pte = walk(old, va, 0)) == 0)
+        continue;
+      if((*pte & PTE_V) == 0){
+        if(*pte & PTE_SWAP){
+          if((npte = walk(new, va, 1)) == 0)
+            return -1;
+          *npte = *pte;
+          swapdup(PTE2SLOT(*pte));
+        }
+        continue;
+      }
+      if((v->flags & MAP_PRIVATE) && (*pte & PTE_W))
+        *pte = (*pte & ~PTE_W) | PTE_COW;
+      pa = PTE2PA(*pte);
+      if(mappages(new, va, PGSIZE, pa, PTE_FLAGS(*pte)) != 0)
+        return -1;
+      kincref((void*)pa);
+    }
+  }
+  return 0;
+}
@@ -1,13 +1,37 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       256  // maximum number of processes
 #define NCPU          8  // maximum number of CPUs
+#define NPRIO         3  // scheduler priority levels
+#define BOOSTTICKS   10  // ticks between priority boosts
+#define NTHREAD      16  // maximum threads per process, at most 32
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NICACHE      64  // unreferenced i-nodes kept in memory
+#define NDCACHE     128  // entries in the name lookup cache
+#define NFLUSHPAGE   16  // pages flushed one by one; more flush the ASID
+#define NVMA         16  // file-backed memory ranges per process
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
-#define MAXARG       32  // max exec arguments
+#define NDISK         2  // virtio disks; disk n is device ROOTDEV+n
+#define TMPDEV        (ROOTDEV+NDISK)  // device number of the tmpfs on /tmp
+#define NMOUNT        8  // mounted file systems, besides the root
+#define NTMPINODE  1024  // tmpfs i-nodes
+#define TMPPAGES   8192  // pages tmpfs may hold, maps included
+#define MAXIOV       16  // max buffers per readv/writev
+#define NPERF         5  // events perfread() counts; see perf.h
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define LOGSIZE      (MAXOPBLOCKS*6)  // max data blocks in on-disk log
+#define NBUF         (MAXOPBLOCKS*24) // size of disk block cache
+#define NPREFETCH    16  // max blocks read ahead by one read
+#define MAXMERGE     32  // max blocks in one disk request
+#define UARTHART      0  // hart that takes console interrupts
+#define DISKHART      1  // and disk interrupts, once it has started;
+                           // disk n's go to hart DISKHART+n
+#define DISKPOLL     (TIMEFREQ/10000)  // r_time() a polled disk wait spins
+#define FSSIZE       (200000*1024/BSIZE)  // size of file system in blocks
+#define SWAPSIZE     (8*1024*1024/BSIZE)  // blocks of it mkfs keeps for swap
+#define RECLAIMLOW   256  // free pages below which the reclaimer runs
+#define RECLAIMHIGH 1024  // free pages it stops at
+#define NRECLAIM      64  // pages a fault that found none free reclaims
+#define TIMEFREQ   10000000  // r_time() counts per second in qemu
+#define TICKINTERVAL (TIMEFREQ/10)  // r_time() counts per scheduler tick
+#define PROFINTERVAL (TIMEFREQ/1000)  // r_time() counts per profiler sample
 #define MAXPATH      128   // maximum file path name
@@ -0,0 +1,647 @@
+// Page cache.
+//
+// Holds copies of file contents a page at a time, so that
+// reading a file's data again doesn't go to the disk, and
+// processes running the same program share its pages instead of
+// each reading the file.  A page is named by its in-memory inode
+// and the file offset of its first byte.  readi() keeps that
+// page aligned, but exec() maps ELF segments at whatever offset
+// the linker put them, so it need not be.
+//
+// The cache has no fixed size: it takes pages from kalloc() as
+// files are read, and kalloc() calls pcshrink() when memory runs
+// out, which frees a batch of pages no process has mapped,
+// chosen by a clock hand going round all the cached pages.  An
+// inode's pages also go when iput() recycles its itable entry.
+//
+// The cache holds one reference to each of its pages (see
+// kincref() in kalloc.c) and each mapping of a page holds
+// another, so a page that the cache evicts lives on until the
+// processes using it let go.  Private mappings are read-only; a
+// store to a writable segment gets a private copy from uvmcow().
+// A MAP_SHARED mapping stores into the page itself, so while one
+// has it mapped the page must stay the file's: pcshrink()
+// passes over mapped pages, and pcwrite() and pcinval() change
+// such a page in place rather than replace or drop it.
+//
+// Pages are read and inserted with the file's inode locked, and
+// itrunc() and writei() of anything but a plain file call
+// pcinval() and pcinvalrange() with it locked for the bytes they
+// changed, so the cache never holds stale contents.  Directories
+// and the rest of the metadata stay in the buffer cache; file
+// data passes through it only on the way to or from a page here.
+//
+// writei() of a plain file only copies into the file's pages
+// here with pcwrite() and marks the blocks it wrote dirty; no
+// block is allocated or logged.  The inode goes on a list of
+// dirty inodes, holding a reference, and the flusher kernel
+// thread later writes each one's dirty blocks home in file order
+// with writeblk(), which allocates blocks as it goes, so that a
+// file gets runs of adjacent blocks however it was written.  It
+// writes an inode once it has been dirty for DIRTYEXPIRE, or any
+// when there are more than NDIRTYBG dirty pages or pcshrink()
+// found memory short of clean ones, and writers wait in
+// pcthrottle() while there are more than NDIRTYMAX.  fsync() and
+// sync() write back at once.  A dirty page stays in the cache
+// until it is written, and ip->dsize, the size the disk inode
+// records, covers only written blocks, so data that never went
+// home can't show up after a crash; if the last reference to a
+// deleted file goes before the flusher gets to it, iput() drops
+// the pages and its data never goes to the disk at all.
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "fs.h"
+#include "file.h"
+#include "slab.h"
+#include "defs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NPCBUCKET 1021
+#define PCHASH(ip, off) ((((uint64)(ip) >> 6) + (off) / PGSIZE) % NPCBUCKET)
+#define NPCSHRINK 64      // most pages one pcshrink() frees
+#define NDIRTYBG 256      // dirty pages past which the flusher writes anything
+#define NDIRTYMAX 1024    // and past which writers wait for it
+#define DIRTYEXPIRE (3*TIMEFREQ)  // 3 s in r_time() units
+
+struct pcpage {
+  struct inode *ip;
+  uint off;               // file offset of the first byte
+  char *pa;
+  int used;               // looked up since the clock hand last passed?
+  int shared;             // has been mapped MAP_SHARED
+  uint dirty;             // blocks not yet written home, a bit each
+  struct pcpage *next;    // hash chain
+  struct pcpage *inext;   // ip->pages list
+  struct pcpage *iprev;
+  struct pcpage *lnext;   // ring of all pages, for the clock hand
+  struct pcpage *lprev;
+};
+
+static struct {
+  struct spinlock lock;
+  struct pcpage *bucket[NPCBUCKET];
+  struct pcpage *hand;    // clock hand, or 0 if the cache is empty
+  int npage;
+  int ndirty;             // pages with dirty blocks
+  struct inode *dirty;    // inodes with dirty pages
+  int pressure;           // pcshrink() passed over dirty pages?
+
+  // Statistics.
+  uint nhit;
+  uint nmiss;
+  uint nevict;            // by pcshrink()
+} pcache;
+
+static struct kmcache pcpagecache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+  kminit(&pcpagecache, "pcpage", sizeof(struct pcpage), 0, 0);
+}
+
+// The page of ip at offset off, or 0.
+// Caller holds pcache.lock.
+static struct pcpage*
+pcfind(struct inode *ip, uint off)
+{
+  struct pcpage *pg;
+
+  for(pg = pcache.bucket[PCHASH(ip, off)]; pg; pg = pg->next)
+    if(pg->ip == ip && pg->off == off)
+      return pg;
+  return 0;
+}
+
+// Hook pg into its hash chain, its inode's list and the ring,
+// just behind the clock hand.  Caller holds pcache.lock.
+static void
+pcinsert(struct pcpage *pg)
+{
+  struct inode *ip = pg->ip;
+
+  pg->next = pcache.bucket[PCHASH(ip, pg->off)];
+  pcache.bucket[PCHASH(ip, pg->off)] = pg;
+
+  pg->iprev = 0;
+  pg->inext = ip->pages;
+  if(ip->pages)
+    ip->pages->iprev = pg;
+  ip->pages = pg;
+  ip->npage++;
+  if(pg->off % PGSIZE)
+    ip->nodd++;
+
+  if(pcache.hand == 0){
+    pg->lnext = pg->lprev = pg;
+    pcache.hand = pg;
+  } else {
+    pg->lnext = pcache.hand;
+    pg->lprev = pcache.hand->lprev;
+    pg->lprev->lnext = pg;
+    pcache.hand->lprev = pg;
+  }
+  pcache.npage++;
+}
+
+// Unhook pg, drop the cache's reference to its page, and free
+// it.  Caller holds pcache.lock.
+static void
+pcdrop(struct pcpage *pg)
+{
+  struct inode *ip = pg->ip;
+  struct pcpage **pp;
+
+  for(pp = &pcache.bucket[PCHASH(ip, pg->off)]; *pp != pg; pp = &(*pp)->next)
+    ;
+  *pp = pg->next;
+
+  if(pg->iprev)
+    pg->iprev->inext = pg->inext;
+  else
+    ip->pages = pg->inext;
+  if(pg->inext)
+    pg->inext->iprev = pg->iprev;
+  ip->npage--;
+  if(pg->off % PGSIZE)
+    ip->nodd--;
+
+  if(pg->lnext == pg){
+    pcache.hand = 0;
+  } else {
+    pg->lprev->lnext = pg->lnext;
+    pg->lnext->lprev = pg->lprev;
+    if(pcache.hand == pg)
+      pcache.hand = pg->lnext;
+  }
+  pcache.npage--;
+  if(pg->dirty)
+    pcache.ndirty--;
+
+  kfree(pg->pa);
+  kmfree(pg);
+}
+
+// Read n bytes at file offset off of ip into the kernel buffer
+// dst, locking ip unless this process already holds it, as when
+// copyin() faults on a page of the file being written.
+// Returns the number of bytes read.
+int
+pcread(struct inode *ip, char *dst, uint off, uint n)
+{
+  int locked, r;
+
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+  r = readi(ip, 0, (uint64)dst, off, n);
+  if(!locked)
+    iunlock(ip);
+  return r;
+}
+
+// Is pg mapped by a MAP_SHARED mapping, or may it be?
+// Caller holds pcache.lock.
+static int
+pcmapped(struct pcpage *pg)
+{
+  return pg->shared && kgetref(pg->pa) > 1;
+}
+
+static char*
+pcgetpage(struct inode *ip, uint off, int shared)
+{
+  struct pcpage *pg;
+  char *mem;
+  int locked, n, r;
+
+  if((locked = holdingsleep(&ip->lock)) == 0)
+    ilock(ip);
+
+  acquire(&pcache.lock);
+  if((pg = pcfind(ip, off)) != 0){
+    pg->used = 1;
+    pg->shared |= shared;
+    kincref(pg->pa);
+    mem = pg->pa;
+    pcache.nhit++;
+    release(&pcache.lock);
+    goto out;
+  }
+  pcache.nmiss++;
+  release(&pcache.lock);
+
+  // without pcache.lock, since kalloc() may call pcshrink().
+  // An aligned page that isn't cached isn't dirty, so the disk
+  // has it; one exec() wants at an odd offset may overlap some
+  // that are, so it comes from them.
+  mem = 0;
+  if((pg = kmalloc(&pcpagecache)) != 0 && (mem = kalloc()) != 0){
+    memset(mem, 0, PGSIZE);
+    if(off % PGSIZE){
+      n = off < ip->size ? ip->size - off : 0;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      r = readi(ip, 0, (uint64)mem, off, n);
+    } else {
+      n = off < ip->dsize ? ip->dsize - off : 0;
+      if(n > PGSIZE)
+        n = PGSIZE;
+      r = readblk(ip, 0, (uint64)mem, off, n);
+    }
+    if(r != n){
+      kfree(mem);
+      mem = 0;
+    }
+  }
+  if(mem == 0){
+    if(pg)
+      kmfree(pg);
+    goto out;
+  }
+
+  pg->ip = ip;
+  pg->off = off;
+  pg->pa = mem;
+  pg->used = 1;
+  pg->shared = shared;
+  pg->dirty = 0;
+  kincref(mem);
+  acquire(&pcache.lock);
+  pcinsert(pg);
+  release(&pcache.lock);
+ out:
+  if(!locked)
+    iunlock(ip);
+  return mem;
+}
+
+// Return the page holding the PGSIZE bytes of ip at offset off,
+// zero-filled past the end of the file, with a reference for
+// the caller.  Returns 0 if out of memory or the read fails.
+char*
+pcget(struct inode *ip, uint off)
+{
+  return pcgetpage(ip, off, 0);
+}
+
+// pcget() for a MAP_SHARED mapping of the page, which will
+// store into it.
+char*
+pcgetshared(struct inode *ip, uint off)
+{
+  return pcgetpage(ip, off, 1);
+}
+
+// Free up to NPCSHRINK cached pages that no process has mapped,
+// passing over those looked up since the hand last came by, for
+// kalloc() when memory runs out.  Returns the number freed.
+int
+pcshrink(void)
+{
+  struct pcpage *pg;
+  int n, left;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(left = 2*pcache.npage; left > 0 && pcache.hand && n < NPCSHRINK; left--){
+    pg = pcache.hand;
+    pcache.hand = pg->lnext;
+    if(pg->dirty){
+      pcache.pressure = 1;
+      continue;
+    }
+    if(kgetref(pg->pa) > 1)
+      continue;  // mapped, or readi() is copying from it
+    if(pg->used){
+      pg->used = 0;
+      continue;
+    }
+    pcdrop(pg);
+    n++;
+  }
+  pcache.nevict += n;
+  release(&pcache.lock);
+  return n;
+}
+
+// Forget the cached pages of ip that hold any of the n bytes at
+// offset off, which have just changed on disk.  Processes that
+// have them mapped keep their copies; only plain files, which
+// never come here, may be mapped shared.
+// Caller must hold ip->lock.
+void
+pcinvalrange(struct inode *ip, uint off, uint n)
+{
+  struct pcpage *pg, *next;
+  uint a, end;
+
+  // only pcget() adds pages, with ip locked, so if there are
+  // none there will be none.
+  if(ip->pages == 0 || n == 0)
+    return;
+  end = off + n;
+  acquire(&pcache.lock);
+  if(ip->nodd == 0 && n/PGSIZE + 2 < ip->npage){
+    for(a = PGROUNDDOWN(off); a < end; a += PGSIZE)
+      if((pg = pcfind(ip, a)) != 0)
+        pcdrop(pg);
+  } else {
+    for(pg = ip->pages; pg; pg = next){
+      next = pg->inext;
+      if(pg->off < end && off < pg->off + PGSIZE)
+        pcdrop(pg);
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Forget all the cached pages of ip, which is being truncated or
+// leaving the inode table.  A page mapped shared, which only a
+// truncate can find since the mapping holds a reference to ip,
+// stays, all of it now past the end of the file.
+// Caller must hold ip->lock, or be iput() recycling ip.
+void
+pcinval(struct inode *ip)
+{
+  struct pcpage *pg, *next;
+
+  if(ip->pages == 0)
+    return;
+  acquire(&pcache.lock);
+  for(pg = ip->pages; pg; pg = next){
+    next = pg->inext;
+    if(!pcmapped(pg)){
+      pcdrop(pg);
+      continue;
+    }
+    memset(pg->pa, 0, PGSIZE);
+    if(pg->dirty){
+      pg->dirty = 0;
+      pcache.ndirty--;
+    }
+  }
+  release(&pcache.lock);
+}
+
+// Write n bytes from src to ip at offset off into ip's pages,
+// for writei() of a plain file, and leave them for the flusher.
+// If user_src==1, then src is a user virtual address;
+// otherwise, src is a kernel address.
+// Returns the number of bytes written.
+// Caller must hold ip->lock.
+int
+pcwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  struct pcpage *pg, *next;
+  uint tot, m, pgoff, bits, i;
+  char *mem, *copy;
+  int shared, r;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > MAXFILE*BSIZE)
+    return -1;
+
+  // pages exec() put at odd offsets would go stale.
+  if(ip->nodd){
+    acquire(&pcache.lock);
+    for(pg = ip->pages; pg; pg = next){
+      next = pg->inext;
+      if((pg->off % PGSIZE) && pg->off < off + n && off < pg->off + PGSIZE)
+        pcdrop(pg);
+    }
+    release(&pcache.lock);
+  }
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    pgoff = PGROUNDDOWN(off);
+    m = min(n - tot, PGSIZE - (off - pgoff));
+    if((mem = pcget(ip, pgoff)) == 0)
+      break;
+
+    // with ip locked, the page can't go, and only mappings can
+    // hold references besides the cache's and ours.  Leave
+    // private ones the old contents; shared ones must see the
+    // new.
+    acquire(&pcache.lock);
+    pg = pcfind(ip, pgoff);
+    shared = kgetref(mem) > 2;
+    if(!shared)
+      pg->shared = 0;
+    else if(pg->shared)
+      shared = 0;
+    release(&pcache.lock);
+    if(shared){
+      if((copy = kalloc()) == 0){
+        kfree(mem);
+        break;
+      }
+      memmove(copy, mem, PGSIZE);
+      acquire(&pcache.lock);
+      pg->pa = copy;
+      release(&pcache.lock);
+      kfree(mem);  // the cache's reference
+      kfree(mem);  // and ours
+      kincref(copy);
+      mem = copy;
+    }
+
+    bits = 0;
+    for(i = (off - pgoff) / BSIZE; i <= (off - pgoff + m - 1) / BSIZE; i++)
+      bits |= 1 << i;
+    acquire(&pcache.lock);
+    if(pg->dirty == 0)
+      pcache.ndirty++;
+    pg->dirty |= bits;
+    release(&pcache.lock);
+
+    r = either_copyin(mem + (off - pgoff), user_src, src, m);
+    kfree(mem);
+    if(r == -1)
+      break;
+  }
+
+  if(off > ip->size)
+    ip->size = off;
+  if(tot > 0 && !ip->dirty){
+    idup(ip);
+    ip->dirty = 1;
+    acquire(&pcache.lock);
+    ip->dirtied = r_time();
+    ip->dnext = pcache.dirty;
+    pcache.dirty = ip;
+    release(&pcache.lock);
+  }
+  return tot;
+}
+
+// Take ip off the dirty list.  The caller clears ip->dirty and
+// drops the list's reference.
+// Caller must hold ip->lock.
+void
+pcundirty(struct inode *ip)
+{
+  struct inode **pp;
+
+  acquire(&pcache.lock);
+  for(pp = &pcache.dirty; *pp != ip; pp = &(*pp)->dnext)
+    ;
+  *pp = ip->dnext;
+  release(&pcache.lock);
+}
+
+// Write ip's dirty blocks home, lowest first, allocating blocks
+// for those that have none, and take ip off the dirty list.
+// Caller must hold a reference to ip, but not ip->lock, and be
+// outside a transaction.
+void
+pcwriteback(struct inode *ip)
+{
+  struct pcpage *pg, *low;
+  uint n, i, off, bits, boff;
+  char *pa;
+  int done, undirty;
+
+  do {
+    begin_opn(ip->dev, BULKOPBLOCKS);
+    ilock(ip);
+    done = undirty = 0;
+    for(n = 0; n + PGSIZE <= MAXOPBYTES; n += PGSIZE){
+      acquire(&pcache.lock);
+      low = 0;
+      for(pg = ip->pages; pg; pg = pg->inext)
+        if(pg->dirty && (low == 0 || pg->off < low->off))
+          low = pg;
+      if(low == 0){
+        release(&pcache.lock);
+        done = 1;
+        break;
+      }
+      // pcshrink() may take the clean page, but not this.
+      off = low->off;
+      pa = low->pa;
+      bits = low->dirty;
+      kincref(pa);
+      low->dirty = 0;
+      pcache.ndirty--;
+      release(&pcache.lock);
+      wakeup(&pcache.ndirty);
+
+      for(i = 0; i < PGSIZE/BSIZE; i++){
+        boff = off + i*BSIZE;
+        if((bits & (1 << i)) && boff < ip->size)
+          writeblk(ip, 0, (uint64)pa + i*BSIZE, boff, min(BSIZE, ip->size - boff));
+      }
+      kfree(pa);
+    }
+    if(done && ip->dirty){
+      pcundirty(ip);
+      ip->dirty = 0;
+      undirty = 1;
+    }
+    iunlock(ip);
+    if(undirty)
+      iput(ip);
+    end_opn(ip->dev, BULKOPBLOCKS);
+  } while(!done);
+}
+
+// Return a dirty inode with a new reference: the one dirty the
+// longest if any is due, or if pcache.dirty is long or memory
+// short, or all is set; else 0.
+static struct inode*
+pcpick(int all)
+{
+  struct inode *ip, *old;
+
+  acquire(&pcache.lock);
+  old = 0;
+  for(ip = pcache.dirty; ip; ip = ip->dnext)
+    if(old == 0 || ip->dirtied < old->dirtied)
+      old = ip;
+  if(old == 0)
+    pcache.pressure = 0;
+  if(old && !all && pcache.ndirty <= NDIRTYBG && !pcache.pressure &&
+     r_time() - old->dirtied < DIRTYEXPIRE)
+    old = 0;
+  if(old)
+    idup(old);
+  release(&pcache.lock);
+  return old;
+}
+
+// Write back ip, which pcpick() returned, and let it go.
+static void
+pcflush(struct inode *ip)
+{
+  pcwriteback(ip);
+  begin_op();
+  iput(ip);
+  end_op();
+}
+
+// Write every dirty inode back, for sync().
+void
+pcsync(void)
+{
+  struct inode *ip;
+  int n;
+
+  // those dirtied meanwhile may wait for the flusher.
+  acquire(&pcache.lock);
+  n = 0;
+  for(ip = pcache.dirty; ip; ip = ip->dnext)
+    n++;
+  release(&pcache.lock);
+  for(; n > 0 && (ip = pcpick(1)) != 0; n--)
+    pcflush(ip);
+}
+
+// Wait while there are too many dirty pages, for writers
+// outside a transaction and holding no inode lock.
+void
+pcthrottle(void)
+{
+  acquire(&pcache.lock);
+  while(pcache.ndirty > NDIRTYMAX)
+    sleep(&pcache.ndirty, &pcache.lock);
+  release(&pcache.lock);
+}
+
+// The flusher kernel thread: every tick, write back the inodes
+// that pcpick() says are due.
+void
+flusher(void)
+{
+  struct inode *ip;
+
+  for(;;){
+    sleepuntil(r_time() + TICKINTERVAL);
+    while((ip = pcpick(0)) != 0)
+      pcflush(ip);
+  }
+}
+
+// Report the cache's size and how often it had the page.
+int
+statspcache(char *buf, int sz)
+{
+  uint npage, ndirty, nhit, nmiss, nevict;
+
+  acquire(&pcache.lock);
+  npage = pcache.npage;
+  ndirty = pcache.ndirty;
+  nhit = pcache.nhit;
+  nmiss = pcache.nmiss;
+  nevict = pcache.nevict;
+  release(&pcache.lock);
+  return snprintf(buf, sz, "pcache: %d pages, %d dirty, %d hits, %d misses, %d%% hit, %d evicted\n",
+                  npage, ndirty, nhit, nmiss,
+                  nhit + nmiss ? (int)((uint64)nhit * 100 / (nhit + nmiss)) : 0, nevict);
+}
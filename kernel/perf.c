@@ -0,0 +1,88 @@
+// Per-thread performance counters.
+//
+// The hart's cycle and instret counters, and hpmcounter3..5,
+// which start.c points at TLB misses, are shared by whatever
+// runs on it.  So that each thread sees only its own events,
+// perfin() notes the counters in c->perfstart[] as a thread
+// starts running, and perfout() adds what they have gone up by
+// to p->perf[] as it stops, wherever scheduler() and sched()
+// account p->rtime.  Counts take in the thread's time in the
+// kernel as well as in user space.
+//
+// perfopen() zeroes the calling thread's counts, and perfread()
+// returns them up to now.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "perf.h"
+#include "defs.h"
+
+int perfhpm;  // start.c found hpmcounter3..5 counting
+
+static void
+perfnow(uint64 *v)
+{
+  v[PERF_CYCLES] = r_cycle();
+  v[PERF_INSTRET] = r_instret();
+  if(perfhpm){
+    v[PERF_DTLBLOAD] = r_hpmcounter3();
+    v[PERF_DTLBSTORE] = r_hpmcounter4();
+    v[PERF_ITLB] = r_hpmcounter5();
+  } else {
+    v[PERF_DTLBLOAD] = v[PERF_DTLBSTORE] = v[PERF_ITLB] = 0;
+  }
+}
+
+// A thread starts running on c.
+// Caller must hold its lock.
+void
+perfin(struct cpu *c)
+{
+  perfnow(c->perfstart);
+}
+
+// p stops running on c.
+// Caller must hold p->lock.
+void
+perfout(struct proc *p, struct cpu *c)
+{
+  uint64 now[NPERF];
+  int i;
+
+  perfnow(now);
+  for(i = 0; i < NPERF; i++)
+    p->perf[i] += now[i] - c->perfstart[i];
+}
+
+// Zero the current thread's counts.
+void
+perfreset(void)
+{
+  struct proc *p = myproc();
+
+  // no switch may come between, with interrupts off.
+  push_off();
+  memset(p->perf, 0, sizeof(p->perf));
+  perfnow(mycpu()->perfstart);
+  pop_off();
+}
+
+// The current thread's counts, into v[NPERF].
+void
+perfget(uint64 *v)
+{
+  struct proc *p = myproc();
+  struct cpu *c;
+  int i;
+
+  push_off();
+  c = mycpu();
+  perfnow(v);
+  for(i = 0; i < NPERF; i++)
+    v[i] = p->perf[i] + v[i] - c->perfstart[i];
+  pop_off();
+}
@@ -0,0 +1,9 @@
+// Events perfread() counts, its counts[] indexes.  The TLB
+// misses need a QEMU whose PMU counts them, 7.1 or later, and
+// are 0 otherwise.  QEMU models no caches, so there are no
+// cache miss events.
+#define PERF_CYCLES    0
+#define PERF_INSTRET   1  // instructions retired
+#define PERF_DTLBLOAD  2  // data TLB misses on loads
+#define PERF_DTLBSTORE 3  // and on stores
+#define PERF_ITLB      4  // instruction TLB misses
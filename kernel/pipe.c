@@ -7,34 +7,103 @@
 #include "fs.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "slab.h"
 
-#define PIPESIZE 512
+#define PIPEPAGES 4
+#define PIPESIZE (PIPEPAGES*PGSIZE)
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *page[PIPEPAGES];  // ring buffer of PIPESIZE bytes
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  int rbusy;      // a splice is reading the ring without the lock
+  int wbusy;      // a splice is filling the ring without the lock
 };
 
+// Address of byte n of the ring.
+static char*
+pipeaddr(struct pipe *pi, uint n)
+{
+  n %= PIPESIZE;
+  return pi->page[n / PGSIZE] + n % PGSIZE;
+}
+
+// How much of n bytes at ring position at can be moved in
+// one copy, given that avail bytes are there.
+static int
+pipechunk(uint at, uint avail, int n)
+{
+  uint m = PGSIZE - at % PGSIZE;
+
+  if(m > avail)
+    m = avail;
+  if(m > n)
+    m = n;
+  return m;
+}
+
+// struct pipes come from pipecache, which keeps their locks
+// initialized while they are free.
+static struct kmcache pipecache;
+
+static void
+pipector(void *obj)
+{
+  initlock(&((struct pipe*)obj)->lock, "pipe");
+}
+
+static void
+pipedtor(void *obj)
+{
+  freelock(&((struct pipe*)obj)->lock);
+}
+
+void
+pipeinit(void)
+{
+  kminit(&pipecache, "pipe", sizeof(struct pipe), pipector, pipedtor);
+}
+
+static void
+pipefree(struct pipe *pi)
+{
+  int i;
+
+  for(i = 0; i < PIPEPAGES; i++){
+    if(pi->page[i])
+      kfree(pi->page[i]);
+  }
+  kmfree(pi);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
   struct pipe *pi;
+  int i;
 
   pi = 0;
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((pi = (struct pipe*)kalloc()) == 0)
+  if((pi = kmalloc(&pipecache)) == 0)
     goto bad;
+  for(i = 0; i < PIPEPAGES; i++)
+    pi->page[i] = 0;
+  for(i = 0; i < PIPEPAGES; i++){
+    if((pi->page[i] = kalloc()) == 0)
+      goto bad;
+  }
   pi->readopen = 1;
   pi->writeopen = 1;
   pi->nwrite = 0;
   pi->nread = 0;
-  initlock(&pi->lock, "pipe");
+  pi->rbusy = 0;
+  pi->wbusy = 0;
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
   (*f0)->writable = 0;
@@ -47,7 +116,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(pi)
-    kfree((char*)pi);
+    pipefree(pi);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -66,65 +135,228 @@ pipeclose(struct pipe *pi, int writable)
     pi->readopen = 0;
     wakeup(&pi->nwrite);
   }
+  pollwakeup();
   if(pi->readopen == 0 && pi->writeopen == 0){
     release(&pi->lock);
-    kfree((char*)pi);
+    pipefree(pi);
   } else
     release(&pi->lock);
 }
 
+// Write n bytes from user addr, waiting for room unless
+// nonblock, in which case return what fit, or -1 if none did.
 int
-pipewrite(struct pipe *pi, uint64 addr, int n)
+pipewrite(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i = 0;
+  int i = 0, m;
   struct proc *pr = myproc();
 
+  // copyin() under pi->lock can't wait for a page of a file.
+  uvmprefault(addr, n, 0);
+
+  // Readers and writers are woken one at a time;
+  // each passes the wakeup on if it leaves room or
+  // data for the next one.
   acquire(&pi->lock);
   while(i < n){
     if(pi->readopen == 0 || pr->killed){
+      wakeupone(&pi->nwrite);
       release(&pi->lock);
       return -1;
     }
-    if(pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
-      wakeup(&pi->nread);
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){ //DOC: pipewrite-full
+      wakeupone(&pi->nread);
+      if(nonblock){
+        if(i == 0)
+          i = -1;
+        break;
+      }
       sleep(&pi->nwrite, &pi->lock);
     } else {
-      char ch;
-      if(copyin(pr->pagetable, &ch, addr + i, 1) == -1)
+      m = pipechunk(pi->nwrite, pi->nread + PIPESIZE - pi->nwrite, n - i);
+      if(copyin(pr->pagetable, pipeaddr(pi, pi->nwrite), addr + i, m) == -1)
         break;
-      pi->data[pi->nwrite++ % PIPESIZE] = ch;
-      i++;
+      pi->nwrite += m;
+      i += m;
     }
   }
-  wakeup(&pi->nread);
+  wakeupone(&pi->nread);
+  if(pi->nwrite < pi->nread + PIPESIZE)
+    wakeupone(&pi->nwrite);
+  pollwakeup();
   release(&pi->lock);
 
   return i;
 }
 
+// Read up to n bytes to user addr, waiting for some unless
+// nonblock, in which case return -1 if there are none.
 int
-piperead(struct pipe *pi, uint64 addr, int n)
+piperead(struct pipe *pi, uint64 addr, int n, int nonblock)
 {
-  int i;
+  int i, m;
   struct proc *pr = myproc();
-  char ch;
 
+  uvmprefault(addr, n, 1);  // as in pipewrite()
   acquire(&pi->lock);
-  while(pi->nread == pi->nwrite && pi->writeopen){  //DOC: pipe-empty
-    if(pr->killed){
+  while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen)){  //DOC: pipe-empty
+    if(pr->killed || nonblock){
       release(&pi->lock);
       return -1;
     }
     sleep(&pi->nread, &pi->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
+  for(i = 0; i < n; i += m){  //DOC: piperead-copy
     if(pi->nread == pi->nwrite)
       break;
-    ch = pi->data[pi->nread++ % PIPESIZE];
-    if(copyout(pr->pagetable, addr + i, &ch, 1) == -1)
+    m = pipechunk(pi->nread, pi->nwrite - pi->nread, n - i);
+    if(copyout(pr->pagetable, addr + i, pipeaddr(pi, pi->nread), m) == -1)
       break;
+    pi->nread += m;
   }
-  wakeup(&pi->nwrite);  //DOC: piperead-wakeup
+  wakeupone(&pi->nwrite);  //DOC: piperead-wakeup
+  if(pi->nread != pi->nwrite)
+    wakeupone(&pi->nread);
+  pollwakeup();
   release(&pi->lock);
   return i;
 }
+
+// What poll() would find for the read end, or the write end
+// if writable.
+int
+pipepoll(struct pipe *pi, int writable)
+{
+  int r = 0;
+
+  acquire(&pi->lock);
+  if(writable){
+    if(!pi->wbusy && pi->nwrite < pi->nread + PIPESIZE)
+      r |= POLLOUT;
+    if(!pi->readopen)
+      r |= POLLHUP;
+  } else {
+    if(!pi->rbusy && pi->nread != pi->nwrite)
+      r |= POLLIN;
+    if(!pi->writeopen)
+      r |= POLLHUP;
+  }
+  release(&pi->lock);
+  return r;
+}
+
+// Move up to n bytes from ip at *off into the pipe, reading
+// the file straight into the ring instead of through a user
+// buffer.  Like pipewrite(), waits for room.
+// pi->wbusy keeps other writers out of the space being
+// filled while pi->lock is released for readi().
+int
+pipesplicein(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  int i = 0, m, r = 0;
+  uint at;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(i < n){
+    if(pi->readopen == 0 || pr->killed){
+      wakeupone(&pi->nwrite);
+      release(&pi->lock);
+      return -1;
+    }
+    if(pi->wbusy || pi->nwrite == pi->nread + PIPESIZE){
+      wakeupone(&pi->nread);
+      sleep(&pi->nwrite, &pi->lock);
+      continue;
+    }
+    at = pi->nwrite;
+    m = pipechunk(at, pi->nread + PIPESIZE - at, n - i);
+    pi->wbusy = 1;
+    release(&pi->lock);
+
+    ilock(ip);
+    if((r = readi(ip, 0, (uint64)pipeaddr(pi, at), *off, m)) > 0)
+      *off += r;
+    iunlock(ip);
+
+    acquire(&pi->lock);
+    pi->wbusy = 0;
+    if(r > 0){
+      pi->nwrite += r;
+      i += r;
+      wakeupone(&pi->nread);
+    }
+    if(r != m)
+      break;  // end of file, or an error
+  }
+  wakeupone(&pi->nread);
+  // writers that pipeclose() woke slept again on wbusy.
+  if(pi->readopen == 0)
+    wakeup(&pi->nwrite);
+  else if(pi->nwrite < pi->nread + PIPESIZE)
+    wakeupone(&pi->nwrite);
+  pollwakeup();
+  release(&pi->lock);
+
+  return (i == 0 && r < 0) ? -1 : i;
+}
+
+// Move up to n bytes out of the pipe to ip at *off, writing
+// the file straight from the ring.  Like piperead(), waits
+// for data and returns once the pipe is empty.
+// pi->rbusy keeps other readers away from the data being
+// written while pi->lock is released for writei().
+int
+pipespliceout(struct pipe *pi, struct inode *ip, uint *off, int n)
+{
+  int i = 0, m, r = 0;
+  uint at;
+  struct proc *pr = myproc();
+
+  acquire(&pi->lock);
+  while(i < n){
+    while(pi->rbusy || (pi->nread == pi->nwrite && pi->writeopen && i == 0)){
+      if(pr->killed){
+        release(&pi->lock);
+        return -1;
+      }
+      sleep(&pi->nread, &pi->lock);
+    }
+    if(pi->nread == pi->nwrite)
+      break;
+    at = pi->nread;
+    m = pipechunk(at, pi->nwrite - at, n - i);
+    if(m > MAXOPBYTES)
+      m = MAXOPBYTES;
+    pi->rbusy = 1;
+    release(&pi->lock);
+
+    begin_opn(ip->dev, BULKOPBLOCKS);
+    ilock(ip);
+    if((r = writei(ip, 0, (uint64)pipeaddr(pi, at), *off, m)) > 0)
+      *off += r;
+    iunlock(ip);
+    end_opn(ip->dev, BULKOPBLOCKS);
+
+    acquire(&pi->lock);
+    pi->rbusy = 0;
+    if(r > 0){
+      pi->nread += r;
+      i += r;
+      wakeupone(&pi->nwrite);
+    }
+    if(r != m)
+      break;  // an error
+  }
+  wakeupone(&pi->nwrite);
+  // readers that pipeclose() woke slept again on rbusy, and
+  // must see the end.
+  if(pi->writeopen == 0)
+    wakeup(&pi->nread);
+  else if(pi->nread != pi->nwrite)
+    wakeupone(&pi->nread);
+  pollwakeup();
+  release(&pi->lock);
+
+  return (i == 0 && r < 0) ? -1 : i;
+}
@@ -7,6 +7,25 @@
 //
 // the riscv Platform Level Interrupt Controller (PLIC).
 //
+// each device's interrupts go to the one hart irqhart[] names,
+// so that a burst of them stays in that hart's caches and
+// doesn't interrupt whatever every other hart is doing.  hart 0
+// takes them until that hart has started, since there may be
+// none such.
+//
+
+static struct {
+  int irq;
+  int hart;
+} irqhart[] = {
+  { UART0_IRQ,   UARTHART },
+  { VIRTIO0_IRQ, DISKHART },
+  { VIRTIO1_IRQ, DISKHART+1 },
+};
+
+// IRQ bits that harts which have started since boot take
+// instead of hart 0.
+static uint32 handover;
 
 void
 plicinit(void)
@@ -14,15 +33,24 @@ plicinit(void)
   // set desired IRQ priorities non-zero (otherwise disabled).
   *(uint32*)(PLIC + UART0_IRQ*4) = 1;
   *(uint32*)(PLIC + VIRTIO0_IRQ*4) = 1;
+  *(uint32*)(PLIC + VIRTIO1_IRQ*4) = 1;
 }
 
 void
 plicinithart(void)
 {
   int hart = cpuid();
-  
-  // set uart's enable bit for this hart's S-mode. 
-  *(uint32*)PLIC_SENABLE(hart)= (1 << UART0_IRQ) | (1 << VIRTIO0_IRQ);
+  uint32 mask = 0;
+  int i;
+
+  for(i = 0; i < NELEM(irqhart); i++)
+    if(irqhart[i].hart == hart || hart == 0)
+      mask |= 1 << irqhart[i].irq;
+
+  // set the enable bits of this hart's devices for its S-mode.
+  *(uint32*)PLIC_SENABLE(hart) = mask;
+  if(hart != 0)
+    __sync_fetch_and_or(&handover, mask);
 
   // set this hart's S-mode priority threshold to 0.
   *(uint32*)PLIC_SPRIORITY(hart) = 0;
@@ -44,3 +72,18 @@ plic_complete(int irq)
   int hart = cpuid();
   *(uint32*)PLIC_SCLAIM(hart) = irq;
 }
+
+// on hart 0, stop taking the interrupts of harts that have
+// started.  hart 0 does this itself, with no IRQ claimed, since
+// the PLIC ignores a complete for an IRQ the hart no longer
+// has enabled.
+void
+plicsteer(void)
+{
+  uint32 m;
+
+  if(handover == 0 || cpuid() != 0)
+    return;
+  m = __sync_lock_test_and_set(&handover, 0);
+  *(uint32*)PLIC_SENABLE(0) &= ~m;
+}
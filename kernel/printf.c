@@ -1,6 +1,13 @@
 //
 // formatted console output -- printf, panic.
 //
+// printf() formats into its CPU's buffer, with interrupts off
+// and no lock, and hands the whole message to uartputs(),
+// which copies it into the uart's transmit buffer.  so CPUs
+// don't wait on each other while formatting or while the uart
+// sends, and messages don't interleave.  once panic() starts,
+// output goes straight to the uart instead.
+//
 
 #include <stdarg.h>
 
@@ -17,16 +24,43 @@
 
 volatile int panicked = 0;
 
-// lock to avoid interleaving concurrent printf's.
+#define PRBUFSIZE 256
+
 static struct {
-  struct spinlock lock;
-  int locking;
+  int buffered;  // 0 before printfinit() and after panic()
 } pr;
 
+// per-CPU message buffers.
+struct prbuf {
+  char buf[PRBUFSIZE];
+  int n;
+};
+static struct prbuf prbufs[NCPU];
+
 static char digits[] = "0123456789abcdef";
 
 static void
-printint(int xx, int base, int sign)
+prflush(struct prbuf *pb)
+{
+  uartputs(pb->buf, pb->n);
+  pb->n = 0;
+}
+
+// add c to pb, or send it to the console at once if pb is 0.
+static void
+prputc(struct prbuf *pb, int c)
+{
+  if(pb == 0){
+    consputc(c);
+    return;
+  }
+  pb->buf[pb->n++] = c;
+  if(pb->n == PRBUFSIZE)
+    prflush(pb);
+}
+
+static void
+printint(struct prbuf *pb, int xx, int base, int sign)
 {
   char buf[16];
   int i;
@@ -46,17 +80,17 @@ printint(int xx, int base, int sign)
     buf[i++] = '-';
 
   while(--i >= 0)
-    consputc(buf[i]);
+    prputc(pb, buf[i]);
 }
 
 static void
-printptr(uint64 x)
+printptr(struct prbuf *pb, uint64 x)
 {
   int i;
-  consputc('0');
-  consputc('x');
+  prputc(pb, '0');
+  prputc(pb, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    consputc(digits[x >> (sizeof(uint64) * 8 - 4)]);
+    prputc(pb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the console. only understands %d, %x, %p, %s.
@@ -64,20 +98,23 @@ void
 printf(char *fmt, ...)
 {
   va_list ap;
-  int i, c, locking;
+  int i, c;
   char *s;
-
-  locking = pr.locking;
-  if(locking)
-    acquire(&pr.lock);
+  struct prbuf *pb;
 
   if (fmt == 0)
     panic("null fmt");
 
+  pb = 0;
+  if(pr.buffered){
+    push_off();
+    pb = &prbufs[cpuid()];
+  }
+
   va_start(ap, fmt);
   for(i = 0; (c = fmt[i] & 0xff) != 0; i++){
     if(c != '%'){
-      consputc(c);
+      prputc(pb, c);
       continue;
     }
     c = fmt[++i] & 0xff;
@@ -85,39 +122,43 @@ printf(char *fmt, ...)
       break;
     switch(c){
     case 'd':
-      printint(va_arg(ap, int), 10, 1);
+      printint(pb, va_arg(ap, int), 10, 1);
       break;
     case 'x':
-      printint(va_arg(ap, int), 16, 1);
+      printint(pb, va_arg(ap, int), 16, 1);
       break;
     case 'p':
-      printptr(va_arg(ap, uint64));
+      printptr(pb, va_arg(ap, uint64));
       break;
     case 's':
       if((s = va_arg(ap, char*)) == 0)
         s = "(null)";
       for(; *s; s++)
-        consputc(*s);
+        prputc(pb, *s);
       break;
     case '%':
-      consputc('%');
+      prputc(pb, '%');
       break;
     default:
       // Print unknown % sequence to draw attention.
-      consputc('%');
-      consputc(c);
+      prputc(pb, '%');
+      prputc(pb, c);
       break;
     }
   }
+  va_end(ap);
 
-  if(locking)
-    release(&pr.lock);
+  if(pb){
+    prflush(pb);
+    pop_off();
+  }
 }
 
 void
 panic(char *s)
 {
-  pr.locking = 0;
+  pr.buffered = 0;
+  uartflush();  // what earlier printf()s left in the uart's buffer
   printf("panic: ");
   printf(s);
   printf("\n");
@@ -130,8 +171,7 @@ panic(char *s)
 void
 printfinit(void)
 {
-  initlock(&pr.lock, "pr");
-  pr.locking = 1;
+  pr.buffered = 1;
 }
 
 // Question: What does the frame pointer directly point to? Deferencing the frame pointer
@@ -12,11 +12,58 @@ struct proc proc[NPROC];
 
 struct proc *initproc;
 
+// Per-CPU queues of RUNNABLE processes that no scheduler
+// has chosen yet, linked through p->rqnext, one for each
+// priority level (0 is highest).  A process goes on the queue
+// of the CPU it last ran on, if its affinity mask allows, to
+// find its cache and TLB entries still there.  A CPU runs the
+// highest level that has anything, its own queue before
+// stealing from the others', in FIFO order within a level.
+// Lock order: p->lock, then a runq lock.
+//
+// The levels are a multi-level feedback queue: a process
+// starts at level 0 and drops a level each time it uses up
+// its quantum there, QUANTUM(level) ticks, so CPU-bound
+// programs sink below interactive ones that mostly sleep.
+// Every BOOSTTICKS ticks everyone is back at level 0, so the
+// sunk ones don't starve.
+#define QUANTUM(prio) (1 << (prio))
+
+struct runq {
+  struct spinlock lock;
+  struct proc *head[NPRIO];
+  struct proc *tail[NPRIO];
+} runq[NCPU];
+
+// Processes in sleep(), on one queue per hash bucket of
+// their chan, so that wakeup() only looks at processes whose
+// chan hashes with its own.  A process adds itself before it
+// sleeps and removes itself after it wakes; wakeup() only
+// changes p->state.  Lock order: sleepq lock, then p->lock.
+#define NSLEEPQ 61
+#define SQHASH(chan) (((uint64)(chan) >> 3) % NSLEEPQ)
+
+struct sleepq {
+  struct spinlock lock;
+  struct proc *head;
+  struct proc *tail;
+} sleepq[NSLEEPQ];
+
 int nextpid = 1;
 struct spinlock pid_lock;
 
+// Procs with a pid, hashed on it and chained through
+// p->pidnext, so kill() needn't search proc[].  pid_lock
+// guards them and nextpid.  Lock order: p->lock, then
+// pid_lock; so a lookup drops pid_lock before it locks the
+// proc it finds, and checks the pid again.
+#define NPIDHASH 64
+static struct proc *pidhash[NPIDHASH];
+
 extern void forkret(void);
 static void freeproc(struct proc *p);
+static int setrunnable(struct proc *p);
+static void schedtail(void);
 
 extern char trampoline[]; // trampoline.S
 
@@ -26,6 +73,13 @@ extern char trampoline[]; // trampoline.S
 // must be acquired before any p->lock.
 struct spinlock wait_lock;
 
+// futexwait() sleeps on the physical address of the word,
+// so that threads find each other however it's mapped, under
+// the lock of the word's hash bucket.
+#define NFUTEXQ 31
+#define FQHASH(pa) (((pa) >> 2) % NFUTEXQ)
+struct spinlock futexq[NFUTEXQ];
+
 // Allocate a page for each process's kernel stack.
 // Map it high in memory, followed by an invalid
 // guard page.
@@ -47,11 +101,19 @@ void
 procinit(void)
 {
   struct proc *p;
+  int i;
   
   initlock(&pid_lock, "nextpid");
   initlock(&wait_lock, "wait_lock");
+  for(i = 0; i < NFUTEXQ; i++)
+    initlock(&futexq[i], "futex");
+  for(i = 0; i < NCPU; i++)
+    initlock(&runq[i].lock, "runq");
+  for(i = 0; i < NSLEEPQ; i++)
+    initlock(&sleepq[i].lock, "sleepq");
   for(p = proc; p < &proc[NPROC]; p++) {
       initlock(&p->lock, "proc");
+      initlock(&p->slock, "group");
       p->kstack = KSTACK((int) (p - proc));
   }
 }
@@ -85,24 +147,116 @@ myproc(void) {
   return p;
 }
 
-int
-allocpid() {
+// Give p the next pid and enter it in pidhash.
+static int
+allocpid(struct proc *p) {
   int pid;
   
   acquire(&pid_lock);
   pid = nextpid;
   nextpid = nextpid + 1;
+  p->pid = pid;
+  p->pidnext = pidhash[pid % NPIDHASH];
+  pidhash[pid % NPIDHASH] = p;
   release(&pid_lock);
 
   return pid;
 }
 
+static void
+freepid(struct proc *p)
+{
+  struct proc **pp;
+
+  acquire(&pid_lock);
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  release(&pid_lock);
+}
+
+// The proc that has pid, or had it a moment ago: the caller
+// must check again once it holds the proc's lock.
+static struct proc*
+findproc(int pid)
+{
+  struct proc *p;
+
+  acquire(&pid_lock);
+  for(p = pidhash[pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  release(&pid_lock);
+  return p;
+}
+
+// Put p on the list at *head, a process's children or threads,
+// linked through p->sibnext and p->sibprev.
+// Caller must hold wait_lock.
+static void
+sibadd(struct proc **head, struct proc *p)
+{
+  p->sibprev = 0;
+  p->sibnext = *head;
+  if(*head)
+    (*head)->sibprev = p;
+  *head = p;
+}
+
+// Caller must hold wait_lock.
+static void
+sibdel(struct proc **head, struct proc *p)
+{
+  if(p->sibprev)
+    p->sibprev->sibnext = p->sibnext;
+  else
+    *head = p->sibnext;
+  if(p->sibnext)
+    p->sibnext->sibprev = p->sibprev;
+  p->sibnext = p->sibprev = 0;
+}
+
+// Map thread p's trapframe into the page table it shares
+// with its group leader g, in a free slot.
+static int
+tfmap(struct proc *g, struct proc *p)
+{
+  int i;
+
+  acquire(&g->slock);
+  for(i = 1; i < NTHREAD && (g->tslots & (1 << i)); i++)
+    ;
+  if(i == NTHREAD || mappages(g->pagetable, THREADTF(i), PGSIZE,
+                              (uint64)p->trapframe, PTE_R | PTE_W) < 0){
+    release(&g->slock);
+    return -1;
+  }
+  g->tslots |= 1 << i;
+  p->tfva = THREADTF(i);
+  release(&g->slock);
+  return 0;
+}
+
+static void
+tfunmap(struct proc *g, struct proc *p)
+{
+  acquire(&g->slock);
+  uvmunmap(g->pagetable, p->tfva, 1, 0);
+  // the next thread in this slot must not use p's trapframe.
+  tlbshootdown(g, p->tfva, PGSIZE);
+  g->tslots &= ~(1 << ((USHARED - p->tfva) / PGSIZE));
+  release(&g->slock);
+  p->tfva = 0;
+}
+
 // Look in the process table for an UNUSED proc.
 // If found, initialize state required to run in the kernel,
 // and return with p->lock held.
+// If g isn't 0, the proc is a thread sharing g's memory;
+// otherwise it gets an empty page table of its own.
 // If there are no free procs, or a memory allocation fails, return 0.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *g)
 {
   struct proc *p;
 
@@ -117,7 +271,7 @@ allocproc(void)
   return 0;
 
 found:
-  p->pid = allocpid();
+  allocpid(p);
   p->state = USED;
 
   // Allocate a trapframe page.
@@ -126,6 +280,12 @@ found:
     release(&p->lock);
     return 0;
   }
+  // the values uservec needs that never change.
+  p->trapframe->kernel_satp = r_satp();
+  p->trapframe->kernel_sp = p->kstack + PGSIZE;
+  p->trapframe->kernel_trap = (uint64)usertrap;
+  p->trapframe->kernel_hartid = -1;
+  p->syscallret = 0;
 
   //Allocate a traprame page.
   if((p->alt_trapframe = (struct trapframe *)kalloc()) == 0){
@@ -133,6 +293,29 @@ found:
       release(&p->lock);
       return 0;
   }  
+
+  if(g){
+    p->group = g;
+    p->pagetable = g->pagetable;
+    if(tfmap(g, p) < 0){
+      freeproc(p);
+      release(&p->lock);
+      return 0;
+    }
+    goto done;
+  }
+  p->group = p;
+  p->nthread = 1;
+  p->tfva = TRAPFRAME;
+
+  // Allocate the page that user space reads at USYSCALL.
+  if((p->usyscall = (struct usyscall *)kalloc()) == 0){
+    freeproc(p);
+    release(&p->lock);
+    return 0;
+  }
+  memset(p->usyscall, 0, PGSIZE);
+  p->usyscall->pid = p->pid;
   
 
   // An empty user page table.
@@ -142,6 +325,22 @@ found:
     release(&p->lock);
     return 0;
   }
+
+done:
+  p->asid = 0;
+  p->tlbstale = 0;
+  p->prio = 0;
+  p->slice = 0;
+  p->boost = ticks / BOOSTTICKS;
+  p->affinity = ALLCPUS;
+  p->lastcpu = -1;
+  p->rtime = 0;
+  memset(p->perf, 0, sizeof(p->perf));
+  p->nswtch = 0;
+  p->utime = 0;
+  p->nfault = 0;
+  p->nblk[0] = p->nblk[1] = 0;
+  p->nsyscall = 0;
   p->alarm_ticks = 0;
   p->alarm_current_ticks = 0;
   p->alarm_handler = 0;
@@ -155,28 +354,58 @@ found:
   return p;
 }
 
+// Give np p's saved user registers, keeping the kernel
+// values in np's trapframe, which usertrapret() doesn't
+// rewrite.
+static void
+tfcopy(struct proc *np, struct proc *p)
+{
+  uint64 ksp = np->trapframe->kernel_sp;
+
+  *(np->trapframe) = *(p->trapframe);
+  np->trapframe->kernel_sp = ksp;
+}
+
 // free a proc structure and the data hanging from it,
 // including user pages.
 // p->lock must be held.
 static void
 freeproc(struct proc *p)
 {
+  if(p->group && p->group != p){
+    // a thread: the page table is the group's.
+    if(p->tfva)
+      tfunmap(p->group, p);
+    p->pagetable = 0;
+  }
   if(p->trapframe)
     kfree((void*)p->trapframe);
   p->trapframe = 0;
   if(p->alt_trapframe)
       kfree((void*)p->alt_trapframe);
   p->alt_trapframe = 0;
+  if(p->usyscall)
+    kfree((void*)p->usyscall);
+  p->usyscall = 0;
   if(p->pagetable)
     proc_freepagetable(p->pagetable, p->sz);
   p->pagetable = 0;
   p->sz = 0;
+  if(p->pid)
+    freepid(p);
   p->pid = 0;
   p->parent = 0;
+  p->children = 0;
+  p->threads = 0;
+  p->group = 0;
+  p->nthread = 0;
+  p->tslots = 0;
+  p->tfva = 0;
   p->name[0] = 0;
   p->chan = 0;
   p->killed = 0;
   p->xstate = 0;
+  p->tracemask = 0;
   p->state = UNUSED;
 }
 
@@ -210,6 +439,18 @@ proc_pagetable(struct proc *p)
     return 0;
   }
 
+  // map the pages of kernel state that user code may read,
+  // but not write, below the trapframe.
+  if(mappages(pagetable, USYSCALL, PGSIZE,
+              (uint64)(p->usyscall), PTE_R | PTE_U) < 0 ||
+     mappages(pagetable, USHARED, PGSIZE,
+              (uint64)ushared, PTE_R | PTE_U) < 0){
+    uvmunmap(pagetable, USHARED, 3, 0);
+    uvmunmap(pagetable, TRAMPOLINE, 1, 0);
+    uvmfree(pagetable, 0);
+    return 0;
+  }
+
   return pagetable;
 }
 
@@ -220,6 +461,7 @@ proc_freepagetable(pagetable_t pagetable, uint64 sz)
 {
   uvmunmap(pagetable, TRAMPOLINE, 1, 0);
   uvmunmap(pagetable, TRAPFRAME, 1, 0);
+  uvmunmap(pagetable, USHARED, 2, 0);
   uvmfree(pagetable, sz);
 }
 
@@ -241,7 +483,7 @@ userinit(void)
 {
   struct proc *p;
 
-  p = allocproc();
+  p = allocproc(0);
   initproc = p;
   
   // allocate one user page and copy init's instructions
@@ -256,29 +498,42 @@ userinit(void)
   safestrcpy(p->name, "initcode", sizeof(p->name));
   p->cwd = namei("/");
 
-  p->state = RUNNABLE;
+  setrunnable(p);
 
   release(&p->lock);
 }
 
 // Grow or shrink user memory by n bytes.
-// Return 0 on success, -1 on failure.
-int
+// Growth is lazy: pages are allocated by uvmlazy() when
+// first touched.
+// Return the old size, or -1 on failure.
+uint64
 growproc(int n)
 {
-  uint sz;
-  struct proc *p = myproc();
+  uint64 sz, oldsz;
+  struct proc *g = myproc()->group;
 
-  sz = p->sz;
+  if(g->vfork)
+    return -1;  // the memory is the parent's
+  acquire(&g->slock);
+  oldsz = sz = g->sz;
   if(n > 0){
-    if((sz = uvmalloc(p->pagetable, sz, sz + n)) == 0) {
+    if(sz + n > MMAPBASE){
+      release(&g->slock);
       return -1;
     }
+    sz += n;
   } else if(n < 0){
-    sz = uvmdealloc(p->pagetable, sz, sz + n);
+    if(-n > sz){
+      release(&g->slock);
+      return -1;
+    }
+    sz = uvmdealloc(g->pagetable, sz, sz + n);
+    tlbshootdown(g, sz, oldsz - sz);
   }
-  p->sz = sz;
-  return 0;
+  g->sz = sz;
+  release(&g->slock);
+  return oldsz;
 }
 
 // Create a new process, copying the parent.
@@ -289,67 +544,401 @@ fork(void)
   int i, pid;
   struct proc *np;
   struct proc *p = myproc();
+  struct proc *g = p->group;
 
   // Allocate process.
-  if((np = allocproc()) == 0){
+  if((np = allocproc(0)) == 0){
     return -1;
   }
 
-  // Copy user memory from parent to child.
-  if(uvmcopy(p->pagetable, np->pagetable, p->sz) < 0){
+  // Copy user memory from parent to child.  Making the
+  // parent's pages copy-on-write takes their write access
+  // away from the parent's other threads too.
+  acquire(&g->slock);
+  if(uvmcopy(p->pagetable, np->pagetable, g->sz) < 0 ||
+     mmapfork(p->pagetable, np->pagetable, g->vma) < 0){
+    tlbshootdown(g, MAXVA, 0);
+    release(&g->slock);
     freeproc(np);
     release(&np->lock);
     return -1;
   }
-  np->sz = p->sz;
+  tlbshootdown(g, MAXVA, 0);
+  np->sz = g->sz;
 
   // copy saved user registers.
-  *(np->trapframe) = *(p->trapframe);
+  tfcopy(np, p);
 
   // Cause fork to return 0 in the child.
   np->trapframe->a0 = 0;
 
   // increment reference counts on open file descriptors.
+  for(i = 0; i < NOFILE; i++)
+    if(g->ofile[i])
+      np->ofile[i] = filedup(g->ofile[i]);
+  np->cwd = idup(g->cwd);
+  vmadup(np->vma, g->vma);
+  release(&g->slock);
+
+  safestrcpy(np->name, p->name, sizeof(p->name));
+
+  np->tracemask = p->tracemask;
+  np->affinity = p->affinity;
+
+  pid = np->pid;
+
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  np->parent = g;
+  sibadd(&g->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return pid;
+}
+
+// Create a child that borrows the current process's memory,
+// page table and all, instead of copying it, and return its
+// pid.  The parent doesn't return until the child has called
+// exec() or exit(), and until then all the child may do is
+// change its own descriptors and directory: it runs on the
+// parent's stack, reads the parent's pid at USYSCALL, and
+// can't grow, map or unmap memory.  Not for a process with
+// other threads, which would go on running in the memory.
+int
+vfork(void)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *p = myproc();
+
+  // only p could start another thread.
+  if(p->group != p || p->nthread > 1 || p->vfork)
+    return -1;
+
+  if((np = allocproc(0)) == 0)
+    return -1;
+
+  // np runs in p's page table, with its trapframe in one
+  // of p's thread slots.
+  proc_freepagetable(np->pagetable, 0);
+  np->pagetable = p->pagetable;
+  if(tfmap(p, np) < 0){
+    np->pagetable = 0;
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // np's kernel uses the pages as its own; see swap.c.
+  __sync_fetch_and_add(&p->npinned, 1);
+  np->npinned = 1;
+
+  acquire(&p->slock);
+  np->sz = p->sz;
+  // p's copies of the vmas keep their files referenced.
+  memmove(np->vma, p->vma, sizeof(p->vma));
   for(i = 0; i < NOFILE; i++)
     if(p->ofile[i])
       np->ofile[i] = filedup(p->ofile[i]);
   np->cwd = idup(p->cwd);
+  release(&p->slock);
 
+  tfcopy(np, p);
+  np->trapframe->a0 = 0;
   safestrcpy(np->name, p->name, sizeof(p->name));
-
+  np->tracemask = p->tracemask;
+  np->affinity = p->affinity;
+  np->vfork = p;
   pid = np->pid;
-
   release(&np->lock);
 
   acquire(&wait_lock);
   np->parent = p;
+  sibadd(&p->children, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  // not even kill() ends this: np is using p's memory.
+  acquire(&wait_lock);
+  while(np->vfork)
+    sleep(&np->vfork, &wait_lock);
+  release(&wait_lock);
+
+  return pid;
+}
+
+// vfork() child p is done with its parent's memory, in exec()
+// or exit(): give it back and wake the parent.  Leaves p with
+// no page table.
+void
+vforkdone(struct proc *p)
+{
+  struct proc *pp = p->vfork;
+
+  tfunmap(pp, p);
+  p->tfva = TRAPFRAME;
+  // p's copy-on-write faults moved pages that the parent's
+  // entries in other CPUs' TLBs may still lead to.
+  acquire(&pp->slock);
+  tlbshootdown(pp, MAXVA, 0);
+  release(&pp->slock);
+  p->pagetable = 0;
+  p->npinned = 0;
+  __sync_fetch_and_sub(&pp->npinned, 1);
+  p->sz = 0;
+  memset(p->vma, 0, sizeof(p->vma));
+
+  acquire(&wait_lock);
+  p->vfork = 0;
+  wakeup(&p->vfork);
+  release(&wait_lock);
+}
+
+// Start the program at path in a new child, built from
+// nothing rather than copied from the current process, and
+// return its pid.  The child's descriptor i is a dup of the
+// current process's fds[i], or closed if i >= nfd or fds[i]
+// is -1; if fds is 0, the child gets all of them, as from
+// fork().  uargv is the argument list in the current process's
+// memory.  Returns -1 if a descriptor is bad or exec() fails.
+int
+spawn(char *path, uint64 uargv, int *fds, int nfd)
+{
+  int i, fd, pid, argc, bad;
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  struct file *f;
+
+  if((np = allocproc(0)) == 0)
+    return -1;
+
+  bad = 0;
+  acquire(&g->slock);
+  for(i = 0; i < NOFILE; i++){
+    f = 0;
+    if(fds == 0)
+      f = g->ofile[i];
+    else if(i < nfd && (fd = fds[i]) != -1 &&
+            (fd < 0 || fd >= NOFILE || (f = g->ofile[fd]) == 0))
+      bad = 1;
+    if(f)
+      np->ofile[i] = filedup(f);
+  }
+  np->cwd = idup(g->cwd);
+  release(&g->slock);
+
+  np->tracemask = p->tracemask;
+  np->affinity = p->affinity;
+  pid = np->pid;
+  // nothing else uses np until it is runnable, and exec()
+  // sleeps.
+  release(&np->lock);
+
+  if(bad || (argc = exec(np, path, uargv, 0)) < 0){
+    for(i = 0; i < NOFILE; i++){
+      if(np->ofile[i])
+        fileclose(np->ofile[i]);
+      np->ofile[i] = 0;
+    }
+    begin_op();
+    iput(np->cwd);
+    end_op();
+    np->cwd = 0;
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  // exec() returns argc, which sys_exec() would put in a0.
+  np->trapframe->a0 = argc;
+
+  acquire(&wait_lock);
+  np->parent = g;
+  sibadd(&g->children, np);
   release(&wait_lock);
 
   acquire(&np->lock);
-  np->state = RUNNABLE;
+  setrunnable(np);
   release(&np->lock);
 
   return pid;
 }
 
+// Start a thread of the current process that runs fn(arg)
+// in user space on the stack below stack, sharing the
+// process's memory and files.  Returns the thread's pid.
+int
+clone(uint64 fn, uint64 arg, uint64 stack)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  int tid;
+
+  if(g->vfork)
+    return -1;
+  if((np = allocproc(g)) == 0)
+    return -1;
+
+  tfcopy(np, p);
+  np->trapframe->epc = fn;
+  np->trapframe->a0 = arg;
+  np->trapframe->sp = stack;
+  safestrcpy(np->name, p->name, sizeof(p->name));
+  np->tracemask = p->tracemask;
+  np->affinity = p->affinity;
+  tid = np->pid;
+  release(&np->lock);
+
+  acquire(&wait_lock);
+  if(g->killed){
+    // the process is exiting; killthreads() won't wait for np.
+    release(&wait_lock);
+    acquire(&np->lock);
+    freeproc(np);
+    release(&np->lock);
+    return -1;
+  }
+  g->nthread++;
+  sibadd(&g->threads, np);
+  release(&wait_lock);
+
+  acquire(&np->lock);
+  setrunnable(np);
+  release(&np->lock);
+
+  return tid;
+}
+
+// Wait for thread tid of the current process to exit, and
+// copy its exit status to addr if it isn't 0.  Returns tid,
+// or -1 if there is no such thread.
+int
+join(int tid, uint64 addr)
+{
+  struct proc *np;
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  int found;
+
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int), 1);  // as in wait()
+  acquire(&wait_lock);
+  for(;;){
+    found = 0;
+    for(np = g->threads; np; np = np->sibnext){
+      if(np->pid != tid || np == p)
+        continue;
+      found = 1;
+      acquire(&np->lock);
+      if(np->state == ZOMBIE){
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0){
+          release(&np->lock);
+          release(&wait_lock);
+          return -1;
+        }
+        sibdel(&g->threads, np);
+        freeproc(np);
+        release(&np->lock);
+        release(&wait_lock);
+        return tid;
+      }
+      release(&np->lock);
+    }
+    if(!found || p->killed){
+      release(&wait_lock);
+      return -1;
+    }
+    // threadexit() wakes this.
+    sleep(&g->nthread, &wait_lock);
+  }
+}
+
+// Kill g's other threads and wait for them to exit, for
+// exit() of the group leader g.
+static void
+killthreads(struct proc *g)
+{
+  struct proc *pp;
+
+  acquire(&wait_lock);
+  // clone() checks this, so no thread starts from now on.
+  acquire(&g->lock);
+  g->killed = 1;
+  release(&g->lock);
+  for(pp = g->threads; pp; pp = pp->sibnext){
+    acquire(&pp->lock);
+    pp->killed = 1;
+    if(pp->state == SLEEPING)
+      setrunnable(pp);
+    release(&pp->lock);
+  }
+  // threadexit() makes a thread a zombie before it lets go
+  // of wait_lock, so then all of them are.
+  while(g->nthread > 1)
+    sleep(&g->nthread, &wait_lock);
+  while((pp = g->threads) != 0){
+    acquire(&pp->lock);
+    sibdel(&g->threads, pp);
+    freeproc(pp);
+    release(&pp->lock);
+  }
+  release(&wait_lock);
+}
+
+// Exit thread p, which isn't its group's leader, leaving a
+// zombie for join() or killthreads().  Does not return.
+static void
+threadexit(struct proc *p, int status)
+{
+  acquire(&wait_lock);
+  p->group->nthread--;
+  wakeup(&p->group->nthread);
+
+  acquire(&p->lock);
+  p->xstate = status;
+  p->state = ZOMBIE;
+  release(&wait_lock);
+
+  sched();
+  panic("zombie exit");
+}
+
 // Pass p's abandoned children to init.
 // Caller must hold wait_lock.
 void
 reparent(struct proc *p)
 {
-  struct proc *pp;
+  struct proc *pp, *last;
 
-  for(pp = proc; pp < &proc[NPROC]; pp++){
-    if(pp->parent == p){
-      pp->parent = initproc;
-      wakeup(initproc);
-    }
+  if(p->children == 0)
+    return;
+  for(pp = p->children; pp; pp = pp->sibnext){
+    pp->parent = initproc;
+    last = pp;
   }
+  last->sibnext = initproc->children;
+  if(initproc->children)
+    initproc->children->sibprev = last;
+  initproc->children = p->children;
+  p->children = 0;
+  wakeup(initproc);
 }
 
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
-// until its parent calls wait().
+// until its parent calls wait().  In a thread, only
+// the thread exits; in the first thread, the others
+// are killed first.
 void
 exit(int status)
 {
@@ -357,6 +946,11 @@ exit(int status)
 
   if(p == initproc)
     panic("init exiting");
+  if(p->group != p)
+    threadexit(p, status);
+  killthreads(p);
+  if(p->vfork)
+    vforkdone(p);
 
   // Close all open files.
   for(int fd = 0; fd < NOFILE; fd++){
@@ -367,7 +961,9 @@ exit(int status)
     }
   }
 
+  munmapall(p);
   begin_op();
+  vmaput(p->vma);
   iput(p->cwd);
   end_op();
   p->cwd = 0;
@@ -400,34 +996,37 @@ wait(uint64 addr)
   struct proc *np;
   int havekids, pid;
   struct proc *p = myproc();
+  struct proc *g = p->group;  // any thread waits for the process's children
 
+  // the copyout() below holds wait_lock.
+  if(addr != 0)
+    uvmprefault(addr, sizeof(int), 1);
   acquire(&wait_lock);
 
   for(;;){
     // Scan through table looking for exited children.
     havekids = 0;
-    for(np = proc; np < &proc[NPROC]; np++){
-      if(np->parent == p){
-        // make sure the child isn't still in exit() or swtch().
-        acquire(&np->lock);
-
-        havekids = 1;
-        if(np->state == ZOMBIE){
-          // Found one.
-          pid = np->pid;
-          if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
-                                  sizeof(np->xstate)) < 0) {
-            release(&np->lock);
-            release(&wait_lock);
-            return -1;
-          }
-          freeproc(np);
+    for(np = g->children; np; np = np->sibnext){
+      // make sure the child isn't still in exit() or swtch().
+      acquire(&np->lock);
+
+      havekids = 1;
+      if(np->state == ZOMBIE){
+        // Found one.
+        pid = np->pid;
+        if(addr != 0 && copyout(p->pagetable, addr, (char *)&np->xstate,
+                                sizeof(np->xstate)) < 0) {
           release(&np->lock);
           release(&wait_lock);
-          return pid;
+          return -1;
         }
+        sibdel(&g->children, np);
+        freeproc(np);
         release(&np->lock);
+        release(&wait_lock);
+        return pid;
       }
+      release(&np->lock);
     }
 
     // No point waiting if we don't have any children.
@@ -437,48 +1036,388 @@ wait(uint64 addr)
     }
     
     // Wait for a child to exit.
-    sleep(p, &wait_lock);  //DOC: wait-sleep
+    sleep(g, &wait_lock);  //DOC: wait-sleep
+  }
+}
+
+// The physical address of the futex word at user address
+// addr, resolved as a store so that a copy-on-write page is
+// copied now, not between a wait and its wake.  Returns 0 if
+// addr is bad.
+static uint64
+futexaddr(uint64 addr)
+{
+  struct proc *p = myproc();
+  struct proc *g = p->group;
+  uint64 pa;
+
+  if(addr % sizeof(int) != 0 || uvmfault(p, addr, 15) < 0)
+    return 0;
+  acquire(&g->slock);
+  pa = walkaddr(g->pagetable, addr);
+  release(&g->slock);
+  return pa ? pa + addr % PGSIZE : 0;
+}
+
+// If the int at user address addr is val, sleep until a
+// futexwake() of it.  Returns -1 for a bad addr or if killed;
+// otherwise 0, and the caller must check its word again.
+int
+futexwait(uint64 addr, int val)
+{
+  struct proc *p = myproc();
+  struct spinlock *lk;
+  uint64 pa;
+
+  // the word must stay at pa, where futexwake() looks.
+  __sync_fetch_and_add(&p->group->npinned, 1);
+  if((pa = futexaddr(addr)) == 0){
+    __sync_fetch_and_sub(&p->group->npinned, 1);
+    return -1;
+  }
+  lk = &futexq[FQHASH(pa)];
+  acquire(lk);
+  // the waker changes the word before it takes lk.
+  if(*(int*)pa == val && !p->killed)
+    sleep((void*)pa, lk);
+  release(lk);
+  __sync_fetch_and_sub(&p->group->npinned, 1);
+  return p->killed ? -1 : 0;
+}
+
+// Wake up to n sleepers in futexwait() on user address addr.
+// Returns how many it woke, or -1 for a bad addr.
+int
+futexwake(uint64 addr, int n)
+{
+  struct spinlock *lk;
+  uint64 pa;
+  int i;
+
+  if((pa = futexaddr(addr)) == 0)
+    return -1;
+  lk = &futexq[FQHASH(pa)];
+  acquire(lk);
+  for(i = 0; i < n; i++)
+    if(!wakeupone((void*)pa))
+      break;
+  release(lk);
+  return i;
+}
+
+// What tlbflush() flushes on each CPU.
+struct tlbrange {
+  uint64 va;
+  uint64 len;    // 0 for all of asid
+  uint64 asid;
+};
+
+static void
+tlbflush(void *arg)
+{
+  struct tlbrange *r = arg;
+  uint64 a;
+
+  if(r->len == 0){
+    sfence_vma_asid(r->asid);
+    return;
   }
+  for(a = r->va; a < r->va + r->len; a += PGSIZE)
+    sfence_vma_page(a, r->asid);
+}
+
+// g's page table has just lost mappings or write access in
+// the len bytes from va, or anywhere if va is MAXVA.  Flush
+// them from the TLBs of this CPU and of the other CPUs running
+// user code of g's threads, all with one smpcall(), and mark
+// every other CPU's entries for g's ASID stale, for uvmasid()
+// to flush before it next returns to g.  Caller holds
+// g->slock, so the page table doesn't change meanwhile.
+void
+tlbshootdown(struct proc *g, uint64 va, uint64 len)
+{
+  struct tlbrange r;
+  struct cpu *c;
+  struct proc *p;
+  uint mask, stale;
+  int me;
+
+  r.asid = g->asid & SATP_ASIDMASK;
+  if(va == MAXVA || len > NFLUSHPAGE*PGSIZE){
+    r.va = 0;
+    r.len = 0;
+  } else {
+    r.va = PGROUNDDOWN(va);
+    r.len = PGROUNDUP(va + len) - r.va;
+  }
+  push_off();
+  me = cpuid();
+  mask = 1 << me;
+  stale = ALLCPUS & ~mask;
+  stale &= ~__sync_fetch_and_or(&g->tlbstale, stale);
+  // reclaim() changes other processes' page tables.
+  if(g->nthread > 1 || myproc() != g){
+    // usertrapret() sets inuser before it looks at tlbstale.
+    __sync_synchronize();
+    for(c = cpus; c < &cpus[NCPU]; c++){
+      p = c->proc;
+      if(c != &cpus[me] && p && p->group == g && c->inuser)
+        mask |= 1 << (c - cpus);
+    }
+  }
+  smpcall(mask, tlbflush, &r);
+  // those CPUs have flushed what this call marked stale; a
+  // bit that was set already may be for more.
+  __sync_fetch_and_and(&g->tlbstale, ~(stale & mask));
+  pop_off();
+}
+
+// Interrupt an idle CPU in mask so that it looks for work:
+// cpu if it is idle, or else any other.
+static void
+kick(int cpu, uint mask)
+{
+  int i, me;
+
+  me = cpuid();
+  __sync_synchronize();
+  if(cpu == me || !cpus[cpu].idle){
+    for(i = 0; i < NCPU; i++)
+      if(i != me && (mask & (1 << i)) && cpus[i].idle)
+        break;
+    if(i == NCPU)
+      return;
+    cpu = i;
+  }
+  cpus[cpu].idle = 0;
+  ipi(cpu);
+}
+
+// Mark p RUNNABLE and put it at the tail of its level on
+// the run queue of the CPU it last ran on, or if p may not
+// run there, of this CPU or the first one p may run on.
+// Returns that CPU.
+// Caller must hold p->lock.
+static int
+setrunnable(struct proc *p)
+{
+  struct runq *rq;
+  uint boost;
+  int cpu;
+
+  if(!holding(&p->lock))
+    panic("setrunnable");
+  p->state = RUNNABLE;
+  boost = ticks / BOOSTTICKS;
+  if(p->boost != boost){
+    p->boost = boost;
+    p->prio = 0;
+    p->slice = 0;
+  }
+  cpu = p->lastcpu;
+  if(cpu < 0 || (p->affinity & (1 << cpu)) == 0)
+    cpu = cpuid();
+  for(; (p->affinity & (1 << cpu)) == 0; cpu = (cpu + 1) % NCPU)
+    ;
+  rq = &runq[cpu];
+  acquire(&rq->lock);
+  p->rqnext = 0;
+  if(rq->tail[p->prio])
+    rq->tail[p->prio]->rqnext = p;
+  else
+    rq->head[p->prio] = p;
+  rq->tail[p->prio] = p;
+  release(&rq->lock);
+  kick(cpu, p->affinity);
+  return cpu;
+}
+
+// Take the first process at level prio of rq that may run
+// on cpu, or return 0.
+static struct proc*
+rqtake(struct runq *rq, int prio, int cpu)
+{
+  struct proc *p, *prev;
+
+  if(rq->head[prio] == 0)
+    return 0;  // a peek, to save the lock
+  acquire(&rq->lock);
+  prev = 0;
+  for(p = rq->head[prio]; p; prev = p, p = p->rqnext)
+    if(p->affinity & (1 << cpu))
+      break;
+  if(p){
+    if(prev)
+      prev->rqnext = p->rqnext;
+    else
+      rq->head[prio] = p->rqnext;
+    if(rq->tail[prio] == p)
+      rq->tail[prio] = prev;
+  }
+  release(&rq->lock);
+  return p;
+}
+
+// Take q off rq, if it is there and nothing at a higher
+// level is.  Returns 1 if it was.
+// Caller must hold q->lock.
+static int
+rqremove(struct runq *rq, struct proc *q)
+{
+  struct proc *p, *prev;
+  int prio;
+
+  acquire(&rq->lock);
+  for(prio = 0; prio < q->prio && rq->head[prio] == 0; prio++)
+    ;
+  prev = 0;
+  p = 0;
+  if(prio == q->prio)
+    for(p = rq->head[prio]; p && p != q; prev = p, p = p->rqnext)
+      ;
+  if(p){
+    if(prev)
+      prev->rqnext = p->rqnext;
+    else
+      rq->head[prio] = p->rqnext;
+    if(rq->tail[prio] == p)
+      rq->tail[prio] = prev;
+  }
+  release(&rq->lock);
+  return p != 0;
+}
+
+// Take the process that cpu should run next, or return 0.
+static struct proc*
+rqnext(int cpu)
+{
+  struct proc *p;
+  int prio, i;
+
+  for(prio = 0; prio < NPRIO; prio++)
+    for(i = 0; i < NCPU; i++)
+      if((p = rqtake(&runq[(cpu + i) % NCPU], prio, cpu)) != 0)
+        return p;
+  return 0;
 }
 
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run.
+//  - take the highest priority process that may run here,
+//    from this CPU's run queue, or stealing one from
+//    another CPU's.
 //  - swtch to start running that process.
 //  - eventually that process transfers control
 //    via swtch back to the scheduler.
+// With nothing to run, the CPU stops its scheduler ticks and
+// waits in wfi for a device interrupt, a sleeper's deadline,
+// or a kick() from setrunnable().
 void
 scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int id = cpuid();
+  int i;
   
   c->proc = 0;
   for(;;){
+    rcuqs();
+
     // Avoid deadlock by ensuring that devices can interrupt.
     intr_on();
 
-    for(p = proc; p < &proc[NPROC]; p++) {
-      acquire(&p->lock);
-      if(p->state == RUNNABLE) {
-        // Switch to chosen process.  It is the process's job
-        // to release its lock and then reacquire it
-        // before jumping back to us.
-        p->state = RUNNING;
-        c->proc = p;
-        swtch(&c->context, &p->context);
-
-        // Process is done running for now.
-        // It should have changed its p->state before coming back.
-        c->proc = 0;
+    p = rqnext(id);
+
+    if(p == 0){
+      // Say that we are idle before the last look, so that
+      // a concurrent setrunnable() either queues before the
+      // look or sees c->idle and kicks us.  With interrupts
+      // off, a pending one still ends the wfi.
+      intr_off();
+      c->idle = 1;
+      __sync_synchronize();
+      for(i = 0; i < NCPU*NPRIO && runq[i/NPRIO].head[i%NPRIO] == 0; i++)
+        ;
+      if(i == NCPU*NPRIO){
+        timeridle(1);
+        asm volatile("wfi");
+        timeridle(0);
       }
-      release(&p->lock);
+      c->idle = 0;
+      continue;
     }
+
+    acquire(&p->lock);
+    if(p->state != RUNNABLE)
+      panic("scheduler");
+    // Switch to chosen process.  It is the process's job
+    // to release its lock and then reacquire it
+    // before jumping back to us.
+    p->state = RUNNING;
+    p->lastcpu = id;
+    c->proc = p;
+    c->handoff = 0;
+    c->start = r_time();
+    perfin(c);
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    // It need not be p, if p handed off; see sched().
+    p = c->proc;
+    p->rtime += r_time() - c->start;
+    perfout(p, c);
+    p->nswtch++;
+    c->proc = 0;
+    release(&p->lock);
+  }
+}
+
+// The process that p, about to block, should switch straight
+// to instead of going through scheduler(): the one p last
+// woke, if it waits on this CPU's run queue with nothing
+// ahead of it, so a round trip over a pipe is one switch
+// each way.  Returns it locked, or 0.
+// Caller must hold p->lock.
+static struct proc*
+handoff(struct proc *p)
+{
+  struct cpu *c = mycpu();
+  struct proc *q;
+
+  q = c->handoff;
+  c->handoff = 0;
+  if(q == 0 || q == p || p->state == RUNNABLE)
+    return 0;
+  // p->lock is held, so we must not wait for another.
+  if(!tryacquire(&q->lock))
+    return 0;
+  if(q->state != RUNNABLE || (q->affinity & (1 << cpuid())) == 0 ||
+     !rqremove(&runq[cpuid()], q)){
+    release(&q->lock);
+    return 0;
   }
+  return q;
 }
 
-// Switch to scheduler.  Must hold only p->lock
+// Release the lock of the process that handed this CPU off
+// to the current one, if it did, now that the switch is done.
+static void
+schedtail(void)
+{
+  struct cpu *c = mycpu();
+  struct proc *prev;
+
+  if((prev = c->prev) != 0){
+    c->prev = 0;
+    release(&prev->lock);
+  }
+}
+
+// Switch to scheduler, or hand the CPU straight to another
+// process.  Must hold only p->lock
 // and have changed proc->state. Saves and restores
 // intena because intena is a property of this
 // kernel thread, not this CPU. It should
@@ -490,6 +1429,8 @@ sched(void)
 {
   int intena;
   struct proc *p = myproc();
+  struct proc *q;
+  struct cpu *c;
 
   if(!holding(&p->lock))
     panic("sched p->lock");
@@ -501,8 +1442,24 @@ sched(void)
     panic("sched interruptible");
 
   intena = mycpu()->intena;
-  swtch(&p->context, &mycpu()->context);
+  rcuqs();
+  if((q = handoff(p)) != 0){
+    c = mycpu();
+    p->rtime += r_time() - c->start;
+    perfout(p, c);
+    p->nswtch++;
+    q->state = RUNNING;
+    q->lastcpu = cpuid();
+    c->proc = q;
+    c->prev = p;
+    c->start = r_time();
+    perfin(c);
+    swtch(&p->context, &q->context);
+  } else {
+    swtch(&p->context, &mycpu()->context);
+  }
   mycpu()->intena = intena;
+  schedtail();
 }
 
 // Give up the CPU for one scheduling round.
@@ -511,19 +1468,68 @@ yield(void)
 {
   struct proc *p = myproc();
   acquire(&p->lock);
-  p->state = RUNNABLE;
+  setrunnable(p);
+  sched();
+  release(&p->lock);
+}
+
+// A scheduler tick interrupted the current process.  Charge
+// it the tick, moving it down a level if that uses up its
+// quantum, and give up the CPU.
+void
+preempt(void)
+{
+  struct proc *p = myproc();
+
+  acquire(&p->lock);
+  if(++p->slice >= QUANTUM(p->prio)){
+    p->slice = 0;
+    if(p->prio < NPRIO-1)
+      p->prio++;
+  }
+  setrunnable(p);
   sched();
   release(&p->lock);
 }
 
+// Let process pid, or the current process if pid is 0, run
+// only on the CPUs in mask, bit i for CPU i.
+int
+setaffinity(int pid, int mask)
+{
+  struct proc *p;
+
+  mask &= ALLCPUS;
+  if(mask == 0)
+    return -1;
+  if(pid == 0)
+    pid = myproc()->pid;
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid || p->state == ZOMBIE){
+    release(&p->lock);
+    return -1;
+  }
+  // a RUNNABLE p moves when it next runs.
+  p->affinity = mask;
+  release(&p->lock);
+  if(p == myproc() && (mask & (1 << cpuid())) == 0)
+    yield();
+  return 0;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch to forkret.
 void
 forkret(void)
 {
   static int first = 1;
+  int i;
 
-  // Still holding p->lock from scheduler.
+  // Still holding p->lock from scheduler, or from sched()
+  // in the process that handed off to us.
+  schedtail();
   release(&myproc()->lock);
 
   if (first) {
@@ -532,17 +1538,55 @@ forkret(void)
     // be run from main().
     first = 0;
     fsinit(ROOTDEV);
+    for(i = 1; i < NDISK; i++)
+      if(virtio_disk_present(i))
+        fsinit(ROOTDEV + i);
+    tmpfsinit();
+    bootmark("fsinit");
   }
 
   usertrapret();
 }
 
+// A kernel thread's very first scheduling by scheduler()
+// will swtch to kthreadstart.
+static void
+kthreadstart(void)
+{
+  struct proc *p = myproc();
+
+  // Still holding p->lock from scheduler or sched().
+  schedtail();
+  release(&p->lock);
+
+  p->kthread();
+  panic("kthread returned");
+}
+
+// Start a process that runs fn in the kernel and never
+// returns to user space, such as the log installer.
+// fn must not return.
+void
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if((p = allocproc(0)) == 0)
+    panic("kthread");
+  p->kthread = fn;
+  p->context.ra = (uint64)kthreadstart;
+  safestrcpy(p->name, name, sizeof(p->name));
+  setrunnable(p);
+  release(&p->lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 void
 sleep(void *chan, struct spinlock *lk)
 {
   struct proc *p = myproc();
+  struct sleepq *sq = &sleepq[SQHASH(chan)];
   
   // Must acquire p->lock in order to
   // change p->state and then call sched.
@@ -550,8 +1594,18 @@ sleep(void *chan, struct spinlock *lk)
   // guaranteed that we won't miss any wakeup
   // (wakeup locks p->lock),
   // so it's okay to release lk.
-
+  // Joining sq first lets wakeup() find us.
+
+  acquire(&sq->lock);
+  p->sqnext = 0;
+  p->sqprev = sq->tail;
+  if(sq->tail)
+    sq->tail->sqnext = p;
+  else
+    sq->head = p;
+  sq->tail = p;
   acquire(&p->lock);  //DOC: sleeplock1
+  release(&sq->lock);
   release(lk);
 
   // Go to sleep.
@@ -562,28 +1616,78 @@ sleep(void *chan, struct spinlock *lk)
 
   // Tidy up.
   p->chan = 0;
+  release(&p->lock);
+
+  acquire(&sq->lock);
+  if(p->sqprev)
+    p->sqprev->sqnext = p->sqnext;
+  else
+    sq->head = p->sqnext;
+  if(p->sqnext)
+    p->sqnext->sqprev = p->sqprev;
+  else
+    sq->tail = p->sqprev;
+  release(&sq->lock);
 
   // Reacquire original lock.
-  release(&p->lock);
   acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Must be called without any p->lock.
-void
-wakeup(void *chan)
+// Wake up processes sleeping on chan, all of them or
+// just the one that has slept longest.  Returns how many
+// it woke.
+static int
+wakeupn(void *chan, int all)
 {
   struct proc *p;
-
-  for(p = proc; p < &proc[NPROC]; p++) {
+  struct sleepq *sq = &sleepq[SQHASH(chan)];
+  struct proc *q;
+  int woke, n, cpu;
+
+  n = 0;
+  q = 0;
+  cpu = -1;
+  acquire(&sq->lock);
+  for(p = sq->head; p != 0; p = p->sqnext) {
     if(p != myproc()){
       acquire(&p->lock);
+      woke = 0;
       if(p->state == SLEEPING && p->chan == chan) {
-        p->state = RUNNABLE;
+        cpu = setrunnable(p);
+        q = p;
+        woke = 1;
+        n++;
       }
       release(&p->lock);
+      if(woke && !all)
+        break;
     }
   }
+  // if the current process now blocks, q can run at once.
+  if(n == 1 && cpu == cpuid() && myproc())
+    mycpu()->handoff = q;
+  release(&sq->lock);
+  return n;
+}
+
+// Wake up all processes sleeping on chan.
+// Must be called without any p->lock.
+void
+wakeup(void *chan)
+{
+  wakeupn(chan, 1);
+}
+
+// Wake up one process sleeping on chan, for a
+// condition that only one waiter can consume.  A
+// waiter that leaves some of it for the others must
+// pass it on with another wakeupone().  Returns 1 if
+// there was one to wake, else 0.
+// Must be called without any p->lock.
+int
+wakeupone(void *chan)
+{
+  return wakeupn(chan, 0);
 }
 
 // Kill the process with the given pid.
@@ -594,20 +1698,21 @@ kill(int pid)
 {
   struct proc *p;
 
-  for(p = proc; p < &proc[NPROC]; p++){
-    acquire(&p->lock);
-    if(p->pid == pid){
-      p->killed = 1;
-      if(p->state == SLEEPING){
-        // Wake process from sleep().
-        p->state = RUNNABLE;
-      }
-      release(&p->lock);
-      return 0;
-    }
+  if((p = findproc(pid)) == 0)
+    return -1;
+  acquire(&p->lock);
+  if(p->pid != pid){
+    // exited and freed since findproc().
     release(&p->lock);
+    return -1;
   }
-  return -1;
+  p->killed = 1;
+  if(p->state == SLEEPING){
+    // Wake process from sleep().
+    setrunnable(p);
+  }
+  release(&p->lock);
+  return 0;
 }
 
 // Copy to either a user address, or kernel address,
@@ -664,11 +1769,53 @@ procdump(void)
       state = states[p->state];
     else
       state = "???";
-    printf("%d %s %s", p->pid, state, p->name);
+    printf("%d %s %s prio %d cpu %d %dms", p->pid, state, p->name,
+           p->prio, p->lastcpu, (int)(p->rtime / (TIMEFREQ / 1000)));
     printf("\n");
   }
 }
 
+// Report each process's accounting, a line each, for the
+// procs device.  Times are in ms, sizes in KB; a thread's
+// ppid is 0 and its tgid is its group leader's pid.
+int
+statsproc(char *buf, int sz)
+{
+  static char *states[] = {
+  [UNUSED]    "unused",
+  [USED]      "used",
+  [SLEEPING]  "sleep",
+  [RUNNABLE]  "runble",
+  [RUNNING]   "run",
+  [ZOMBIE]    "zombie"
+  };
+  struct proc *p;
+  uint64 utime, stime;
+  int n;
+
+  n = snprintf(buf, sz, "pid ppid tgid state prio cpu user sys switches faults reads writes syscalls kb name\n");
+  acquire(&wait_lock);
+  for(p = proc; p < &proc[NPROC]; p++){
+    acquire(&p->lock);
+    if(p->state == UNUSED || p->group == 0){
+      release(&p->lock);
+      continue;
+    }
+    // utime may count the part of the slice now running.
+    utime = p->utime;
+    stime = p->rtime > utime ? p->rtime - utime : 0;
+    n += snprintf(buf+n, sz-n, "%d %d %d %s %d %d %d %d %d %d %d %d %d %d %s\n",
+                  p->pid, p->parent ? p->parent->pid : 0, p->group->pid,
+                  states[p->state], p->prio, p->lastcpu,
+                  (int)(utime / (TIMEFREQ / 1000)), (int)(stime / (TIMEFREQ / 1000)),
+                  p->nswtch, p->nfault, p->nblk[0], p->nblk[1], p->nsyscall,
+                  (int)(p->group->sz / 1024), p->name);
+    release(&p->lock);
+  }
+  release(&wait_lock);
+  return n;
+}
+
 void sigalarm(int ticks, void (*handler)(void)) 
 {
     struct proc *p = myproc();
@@ -682,6 +1829,7 @@ void sigreturn()
     struct proc *p = myproc();     
     memmove(p->trapframe, p->alt_trapframe, sizeof(struct trapframe));
     p->alarm_pending = 0;
+    p->syscallret = 0;  // every register is the handler's to restore
     return;
 
 }
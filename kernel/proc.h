@@ -19,15 +19,41 @@ struct context {
 };
 
 // Per-CPU state.
+// Work an interrupt handler leaves to be done after it, with
+// interrupts on, on the same CPU; see defer().
+struct work {
+  void (*fn)(void);
+  int pending;                // queued and not yet started
+  struct work *next;
+};
+
+struct call;
+
 struct cpu {
   struct proc *proc;          // The process running on this cpu, or null.
   struct context context;     // swtch() here to enter scheduler().
   int noff;                   // Depth of push_off() nesting.
   int intena;                 // Were interrupts enabled before push_off()?
+  int idle;                   // Waiting in scheduler() for a kick()?
+  int inuser;                 // Running user code, maybe on stale TLB entries?
+  uint asidgen;               // ASID generation the TLB holds entries of
+  int profdue;                // The next trap should take a profile sample
+  uint64 start;               // r_time() when proc started running
+  uint64 perfstart[NPERF];    // and the counters perf.c reads
+  struct proc *handoff;       // Woken by proc, maybe to run next; see sched()
+  struct proc *prev;          // Handed off from, for sched() to unlock
+  struct work *work;          // Deferred interrupt work, oldest first
+  struct work *worklast;
+  int insoftirq;              // Doing it in softirq(), so don't preempt
+  struct call *call[NCPU];    // Each CPU's smpcall() to this one
+  uint callmask;              // The slots of call[] in use
+  uint64 nqs;                 // Quiescent states passed, for rcu.c
 };
 
 extern struct cpu cpus[NCPU];
 
+#define ALLCPUS ((1 << NCPU) - 1)  // a mask of every CPU
+
 // per-process data for the trap handling code in trampoline.S.
 // sits in a page by itself just under the trampoline page in the
 // user page table. not specially mapped in the kernel page table.
@@ -82,6 +108,20 @@ struct trapframe {
 
 enum procstate { UNUSED, USED, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
+// A range of user memory paged in on first touch by
+// uvmfile().  exec() makes one for each ELF segment, and
+// mmap() one for each mapping.  Past filesz bytes, or if
+// there is no file, the memory is zero-filled.
+struct vma {
+  uint64 start;                // page-aligned first address
+  uint64 end;                  // page-aligned end, or 0 if the slot is free
+  struct inode *ip;            // the file, or 0 if anonymous
+  uint off;                    // file offset of start
+  uint filesz;                 // bytes that come from the file
+  int perm;                    // PTE_R, PTE_W and PTE_X
+  int flags;                   // mmap()'s MAP_ flags; 0 for exec()
+};
+
 // Per-process state
 struct proc {
   struct spinlock lock;
@@ -92,22 +132,73 @@ struct proc {
   int killed;                  // If non-zero, have been killed
   int xstate;                  // Exit status to be returned to parent's wait
   int pid;                     // Process ID
+  uint64 tracemask;            // System calls to trace, 1L<<SYS_x
+  struct proc *rqnext;         // Next on run queue, if RUNNABLE
+  int prio;                    // Run queue level, 0 highest
+  int slice;                   // Ticks used of this level's quantum
+  uint boost;                  // ticks/BOOSTTICKS when last boosted
+  int affinity;                // CPUs p may run on, 1<<cpu each
+  int lastcpu;                 // CPU p last ran on, or -1
+  uint64 rtime;                // r_time() spent running
+  uint64 perf[NPERF];          // events while running; see perf.c
+  uint nswtch;                 // Times switched to
+  struct proc *sqnext;         // Sleep queue links, for chan's bucket
+  struct proc *sqprev;
+
+  // the lock of the CPU's timer queue must be held when using these:
+  uint64 deadline;             // r_time() to wake at, in sleepuntil()
+  int tidx;                    // Index in the timer heap, or -1
+  int polling;                 // Deadline is poll()'s, see timerpoll()
+  int tcpu;                    // Whose heap, for timerpollcancel()
+
+  struct proc *pidnext;        // In pidhash; pid_lock must be held
 
-  // wait_lock must be held when using this:
-  struct proc *parent;         // Parent process
+  // wait_lock must be held when using these:
+  struct proc *parent;         // Parent process; 0 for a clone()d thread
+  struct proc *children;       // Processes whose parent is p
+  struct proc *threads;        // Group leader: its other threads
+  struct proc *sibnext;        // On the parent's children, or the
+  struct proc *sibprev;        //   leader's threads
+  int nthread;                 // Group leader: its threads, itself included
+  struct proc *vfork;          // Parent whose memory p borrows, see vfork()
+
+  // A process's threads share the memory, open files and current
+  // directory of the first, the group leader; only its copies of
+  // sz, ofile, cwd and vma are used.  Its slock must be held to
+  // change its page table, sz, vma or ofile.
+  struct proc *group;          // Group leader, p itself if not a thread
+  struct spinlock slock;
+  uint tslots;                 // Group leader: trapframe slots in use
+  uint64 tfva;                 // Where p->trapframe is mapped
+  int syscallret;              // Returning from a system call, so userret
+                               //   needn't restore caller-saved registers
+  uint64 asid;                 // Group leader: generation<<32 | ASID,
+  uint tlbstale;               //   and CPUs whose entries are stale
+  int npinned;                 // Group leader: kernel users of its pages'
+                               //   physical addresses, see swap.c
 
   // these are private to the process, so p->lock need not be held.
   uint64 kstack;               // Virtual address of kernel stack
   uint64 sz;                   // Size of process memory (bytes)
   pagetable_t pagetable;       // User page table
   struct trapframe *trapframe; // data page for trampoline.S
+  struct usyscall *usyscall;   // page user code reads at USYSCALL
   struct trapframe *alt_trapframe;  // Saved trapframe for sigalarm.
   struct context context;      // swtch() here to run process
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
+  struct vma vma[NVMA];        // File-backed memory
   char name[16];               // Process name (debugging)
+  void (*kthread)(void);       // Body of a kernel thread, or 0
   int alarm_ticks;             // Number of ticks to wait between alarm_fn invocation
   int alarm_current_ticks;     // Current number of ticks between last invocation of alarm_handler
   void (*alarm_handler)(void);  // sigalarm handler fn
   int alarm_pending;                                
+
+  // Accounting, for the procs device.  Only p updates these.
+  uint64 utime;                // r_time() spent in user space
+  uint64 uentry;               // r_time() at the last return to it
+  uint nfault;                 // Page faults
+  uint nblk[2];                // Disk blocks read and written
+  uint nsyscall;               // System calls
 };
@@ -0,0 +1,200 @@
+// The sampling profiler device.
+//
+// Writing "1" to it clears the samples and starts profiling;
+// "0" stops it.  While it runs, each ticking CPU takes a timer
+// interrupt every PROFINTERVAL, and the trap handler records
+// where it interrupted, the pc and up to PROFDEPTH-1 return
+// addresses found by following frame pointers, into that
+// CPU's ring.  A full ring drops samples and counts them.
+//
+// Reading it returns whole struct profsamples, at least one,
+// waiting for some while profiling runs; 0 means profiling
+// has stopped and every sample has been read.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "riscv.h"
+#include "proc.h"
+#include "fs.h"
+#include "file.h"
+#include "prof.h"
+#include "defs.h"
+
+#define NPROFSAMPLE 256  // per CPU
+
+static struct profbuf {
+  struct spinlock lock;
+  struct profsample s[NPROFSAMPLE];
+  uint r, w;               // next to read and to write
+  uint ndropped;
+} profbufs[NCPU];
+
+int profon;                // timerintr() asks for samples
+
+// Read the user word at va of pagetable into *x; the page
+// must already be mapped, since we can't fault it in here.
+static int
+fetchuser(pagetable_t pagetable, uint64 va, uint64 *x)
+{
+  uint64 pa;
+
+  if(va % sizeof(uint64) != 0 || va >= MAXVA)
+    return -1;
+  if((pa = walkaddr(pagetable, PGROUNDDOWN(va))) == 0)
+    return -1;
+  *x = *(uint64*)(pa + va % PGSIZE);
+  return 0;
+}
+
+// Fill in s's return addresses by walking the frame pointer
+// chain from fp: a user one through p's page table, a kernel
+// one within the kernel stack page it starts in.
+static void
+profwalk(struct profsample *s, struct proc *p, int user, uint64 fp)
+{
+  uint64 lo = PGROUNDDOWN(fp), ra;
+  struct proc *g;
+  int i;
+
+  if(user)
+    acquire(&(g = p->group)->slock);
+  for(i = 1; i < PROFDEPTH && fp != 0; i++){
+    if(user){
+      if(fetchuser(p->pagetable, fp - 8, &ra) < 0 ||
+         fetchuser(p->pagetable, fp - 16, &fp) < 0)
+        break;
+    } else {
+      if(fp < lo + 16 || fp > lo + PGSIZE || fp % 8 != 0)
+        break;
+      ra = ((uint64*)fp)[-1];
+      fp = ((uint64*)fp)[-2];
+    }
+    s->pc[i] = ra;
+  }
+  if(user)
+    release(&g->slock);
+}
+
+// Called on each trap with the interrupted pc and frame
+// pointer, and whether the trap came from user space.
+// Records a sample if timerintr() asked for one.
+void
+proftrap(int user, uint64 pc, uint64 fp)
+{
+  struct profbuf *b;
+  struct profsample *s;
+  struct proc *p;
+
+  push_off();
+  if(!mycpu()->profdue){
+    pop_off();
+    return;
+  }
+  mycpu()->profdue = 0;
+  p = myproc();
+  b = &profbufs[cpuid()];
+  acquire(&b->lock);
+  if(b->w - b->r == NPROFSAMPLE){
+    b->ndropped++;
+  } else {
+    s = &b->s[b->w % NPROFSAMPLE];
+    memset(s, 0, sizeof(*s));
+    s->user = user;
+    if(p){
+      s->pid = p->pid;
+      safestrcpy(s->name, p->name, sizeof(s->name));
+    }
+    s->pc[0] = pc;
+    if(p || !user)
+      profwalk(s, p, user, fp);
+    b->w++;
+  }
+  release(&b->lock);
+  pop_off();
+}
+
+static int
+profwrite(int user_src, uint64 src, int n)
+{
+  struct profbuf *b;
+  char c;
+
+  if(n < 1 || either_copyin(&c, user_src, src, 1) < 0)
+    return -1;
+  if(c == '1'){
+    for(b = profbufs; b < &profbufs[NCPU]; b++){
+      acquire(&b->lock);
+      b->r = b->w = b->ndropped = 0;
+      release(&b->lock);
+    }
+    __atomic_store_n(&profon, 1, __ATOMIC_RELEASE);
+  } else if(c == '0'){
+    __atomic_store_n(&profon, 0, __ATOMIC_RELEASE);
+  } else {
+    return -1;
+  }
+  return n;
+}
+
+static int
+profread(int user_dst, uint64 dst, int n)
+{
+  struct profbuf *b;
+  struct profsample s;
+  int tot, got;
+
+  tot = 0;
+  while(n - tot >= sizeof(s)){
+    got = 0;
+    for(b = profbufs; b < &profbufs[NCPU] && n - tot >= sizeof(s); b++){
+      acquire(&b->lock);
+      if(b->r == b->w){
+        release(&b->lock);
+        continue;
+      }
+      s = b->s[b->r++ % NPROFSAMPLE];
+      release(&b->lock);
+      if(either_copyout(user_dst, dst + tot, &s, sizeof(s)) < 0)
+        return -1;
+      tot += sizeof(s);
+      got = 1;
+    }
+    if(got)
+      continue;
+    if(tot > 0 || !__atomic_load_n(&profon, __ATOMIC_ACQUIRE))
+      break;
+    // the rings fill in no less than NPROFSAMPLE*PROFINTERVAL.
+    if(sleepuntil(r_time() + TICKINTERVAL) < 0)
+      return -1;
+  }
+  return tot;
+}
+
+// Report samples dropped by full rings.
+int
+statsprof(char *buf, int sz)
+{
+  struct profbuf *b;
+  uint n = 0;
+
+  for(b = profbufs; b < &profbufs[NCPU]; b++){
+    acquire(&b->lock);
+    n += b->ndropped;
+    release(&b->lock);
+  }
+  return snprintf(buf, sz, "prof: %d samples dropped\n", n);
+}
+
+void
+profinit(void)
+{
+  struct profbuf *b;
+
+  for(b = profbufs; b < &profbufs[NCPU]; b++)
+    initlock(&b->lock, "prof");
+  devsw[PROF].read = profread;
+  devsw[PROF].write = profwrite;
+}
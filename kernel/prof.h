@@ -0,0 +1,10 @@
+// Samples as reads of the profiler device return them.
+#define PROFDEPTH 8
+
+struct profsample {
+  int pid;                 // 0 if the CPU ran no process
+  int user;                // interrupted in user space?
+  char name[16];           // the process's name, for its symbols
+  uint64 pc[PROFDEPTH];    // interrupted pc, then return addresses;
+                           // 0 after the last
+};
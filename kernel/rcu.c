@@ -0,0 +1,160 @@
+// Read-copy update.
+//
+// A lookup that reads a shared structure between rcureadlock()
+// and rcureadunlock() takes no lock, and so writes no shared
+// cache line.  Writers still lock against each other; one that
+// takes something out of the structure frees it only after a
+// grace period, when every CPU that might have been in a read
+// section when it was taken out has left it: rcusync() waits
+// for one, and rcucall() has the rcu kernel thread call a
+// function after one.
+//
+// A read section has interrupts off, so it can't sleep or be
+// preempted, and a CPU has left any it was in once it has been
+// through sched() or round the scheduler loop (which bump its
+// nqs count), or is idle or running user code.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+#define RCUPOLL (TIMEFREQ/1000)  // r_time() between looks at a grace period
+
+static struct {
+  struct spinlock lock;
+  struct rcuhead *head;  // rcucall()s yet to be called
+  struct rcuhead **tail;
+
+  // Statistics.
+  uint ngp;              // grace periods
+  uint ncall;            // rcucall()s called
+} rcu;
+
+static void rcud(void);
+
+void
+rcuinit(void)
+{
+  initlock(&rcu.lock, "rcu");
+  rcu.tail = &rcu.head;
+  kthread("rcu", rcud);
+}
+
+void
+rcureadlock(void)
+{
+  push_off();
+}
+
+void
+rcureadunlock(void)
+{
+  pop_off();
+}
+
+// This CPU is in no read section.  Called by the scheduler.
+void
+rcuqs(void)
+{
+  struct cpu *c = mycpu();
+
+  __atomic_store_n(&c->nqs, c->nqs + 1, __ATOMIC_RELEASE);
+}
+
+// Note where each CPU is, to start a grace period.
+static void
+rcusnap(uint64 *snap)
+{
+  int i;
+
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++)
+    snap[i] = __atomic_load_n(&cpus[i].nqs, __ATOMIC_ACQUIRE);
+}
+
+// Has the grace period that started at snap ended?  A CPU
+// that hasn't yet been to the scheduler, perhaps one that
+// doesn't exist, is in no read section.
+static int
+rcudone(uint64 *snap)
+{
+  struct cpu *c;
+  int i;
+
+  __sync_synchronize();
+  for(i = 0; i < NCPU; i++){
+    c = &cpus[i];
+    if(snap[i] == 0 || __atomic_load_n(&c->nqs, __ATOMIC_ACQUIRE) != snap[i] ||
+       c->idle || c->inuser)
+      continue;
+    return 0;
+  }
+  return 1;
+}
+
+// Wait for a grace period.  Caller may not hold a spinlock.
+void
+rcusync(void)
+{
+  uint64 snap[NCPU];
+
+  rcusnap(snap);
+  while(!rcudone(snap))
+    sleepuntil(r_time() + RCUPOLL);
+  __sync_fetch_and_add(&rcu.ngp, 1);
+}
+
+// Call fn(arg) after a grace period, using h, which the caller
+// must not change until then.  Never sleeps.
+void
+rcucall(struct rcuhead *h, void (*fn)(void*), void *arg)
+{
+  h->fn = fn;
+  h->arg = arg;
+  h->next = 0;
+  acquire(&rcu.lock);
+  *rcu.tail = h;
+  rcu.tail = &h->next;
+  release(&rcu.lock);
+}
+
+// The rcu kernel thread: every tick, wait a grace period for
+// the rcucall()s made so far, and call them.
+static void
+rcud(void)
+{
+  struct rcuhead *h, *next;
+
+  for(;;){
+    sleepuntil(r_time() + TICKINTERVAL);
+    acquire(&rcu.lock);
+    h = rcu.head;
+    rcu.head = 0;
+    rcu.tail = &rcu.head;
+    release(&rcu.lock);
+    if(h == 0)
+      continue;
+    rcusync();
+    for(; h; h = next){
+      next = h->next;  // h may go in h->fn()
+      h->fn(h->arg);
+      __sync_fetch_and_add(&rcu.ncall, 1);
+    }
+  }
+}
+
+// Report grace periods and deferred calls.
+int
+statsrcu(char *buf, int sz)
+{
+  int n;
+
+  acquire(&rcu.lock);
+  n = snprintf(buf, sz, "rcu: %d grace periods, %d calls\n", rcu.ngp, rcu.ncall);
+  release(&rcu.lock);
+  return n;
+}
@@ -198,6 +198,12 @@ w_pmpaddr0(uint64 x)
 
 #define MAKE_SATP(pagetable) (SATP_SV39 | (((uint64)pagetable) >> 12))
 
+// satp's address space identifier field, which tags TLB
+// entries so a switch of page table need not flush them.
+#define SATP_ASIDSHIFT 44
+#define SATP_ASIDMASK  0xffffL
+#define SATP_ASID(asid) ((uint64)(asid) << SATP_ASIDSHIFT)
+
 // supervisor address translation and protection;
 // holds the address of the page table.
 static inline void 
@@ -260,6 +266,21 @@ r_mcounteren()
   return x;
 }
 
+// Supervisor-mode Counter-Enable
+static inline void 
+w_scounteren(uint64 x)
+{
+  asm volatile("csrw scounteren, %0" : : "r" (x));
+}
+
+static inline uint64
+r_scounteren()
+{
+  uint64 x;
+  asm volatile("csrr %0, scounteren" : "=r" (x) );
+  return x;
+}
+
 // machine-mode cycle counter
 static inline uint64
 r_time()
@@ -269,6 +290,76 @@ r_time()
   return x;
 }
 
+// cycles executed by this hart
+static inline uint64
+r_cycle()
+{
+  uint64 x;
+  asm volatile("csrr %0, cycle" : "=r" (x) );
+  return x;
+}
+
+// instructions retired by this hart
+static inline uint64
+r_instret()
+{
+  uint64 x;
+  asm volatile("csrr %0, instret" : "=r" (x) );
+  return x;
+}
+
+// hardware performance counters 3..5, which count the events
+// mhpmevent3..5 select.
+static inline uint64
+r_hpmcounter3()
+{
+  uint64 x;
+  asm volatile("csrr %0, hpmcounter3" : "=r" (x) );
+  return x;
+}
+
+static inline uint64
+r_hpmcounter4()
+{
+  uint64 x;
+  asm volatile("csrr %0, hpmcounter4" : "=r" (x) );
+  return x;
+}
+
+static inline uint64
+r_hpmcounter5()
+{
+  uint64 x;
+  asm volatile("csrr %0, hpmcounter5" : "=r" (x) );
+  return x;
+}
+
+static inline void
+w_mhpmevent3(uint64 x)
+{
+  asm volatile("csrw mhpmevent3, %0" : : "r" (x));
+}
+
+static inline uint64
+r_mhpmevent3()
+{
+  uint64 x;
+  asm volatile("csrr %0, mhpmevent3" : "=r" (x) );
+  return x;
+}
+
+static inline void
+w_mhpmevent4(uint64 x)
+{
+  asm volatile("csrw mhpmevent4, %0" : : "r" (x));
+}
+
+static inline void
+w_mhpmevent5(uint64 x)
+{
+  asm volatile("csrw mhpmevent5, %0" : : "r" (x));
+}
+
 // enable device interrupts
 static inline void
 intr_on()
@@ -331,6 +422,20 @@ sfence_vma()
   asm volatile("sfence.vma zero, zero");
 }
 
+// flush the TLB entries of one address space.
+static inline void
+sfence_vma_asid(uint64 asid)
+{
+  asm volatile("sfence.vma zero, %0" : : "r" (asid));
+}
+
+// flush one address space's entries for the page at va.
+static inline void
+sfence_vma_page(uint64 va, uint64 asid)
+{
+  asm volatile("sfence.vma %0, %1" : : "r" (va), "r" (asid));
+}
+
 
 #define PGSIZE 4096 // bytes per page
 #define PGSHIFT 12  // bits of offset within a page
@@ -343,6 +448,10 @@ sfence_vma()
 #define PTE_W (1L << 2)
 #define PTE_X (1L << 3)
 #define PTE_U (1L << 4) // 1 -> user can access
+#define PTE_A (1L << 6) // accessed
+#define PTE_D (1L << 7) // dirty, set by hardware on a store
+#define PTE_COW (1L << 8) // copy-on-write page (RSW bit)
+#define PTE_SWAP (1L << 9) // swapped out (RSW bit); see swap.c
 
 // shift a physical address to the right place for a PTE.
 #define PA2PTE(pa) ((((uint64)pa) >> 12) << 10)
@@ -351,11 +460,25 @@ sfence_vma()
 
 #define PTE_FLAGS(pte) ((pte) & 0x3FF)
 
+// a swapped-out page's PTE holds its swap slot where the
+// physical page number would go.
+#define SLOT2PTE(slot) (((uint64)(slot)) << 10)
+#define PTE2SLOT(pte) ((pte) >> 10)
+
 // extract the three 9-bit page table indices from a virtual address.
 #define PXMASK          0x1FF // 9 bits
 #define PXSHIFT(level)  (PGSHIFT+(9*(level)))
 #define PX(level, va) ((((uint64) (va)) >> PXSHIFT(level)) & PXMASK)
 
+// bytes mapped by one leaf PTE at level; level 1 leaves
+// are 2MB megapages.
+#define LEVELSIZE(level) (1L << PXSHIFT(level))
+#define SUPERPGSIZE LEVELSIZE(1)
+
+// a valid PTE with any of R, W, X maps memory; otherwise
+// it points to the next level of the page table.
+#define PTE_LEAF(pte) ((pte) & (PTE_R|PTE_W|PTE_X))
+
 // one beyond the highest possible virtual address.
 // MAXVA is actually one bit less than the max allowed by
 // Sv39, to avoid having to sign-extend virtual addresses
@@ -0,0 +1,247 @@
+// Object caches.
+//
+// A kmcache hands out objects of one size, packed into slab
+// pages from kalloc(), so that a pipe or an open file costs
+// what it needs instead of a page or a slot in a fixed table.
+//
+// Each slab page starts with a struct slab, and each object in
+// it is followed by a link word that chains it on the slab's
+// free list, leaving the object itself alone.  So the cache's
+// ctor() runs only when a slab page is made, and an object
+// keeps what ctor() set up, its locks say, from one kmalloc()
+// to the next; kmfree() must get it back in that state.
+//
+// Each CPU has a magazine of free objects for each cache.
+// kmalloc() and kmfree() use it with interrupts off and no lock,
+// and only take the cache's lock to move half a magazine's worth
+// from or to the slabs when it is empty or full.  A cache keeps
+// one slab page that is all free and gives any other back to
+// kalloc().
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "spinlock.h"
+#include "riscv.h"
+#include "slab.h"
+#include "defs.h"
+
+struct slab {
+  struct kmcache *c;
+  uint nfree;
+  void *free;             // first free object
+  struct slab *next;      // on c->partial
+  struct slab *prev;
+};
+
+#define SLABHDR ((sizeof(struct slab) + 15) & ~15)
+#define LINK(c, obj) ((void**)((char*)(obj) + (c)->size))
+#define SLAB(obj) ((struct slab*)PGROUNDDOWN((uint64)(obj)))
+
+// Every cache, for statskmcache().  Caches are made while
+// booting, by the first CPU, so nothing locks this.
+static struct kmcache *kmcaches[16];
+static int nkmcache;
+
+void
+kminit(struct kmcache *c, char *name, uint size,
+       void (*ctor)(void*), void (*dtor)(void*))
+{
+  memset(c, 0, sizeof(*c));
+  initlock(&c->lock, "kmcache");
+  c->name = name;
+  c->size = (size + 7) & ~7;
+  c->slotsize = c->size + sizeof(void*);
+  c->perslab = (PGSIZE - SLABHDR) / c->slotsize;
+  if(c->perslab == 0)
+    panic("kminit: too big");
+  c->ctor = ctor;
+  c->dtor = dtor;
+
+  if(nkmcache == NELEM(kmcaches))
+    panic("kminit: too many caches");
+  kmcaches[nkmcache++] = c;
+}
+
+// Make a slab page for c, without holding c->lock.
+static struct slab*
+newslab(struct kmcache *c)
+{
+  struct slab *s;
+  char *obj;
+  int i;
+
+  if((s = kalloc()) == 0)
+    return 0;
+  s->c = c;
+  s->nfree = 0;
+  s->free = 0;
+  for(i = c->perslab - 1; i >= 0; i--){
+    obj = (char*)s + SLABHDR + i*c->slotsize;
+    if(c->ctor)
+      c->ctor(obj);
+    *LINK(c, obj) = s->free;
+    s->free = obj;
+    s->nfree++;
+  }
+  return s;
+}
+
+static void
+freeslab(struct kmcache *c, struct slab *s)
+{
+  int i;
+
+  if(c->dtor){
+    for(i = 0; i < c->perslab; i++)
+      c->dtor((char*)s + SLABHDR + i*c->slotsize);
+  }
+  kfree(s);
+}
+
+// Caller holds c->lock.
+static void
+partialadd(struct kmcache *c, struct slab *s)
+{
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+}
+
+// Caller holds c->lock.
+static void
+partialdel(struct kmcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Move objects from c's slabs to m until it holds n.
+// Caller holds c->lock.
+static void
+slabtake(struct kmcache *c, struct magazine *m, int n)
+{
+  struct slab *s;
+  void *obj;
+
+  while(m->n < n){
+    if((s = c->partial) == 0){
+      if((s = c->empty) == 0)
+        break;
+      c->empty = 0;
+      partialadd(c, s);
+    }
+    obj = s->free;
+    s->free = *LINK(c, obj);
+    if(--s->nfree == 0)
+      partialdel(c, s);
+    m->obj[m->n++] = obj;
+  }
+}
+
+// Return obj to its slab.  If that leaves a second slab all
+// free, return the slab for the caller to free.
+// Caller holds c->lock.
+static struct slab*
+slabput(struct kmcache *c, void *obj)
+{
+  struct slab *s = SLAB(obj);
+
+  *LINK(c, obj) = s->free;
+  s->free = obj;
+  if(s->nfree++ == 0)
+    partialadd(c, s);
+  if(s->nfree < c->perslab)
+    return 0;
+  partialdel(c, s);
+  if(c->empty == 0){
+    c->empty = s;
+    return 0;
+  }
+  c->nslab--;
+  return s;
+}
+
+// Allocate an object from c.  Returns 0 if out of memory.
+void*
+kmalloc(struct kmcache *c)
+{
+  struct magazine *m;
+  struct slab *s;
+  void *obj;
+
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == 0){
+    acquire(&c->lock);
+    slabtake(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  if(m->n == 0){
+    // Grow the cache.
+    if((s = newslab(c)) == 0){
+      pop_off();
+      return 0;
+    }
+    acquire(&c->lock);
+    c->nslab++;
+    partialadd(c, s);
+    slabtake(c, m, MAGSIZE/2);
+    release(&c->lock);
+  }
+  obj = m->obj[--m->n];
+  pop_off();
+  __sync_fetch_and_add(&c->nalloc, 1);
+  return obj;
+}
+
+// Give obj back to the cache it came from.
+void
+kmfree(void *obj)
+{
+  struct kmcache *c = SLAB(obj)->c;
+  struct magazine *m;
+  struct slab *s, *spare;
+
+  __sync_fetch_and_sub(&c->nalloc, 1);
+  push_off();
+  m = &c->mag[cpuid()];
+  if(m->n == MAGSIZE){
+    spare = 0;
+    acquire(&c->lock);
+    while(m->n > MAGSIZE/2){
+      if((s = slabput(c, m->obj[--m->n])) != 0){
+        s->next = spare;
+        spare = s;
+      }
+    }
+    release(&c->lock);
+    for(; spare; spare = s){
+      s = spare->next;
+      freeslab(c, spare);
+    }
+  }
+  m->obj[m->n++] = obj;
+  pop_off();
+}
+
+// Report each cache's objects and pages.
+int
+statskmcache(char *buf, int sz)
+{
+  struct kmcache *c;
+  int i, n = 0;
+
+  for(i = 0; i < nkmcache; i++){
+    c = kmcaches[i];
+    n += snprintf(buf+n, sz-n, "kmcache %s: %d objects, %d pages, %d bytes each\n",
+                  c->name, c->nalloc, c->nslab, c->size);
+  }
+  return n;
+}
@@ -0,0 +1,24 @@
+// Per-CPU stack of free objects, so that most kmalloc()s and
+// kmfree()s take no lock.
+#define MAGSIZE 16
+
+struct magazine {
+  int n;
+  void *obj[MAGSIZE];
+};
+
+// A cache of objects of one size, carved from kalloc() pages.
+struct kmcache {
+  struct spinlock lock;   // protects the slab lists and counts
+  char *name;
+  uint size;              // object size
+  uint slotsize;          // size plus the free-list link
+  uint perslab;           // objects per slab page
+  void (*ctor)(void*);    // run on each object of a new slab page
+  void (*dtor)(void*);    // and when the page is given back
+  struct slab *partial;   // slabs with some objects free
+  struct slab *empty;     // one slab with all of them free
+  uint nslab;             // pages held
+  uint nalloc;            // objects handed out
+  struct magazine mag[NCPU];
+};
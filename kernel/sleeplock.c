@@ -9,6 +9,13 @@
 #include "proc.h"
 #include "sleeplock.h"
 
+// Every sleep lock, for statslock().  A sleep lock whose
+// memory is freed must be passed to freesleeplock() first.
+// Like lock_locks, sleeplocks_lock is never passed to
+// initlock().
+static struct spinlock sleeplocks_lock;
+static struct sleeplock *sleeplocks;
+
 void
 initsleeplock(struct sleeplock *lk, char *name)
 {
@@ -16,17 +23,46 @@ initsleeplock(struct sleeplock *lk, char *name)
   lk->name = name;
   lk->locked = 0;
   lk->pid = 0;
+  lk->n = 0;
+  lk->nwait = 0;
+  lk->held = 0;
+
+  acquire(&sleeplocks_lock);
+  lk->next = sleeplocks;
+  sleeplocks = lk;
+  release(&sleeplocks_lock);
+}
+
+// Forget a sleep lock whose memory is about to be freed.
+void
+freesleeplock(struct sleeplock *lk)
+{
+  struct sleeplock **pp;
+
+  acquire(&sleeplocks_lock);
+  for(pp = &sleeplocks; *pp; pp = &(*pp)->next){
+    if(*pp == lk){
+      *pp = lk->next;
+      break;
+    }
+  }
+  release(&sleeplocks_lock);
+  freelock(&lk->lk);
 }
 
 void
 acquiresleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lk->n++;
+  if(lk->locked)
+    lk->nwait++;
   while (lk->locked) {
     sleep(lk, &lk->lk);
   }
   lk->locked = 1;
   lk->pid = myproc()->pid;
+  lk->acquired = r_time();
   release(&lk->lk);
 }
 
@@ -34,9 +70,10 @@ void
 releasesleep(struct sleeplock *lk)
 {
   acquire(&lk->lk);
+  lk->held += r_time() - lk->acquired;
   lk->locked = 0;
   lk->pid = 0;
-  wakeup(lk);
+  wakeupone(lk);
   release(&lk->lk);
 }
 
@@ -51,5 +88,20 @@ holdingsleep(struct sleeplock *lk)
   return r;
 }
 
+// Add each sleep lock's counts to its class in cls.
+void
+statssleeplock(struct lockclass *cls, int *ncls, int max)
+{
+  struct sleeplock *lk;
+  struct lockclass *c;
 
-
+  acquire(&sleeplocks_lock);
+  for(lk = sleeplocks; lk; lk = lk->next){
+    if(lk->n == 0 || (c = lockclass(cls, ncls, max, lk->name, 1)) == 0)
+      continue;
+    c->n += lk->n;
+    c->nwait += lk->nwait;
+    c->held += lk->held;
+  }
+  release(&sleeplocks_lock);
+}
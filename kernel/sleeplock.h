@@ -6,5 +6,12 @@ struct sleeplock {
   // For debugging:
   char *name;        // Name of lock.
   int pid;           // Process holding lock
+
+  // For contention statistics, protected by lk:
+  uint n;            // Number of acquiresleep() calls.
+  uint nwait;        // Number of those that had to sleep.
+  uint64 acquired;   // r_time() when last acquired.
+  uint64 held;       // Total time held.
+  struct sleeplock *next;  // Next in the list of all sleep locks.
 };
 
@@ -8,12 +8,59 @@
 #include "proc.h"
 #include "defs.h"
 
+// Every initialized lock is recorded in locks[] so that
+// statslock() can report contention, as long as there is
+// room; locks of objects allocated at run time may not be.
+// lock_locks is never passed to initlock(); its zeroed state
+// is a free lock.
+#define NLOCK 1000
+
+static struct spinlock lock_locks;
+static struct spinlock *locks[NLOCK];
+
+static void
+findslot(struct spinlock *lk)
+{
+  int i;
+
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if(locks[i] == 0){
+      locks[i] = lk;
+      release(&lock_locks);
+      return;
+    }
+  }
+  release(&lock_locks);
+}
+
 void
 initlock(struct spinlock *lk, char *name)
 {
   lk->name = name;
-  lk->locked = 0;
+  lk->next = 0;
+  lk->owner = 0;
   lk->cpu = 0;
+  lk->n = 0;
+  lk->nts = 0;
+  lk->held = 0;
+  findslot(lk);
+}
+
+// Forget a lock whose memory is about to be freed.
+void
+freelock(struct spinlock *lk)
+{
+  int i;
+
+  acquire(&lock_locks);
+  for(i = 0; i < NLOCK; i++){
+    if(locks[i] == lk){
+      locks[i] = 0;
+      break;
+    }
+  }
+  release(&lock_locks);
 }
 
 // Acquire the lock.
@@ -21,16 +68,25 @@ initlock(struct spinlock *lk, char *name)
 void
 acquire(struct spinlock *lk)
 {
+  uint ticket, spins;
+
   push_off(); // disable interrupts to avoid deadlock.
   if(holding(lk))
     panic("acquire");
 
-  // On RISC-V, sync_lock_test_and_set turns into an atomic swap:
+  // On RISC-V, sync_fetch_and_add turns into an atomic add:
   //   a5 = 1
-  //   s1 = &lk->locked
-  //   amoswap.w.aq a5, a5, (s1)
-  while(__sync_lock_test_and_set(&lk->locked, 1) != 0)
-    ;
+  //   s1 = &lk->next
+  //   amoadd.w.aqrl a5, a5, (s1)
+  // Waiters then only read owner, so the line is shared among
+  // them until release() writes it.
+  ticket = __sync_fetch_and_add(&lk->next, 1);
+  spins = 0;
+  while(__atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE) != ticket){
+    // the holder may be waiting in smpcall() for this CPU.
+    ipirecv();
+    spins++;
+  }
 
   // Tell the C compiler and the processor to not move loads or stores
   // past this point, to ensure that the critical section's memory
@@ -39,7 +95,34 @@ acquire(struct spinlock *lk)
   __sync_synchronize();
 
   // Record info about lock acquisition for holding() and debugging.
+  // The counters are only written by the holder, so spinning
+  // CPUs don't write the lock's cache line.
   lk->cpu = mycpu();
+  lk->n++;
+  lk->nts += spins;
+  lk->acquired = r_cycle();
+}
+
+// Acquire the lock if no one holds it or waits for it, and
+// return 1; otherwise return 0 at once.
+int
+tryacquire(struct spinlock *lk)
+{
+  uint t;
+
+  push_off();
+  if(holding(lk))
+    panic("tryacquire");
+  t = __atomic_load_n(&lk->owner, __ATOMIC_ACQUIRE);
+  if(!__sync_bool_compare_and_swap(&lk->next, t, t + 1)){
+    pop_off();
+    return 0;
+  }
+  __sync_synchronize();
+  lk->cpu = mycpu();
+  lk->n++;
+  lk->acquired = r_cycle();
+  return 1;
 }
 
 // Release the lock.
@@ -49,6 +132,9 @@ release(struct spinlock *lk)
   if(!holding(lk))
     panic("release");
 
+  // Interrupts have been off since acquire(), so this is
+  // still the CPU whose cycle counter started the interval.
+  lk->held += r_cycle() - lk->acquired;
   lk->cpu = 0;
 
   // Tell the C compiler and the CPU to not move loads or stores
@@ -59,14 +145,10 @@ release(struct spinlock *lk)
   // On RISC-V, this emits a fence instruction.
   __sync_synchronize();
 
-  // Release the lock, equivalent to lk->locked = 0.
-  // This code doesn't use a C assignment, since the C standard
-  // implies that an assignment might be implemented with
-  // multiple store instructions.
-  // On RISC-V, sync_lock_release turns into an atomic swap:
-  //   s1 = &lk->locked
-  //   amoswap.w zero, zero, (s1)
-  __sync_lock_release(&lk->locked);
+  // Release the lock by serving the next ticket.  Only the
+  // holder writes owner, so a plain increment suffices, but
+  // it must be a single store with release ordering.
+  __atomic_store_n(&lk->owner, lk->owner + 1, __ATOMIC_RELEASE);
 
   pop_off();
 }
@@ -77,7 +159,20 @@ int
 holding(struct spinlock *lk)
 {
   int r;
-  r = (lk->locked && lk->cpu == mycpu());
+  r = (lk->owner != lk->next && lk->cpu == mycpu());
+  return r;
+}
+
+// Check whether this cpu is holding any spinlock, and so
+// whether the caller must not sleep.
+int
+holdingany(void)
+{
+  int r;
+
+  push_off();
+  r = mycpu()->noff > 1;
+  pop_off();
   return r;
 }
 
@@ -108,3 +203,193 @@ pop_off(void)
   if(c->noff == 0 && c->intena)
     intr_on();
 }
+
+static int
+snprint_lock(char *buf, int sz, struct spinlock *lk)
+{
+  int n = 0;
+
+  if(lk->n > 0){
+    n = snprintf(buf, sz, "lock: %s: #test-and-set %d #acquire() %d\n",
+                 lk->name, lk->nts, lk->n);
+  }
+  return n;
+}
+
+static int
+isstatlock(struct spinlock *lk)
+{
+  return strncmp(lk->name, "bcache", strlen("bcache")) == 0 ||
+    strncmp(lk->name, "kmem", strlen("kmem")) == 0;
+}
+
+// Find the class for locks called name in cls[0..*ncls),
+// adding it if there is room.
+struct lockclass*
+lockclass(struct lockclass *cls, int *ncls, int max, char *name, int sleep)
+{
+  struct lockclass *c;
+
+  for(c = cls; c < cls + *ncls; c++)
+    if(c->sleep == sleep && strncmp(c->name, name, 32) == 0)
+      return c;
+  if(*ncls == max)
+    return 0;
+  c = &cls[(*ncls)++];
+  memset(c, 0, sizeof(*c));
+  c->name = name;
+  c->sleep = sleep;
+  return c;
+}
+
+// Print the lock classes, spin and sleep, that were waited
+// for most, with the mean time each acquisition held them.
+static int
+statslockclass(char *buf, int sz)
+{
+  enum { NCLASS = 64, NTOP = 10 };
+  static struct lockclass cls[NCLASS];
+  struct lockclass *c, tmp;
+  struct spinlock *lk;
+  int i, j, n, ncls;
+
+  ncls = 0;
+  for(i = 0; i < NLOCK; i++){
+    if((lk = locks[i]) == 0 || lk->n == 0)
+      continue;
+    if((c = lockclass(cls, &ncls, NCLASS, lk->name, 0)) == 0)
+      continue;
+    c->n += lk->n;
+    c->nwait += lk->nts;
+    c->held += lk->held;
+  }
+  statssleeplock(cls, &ncls, NCLASS);
+
+  // Selection sort of the first NTOP by decreasing nwait.
+  for(i = 0; i < NTOP && i < ncls; i++){
+    for(j = i+1; j < ncls; j++){
+      if(cls[j].nwait > cls[i].nwait){
+        tmp = cls[i];
+        cls[i] = cls[j];
+        cls[j] = tmp;
+      }
+    }
+  }
+
+  n = snprintf(buf, sz, "--- top %d lock classes: waits, acquires, mean hold (%s)\n",
+               NTOP, "cycles; sleep locks in timer units");
+  for(i = 0; i < NTOP && i < ncls; i++){
+    c = &cls[i];
+    n += snprintf(buf+n, sz-n, "%s%s: %l %l %l\n", c->name,
+                  c->sleep ? " (sleep)" : "", c->nwait, c->n, c->held / c->n);
+  }
+  return n;
+}
+
+// Print contention counts of the buffer cache and allocator
+// locks, then the most contended locks overall and by name.
+// kalloctest and bcachetest look for the first '=', in tot=.
+int
+statslock(char *buf, int sz)
+{
+  enum { NTOP = 5 };
+  struct spinlock *top[NTOP];
+  struct spinlock *lk;
+  int i, j, n, tot;
+
+  n = 0;
+  tot = 0;
+  acquire(&lock_locks);
+  n += snprintf(buf+n, sz-n, "--- lock kmem/bcache stats\n");
+  for(i = 0; i < NLOCK; i++){
+    if((lk = locks[i]) == 0)
+      continue;
+    if(isstatlock(lk)){
+      tot += lk->nts;
+      n += snprint_lock(buf+n, sz-n, lk);
+    }
+  }
+
+  // Keep top[] sorted by decreasing nts.
+  memset(top, 0, sizeof(top));
+  for(i = 0; i < NLOCK; i++){
+    if((lk = locks[i]) == 0)
+      continue;
+    for(j = NTOP; j > 0 && (top[j-1] == 0 || top[j-1]->nts < lk->nts); j--){
+      if(j < NTOP)
+        top[j] = top[j-1];
+    }
+    if(j < NTOP)
+      top[j] = lk;
+  }
+  n += snprintf(buf+n, sz-n, "--- top %d contended locks:\n", NTOP);
+  for(i = 0; i < NTOP && top[i] != 0; i++)
+    n += snprint_lock(buf+n, sz-n, top[i]);
+
+  n += snprintf(buf+n, sz-n, "tot= %d\n", tot);
+  n += statslockclass(buf+n, sz-n);
+  release(&lock_locks);
+  return n;
+}
+
+#ifdef LOCKBENCH
+// Boot-time lock benchmark, built with make LOCKBENCH=1.  Every
+// CPU calls lockbench() before entering the scheduler.  CPU 0
+// waits for the rest to arrive, then they all hammer one lock
+// for a while and CPU 0 prints each CPU's share of the
+// acquisitions, which a fair lock keeps about equal.
+#define BENCHTIME 1000000   // r_time() units, about 0.1 seconds
+
+static struct spinlock benchlock;
+static volatile int benchgo, benchdone;
+static int benchcpus;
+static uint64 benchcount[NCPU];
+static uint64 benchtotal;
+
+void
+lockbench(void)
+{
+  uint64 end, n;
+  int id = cpuid(), i;
+
+  if(id == 0){
+    initlock(&benchlock, "bench");
+    __sync_fetch_and_add(&benchcpus, 1);
+    end = r_time() + BENCHTIME;
+    while(r_time() < end)  // let the other CPUs check in
+      ;
+    __sync_synchronize();
+    benchgo = 1;
+  } else {
+    __sync_fetch_and_add(&benchcpus, 1);
+    while(benchgo == 0)
+      ;
+  }
+  __sync_synchronize();
+
+  end = r_time() + BENCHTIME;
+  for(n = 0; r_time() < end; n++){
+    acquire(&benchlock);
+    benchtotal++;
+    release(&benchlock);
+  }
+  benchcount[id] = n;
+  __sync_fetch_and_add(&benchdone, 1);
+
+  if(id != 0)
+    return;
+  while(benchdone < benchcpus)
+    ;
+  __sync_synchronize();
+  n = 0;
+  for(i = 0; i < NCPU; i++)
+    n += benchcount[i];
+  printf("lockbench: %d cpus, %d acquires, %d spins, %d cycles held each\n",
+         benchcpus, (int)n, benchlock.nts, (int)(benchlock.held / n));
+  for(i = 0; i < benchcpus; i++)
+    printf("lockbench: cpu %d: %d\n", i, (int)benchcount[i]);
+  if(benchtotal != n)
+    panic("lockbench");
+  freelock(&benchlock);
+}
+#endif
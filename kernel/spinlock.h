@@ -1,9 +1,36 @@
-// Mutual exclusion lock.
+// Mutual exclusion lock.  A ticket lock: acquire() takes the
+// next ticket and waits until owner reaches it, so CPUs get the
+// lock in the order they asked for it.  Held while owner != next;
+// a zeroed lock is free.
 struct spinlock {
-  uint locked;       // Is the lock held?
+  uint next;         // Next ticket to hand out.
+  uint owner;        // Ticket that holds the lock.
 
   // For debugging:
   char *name;        // Name of lock.
   struct cpu *cpu;   // The cpu holding the lock.
+
+  // For contention statistics:
+  uint n;            // Number of acquire() calls.
+  uint nts;          // Number of failed test-and-set attempts.
+  uint64 acquired;   // r_cycle() when last acquired.
+  uint64 held;       // Total cycles held.
+};
+
+// Totals over all the locks that share a name, for statslock().
+struct lockclass {
+  char *name;
+  int sleep;         // Sleep locks, timed with r_time()?
+  uint64 n;          // Acquisitions.
+  uint64 nwait;      // Failed test-and-sets, or acquisitions that slept.
+  uint64 held;       // Total time held.
 };
 
+
+// A call rcucall() defers past a grace period, kept in the
+// object the call frees.
+struct rcuhead {
+  struct rcuhead *next;
+  void (*fn)(void*);
+  void *arg;
+};
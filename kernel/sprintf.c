@@ -0,0 +1,104 @@
+// Formatted output into a kernel buffer, for /statistics and
+// other reports that are read by user programs.
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+static char digits[] = "0123456789abcdef";
+
+// Append c to buf if there is room; return the number of bytes added.
+static int
+sputc(char *buf, int sz, int off, char c)
+{
+  if(off >= sz)
+    return 0;
+  buf[off] = c;
+  return 1;
+}
+
+static int
+sprintint(char *buf, int sz, int off, long xx, int base, int sign)
+{
+  char tmp[24];
+  int i, n;
+  uint64 x;
+
+  if(sign && (sign = xx < 0))
+    x = -xx;
+  else
+    x = xx;
+
+  i = 0;
+  do {
+    tmp[i++] = digits[x % base];
+  } while((x /= base) != 0);
+
+  if(sign)
+    tmp[i++] = '-';
+
+  n = 0;
+  while(--i >= 0)
+    n += sputc(buf, sz, off+n, tmp[i]);
+  return n;
+}
+
+// Print to buf, which holds sz bytes.  Understands %d, %l, %x,
+// %s and %%.  Returns the number of bytes written; the output
+// is not NUL-terminated.
+int
+snprintf(char *buf, int sz, char *fmt, ...)
+{
+  va_list ap;
+  int i, c;
+  int off = 0;
+  char *s;
+
+  if (fmt == 0)
+    panic("null fmt");
+
+  va_start(ap, fmt);
+  for(i = 0; off < sz && (c = fmt[i] & 0xff) != 0; i++){
+    if(c != '%'){
+      off += sputc(buf, sz, off, c);
+      continue;
+    }
+    c = fmt[++i] & 0xff;
+    if(c == 0)
+      break;
+    switch(c){
+    case 'd':
+      off += sprintint(buf, sz, off, va_arg(ap, int), 10, 1);
+      break;
+    case 'l':
+      off += sprintint(buf, sz, off, va_arg(ap, uint64), 10, 0);
+      break;
+    case 'x':
+      off += sprintint(buf, sz, off, va_arg(ap, uint), 16, 0);
+      break;
+    case 's':
+      if((s = va_arg(ap, char*)) == 0)
+        s = "(null)";
+      for(; *s && off < sz; s++)
+        off += sputc(buf, sz, off, *s);
+      break;
+    case '%':
+      off += sputc(buf, sz, off, '%');
+      break;
+    default:
+      // Print unknown % sequence to draw attention.
+      off += sputc(buf, sz, off, '%');
+      off += sputc(buf, sz, off, c);
+      break;
+    }
+  }
+  va_end(ap);
+  return off;
+}
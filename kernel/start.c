@@ -11,11 +11,14 @@ void timerinit();
 __attribute__ ((aligned (16))) char stack0[4096 * NCPU];
 
 // a scratch area per CPU for machine-mode timer interrupts.
-uint64 timer_scratch[NCPU][5];
+uint64 timer_scratch[NCPU][7];
 
-// assembly code in kernelvec.S for machine-mode timer interrupt.
+// assembly code in kernelvec.S for machine-mode timer
+// and software interrupts.
 extern void timervec();
 
+extern int perfhpm;
+
 // entry.S jumps here in machine mode on stack0.
 void
 start()
@@ -43,6 +46,22 @@ start()
   w_pmpaddr0(0x3fffffffffffffull);
   w_pmpcfg0(0xf);
 
+  // let supervisor mode read the cycle, time and instret
+  // counters, for system call latencies.
+  w_mcounteren(r_mcounteren() | 0x7);
+  // point hpmcounter3..5 at TLB misses for perf.c, with the
+  // SBI PMU's event codes, if this QEMU can count them: an
+  // event a counter can't count reads back as 0.
+  w_mhpmevent3(0x10019);  // data TLB read miss
+  w_mhpmevent4(0x1001b);  // data TLB write miss
+  w_mhpmevent5(0x10021);  // instruction TLB miss
+  if(r_mhpmevent3() == 0x10019){
+    perfhpm = 1;
+    w_mcounteren(r_mcounteren() | 0x38);
+  }
+  // and user mode the time counter, for rdtime().
+  w_scounteren(r_scounteren() | 0x2);
+
   // ask for clock interrupts.
   timerinit();
 
@@ -64,17 +83,21 @@ timerinit()
   // each CPU has a separate source of timer interrupts.
   int id = r_mhartid();
 
-  // ask the CLINT for a timer interrupt.
-  int interval = 1000000; // cycles; about 1/10th second in qemu.
-  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + interval;
+  // ask the CLINT for a timer interrupt.  After this,
+  // timerinithart() in supervisor mode programs MTIMECMP.
+  *(uint64*)CLINT_MTIMECMP(id) = *(uint64*)CLINT_MTIME + TICKINTERVAL;
 
   // prepare information in scratch[] for timervec.
   // scratch[0..2] : space for timervec to save registers.
   // scratch[3] : address of CLINT MTIMECMP register.
-  // scratch[4] : desired interval (in cycles) between timer interrupts.
+  // scratch[4] : unused.
+  // scratch[5] : address of CLINT MSIP register.
+  // scratch[6] : set by timervec when it forwards a timer interrupt.
   uint64 *scratch = &timer_scratch[id][0];
   scratch[3] = CLINT_MTIMECMP(id);
-  scratch[4] = interval;
+  scratch[4] = 0;
+  scratch[5] = CLINT_MSIP(id);
+  scratch[6] = 0;
   w_mscratch((uint64)scratch);
 
   // set the machine-mode trap handler.
@@ -83,6 +106,16 @@ timerinit()
   // enable machine-mode interrupts.
   w_mstatus(r_mstatus() | MSTATUS_MIE);
 
-  // enable machine-mode timer interrupts.
-  w_mie(r_mie() | MIE_MTIE);
+  // enable machine-mode timer interrupts, and software
+  // interrupts from other CPUs' ipi().
+  w_mie(r_mie() | MIE_MTIE | MIE_MSIE);
+}
+
+// Called in supervisor mode by devintr(): was the software
+// interrupt just taken forwarded from a timer interrupt,
+// rather than from another CPU's ipi()?
+int
+timertick(void)
+{
+  return __sync_lock_test_and_set(&timer_scratch[cpuid()][6], 0);
 }
@@ -0,0 +1,142 @@
+// The statistics device.  Reading it returns a text report
+// of kernel counters, built when a read starts at offset 0
+// and handed out in pieces until the reader reaches the end.
+// The procs device works the same way, with a line for each
+// process after the memory, buffer and page cache, swap and log
+// counters.
+
+#include <stdarg.h>
+
+#include "types.h"
+#include "param.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "riscv.h"
+#include "defs.h"
+
+#define BUFSZ 8192
+#define PROCSBUFSZ (NPROC*128)
+
+struct report {
+  struct spinlock lock;
+  char *buf;
+  int bufsz;
+  int sz;
+  int off;
+  int (*build)(char*, int);
+};
+
+static char statsbuf[BUFSZ];
+static char procsbuf[PROCSBUFSZ];
+static struct report stats, procs;
+
+static int
+statsbuild(char *buf, int sz)
+{
+  int n;
+
+  n = statsboot(buf, sz);
+  n += statslock(buf+n, sz-n);
+  n += statslog(buf+n, sz-n);
+  n += statsfs(buf+n, sz-n);
+  n += statsblk(buf+n, sz-n);
+  n += statsmem(buf+n, sz-n);
+  n += statsbcache(buf+n, sz-n);
+  n += statspcache(buf+n, sz-n);
+  n += statsswap(buf+n, sz-n);
+  n += statsrcu(buf+n, sz-n);
+  n += statstmp(buf+n, sz-n);
+#ifdef KSM
+  n += statsksm(buf+n, sz-n);
+#endif
+  n += statssyscall(buf+n, sz-n);
+  n += statskmcache(buf+n, sz-n);
+  n += statsprof(buf+n, sz-n);
+  return n;
+}
+
+static int
+procsbuild(char *buf, int sz)
+{
+  int n;
+
+  n = statsmem(buf, sz);
+  n += statsbcache(buf+n, sz-n);
+  n += statspcache(buf+n, sz-n);
+  n += statsswap(buf+n, sz-n);
+  n += statslog(buf+n, sz-n);
+  n += statsproc(buf+n, sz-n);
+  return n;
+}
+
+static int
+reportread(struct report *r, int user_dst, uint64 dst, int n)
+{
+  int m;
+
+  // either_copyout() under r->lock can't wait for a file's page.
+  if(user_dst)
+    uvmprefault(dst, n, 1);
+  acquire(&r->lock);
+
+  if(r->sz == 0)
+    r->sz = r->build(r->buf, r->bufsz);
+  m = r->sz - r->off;
+
+  if (m > 0) {
+    if(m > n)
+      m  = n;
+    if(either_copyout(user_dst, dst, r->buf+r->off, m) != -1) {
+      r->off += m;
+    }
+  } else {
+    // End of report; the next read starts a fresh one.
+    m = 0;
+    r->sz = 0;
+    r->off = 0;
+  }
+  release(&r->lock);
+  return m;
+}
+
+int
+statswrite(int user_src, uint64 src, int n)
+{
+  return -1;
+}
+
+int
+statsread(int user_dst, uint64 dst, int n)
+{
+  return reportread(&stats, user_dst, dst, n);
+}
+
+int
+procsread(int user_dst, uint64 dst, int n)
+{
+  return reportread(&procs, user_dst, dst, n);
+}
+
+static void
+reportinit(struct report *r, char *name, char *buf, int bufsz,
+           int (*build)(char*, int))
+{
+  initlock(&r->lock, name);
+  r->buf = buf;
+  r->bufsz = bufsz;
+  r->build = build;
+}
+
+void
+statsinit(void)
+{
+  reportinit(&stats, "stats", statsbuf, BUFSZ, statsbuild);
+  reportinit(&procs, "procs", procsbuf, PROCSBUFSZ, procsbuild);
+
+  devsw[STATS].read = statsread;
+  devsw[STATS].write = statswrite;
+  devsw[PROCS].read = procsread;
+  devsw[PROCS].write = statswrite;
+}
@@ -1,13 +1,32 @@
 #include "types.h"
 
+// The mem* routines below move 8-byte words once the
+// addresses allow aligned accesses, and bytes otherwise;
+// RISC-V need not support misaligned loads and stores.
+// word may alias any object that memset/memmove touch.
+typedef uint64 __attribute__((__may_alias__)) word;
+
+#define WSIZE sizeof(word)
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w;
+
+  if(n >= 2*WSIZE){
+    for(; !WALIGNED(cdst); n--)
+      *cdst++ = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    for(; n >= WSIZE; n -= WSIZE, cdst += WSIZE)
+      *(word*)cdst = w;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -18,6 +37,14 @@ memcmp(const void *v1, const void *v2, uint n)
 
   s1 = v1;
   s2 = v2;
+  if(n >= 2*WSIZE && ((uint64)s1 & (WSIZE-1)) == ((uint64)s2 & (WSIZE-1))){
+    for(; !WALIGNED(s1); n--, s1++, s2++)
+      if(*s1 != *s2)
+        return *s1 - *s2;
+    // skip equal words; the byte loop finds the difference.
+    for(; n >= WSIZE && *(word*)s1 == *(word*)s2; n -= WSIZE)
+      s1 += WSIZE, s2 += WSIZE;
+  }
   while(n-- > 0){
     if(*s1 != *s2)
       return *s1 - *s2;
@@ -32,6 +59,9 @@ memmove(void *dst, const void *src, uint n)
 {
   const char *s;
   char *d;
+  const word *sw;
+  word lo, hi;
+  int sh;
 
   if(n == 0)
     return dst;
@@ -41,11 +71,41 @@ memmove(void *dst, const void *src, uint n)
   if(s < d && s + n > d){
     s += n;
     d += n;
+    if(n >= 2*WSIZE && ((uint64)s & (WSIZE-1)) == ((uint64)d & (WSIZE-1))){
+      for(; !WALIGNED(d); n--)
+        *--d = *--s;
+      for(; n >= WSIZE; n -= WSIZE){
+        s -= WSIZE;
+        d -= WSIZE;
+        *(word*)d = *(word*)s;
+      }
+    }
     while(n-- > 0)
       *--d = *--s;
-  } else
+  } else {
+    if(n >= 2*WSIZE){
+      for(; !WALIGNED(d); n--)
+        *d++ = *s++;
+      if(WALIGNED(s)){
+        for(; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE)
+          *(word*)d = *(word*)s;
+      } else {
+        // s is misaligned: assemble each word from the two
+        // aligned (little-endian) words it straddles.  These
+        // reads stay within the words holding src's bytes.
+        sh = ((uint64)s & (WSIZE-1)) * 8;
+        sw = (const word*)(s - sh/8);
+        lo = *sw++;
+        for(; n >= WSIZE; n -= WSIZE, d += WSIZE, s += WSIZE){
+          hi = *sw++;
+          *(word*)d = (lo >> sh) | (hi << (64 - sh));
+          lo = hi;
+        }
+      }
+    }
     while(n-- > 0)
       *d++ = *s++;
+  }
 
   return dst;
 }
@@ -95,6 +155,29 @@ safestrcpy(char *s, const char *t, int n)
   return os;
 }
 
+// The length of s, or n if s has no NUL in its first n bytes.
+// Tests a word at a time once s is aligned; aligned words
+// don't cross a page, so the reads past a NUL are harmless.
+int
+strnlen(const char *s, uint n)
+{
+  const word ones = 0x0101010101010101ULL;
+  const char *p;
+  word w;
+
+  for(p = s; n > 0 && !WALIGNED(p); n--, p++)
+    if(*p == 0)
+      return p - s;
+  for(; n >= WSIZE; n -= WSIZE, p += WSIZE){
+    w = *(word*)p;
+    if((w - ones) & ~w & (ones << 7))
+      break;  // a zero byte
+  }
+  for(; n > 0 && *p; n--, p++)
+    ;
+  return p - s;
+}
+
 int
 strlen(const char *s)
 {
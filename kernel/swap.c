@@ -0,0 +1,468 @@
+// Page reclaim and swap.
+//
+// When free memory runs low, reclaim() frees pages: first the
+// page cache's clean ones that no one maps, through pcshrink(),
+// then user processes' pages that haven't been used lately,
+// which it writes to the swap area that mkfs leaves between
+// the free bit map and the data blocks.  The reclaimer kernel
+// thread runs it every tick that fewer than RECLAIMLOW pages
+// are free, until RECLAIMHIGH are; a page fault that finds
+// none free runs it too, since kalloc() can't sleep.  The
+// buffer cache is a fixed array and has nothing to give back.
+//
+// Pages are picked by a clock that goes round all processes'
+// page tables: the hand clears the accessed bit (PTE_A) of a
+// page that has it, and takes a page that still hasn't when
+// the hand comes round again.  Only pages that one process
+// alone maps are taken, not ones shared copy-on-write, the
+// page cache's, or a MAP_SHARED mapping's.  A taken page's PTE
+// loses PTE_V, gains PTE_SWAP and holds its swap slot in place
+// of the physical page number, and keeps the permissions for
+// swapin(), which uvmfault() calls on the next touch.
+//
+// Slots are reference counted like pages, since fork() copies
+// a swapped-out PTE as it is; each copy reads back a private
+// page.  A slot that is still being written has its page in
+// slot.pa, for swapin() to copy instead of waiting.
+//
+// copyin() and copyout() use a process's pages by physical
+// address, and futexwait() sleeps on one; a process's npinned
+// counts them, and a scan that finds it non-zero afterwards
+// puts back what it took.  A process that vfork() lent its
+// memory is pinned until the child is done with it.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "proc.h"
+#include "fs.h"
+#include "buf.h"
+#include "fcntl.h"
+#include "defs.h"
+
+#define SLOTBLOCKS (PGSIZE/BSIZE)       // disk blocks per slot
+#define NSLOT (SWAPSIZE/SLOTBLOCKS)     // most slots used
+#define NSWAPBATCH 16  // pages written out together
+#define NSCAN 512      // PTEs one scan looks at, holding locks
+#define NSWAPIO 4      // swap-ins that may sleep, reading at once
+
+extern struct proc proc[NPROC];
+
+struct slot {
+  ushort ref;             // PTEs, and reads and writes under way
+  char *pa;               // page being written to the slot, or 0
+};
+
+static struct {
+  struct spinlock lock;
+  int dev;
+  uint start;             // first block of the swap area
+  int nslot;
+  int nused;
+  int next;               // where slotalloc() looks first
+  struct slot slot[NSLOT];
+  struct buf io[NSWAPIO][SLOTBLOCKS];   // for reads that sleep
+  int iobusy[NSWAPIO];
+  struct buf spinio[NCPU][SLOTBLOCKS];  // and for those that can't
+
+  // Statistics.
+  uint nout;              // pages written out
+  uint nin;               // and read back
+} swap;
+
+static struct {
+  struct sleeplock lock;  // one reclaim() at a time
+  int hand;               // proc[] index of the clock hand
+  uint64 va;              // and where it is in that memory
+  struct buf io[NSWAPBATCH*SLOTBLOCKS];
+  uint nfreed;            // by reclaim(), for statistics
+} rc;
+
+// Pages one scan took out of a page table, to write out.
+struct batch {
+  int n;
+  uint64 va[NSWAPBATCH];
+  pte_t old[NSWAPBATCH];  // the PTEs they had
+  int slot[NSWAPBATCH];
+};
+
+static void reclaimer(void);
+
+void
+swapinit(int dev, uint start, uint nblocks)
+{
+  initlock(&swap.lock, "swap");
+  initsleeplock(&rc.lock, "reclaim");
+  swap.dev = dev;
+  swap.start = start;
+  swap.nslot = nblocks / SLOTBLOCKS;
+  if(swap.nslot > NSLOT)
+    swap.nslot = NSLOT;
+  kthread("reclaim", reclaimer);
+}
+
+// Allocate a slot for the page at pa, which is about to be
+// written to it, with references for its PTE and the write.
+// Returns -1 if the swap area is full.
+// Caller must hold swap.lock.
+static int
+slotalloc(char *pa)
+{
+  int i, s;
+
+  for(i = 0; i < swap.nslot; i++){
+    s = (swap.next + i) % swap.nslot;
+    if(swap.slot[s].ref == 0){
+      swap.slot[s].ref = 2;
+      swap.slot[s].pa = pa;
+      swap.next = s + 1;
+      swap.nused++;
+      return s;
+    }
+  }
+  return -1;
+}
+
+// Caller must hold swap.lock.
+static void
+slotput(int s)
+{
+  if(swap.slot[s].ref < 1)
+    panic("slotput");
+  if(--swap.slot[s].ref == 0)
+    swap.nused--;
+}
+
+// fork() has copied a PTE for slot s.
+void
+swapdup(uint s)
+{
+  acquire(&swap.lock);
+  swap.slot[s].ref++;
+  release(&swap.lock);
+}
+
+// A page table no longer has a PTE for slot s.
+void
+swapfree(uint s)
+{
+  acquire(&swap.lock);
+  slotput(s);
+  release(&swap.lock);
+}
+
+// Read slot s into mem.  Sleeps for the disk, unless the caller
+// holds a spinlock, when it polls instead.
+static void
+swapread(int s, char *mem)
+{
+  struct buf *bufs[SLOTBLOCKS], *b;
+  int i, io, spin;
+
+  spin = holdingany();
+  acquire(&swap.lock);
+  if(swap.slot[s].pa){
+    // still being written out.
+    memmove(mem, swap.slot[s].pa, PGSIZE);
+    release(&swap.lock);
+    return;
+  }
+  io = -1;
+  if(spin){
+    // interrupts are off, so nothing else on this CPU reads.
+    b = swap.spinio[cpuid()];
+  } else {
+    for(;;){
+      for(io = 0; io < NSWAPIO && swap.iobusy[io]; io++)
+        ;
+      if(io < NSWAPIO)
+        break;
+      sleep(swap.iobusy, &swap.lock);
+    }
+    swap.iobusy[io] = 1;
+    b = swap.io[io];
+  }
+  swap.nin++;
+  release(&swap.lock);
+
+  for(i = 0; i < SLOTBLOCKS; i++){
+    b[i].dev = swap.dev;
+    b[i].blockno = swap.start + s*SLOTBLOCKS + i;
+    bufs[i] = &b[i];
+  }
+  blksubmit(bufs, SLOTBLOCKS, 0);
+  for(i = 0; i < SLOTBLOCKS; i++){
+    if(spin)
+      blkspin(bufs[i]);
+    else
+      blkwait(bufs[i], IO_READ);
+    memmove(mem + i*BSIZE, b[i].data, BSIZE);
+  }
+
+  if(io >= 0){
+    acquire(&swap.lock);
+    swap.iobusy[io] = 0;
+    wakeup(swap.iobusy);
+    release(&swap.lock);
+  }
+}
+
+// Bring back g's swapped-out page at va, for uvmfault().
+// Returns 0 if g can retry the access, -1 if memory is
+// exhausted.
+int
+swapin(struct proc *g, uint64 va)
+{
+  pte_t *pte, old;
+  char *mem;
+  int s;
+
+  acquire(&g->slock);
+  pte = walk(g->pagetable, va, 0);
+  if(pte == 0 || (*pte & PTE_SWAP) == 0){
+    // another thread has brought it back.
+    release(&g->slock);
+    return 0;
+  }
+  old = *pte;
+  s = PTE2SLOT(old);
+  // so that s isn't reused while we read it.
+  swapdup(s);
+  release(&g->slock);
+
+  if((mem = kalloc()) == 0){
+    swapfree(s);
+    return -1;
+  }
+  swapread(s, mem);
+
+  acquire(&g->slock);
+  pte = walk(g->pagetable, va, 0);
+  if(pte && *pte == old){
+    *pte = PA2PTE(mem) | (PTE_FLAGS(old) & ~PTE_SWAP) | PTE_V;
+    swapfree(s);
+    mem = 0;
+  }
+  release(&g->slock);
+  swapfree(s);
+  if(mem)
+    kfree(mem);
+  return 0;
+}
+
+// Move the clock hand over up to NSCAN of g's pages from
+// rc.va: clear the accessed bit of each that has it, and take
+// each that hasn't and that only g maps out of g's page table,
+// into b, until b holds max.  Returns 1 if the hand has gone
+// past the end of g's memory.
+// Caller must hold g->lock and g->slock.
+static int
+swapscan(struct proc *g, struct batch *b, int max)
+{
+  pagetable_t pt;
+  pte_t *pte;
+  struct vma *v;
+  uint64 va, a, pa;
+  int nscan, s, flush;
+
+  flush = 0;
+  va = rc.va;
+  for(nscan = 0; va < MMAPTOP && nscan < NSCAN && b->n < max; ){
+    pte = &g->pagetable[PX(2, va)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va + LEVELSIZE(2)) & ~(LEVELSIZE(2) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(1, va)];
+    if((*pte & PTE_V) == 0 || PTE_LEAF(*pte)){
+      va = (va + LEVELSIZE(1)) & ~(LEVELSIZE(1) - 1);
+      continue;
+    }
+    pt = (pagetable_t)PTE2PA(*pte);
+    pte = &pt[PX(0, va)];
+    a = va;
+    va += PGSIZE;
+    nscan++;
+
+    if((*pte & (PTE_V|PTE_U)) != (PTE_V|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      // the hardware may be setting PTE_D.
+      __sync_fetch_and_and(pte, ~PTE_A);
+      flush = 1;
+      continue;
+    }
+    pa = PTE2PA(*pte);
+    if(kgetref((void*)pa) != 1)
+      continue;  // shared copy-on-write, or the page cache's
+    if((v = vmafind(g, a)) != 0 && (v->flags & MAP_SHARED))
+      continue;
+    acquire(&swap.lock);
+    s = slotalloc((char*)pa);
+    release(&swap.lock);
+    if(s < 0){
+      va = a;
+      break;
+    }
+    b->va[b->n] = a;
+    b->old[b->n] = *pte;
+    b->slot[b->n] = s;
+    b->n++;
+    *pte = SLOT2PTE(s) | (PTE_FLAGS(*pte) & (PTE_R|PTE_W|PTE_X|PTE_U|PTE_COW)) | PTE_SWAP;
+  }
+  // the other CPUs must stop using the pages before we copy
+  // them, and see the cleared bits.
+  if(flush || b->n > 0)
+    tlbshootdown(g, MAXVA, 0);
+  rc.va = va;
+  return va >= MMAPTOP;
+}
+
+// Put back the pages of b in g's page table, since the kernel
+// started using one of them while swapscan() was taking them.
+// Caller must hold g->slock.
+static void
+swapundo(struct proc *g, struct batch *b)
+{
+  int i;
+
+  acquire(&swap.lock);
+  for(i = 0; i < b->n; i++){
+    *walk(g->pagetable, b->va[i], 0) = b->old[i];
+    swap.slot[b->slot[i]].pa = 0;
+    slotput(b->slot[i]);
+    slotput(b->slot[i]);
+  }
+  release(&swap.lock);
+  b->n = 0;
+}
+
+// Write b's pages to their slots, then free them.
+// Returns how many were freed.
+static int
+swapwrite(struct batch *b)
+{
+  struct buf *bufs[NSWAPBATCH*SLOTBLOCKS], *bp;
+  char *pa;
+  int i, j, k;
+
+  k = 0;
+  for(i = 0; i < b->n; i++){
+    pa = (char*)PTE2PA(b->old[i]);
+    for(j = 0; j < SLOTBLOCKS; j++){
+      bp = &rc.io[k];
+      bp->dev = swap.dev;
+      bp->blockno = swap.start + b->slot[i]*SLOTBLOCKS + j;
+      memmove(bp->data, pa + j*BSIZE, BSIZE);
+      bufs[k++] = bp;
+    }
+  }
+  blksubmit(bufs, k, 1);
+  for(i = 0; i < k; i++)
+    blkwait(bufs[i], IO_WRITE);
+
+  acquire(&swap.lock);
+  for(i = 0; i < b->n; i++){
+    swap.slot[b->slot[i]].pa = 0;
+    slotput(b->slot[i]);
+  }
+  swap.nout += b->n;
+  release(&swap.lock);
+  for(i = 0; i < b->n; i++)
+    kfree((void*)PTE2PA(b->old[i]));
+  return b->n;
+}
+
+// Swap out up to want pages, going on round the processes
+// from where the clock hand is.  Gives up after two trips
+// round, since the first may only clear accessed bits.
+// Returns the number freed.
+// Caller must hold rc.lock.
+static int
+swapout(int want)
+{
+  struct batch b;
+  struct proc *g;
+  int n, done, left;
+
+  n = 0;
+  for(left = 2*NPROC; n < want && left > 0 && swap.nused < swap.nslot; ){
+    g = &proc[rc.hand];
+    b.n = 0;
+    done = 1;
+    acquire(&g->lock);
+    // freeproc() frees the page table with g->lock held.
+    if(g->state != UNUSED && g->state != USED && g->state != ZOMBIE &&
+       g->group == g && g->kthread == 0 && g->pagetable && g->npinned == 0){
+      acquire(&g->slock);
+      done = swapscan(g, &b, want - n < NSWAPBATCH ? want - n : NSWAPBATCH);
+      __sync_synchronize();
+      if(g->npinned)
+        swapundo(g, &b);
+      release(&g->slock);
+    }
+    release(&g->lock);
+    if(b.n > 0)
+      n += swapwrite(&b);
+    if(done){
+      rc.hand = (rc.hand + 1) % NPROC;
+      rc.va = 0;
+      left--;
+    }
+  }
+  return n;
+}
+
+// Free up to want pages: the page cache's first, then by
+// swapping.  May sleep, so the caller must hold no spinlock.
+// Returns the number freed.
+int
+reclaim(int want)
+{
+  int n, m;
+
+  acquiresleep(&rc.lock);
+  n = 0;
+  while(n < want && (m = pcshrink()) > 0)
+    n += m;
+  if(n < want)
+    n += swapout(want - n);
+  rc.nfreed += n;
+  releasesleep(&rc.lock);
+  return n;
+}
+
+// The reclaimer kernel thread: every tick that free memory
+// is below RECLAIMLOW, reclaim up to RECLAIMHIGH.
+static void
+reclaimer(void)
+{
+  int n;
+
+  for(;;){
+    sleepuntil(r_time() + TICKINTERVAL);
+    if((n = kfreepages()) < RECLAIMLOW)
+      reclaim(RECLAIMHIGH - n);
+  }
+}
+
+// Report the swap area's use and reclaim()'s work.
+int
+statsswap(char *buf, int sz)
+{
+  int nslot, nused;
+  uint nout, nin;
+
+  acquire(&swap.lock);
+  nslot = swap.nslot;
+  nused = swap.nused;
+  nout = swap.nout;
+  nin = swap.nin;
+  release(&swap.lock);
+  return snprintf(buf, sz, "swap: %d slots, %d used, %d out, %d in, %d reclaimed\n",
+                  nslot, nused, nout, nin, rc.nfreed);
+}
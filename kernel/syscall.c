@@ -12,7 +12,7 @@ int
 fetchaddr(uint64 addr, uint64 *ip)
 {
   struct proc *p = myproc();
-  if(addr >= p->sz || addr+sizeof(uint64) > p->sz)
+  if(addr >= p->group->sz || addr+sizeof(uint64) > p->group->sz)
     return -1;
   if(copyin(p->pagetable, (char *)ip, addr, sizeof(*ip)) != 0)
     return -1;
@@ -106,6 +106,30 @@ extern uint64 sys_write(void);
 extern uint64 sys_uptime(void);
 extern uint64 sys_sigalarm(void);
 extern uint64 sys_sigreturn(void);
+extern uint64 sys_splice(void);
+extern uint64 sys_trace(void);
+extern uint64 sys_usleep(void);
+extern uint64 sys_mmap(void);
+extern uint64 sys_munmap(void);
+extern uint64 sys_readv(void);
+extern uint64 sys_writev(void);
+extern uint64 sys_pread(void);
+extern uint64 sys_pwrite(void);
+extern uint64 sys_fcntl(void);
+extern uint64 sys_poll(void);
+extern uint64 sys_clone(void);
+extern uint64 sys_join(void);
+extern uint64 sys_futex_wait(void);
+extern uint64 sys_futex_wake(void);
+extern uint64 sys_setaffinity(void);
+extern uint64 sys_spawn(void);
+extern uint64 sys_vfork(void);
+extern uint64 sys_sync(void);
+extern uint64 sys_fsync(void);
+extern uint64 sys_mount(void);
+extern uint64 sys_execve(void);
+extern uint64 sys_perfopen(void);
+extern uint64 sys_perfread(void);
 
 static uint64 (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -131,20 +155,181 @@ static uint64 (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_sigalarm] sys_sigalarm,
 [SYS_sigreturn] sys_sigreturn,
+[SYS_splice]  sys_splice,
+[SYS_trace]   sys_trace,
+[SYS_usleep]  sys_usleep,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_fcntl]   sys_fcntl,
+[SYS_poll]    sys_poll,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_setaffinity] sys_setaffinity,
+[SYS_spawn]   sys_spawn,
+[SYS_vfork]   sys_vfork,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
+[SYS_mount]   sys_mount,
+[SYS_execve]  sys_execve,
+[SYS_perfopen] sys_perfopen,
+[SYS_perfread] sys_perfread,
 };
 
+static char *syscallnames[] = {
+[SYS_fork]    "fork",
+[SYS_exit]    "exit",
+[SYS_wait]    "wait",
+[SYS_pipe]    "pipe",
+[SYS_read]    "read",
+[SYS_kill]    "kill",
+[SYS_exec]    "exec",
+[SYS_fstat]   "fstat",
+[SYS_chdir]   "chdir",
+[SYS_dup]     "dup",
+[SYS_getpid]  "getpid",
+[SYS_sbrk]    "sbrk",
+[SYS_sleep]   "sleep",
+[SYS_uptime]  "uptime",
+[SYS_open]    "open",
+[SYS_write]   "write",
+[SYS_mknod]   "mknod",
+[SYS_unlink]  "unlink",
+[SYS_link]    "link",
+[SYS_mkdir]   "mkdir",
+[SYS_close]   "close",
+[SYS_sigalarm] "sigalarm",
+[SYS_sigreturn] "sigreturn",
+[SYS_splice]  "splice",
+[SYS_trace]   "trace",
+[SYS_usleep]  "usleep",
+[SYS_mmap]    "mmap",
+[SYS_munmap]  "munmap",
+[SYS_readv]   "readv",
+[SYS_writev]  "writev",
+[SYS_pread]   "pread",
+[SYS_pwrite]  "pwrite",
+[SYS_fcntl]   "fcntl",
+[SYS_poll]    "poll",
+[SYS_clone]   "clone",
+[SYS_join]    "join",
+[SYS_futex_wait] "futex_wait",
+[SYS_futex_wake] "futex_wake",
+[SYS_setaffinity] "setaffinity",
+[SYS_spawn]   "spawn",
+[SYS_vfork]   "vfork",
+[SYS_sync]    "sync",
+[SYS_fsync]   "fsync",
+[SYS_mount]   "mount",
+[SYS_execve]  "execve",
+[SYS_perfopen] "perfopen",
+[SYS_perfread] "perfread",
+};
+
+// Per-call counts and latencies, in cycles, for the statistics
+// device.  Bucket i of hist counts calls that took fewer than
+// 2^(i+HISTSHIFT) cycles but no fewer than half that; the first
+// and last buckets also take everything below and above.
+// Updated with atomic adds, so CPUs never wait on each other.
+#define NHIST     16
+#define HISTSHIFT 8
+
+static struct sysstat {
+  uint64 count;
+  uint64 cycles;
+  uint64 hist[NHIST];
+} sysstats[NELEM(syscalls)];
+
+static void
+sysrecord(int num, uint64 cycles)
+{
+  struct sysstat *st = &sysstats[num];
+  int i;
+
+  for(i = 0; i < NHIST-1 && (cycles >> (i+HISTSHIFT)) != 0; i++)
+    ;
+  __sync_fetch_and_add(&st->count, 1);
+  __sync_fetch_and_add(&st->cycles, cycles);
+  __sync_fetch_and_add(&st->hist[i], 1);
+}
+
+// The system calls that neither sleep nor touch user memory,
+// which usertrap() runs with interrupts still off.
+static char fastcalls[NELEM(syscalls)] = {
+[SYS_getpid]  1,
+[SYS_uptime]  1,
+};
+
+// Run the current process's system call, if it is one of the
+// fastcalls[] and isn't traced, and return 1; otherwise
+// return 0.
+int
+syscallfast(void)
+{
+  int num;
+  uint64 start;
+  struct proc *p = myproc();
+
+  num = p->trapframe->a7;
+  if(num <= 0 || num >= NELEM(syscalls) || !fastcalls[num] ||
+     (p->tracemask & (1L << num)))
+    return 0;
+  p->nsyscall++;
+  start = r_cycle();
+  p->trapframe->a0 = syscalls[num]();
+  sysrecord(num, r_cycle() - start);
+  return 1;
+}
+
 void
 syscall(void)
 {
   int num;
+  uint64 start;
   struct proc *p = myproc();
 
   num = p->trapframe->a7;
+  p->nsyscall++;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    start = r_cycle();
     p->trapframe->a0 = syscalls[num]();
+    // exit never gets here; a successful exec reports its argc.
+    sysrecord(num, r_cycle() - start);
+    if(p->tracemask & (1L << num))
+      printf("%d: syscall %s -> %d\n", p->pid, syscallnames[num],
+             (int)p->trapframe->a0);
   } else {
     printf("%d %s: unknown sys call %d\n",
             p->pid, p->name, num);
     p->trapframe->a0 = -1;
   }
 }
+
+// Report calls made, mean latency and the latency histogram
+// of each system call that has been used.
+int
+statssyscall(char *buf, int sz)
+{
+  struct sysstat *st;
+  uint64 count;
+  int num, i, n;
+
+  n = snprintf(buf, sz, "--- syscall count, mean cycles, histogram <2^%d..\n",
+               HISTSHIFT);
+  for(num = 1; num < NELEM(syscalls); num++){
+    st = &sysstats[num];
+    if((count = st->count) == 0)
+      continue;
+    n += snprintf(buf+n, sz-n, "%s: %l %l |", syscallnames[num],
+                  count, st->cycles / count);
+    for(i = 0; i < NHIST; i++)
+      n += snprintf(buf+n, sz-n, " %l", st->hist[i]);
+    n += snprintf(buf+n, sz-n, "\n");
+  }
+  return n;
+}
@@ -22,3 +22,27 @@
 #define SYS_close  21
 #define SYS_sigalarm 22
 #define SYS_sigreturn 23
+#define SYS_splice 24
+#define SYS_trace  25
+#define SYS_usleep 26
+#define SYS_mmap   27
+#define SYS_munmap 28
+#define SYS_readv  29
+#define SYS_writev 30
+#define SYS_pread  31
+#define SYS_pwrite 32
+#define SYS_fcntl  33
+#define SYS_poll   34
+#define SYS_clone  35
+#define SYS_join   36
+#define SYS_futex_wait 37
+#define SYS_futex_wake 38
+#define SYS_setaffinity 39
+#define SYS_spawn  40
+#define SYS_vfork  41
+#define SYS_sync   42
+#define SYS_fsync  43
+#define SYS_mount  44
+#define SYS_execve 45
+#define SYS_perfopen 46
+#define SYS_perfread 47
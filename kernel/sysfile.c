@@ -26,7 +26,7 @@ argfd(int n, int *pfd, struct file **pf)
 
   if(argint(n, &fd) < 0)
     return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(fd < 0 || fd >= NOFILE || (f=myproc()->group->ofile[fd]) == 0)
     return -1;
   if(pfd)
     *pfd = fd;
@@ -41,14 +41,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
 
+  acquire(&p->slock);
   for(fd = 0; fd < NOFILE; fd++){
     if(p->ofile[fd] == 0){
       p->ofile[fd] = f;
+      release(&p->slock);
       return fd;
     }
   }
+  release(&p->slock);
   return -1;
 }
 
@@ -91,15 +94,207 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+// Fetch the iovec array and count that are the nth and n+1th
+// system call arguments into iov.  Returns the count, or -1.
+static int
+argiov(int n, struct iovec *iov)
+{
+  uint64 addr;
+  int niov, i, tot;
+
+  if(argaddr(n, &addr) < 0 || argint(n+1, &niov) < 0)
+    return -1;
+  if(niov < 0 || niov > MAXIOV)
+    return -1;
+  if(copyin(myproc()->pagetable, (char*)iov, addr, niov*sizeof(struct iovec)) < 0)
+    return -1;
+  tot = 0;
+  for(i = 0; i < niov; i++){
+    // the total must fit in the int we return.
+    if(iov[i].iov_len < 0 || iov[i].iov_len > 0x7fffffff - tot)
+      return -1;
+    tot += iov[i].iov_len;
+  }
+  return niov;
+}
+
+uint64
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(1, iov)) < 0)
+    return -1;
+  return filereadv(f, iov, niov, -1);
+}
+
+uint64
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[MAXIOV];
+  int niov;
+
+  if(argfd(0, 0, &f) < 0 || (niov = argiov(1, iov)) < 0)
+    return -1;
+  return filewritev(f, iov, niov, -1);
+}
+
+uint64
+sys_pread(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filereadv(f, &iov, 1, off);
+}
+
+uint64
+sys_pwrite(void)
+{
+  struct file *f;
+  struct iovec iov;
+  int n, off;
+  uint64 p;
+
+  if(argfd(0, 0, &f) < 0 || argaddr(1, &p) < 0 || argint(2, &n) < 0 ||
+     argint(3, &off) < 0)
+    return -1;
+  if(n < 0 || off < 0)
+    return -1;
+  iov.iov_base = (void*)p;
+  iov.iov_len = n;
+  return filewritev(f, &iov, 1, off);
+}
+
+uint64
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0)
+    return -1;
+  if(n < 0)
+    return -1;
+
+  return filesplice(in, out, n);
+}
+
+uint64
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &cmd) < 0 || argint(2, &arg) < 0)
+    return -1;
+  switch(cmd){
+  case F_GETFL:
+    return (f->readable && f->writable ? O_RDWR : f->writable ? O_WRONLY : O_RDONLY) |
+           (f->nonblock ? O_NONBLOCK : 0);
+  case F_SETFL:
+    f->nonblock = (arg & O_NONBLOCK) != 0;
+    return 0;
+  }
+  return -1;
+}
+
+uint64
+sys_poll(void)
+{
+  struct proc *p = myproc()->group;
+  struct pollfd fds[NOFILE];
+  struct file *f[NOFILE];
+  uint64 addr;
+  int n, timeout, i, fd, r;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  if(n < 0 || n > NOFILE)
+    return -1;
+  if(copyin(p->pagetable, (char*)fds, addr, n*sizeof(fds[0])) < 0)
+    return -1;
+
+  // hold references, in case another thread closes a
+  // descriptor while we sleep.
+  acquire(&p->slock);
+  for(i = 0; i < n; i++){
+    fd = fds[i].fd;
+    if(fd >= 0 && fd < NOFILE && p->ofile[fd])
+      f[i] = filedup(p->ofile[fd]);
+    else
+      f[i] = 0;
+  }
+  release(&p->slock);
+  r = filepoll(f, fds, n, timeout);
+  for(i = 0; i < n; i++){
+    if(f[i])
+      fileclose(f[i]);
+  }
+
+  if(r >= 0 && copyout(p->pagetable, addr, (char*)fds, n*sizeof(fds[0])) < 0)
+    return -1;
+  return r;
+}
+
+// mmap(addr, len, prot, flags, fd, off).  addr is ignored;
+// fd is ignored for MAP_ANONYMOUS.
+uint64
+sys_mmap(void)
+{
+  uint64 len;
+  int prot, flags, fd, off;
+  struct file *f = 0;
+
+  if(argaddr(1, &len) < 0 || argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argint(4, &fd) < 0 || argint(5, &off) < 0)
+    return -1;
+  if((flags & MAP_ANONYMOUS) == 0 && argfd(4, 0, &f) < 0)
+    return -1;
+  if(off < 0)
+    return -1;
+  return mmap(len, prot, flags, f, off);
+}
+
+uint64
+sys_munmap(void)
+{
+  uint64 addr, len;
+
+  if(argaddr(0, &addr) < 0 || argaddr(1, &len) < 0)
+    return -1;
+  return munmap(addr, len);
+}
+
 uint64
 sys_close(void)
 {
   int fd;
   struct file *f;
+  struct proc *p = myproc()->group;
 
   if(argfd(0, &fd, &f) < 0)
     return -1;
-  myproc()->ofile[fd] = 0;
+  // another thread may be closing fd too.
+  acquire(&p->slock);
+  if(p->ofile[fd] != f)
+    f = 0;
+  p->ofile[fd] = 0;
+  release(&p->slock);
+  if(f == 0)
+    return -1;
   fileclose(f);
   return 0;
 }
@@ -115,6 +310,30 @@ sys_fstat(void)
   return filestat(f, st);
 }
 
+// Write the file's data that is only in the page cache home,
+// and return once it and everything logged before it are on
+// the disk.
+uint64
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  if(f->type != FD_INODE)
+    return -1;
+  pcwriteback(f->ip);
+  return 0;
+}
+
+// Like fsync() of every file.
+uint64
+sys_sync(void)
+{
+  pcsync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 uint64
 sys_link(void)
@@ -206,6 +425,10 @@ sys_unlink(void)
 
   if((ip = dirlookup(dp, name, &off)) == 0)
     goto bad;
+  if(mntcovers(ip)){
+    iput(ip);
+    goto bad;
+  }
   ilock(ip);
 
   if(ip->nlink < 1)
@@ -215,6 +438,7 @@ sys_unlink(void)
     goto bad;
   }
 
+  dcremove(dp, name);
   memset(&de, 0, sizeof(de));
   if(writei(dp, 0, (uint64)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
@@ -309,7 +533,7 @@ sys_open(void)
       return -1;
     }
     ilock(ip);
-    if(ip->type == T_DIR && omode != O_RDONLY){
+    if(ip->type == T_DIR && (omode & ~O_NONBLOCK) != O_RDONLY){
       iunlockput(ip);
       end_op();
       return -1;
@@ -340,6 +564,7 @@ sys_open(void)
   f->ip = ip;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
+  f->nonblock = (omode & O_NONBLOCK) != 0;
 
   if((omode & O_TRUNC) && ip->type == T_FILE){
     itrunc(ip);
@@ -391,8 +616,8 @@ uint64
 sys_chdir(void)
 {
   char path[MAXPATH];
-  struct inode *ip;
-  struct proc *p = myproc();
+  struct inode *ip, *old;
+  struct proc *p = myproc()->group;
   
   begin_op();
   if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
@@ -406,52 +631,92 @@ sys_chdir(void)
     return -1;
   }
   iunlock(ip);
-  iput(p->cwd);
-  end_op();
+  acquire(&p->slock);
+  old = p->cwd;
   p->cwd = ip;
+  release(&p->slock);
+  iput(old);
+  end_op();
+  return 0;
+}
+
+// Mount the file system on disk device dev, other than the
+// root's, on the directory path.  Mounts last until the
+// machine stops.
+uint64
+sys_mount(void)
+{
+  char path[MAXPATH];
+  struct inode *ip, *root;
+  int dev;
+
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &dev) < 0 || dev == ROOTDEV)
+    return -1;
+  begin_op();
+  if((ip = namei(path)) == 0){
+    end_op();
+    return -1;
+  }
+  ilock(ip);
+  if(ip->type != T_DIR || (ip->dev == ROOTDEV && ip->inum == ROOTINO)){
+    iunlockput(ip);
+    end_op();
+    return -1;
+  }
+  iunlock(ip);
+  if((root = fsroot(dev)) == 0 || mount(ip, root) < 0){
+    if(root)
+      iput(root);
+    iput(ip);
+    end_op();
+    return -1;
+  }
+  end_op();
   return 0;
 }
 
+// exec() copies the argument strings straight from user
+// memory onto the new stack.
 uint64
 sys_exec(void)
 {
-  char path[MAXPATH], *argv[MAXARG];
-  int i;
-  uint64 uargv, uarg;
+  char path[MAXPATH];
+  uint64 uargv;
 
   if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0){
     return -1;
   }
-  memset(argv, 0, sizeof(argv));
-  for(i=0;; i++){
-    if(i >= NELEM(argv)){
-      goto bad;
-    }
-    if(fetchaddr(uargv+sizeof(uint64)*i, (uint64*)&uarg) < 0){
-      goto bad;
-    }
-    if(uarg == 0){
-      argv[i] = 0;
-      break;
-    }
-    argv[i] = kalloc();
-    if(argv[i] == 0)
-      goto bad;
-    if(fetchstr(uarg, argv[i], PGSIZE) < 0)
-      goto bad;
-  }
+  return exec(myproc(), path, uargv, 0);
+}
 
-  int ret = exec(path, argv);
+// Like exec(), passing the environment envp as well.
+uint64
+sys_execve(void)
+{
+  char path[MAXPATH];
+  uint64 uargv, uenvp;
 
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &uenvp) < 0)
+    return -1;
+  return exec(myproc(), path, uargv, uenvp);
+}
 
-  return ret;
+uint64
+sys_spawn(void)
+{
+  char path[MAXPATH];
+  int fds[NOFILE], nfd;
+  uint64 uargv, ufds;
 
- bad:
-  for(i = 0; i < NELEM(argv) && argv[i] != 0; i++)
-    kfree(argv[i]);
-  return -1;
+  if(argstr(0, path, MAXPATH) < 0 || argaddr(1, &uargv) < 0 ||
+     argaddr(2, &ufds) < 0 || argint(3, &nfd) < 0)
+    return -1;
+  if(nfd < 0 || nfd > NOFILE)
+    return -1;
+  if(ufds && copyin(myproc()->pagetable, (char*)fds, ufds, nfd*sizeof(fds[0])) < 0)
+    return -1;
+  return spawn(path, uargv, ufds ? fds : 0, nfd);
 }
 
 uint64
@@ -460,7 +725,7 @@ sys_pipe(void)
   uint64 fdarray; // user pointer to array of two integers
   struct file *rf, *wf;
   int fd0, fd1;
-  struct proc *p = myproc();
+  struct proc *p = myproc()->group;
 
   if(argaddr(0, &fdarray) < 0)
     return -1;
@@ -29,6 +29,12 @@ sys_fork(void)
   return fork();
 }
 
+uint64
+sys_vfork(void)
+{
+  return vfork();
+}
+
 uint64
 sys_wait(void)
 {
@@ -41,36 +47,33 @@ sys_wait(void)
 uint64
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
-    return -1;
-  return addr;
+  return growproc(n);
 }
 
 uint64
 sys_sleep(void)
 {
   int n;
-  uint ticks0;
+
   backtrace();
   if(argint(0, &n) < 0)
     return -1;
-  acquire(&tickslock);
-  ticks0 = ticks;
-  while(ticks - ticks0 < n){
-    if(myproc()->killed){
-      release(&tickslock);
-      return -1;
-    }
-    sleep(&ticks, &tickslock);
-  }
-  release(&tickslock);
-  return 0;
+  return sleepuntil(r_time() + (uint64)n * TICKINTERVAL);
+}
+
+// Sleep for n microseconds, which may be less than a tick.
+uint64
+sys_usleep(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return sleepuntil(r_time() + (uint64)n * (TIMEFREQ/1000000));
 }
 
 uint64
@@ -110,6 +113,99 @@ sys_sigalarm(void)
 
 }
 
+// Trace the system calls in mask, 1L<<SYS_x, for this
+// process and the children it forks from now on.
+uint64
+sys_trace(void)
+{
+  uint64 mask;
+
+  if(argaddr(0, &mask) < 0)
+    return -1;
+  myproc()->tracemask = mask;
+  return 0;
+}
+
+uint64
+sys_clone(void)
+{
+  uint64 fn, arg, stack;
+
+  if(argaddr(0, &fn) < 0 || argaddr(1, &arg) < 0 || argaddr(2, &stack) < 0)
+    return -1;
+  return clone(fn, arg, stack);
+}
+
+uint64
+sys_join(void)
+{
+  int tid;
+  uint64 p;
+
+  if(argint(0, &tid) < 0 || argaddr(1, &p) < 0)
+    return -1;
+  return join(tid, p);
+}
+
+uint64
+sys_futex_wait(void)
+{
+  uint64 addr;
+  int val;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val);
+}
+
+uint64
+sys_futex_wake(void)
+{
+  uint64 addr;
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0)
+    return -1;
+  return futexwake(addr, n);
+}
+
+// Start counting the events in perf.h for the calling
+// thread, from zero.  Returns how many there are.
+uint64
+sys_perfopen(void)
+{
+  perfreset();
+  return NPERF;
+}
+
+// Copy the first n of the calling thread's counts to the
+// array at addr.  Returns how many it copied.
+uint64
+sys_perfread(void)
+{
+  uint64 addr, v[NPERF];
+  int n;
+
+  if(argaddr(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  if(n > NPERF)
+    n = NPERF;
+  perfget(v);
+  if(copyout(myproc()->pagetable, addr, (char*)v, n*sizeof(v[0])) < 0)
+    return -1;
+  return n;
+}
+
+uint64
+sys_setaffinity(void)
+{
+  int pid, mask;
+
+  if(argint(0, &pid) < 0 || argint(1, &mask) < 0)
+    return -1;
+  return setaffinity(pid, mask);
+}
+
 uint64
 sys_sigreturn(void) {
     sigreturn();
@@ -0,0 +1,278 @@
+// Per-CPU timers.
+//
+// Each CPU programs its own CLINT comparator from supervisor
+// mode.  timervec only disarms the comparator and forwards the
+// interrupt; timerintr() then decides what the interrupt was
+// for and when the next one should come:
+//
+//  - a scheduler tick, every TICKINTERVAL, but only while the
+//    CPU has something to run.  An idle CPU takes no ticks.
+//  - the nearest deadline of a process sleeping in sleepuntil().
+//    A sleeper goes on a heap belonging to the CPU it slept on,
+//    ordered by deadline, and is woken by that CPU when its
+//    deadline passes, so no one else is woken to check.
+//  - the timeout of a process in poll(), which puts itself on a
+//    heap with timerpoll() and then sleeps on the poll channel;
+//    its deadline passing is one more pollwakeup().
+//  - while the profiler runs, a sample every PROFINTERVAL on
+//    a CPU that is ticking; see prof.c.
+//
+// ticks is derived from the time register, so it stays right
+// however many CPUs are ticking.
+
+#include "types.h"
+#include "param.h"
+#include "memlayout.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "defs.h"
+
+struct timerq {
+  struct spinlock lock;
+  struct proc *heap[NPROC];  // min-heap on deadline
+  int n;
+  int ticking;               // Not idle, so take ticks?
+  uint64 nexttick;           // r_time() of the next tick
+  uint64 nextprof;           // r_time() of the next profile sample
+};
+
+static struct timerq timerq[NCPU];
+static uint64 boottime;
+
+static int
+before(struct proc *a, struct proc *b)
+{
+  return a->deadline < b->deadline;
+}
+
+static void
+heapset(struct timerq *tq, int i, struct proc *p)
+{
+  tq->heap[i] = p;
+  p->tidx = i;
+}
+
+static void
+siftup(struct timerq *tq, int i)
+{
+  struct proc *p = tq->heap[i];
+
+  while(i > 0 && before(p, tq->heap[(i-1)/2])){
+    heapset(tq, i, tq->heap[(i-1)/2]);
+    i = (i-1)/2;
+  }
+  heapset(tq, i, p);
+}
+
+static void
+siftdown(struct timerq *tq, int i)
+{
+  struct proc *p = tq->heap[i];
+  int c;
+
+  while((c = 2*i+1) < tq->n){
+    if(c+1 < tq->n && before(tq->heap[c+1], tq->heap[c]))
+      c++;
+    if(!before(tq->heap[c], p))
+      break;
+    heapset(tq, i, tq->heap[c]);
+    i = c;
+  }
+  heapset(tq, i, p);
+}
+
+// Take p off tq's heap.  Caller holds tq->lock.
+static void
+heapremove(struct timerq *tq, struct proc *p)
+{
+  int i = p->tidx;
+
+  p->tidx = -1;
+  if(--tq->n == i)
+    return;
+  heapset(tq, i, tq->heap[tq->n]);
+  siftup(tq, i);
+  siftdown(tq, i);
+}
+
+// Set this CPU's comparator for its next tick or deadline,
+// whichever is sooner.  Caller holds tq->lock, which keeps
+// interrupts off and so keeps us on tq's CPU.
+static void
+timerarm(struct timerq *tq)
+{
+  uint64 when = ~0ULL;
+
+  if(tq->ticking){
+    when = tq->nexttick;
+    if(profon && tq->nextprof < when)
+      when = tq->nextprof;
+  }
+  if(tq->n > 0 && tq->heap[0]->deadline < when)
+    when = tq->heap[0]->deadline;
+  *(uint64*)CLINT_MTIMECMP(cpuid()) = when;
+}
+
+// Bring ticks, and the copy user space reads, up to date.
+static void
+tickupdate(uint64 now)
+{
+  uint t = (now - boottime) / TICKINTERVAL;
+
+  acquire(&tickslock);
+  if(t != ticks){
+    ticks = t;
+    ushared->ticks = t;
+  }
+  release(&tickslock);
+}
+
+// Called by each CPU from main().
+void
+timerinithart(void)
+{
+  struct timerq *tq = &timerq[cpuid()];
+
+  if(cpuid() == 0)
+    boottime = r_time();
+  initlock(&tq->lock, "timerq");
+  acquire(&tq->lock);
+  tq->ticking = 1;
+  tq->nexttick = r_time() + TICKINTERVAL;
+  timerarm(tq);
+  release(&tq->lock);
+}
+
+// Handle this CPU's timer interrupt: wake the sleepers that are
+// due and set up the next interrupt.  Returns 1 if the interrupt
+// is a scheduler tick.
+int
+timerintr(void)
+{
+  struct timerq *tq = &timerq[cpuid()];
+  struct proc *p;
+  uint64 now;
+  int tick = 0;
+
+  acquire(&tq->lock);
+  now = r_time();
+  while(tq->n > 0 && tq->heap[0]->deadline <= now){
+    p = tq->heap[0];
+    heapremove(tq, p);
+    if(p->polling)
+      pollwakeup();
+    else
+      wakeup(&p->deadline);
+  }
+  if(profon && tq->ticking && tq->nextprof <= now){
+    mycpu()->profdue = 1;
+    tq->nextprof = now + PROFINTERVAL;
+  }
+  if(tq->ticking && tq->nexttick <= now){
+    tick = 1;
+    tq->nexttick += TICKINTERVAL;
+    if(tq->nexttick <= now)
+      tq->nexttick = now + TICKINTERVAL;
+  }
+  timerarm(tq);
+  release(&tq->lock);
+
+  if(tick)
+    tickupdate(now);
+  return tick;
+}
+
+// The scheduler calls timeridle(1) before waiting for an
+// interrupt with nothing to run, and timeridle(0) after.
+// Interrupts are off.
+void
+timeridle(int idle)
+{
+  struct timerq *tq = &timerq[cpuid()];
+  uint64 now;
+
+  acquire(&tq->lock);
+  now = r_time();
+  tq->ticking = !idle;
+  if(!idle && tq->nexttick <= now)
+    tq->nexttick = now + TICKINTERVAL;
+  timerarm(tq);
+  release(&tq->lock);
+
+  if(!idle)
+    tickupdate(now);
+}
+
+// Sleep until r_time() reaches when.  Returns -1 if killed first.
+int
+sleepuntil(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timerq *tq;
+
+  // acquire() turns interrupts off, so once it returns we
+  // are on tq's CPU and stay there until sleep().
+  push_off();
+  tq = &timerq[cpuid()];
+  acquire(&tq->lock);
+  pop_off();
+
+  if(when <= r_time()){
+    release(&tq->lock);
+    return 0;
+  }
+  p->deadline = when;
+  heapset(tq, tq->n++, p);
+  siftup(tq, p->tidx);
+  if(tq->heap[0] == p)
+    timerarm(tq);
+
+  while(p->tidx >= 0){
+    if(p->killed){
+      heapremove(tq, p);
+      release(&tq->lock);
+      return -1;
+    }
+    sleep(&p->deadline, &tq->lock);
+  }
+  release(&tq->lock);
+  return 0;
+}
+
+// Have this CPU's timer call pollwakeup() when r_time() reaches
+// when, for a poll() with a timeout.  p->tidx goes to -1 then.
+void
+timerpoll(uint64 when)
+{
+  struct proc *p = myproc();
+  struct timerq *tq;
+
+  push_off();
+  tq = &timerq[cpuid()];
+  acquire(&tq->lock);
+  pop_off();
+
+  p->deadline = when;
+  p->polling = 1;
+  p->tcpu = tq - timerq;
+  heapset(tq, tq->n++, p);
+  siftup(tq, p->tidx);
+  if(tq->heap[0] == p)
+    timerarm(tq);
+  release(&tq->lock);
+}
+
+// Undo timerpoll(), whether or not the deadline has passed.
+void
+timerpollcancel(void)
+{
+  struct proc *p = myproc();
+  struct timerq *tq = &timerq[p->tcpu];
+
+  acquire(&tq->lock);
+  if(p->tidx >= 0)
+    heapremove(tq, p);
+  p->polling = 0;
+  release(&tq->lock);
+}
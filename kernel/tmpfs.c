@@ -0,0 +1,263 @@
+// tmpfs: a file system in memory, mounted on /tmp.
+//
+// Its i-nodes, on device TMPDEV, live only in the inode table,
+// and keep their contents in pages from kalloc(), found through
+// a two-level map from ip->tmap, so reading and writing them is
+// a copy, with neither the buffer cache nor the log, and none of
+// it ever goes to the disk.  Directories are arrays of struct
+// dirent like on the disk, without an index.
+//
+// fs.c calls in here wherever it would touch the disk for a
+// TMPDEV inode: ialloc(), iupdate(), itrunc(), and readblk(),
+// readi(), writeblk() and writei(), so the page cache is not
+// used for tmpfs files either, except for pages exec() and
+// mmap() map.  In place of the disk copy, the file system holds
+// a reference to each i-node while it has links (ip->tmpheld),
+// which iupdate() takes and drops as nlink changes, and which
+// keeps the inode out of the LRU list; once the last link and
+// the last other reference are gone, iput() frees it as it does
+// any inode, and itrunc() its pages.
+//
+// tmpfsinit() mounts it on /tmp like any other file system
+// (see mount() in fs.c).
+
+#include "types.h"
+#include "param.h"
+#include "riscv.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+#include "defs.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+#define NMAP (PGSIZE / sizeof(char*))  // pointers in a map page
+#define TMPMAXFILE (NMAP * NMAP * PGSIZE)
+
+static struct {
+  struct spinlock lock;
+  uchar used[NTMPINODE/8];  // i-numbers in use
+  int ninode;
+  int npage;                // data and map pages, at most TMPPAGES
+} tmp;
+
+// Allocate an i-number, or return 0 if there are none.
+uint
+tmpinum(void)
+{
+  uint inum;
+
+  acquire(&tmp.lock);
+  for(inum = ROOTINO; inum < NTMPINODE; inum++){
+    if((tmp.used[inum/8] & (1 << (inum%8))) == 0){
+      tmp.used[inum/8] |= 1 << (inum%8);
+      tmp.ninode++;
+      release(&tmp.lock);
+      return inum;
+    }
+  }
+  release(&tmp.lock);
+  return 0;
+}
+
+// Free an i-number, for iput().
+void
+tmpifree(uint inum)
+{
+  acquire(&tmp.lock);
+  tmp.used[inum/8] &= ~(1 << (inum%8));
+  tmp.ninode--;
+  release(&tmp.lock);
+}
+
+// A zeroed page counted against TMPPAGES, or 0.
+static void*
+tmppage(void)
+{
+  void *pa;
+
+  acquire(&tmp.lock);
+  if(tmp.npage >= TMPPAGES){
+    release(&tmp.lock);
+    return 0;
+  }
+  tmp.npage++;
+  release(&tmp.lock);
+  if((pa = kalloc()) == 0){
+    acquire(&tmp.lock);
+    tmp.npage--;
+    release(&tmp.lock);
+    return 0;
+  }
+  memset(pa, 0, PGSIZE);
+  return pa;
+}
+
+// The slot in ip's map for the page at page number pn,
+// adding map pages if alloc is set, or 0.
+// Caller must hold ip->lock.
+static char**
+tmpslot(struct inode *ip, uint pn, int alloc)
+{
+  char ***top, **mid;
+
+  if(ip->tmap == 0){
+    if(!alloc || (ip->tmap = tmppage()) == 0)
+      return 0;
+  }
+  top = (char***)ip->tmap;
+  if((mid = top[pn / NMAP]) == 0){
+    if(!alloc || (mid = top[pn / NMAP] = tmppage()) == 0)
+      return 0;
+  }
+  return &mid[pn % NMAP];
+}
+
+// Update the file system's reference to ip after a change to
+// nlink, in place of writing ip to the disk.
+// Caller must hold ip->lock, and a reference of its own.
+void
+tmpupdate(struct inode *ip)
+{
+  if(ip->nlink > 0 && !ip->tmpheld){
+    ip->tmpheld = 1;
+    idup(ip);
+  } else if(ip->nlink == 0 && ip->tmpheld){
+    ip->tmpheld = 0;
+    __sync_fetch_and_sub(&ip->ref, 1);  // the caller's is left
+  }
+}
+
+// Free all of ip's pages.
+// Caller must hold ip->lock.
+void
+tmptrunc(struct inode *ip)
+{
+  char ***top;
+  char **mid;
+  int i, j, n;
+
+  n = 0;
+  if((top = (char***)ip->tmap) != 0){
+    for(i = 0; i < NMAP; i++){
+      if((mid = top[i]) == 0)
+        continue;
+      for(j = 0; j < NMAP; j++){
+        if(mid[j]){
+          kfree(mid[j]);
+          n++;
+        }
+      }
+      kfree(mid);
+      n++;
+    }
+    kfree(top);
+    n++;
+    ip->tmap = 0;
+  }
+  acquire(&tmp.lock);
+  tmp.npage -= n;
+  release(&tmp.lock);
+  ip->size = ip->dsize = 0;
+}
+
+// Read from ip's pages.
+// Caller must hold ip->lock.
+int
+tmpread(struct inode *ip, int user_dst, uint64 dst, uint off, uint n)
+{
+  uint tot, m;
+  char **slot;
+
+  if(off > ip->size || off + n < off)
+    return 0;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((slot = tmpslot(ip, off/PGSIZE, 0)) == 0 || *slot == 0)
+      panic("tmpread");
+    if(either_copyout(user_dst, dst, *slot + off%PGSIZE, m) == -1)
+      return -1;
+  }
+  return tot;
+}
+
+// Write to ip's pages, allocating any it lacks.
+// Caller must hold ip->lock.
+// Returns the number of bytes written, less than n if the
+// copy faulted or tmpfs is full.
+int
+tmpwrite(struct inode *ip, int user_src, uint64 src, uint off, uint n)
+{
+  uint tot, m;
+  char **slot;
+
+  if(off > ip->size || off + n < off)
+    return -1;
+  if(off + n > TMPMAXFILE)
+    return -1;
+
+  for(tot=0; tot<n; tot+=m, off+=m, src+=m){
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    if((slot = tmpslot(ip, off/PGSIZE, 1)) == 0)
+      break;
+    if(*slot == 0 && (*slot = tmppage()) == 0)
+      break;
+    if(either_copyin(*slot + off%PGSIZE, user_src, src, m) == -1)
+      break;
+  }
+  if(off > ip->size)
+    ip->size = ip->dsize = off;
+  return tot;
+}
+
+// Mount tmpfs on /tmp, if the root file system has that
+// directory.  Called once, from the first process.
+void
+tmpfsinit(void)
+{
+  struct inode *dp, *ip;
+
+  initlock(&tmp.lock, "tmpfs");
+  begin_op();
+  if((dp = namei("/tmp")) == 0){
+    end_op();
+    return;
+  }
+  ilock(dp);
+  if(dp->type != T_DIR){
+    iunlockput(dp);
+    end_op();
+    return;
+  }
+  iunlock(dp);
+
+  if((ip = ialloc(TMPDEV, T_DIR)) == 0)
+    panic("tmpfsinit");
+  ilock(ip);
+  ip->nlink = 1;
+  iupdate(ip);
+  // namex() takes ".." to the mount point instead.
+  if(dirlink(ip, ".", ip->inum) < 0 || dirlink(ip, "..", ip->inum) < 0)
+    panic("tmpfsinit dots");
+  iunlock(ip);
+  if(mount(dp, ip) < 0)
+    panic("tmpfsinit mount");
+  end_op();
+}
+
+// Report how much tmpfs holds.
+int
+statstmp(char *buf, int sz)
+{
+  int n;
+
+  acquire(&tmp.lock);
+  n = snprintf(buf, sz, "tmpfs: %d inodes, %d pages\n", tmp.ninode, tmp.npage);
+  release(&tmp.lock);
+  return n;
+}
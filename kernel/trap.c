@@ -9,6 +9,9 @@
 struct spinlock tickslock;
 uint ticks;
 
+// mapped read-only in every process at USHARED.
+struct ushared *ushared;
+
 extern char trampoline[], uservec[], userret[];
 
 // in kernelvec.S, calls kerneltrap().
@@ -20,6 +23,9 @@ void
 trapinit(void)
 {
   initlock(&tickslock, "time");
+  if((ushared = (struct ushared*)kalloc()) == 0)
+    panic("trapinit");
+  memset(ushared, 0, PGSIZE);
 }
 
 // set up to take exceptions and traps while in the kernel.
@@ -45,7 +51,11 @@ usertrap(void)
   // since we're now in the kernel.
   w_stvec((uint64)kernelvec);
 
+  // for tlbshootdown().
+  mycpu()->inuser = 0;
+
   struct proc *p = myproc();
+  p->utime += r_time() - p->uentry;
   
   // save user program counter.
   p->trapframe->epc = r_sepc();
@@ -60,19 +70,32 @@ usertrap(void)
     // but we want to return to the next instruction.
     p->trapframe->epc += 4;
 
+    // uservec didn't save the caller-saved registers, and
+    // userret needn't restore them, unless exec() or
+    // sigreturn() says otherwise.
+    p->syscallret = 1;
+
     // an interrupt will change sstatus &c registers,
     // so don't enable until done with those registers.
-    intr_on();
-
-    syscall();
+    // The simplest calls don't need them on at all.
+    if(syscallfast() == 0){
+      intr_on();
+      syscall();
+    }
   } else if((which_dev = devintr()) != 0){
-    // ok
+    intr_on();
+    softirq();
+  } else if((r_scause() == 12 || r_scause() == 13 || r_scause() == 15) &&
+            uvmfault(p, r_stval(), r_scause()) == 0){
+    // copy-on-write, file-backed or lazily allocated page
   } else {
     printf("usertrap(): unexpected scause %p pid=%d\n", r_scause(), p->pid);
     printf("            sepc=%p stval=%p\n", r_sepc(), r_stval());
     p->killed = 1;
   }
 
+  proftrap(1, p->trapframe->epc, p->trapframe->s0);
+
   if(p->killed)
     exit(-1);
 
@@ -90,7 +113,7 @@ usertrap(void)
             p->alarm_pending = 1;
         }
       }
-    yield();
+    preempt();
   }
   usertrapret();
 }
@@ -111,32 +134,44 @@ usertrapret(void)
   // send syscalls, interrupts, and exceptions to trampoline.S
   w_stvec(TRAMPOLINE + (uservec - trampoline));
 
-  // set up trapframe values that uservec will need when
-  // the process next re-enters the kernel.
-  p->trapframe->kernel_satp = r_satp();         // kernel page table
-  p->trapframe->kernel_sp = p->kstack + PGSIZE; // process's kernel stack
-  p->trapframe->kernel_trap = (uint64)usertrap;
-  p->trapframe->kernel_hartid = r_tp();         // hartid for cpuid()
+  // set up the trapframe value that uservec will need when
+  // the process next re-enters the kernel; allocproc() set
+  // the ones that don't change.
+  if(p->trapframe->kernel_hartid != r_tp())
+    p->trapframe->kernel_hartid = r_tp();       // hartid for cpuid()
 
   // set up the registers that trampoline.S's sret will use
   // to get to user space.
   
-  // set S Previous Privilege mode to User.
+  // set S Previous Privilege mode to User, and enable
+  // interrupts in user mode; after a trap from user mode
+  // they usually are already.
   unsigned long x = r_sstatus();
-  x &= ~SSTATUS_SPP; // clear SPP to 0 for user mode
-  x |= SSTATUS_SPIE; // enable interrupts in user mode
-  w_sstatus(x);
+  if((x & (SSTATUS_SPP|SSTATUS_SPIE)) != SSTATUS_SPIE)
+    w_sstatus((x & ~SSTATUS_SPP) | SSTATUS_SPIE);
 
   // set S Exception Program Counter to the saved user pc.
   w_sepc(p->trapframe->epc);
-  // tell trampoline.S the user page table to switch to.
-  uint64 satp = MAKE_SATP(p->pagetable);
+  // from here until the next trap, this CPU may use TLB
+  // entries of the page table, which uvmasid() makes sure are
+  // up to date.  tlbshootdown() marks them stale and then
+  // looks at inuser, so saying so before uvmasid() looks at
+  // them means one or the other sees the other's store.
+  mycpu()->inuser = 1;
+  __sync_synchronize();
+
+  // tell trampoline.S the user page table to switch to,
+  // tagged with its ASID so the TLB can keep its entries.
+  uint64 satp = MAKE_SATP(p->pagetable) | SATP_ASID(uvmasid(p->group));
+  p->uentry = r_time();
+  int sys = p->syscallret;
+  p->syscallret = 0;
 
   // jump to trampoline.S at the top of memory, which 
   // switches to the user page table, restores user registers,
   // and switches to user mode with sret.
   uint64 fn = TRAMPOLINE + (userret - trampoline);
-  ((void (*)(uint64,uint64))fn)(TRAPFRAME, satp);
+  ((void (*)(uint64,uint64,uint64))fn)(p->tfva, satp, sys);
 }
 
 // interrupts and exceptions from kernel code go here via kernelvec,
@@ -160,25 +195,28 @@ kerneltrap()
     panic("kerneltrap");
   }
 
-  // give up the CPU if this is a timer interrupt.
-  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING)
-    yield();
+  // kernelvec leaves s0 alone, so the s0 our prologue saved
+  // is the interrupted code's frame pointer.
+  proftrap(0, sepc, ((uint64*)r_fp())[-2]);
+
+  // the interrupted code had interrupts on, so holds no
+  // spinlock, and so the deferred work can take them.
+  intr_on();
+  softirq();
+  intr_off();
+
+  // give up the CPU if this is a timer interrupt, unless it
+  // came in the middle of softirq().
+  if(which_dev == 2 && myproc() != 0 && myproc()->state == RUNNING &&
+     !mycpu()->insoftirq)
+    preempt();
 
-  // the yield() may have caused some traps to occur,
+  // the preempt() may have caused some traps to occur,
   // so restore trap registers for use by kernelvec.S's sret instruction.
   w_sepc(sepc);
   w_sstatus(sstatus);
 }
 
-void
-clockintr()
-{
-  acquire(&tickslock);
-  ticks++;
-  wakeup(&ticks);
-  release(&tickslock);
-}
-
 // check if it's an external interrupt or software interrupt,
 // and handle it.
 // returns 2 if timer interrupt,
@@ -193,13 +231,15 @@ devintr()
      (scause & 0xff) == 9){
     // this is a supervisor external interrupt, via PLIC.
 
+    plicsteer();
+
     // irq indicates which device interrupted.
     int irq = plic_claim();
 
     if(irq == UART0_IRQ){
       uartintr();
-    } else if(irq == VIRTIO0_IRQ){
-      virtio_disk_intr();
+    } else if(irq >= VIRTIO0_IRQ && irq < VIRTIO0_IRQ + NDISK){
+      blkintr(irq - VIRTIO0_IRQ);
     } else if(irq){
       printf("unexpected interrupt irq=%d\n", irq);
     }
@@ -213,19 +253,79 @@ devintr()
     return 1;
   } else if(scause == 0x8000000000000001L){
     // software interrupt from a machine-mode timer interrupt,
-    // forwarded by timervec in kernelvec.S.
+    // or from another CPU's ipi(), forwarded by timervec in
+    // kernelvec.S.
 
-    if(cpuid() == 0){
-      clockintr();
-    }
-    
     // acknowledge the software interrupt by clearing
     // the SSIP bit in sip.
     w_sip(r_sip() & ~2);
 
+    plicsteer();
+
+    // run other CPUs' smpcall()s to this one.
+    ipirecv();
+
+    // a kick() only needs to get an idle CPU out of wfi,
+    // and a timer interrupt might only have been for a
+    // sleeper's deadline.
+    if(!timertick() || !timerintr())
+      return 1;
+
     return 2;
   } else {
     return 0;
   }
 }
 
+
+// Have w->fn() called on this CPU after the interrupt being
+// handled, with interrupts on, for the part of the handling
+// that takes locks others hold for long, or wakes processes.
+// Queueing w again before it starts does nothing.  Called by
+// an interrupt handler, with interrupts off.
+void
+defer(struct work *w)
+{
+  struct cpu *c;
+
+  if(__sync_lock_test_and_set(&w->pending, 1))
+    return;
+  push_off();
+  c = mycpu();
+  w->next = 0;
+  if(c->work)
+    c->worklast->next = w;
+  else
+    c->work = w;
+  c->worklast = w;
+  pop_off();
+}
+
+// Do this CPU's deferred interrupt work, oldest first.  Called
+// with interrupts on and no spinlock held, at the end of an
+// interrupt.  An interrupt taken meanwhile queues its work for
+// this loop to do, and neither preempts it nor recurses, so the
+// caller stays on this CPU; the work must not sleep.
+void
+softirq(void)
+{
+  struct cpu *c;
+  struct work *w;
+
+  push_off();
+  c = mycpu();
+  if(c->insoftirq){
+    pop_off();
+    return;
+  }
+  c->insoftirq = 1;
+  while((w = c->work) != 0){
+    c->work = w->next;
+    __sync_lock_release(&w->pending);
+    pop_off();
+    w->fn();
+    push_off();
+  }
+  c->insoftirq = 0;
+  pop_off();
+}
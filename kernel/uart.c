@@ -34,13 +34,15 @@
 #define LSR 5                 // line status register
 #define LSR_RX_READY (1<<0)   // input is waiting to be read from RHR
 #define LSR_TX_IDLE (1<<5)    // THR can accept another character to send
+#define FIFOSIZE 16           // bytes the transmit FIFO holds
 
 #define ReadReg(reg) (*(Reg(reg)))
 #define WriteReg(reg, v) (*(Reg(reg)) = (v))
 
-// the transmit output buffer.
+// the transmit output buffer, shared by write()s to the
+// console and kernel printf().
 struct spinlock uart_tx_lock;
-#define UART_TX_BUF_SIZE 32
+#define UART_TX_BUF_SIZE 2048
 char uart_tx_buf[UART_TX_BUF_SIZE];
 uint64 uart_tx_w; // write next to uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE]
 uint64 uart_tx_r; // read next from uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]
@@ -77,15 +79,17 @@ uartinit(void)
   initlock(&uart_tx_lock, "uart");
 }
 
-// add a character to the output buffer and tell the
+// add n characters to the output buffer and tell the
 // UART to start sending if it isn't already.
-// blocks if the output buffer is full.
+// blocks while the output buffer is full.
 // because it may block, it can't be called
 // from interrupts; it's only suitable for use
 // by write().
 void
-uartputc(int c)
+uartwrite(char *s, int n)
 {
+  int i;
+
   acquire(&uart_tx_lock);
 
   if(panicked){
@@ -93,18 +97,56 @@ uartputc(int c)
       ;
   }
 
-  while(1){
-    if(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE){
       // buffer is full.
-      // wait for uartstart() to open up space in the buffer.
-      sleep(&uart_tx_r, &uart_tx_lock);
-    } else {
-      uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = c;
-      uart_tx_w += 1;
+      // wait for uartintr() to open up space in the buffer.
       uartstart();
-      release(&uart_tx_lock);
-      return;
+      sleep(&uart_tx_r, &uart_tx_lock);
     }
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = s[i];
+    uart_tx_w += 1;
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// like uartwrite(), but for kernel printf(): it never sleeps,
+// so it works with interrupts off and locks held.  if the
+// buffer is full it spins, sending bytes itself.
+void
+uartputs(char *s, int n)
+{
+  int i;
+
+  acquire(&uart_tx_lock);
+
+  if(panicked){
+    for(;;)
+      ;
+  }
+
+  for(i = 0; i < n; i++){
+    while(uart_tx_w == uart_tx_r + UART_TX_BUF_SIZE)
+      uartstart();
+    uart_tx_buf[uart_tx_w % UART_TX_BUF_SIZE] = s[i];
+    uart_tx_w += 1;
+  }
+  uartstart();
+  release(&uart_tx_lock);
+}
+
+// send what is left in the output buffer, spinning, without
+// the lock.  for panic(), which may have interrupted a CPU
+// holding it.
+void
+uartflush(void)
+{
+  while(uart_tx_w != uart_tx_r){
+    while((ReadReg(LSR) & LSR_TX_IDLE) == 0)
+      ;
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
+    uart_tx_r += 1;
   }
 }
 
@@ -130,33 +172,27 @@ uartputc_sync(int c)
   pop_off();
 }
 
-// if the UART is idle, and a character is waiting
-// in the transmit buffer, send it.
+// if the UART is idle, and characters are waiting
+// in the transmit buffer, send a FIFO's worth.
 // caller must hold uart_tx_lock.
 // called from both the top- and bottom-half.
+// it doesn't wakeup(), since printf() may call it
+// holding any lock; uartintr() does.
 void
 uartstart()
 {
-  while(1){
-    if(uart_tx_w == uart_tx_r){
-      // transmit buffer is empty.
-      return;
-    }
-    
-    if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
-      // the UART transmit holding register is full,
-      // so we cannot give it another byte.
-      // it will interrupt when it's ready for a new byte.
-      return;
-    }
-    
-    int c = uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE];
+  int i;
+
+  if((ReadReg(LSR) & LSR_TX_IDLE) == 0){
+    // the UART transmit FIFO isn't empty yet.
+    // it will interrupt when it is.
+    return;
+  }
+
+  // the FIFO is empty, so it can take FIFOSIZE bytes.
+  for(i = 0; i < FIFOSIZE && uart_tx_r != uart_tx_w; i++){
+    WriteReg(THR, uart_tx_buf[uart_tx_r % UART_TX_BUF_SIZE]);
     uart_tx_r += 1;
-    
-    // maybe uartputc() is waiting for space in the buffer.
-    wakeup(&uart_tx_r);
-    
-    WriteReg(THR, c);
   }
 }
 
@@ -190,5 +226,7 @@ uartintr(void)
   // send buffered characters.
   acquire(&uart_tx_lock);
   uartstart();
+  // maybe uartwrite() is waiting for space in the buffer.
+  wakeup(&uart_tx_r);
   release(&uart_tx_lock);
 }
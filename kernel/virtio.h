@@ -44,8 +44,10 @@
 #define VIRTIO_RING_F_EVENT_IDX     29
 
 // this many virtio descriptors.
-// must be a power of two.
-#define NUM 8
+// must be a power of two, and small enough that the
+// descriptors and the avail ring fit in one page.
+// a request for n blocks uses n+2.
+#define NUM 64
 
 // a single descriptor, from the spec.
 struct virtq_desc {
@@ -56,15 +58,18 @@ struct virtq_desc {
 };
 #define VRING_DESC_F_NEXT  1 // chained with another descriptor
 #define VRING_DESC_F_WRITE 2 // device writes (vs read)
+#define VRING_DESC_F_INDIRECT 4 // addr is a table of descriptors
 
 // the (entire) avail ring, from the spec.
 struct virtq_avail {
-  uint16 flags; // always zero
+  uint16 flags; // VRING_AVAIL_F_NO_INTERRUPT or zero
   uint16 idx;   // driver will write ring[idx] next
   uint16 ring[NUM]; // descriptor numbers of chain heads
   uint16 unused;
 };
 
+#define VRING_AVAIL_F_NO_INTERRUPT 1 // driver is polling the used ring
+
 // one entry in the "used" ring, with which the
 // device tells the driver about completed requests.
 struct virtq_used_elem {
@@ -5,6 +5,14 @@
 //
 // qemu ... -drive file=fs.img,if=none,format=raw,id=x0 -device virtio-blk-device,drive=x0,bus=virtio-mmio-bus.0
 //
+// there may be up to NDISK disks, disk n on virtio-mmio-bus.n,
+// with its registers at VIRTIO0 + n pages and interrupt
+// VIRTIO0_IRQ + n.  disk 0, the root disk, must be there.
+//
+// blk.c decides what to start and when; every function here
+// but virtio_disk_init() and virtio_disk_present() is called
+// with the disk's queue lock held.
+//
 
 #include "types.h"
 #include "riscv.h"
@@ -18,7 +26,7 @@
 #include "virtio.h"
 
 // the address of virtio mmio register r.
-#define R(r) ((volatile uint32 *)(VIRTIO0 + (r)))
+#define R(r) ((volatile uint32 *)(d->regs + (r)))
 
 static struct disk {
   // the virtio driver and device mostly communicate through a set of
@@ -61,31 +69,60 @@ static struct disk {
   // for use when completion interrupt arrives.
   // indexed by first descriptor index of chain.
   struct {
-    struct buf *b;
+    struct buf *b;   // first of n blocks, linked through qnext
+    int n;
+    int write;
     char status;
   } info[NUM];
 
   // disk command headers.
   // one-for-one with descriptors, for convenience.
   struct virtio_blk_req ops[NUM];
+
+  // if the device supports indirect descriptors, each request
+  // takes one descriptor, pointing to its row of indir[].
+  int indirect;
+  struct virtq_desc indir[NUM][MAXMERGE+2];
   
-  struct spinlock vdisk_lock;
-  
-} __attribute__ ((aligned (PGSIZE))) disk;
+  uint64 regs;     // its mmio registers
+  int present;
+} __attribute__ ((aligned (PGSIZE))) disk[NDISK];
+
+static void diskinit(struct disk *d);
 
 void
 virtio_disk_init(void)
 {
-  uint32 status = 0;
+  struct disk *d;
+  int n;
+
+  for(n = 0; n < NDISK; n++){
+    d = &disk[n];
+    d->regs = VIRTIO0 + n*(VIRTIO1 - VIRTIO0);
+    if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
+       *R(VIRTIO_MMIO_VERSION) != 1 ||
+       *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
+       *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
+      if(n == 0)
+        panic("could not find virtio disk");
+      continue;
+    }
+    diskinit(d);
+    d->present = 1;
+  }
+}
 
-  initlock(&disk.vdisk_lock, "virtio_disk");
+// Is there a disk n?
+int
+virtio_disk_present(int n)
+{
+  return n >= 0 && n < NDISK && disk[n].present;
+}
 
-  if(*R(VIRTIO_MMIO_MAGIC_VALUE) != 0x74726976 ||
-     *R(VIRTIO_MMIO_VERSION) != 1 ||
-     *R(VIRTIO_MMIO_DEVICE_ID) != 2 ||
-     *R(VIRTIO_MMIO_VENDOR_ID) != 0x554d4551){
-    panic("could not find virtio disk");
-  }
+static void
+diskinit(struct disk *d)
+{
+  uint32 status = 0;
   
   status |= VIRTIO_CONFIG_S_ACKNOWLEDGE;
   *R(VIRTIO_MMIO_STATUS) = status;
@@ -101,8 +138,8 @@ virtio_disk_init(void)
   features &= ~(1 << VIRTIO_BLK_F_MQ);
   features &= ~(1 << VIRTIO_F_ANY_LAYOUT);
   features &= ~(1 << VIRTIO_RING_F_EVENT_IDX);
-  features &= ~(1 << VIRTIO_RING_F_INDIRECT_DESC);
   *R(VIRTIO_MMIO_DRIVER_FEATURES) = features;
+  d->indirect = (features >> VIRTIO_RING_F_INDIRECT_DESC) & 1;
 
   // tell device that feature negotiation is complete.
   status |= VIRTIO_CONFIG_S_FEATURES_OK;
@@ -122,31 +159,31 @@ virtio_disk_init(void)
   if(max < NUM)
     panic("virtio disk max queue too short");
   *R(VIRTIO_MMIO_QUEUE_NUM) = NUM;
-  memset(disk.pages, 0, sizeof(disk.pages));
-  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)disk.pages) >> PGSHIFT;
+  memset(d->pages, 0, sizeof(d->pages));
+  *R(VIRTIO_MMIO_QUEUE_PFN) = ((uint64)d->pages) >> PGSHIFT;
 
   // desc = pages -- num * virtq_desc
   // avail = pages + 0x40 -- 2 * uint16, then num * uint16
   // used = pages + 4096 -- 2 * uint16, then num * vRingUsedElem
 
-  disk.desc = (struct virtq_desc *) disk.pages;
-  disk.avail = (struct virtq_avail *)(disk.pages + NUM*sizeof(struct virtq_desc));
-  disk.used = (struct virtq_used *) (disk.pages + PGSIZE);
+  d->desc = (struct virtq_desc *) d->pages;
+  d->avail = (struct virtq_avail *)(d->pages + NUM*sizeof(struct virtq_desc));
+  d->used = (struct virtq_used *) (d->pages + PGSIZE);
 
   // all NUM descriptors start out unused.
   for(int i = 0; i < NUM; i++)
-    disk.free[i] = 1;
+    d->free[i] = 1;
 
-  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ.
+  // plic.c and trap.c arrange for interrupts from VIRTIO0_IRQ + n.
 }
 
 // find a free descriptor, mark it non-free, return its index.
 static int
-alloc_desc()
+alloc_desc(struct disk *d)
 {
   for(int i = 0; i < NUM; i++){
-    if(disk.free[i]){
-      disk.free[i] = 0;
+    if(d->free[i]){
+      d->free[i] = 0;
       return i;
     }
   }
@@ -155,28 +192,27 @@ alloc_desc()
 
 // mark a descriptor as free.
 static void
-free_desc(int i)
+free_desc(struct disk *d, int i)
 {
   if(i >= NUM)
     panic("free_desc 1");
-  if(disk.free[i])
+  if(d->free[i])
     panic("free_desc 2");
-  disk.desc[i].addr = 0;
-  disk.desc[i].len = 0;
-  disk.desc[i].flags = 0;
-  disk.desc[i].next = 0;
-  disk.free[i] = 1;
-  wakeup(&disk.free[0]);
+  d->desc[i].addr = 0;
+  d->desc[i].len = 0;
+  d->desc[i].flags = 0;
+  d->desc[i].next = 0;
+  d->free[i] = 1;
 }
 
 // free a chain of descriptors.
 static void
-free_chain(int i)
+free_chain(struct disk *d, int i)
 {
   while(1){
-    int flag = disk.desc[i].flags;
-    int nxt = disk.desc[i].next;
-    free_desc(i);
+    int flag = d->desc[i].flags;
+    int nxt = d->desc[i].next;
+    free_desc(d, i);
     if(flag & VRING_DESC_F_NEXT)
       i = nxt;
     else
@@ -184,46 +220,78 @@ free_chain(int i)
   }
 }
 
-// allocate three descriptors (they need not be contiguous).
-// disk transfers always use three descriptors.
+// allocate n descriptors (they need not be contiguous).
 static int
-alloc3_desc(int *idx)
+allocn_desc(struct disk *d, int *idx, int n)
 {
-  for(int i = 0; i < 3; i++){
-    idx[i] = alloc_desc();
+  for(int i = 0; i < n; i++){
+    idx[i] = alloc_desc(d);
     if(idx[i] < 0){
       for(int j = 0; j < i; j++)
-        free_desc(idx[j]);
+        free_desc(d, idx[j]);
       return -1;
     }
   }
   return 0;
 }
 
-void
-virtio_disk_rw(struct buf *b, int write)
+// The most blocks one request to disk n can hold.
+int
+virtio_disk_max(int n)
 {
-  uint64 sector = b->blockno * (BSIZE / 512);
+  struct disk *d = &disk[n];
 
-  acquire(&disk.vdisk_lock);
+  return d->indirect ? MAXMERGE : NUM - 2;
+}
 
-  // the spec's Section 5.2 says that legacy block operations use
-  // three descriptors: one for type/reserved/sector, one for the
-  // data, one for a 1-byte status result.
+// Queue one request to read (write == 0) or write the n
+// blocks from b on, linked through b->qnext, which must be
+// consecutive.  Returns -1, queueing nothing, if there are
+// not enough free descriptors.  blkdone() hears when it
+// finishes; virtio_disk_notify() tells the device to start.
+int
+virtio_disk_start(struct buf *b, int n, int write)
+{
+  struct disk *dk = &disk[DISK(b->dev)];
+  uint64 sector = b->blockno * (BSIZE / 512);
+  struct virtq_desc *d[MAXMERGE+2];
+  uint16 next[MAXMERGE+2];
+  struct buf *bn;
+  int i, head;
 
-  // allocate the three descriptors.
-  int idx[3];
-  while(1){
-    if(alloc3_desc(idx) == 0) {
-      break;
+  // the spec's Section 5.2 says that legacy block operations use
+  // a descriptor for type/reserved/sector, then the data, here
+  // one descriptor per block, then one for a 1-byte status
+  // result.  they are either a chain in desc[] or one
+  // row of indir[].
+  int idx[MAXMERGE+2];
+  if(n > virtio_disk_max(DISK(b->dev)))
+    panic("virtio_disk_start");
+  if(dk->indirect){
+    if((head = alloc_desc(dk)) < 0)
+      return -1;
+    for(i = 0; i < n + 2; i++){
+      d[i] = &dk->indir[head][i];
+      next[i] = i + 1;
+    }
+    dk->desc[head].addr = (uint64) dk->indir[head];
+    dk->desc[head].len = (n + 2) * sizeof(struct virtq_desc);
+    dk->desc[head].flags = VRING_DESC_F_INDIRECT;
+    dk->desc[head].next = 0;
+  } else {
+    if(allocn_desc(dk, idx, n + 2) < 0)
+      return -1;
+    head = idx[0];
+    for(i = 0; i < n + 2; i++){
+      d[i] = &dk->desc[idx[i]];
+      next[i] = i + 1 < n + 2 ? idx[i+1] : 0;
     }
-    sleep(&disk.free[0], &disk.vdisk_lock);
   }
 
-  // format the three descriptors.
+  // format the descriptors.
   // qemu's virtio-blk.c reads them.
 
-  struct virtio_blk_req *buf0 = &disk.ops[idx[0]];
+  struct virtio_blk_req *buf0 = &dk->ops[head];
 
   if(write)
     buf0->type = VIRTIO_BLK_T_OUT; // write the disk
@@ -232,84 +300,124 @@ virtio_disk_rw(struct buf *b, int write)
   buf0->reserved = 0;
   buf0->sector = sector;
 
-  disk.desc[idx[0]].addr = (uint64) buf0;
-  disk.desc[idx[0]].len = sizeof(struct virtio_blk_req);
-  disk.desc[idx[0]].flags = VRING_DESC_F_NEXT;
-  disk.desc[idx[0]].next = idx[1];
+  d[0]->addr = (uint64) buf0;
+  d[0]->len = sizeof(struct virtio_blk_req);
+  d[0]->flags = VRING_DESC_F_NEXT;
+  d[0]->next = next[0];
 
-  disk.desc[idx[1]].addr = (uint64) b->data;
-  disk.desc[idx[1]].len = BSIZE;
-  if(write)
-    disk.desc[idx[1]].flags = 0; // device reads b->data
-  else
-    disk.desc[idx[1]].flags = VRING_DESC_F_WRITE; // device writes b->data
-  disk.desc[idx[1]].flags |= VRING_DESC_F_NEXT;
-  disk.desc[idx[1]].next = idx[2];
+  for(i = 1, bn = b; i <= n; i++, bn = bn->qnext){
+    d[i]->addr = (uint64) bn->data;
+    d[i]->len = BSIZE;
+    if(write)
+      d[i]->flags = 0; // device reads bn->data
+    else
+      d[i]->flags = VRING_DESC_F_WRITE; // device writes bn->data
+    d[i]->flags |= VRING_DESC_F_NEXT;
+    d[i]->next = next[i];
+  }
 
-  disk.info[idx[0]].status = 0xff; // device writes 0 on success
-  disk.desc[idx[2]].addr = (uint64) &disk.info[idx[0]].status;
-  disk.desc[idx[2]].len = 1;
-  disk.desc[idx[2]].flags = VRING_DESC_F_WRITE; // device writes the status
-  disk.desc[idx[2]].next = 0;
+  dk->info[head].status = 0xff; // device writes 0 on success
+  d[n+1]->addr = (uint64) &dk->info[head].status;
+  d[n+1]->len = 1;
+  d[n+1]->flags = VRING_DESC_F_WRITE; // device writes the status
+  d[n+1]->next = 0;
 
-  // record struct buf for virtio_disk_intr().
-  b->disk = 1;
-  disk.info[idx[0]].b = b;
+  // record the request for virtio_disk_intr().
+  dk->info[head].b = b;
+  dk->info[head].n = n;
+  dk->info[head].write = write;
 
   // tell the device the first index in our chain of descriptors.
-  disk.avail->ring[disk.avail->idx % NUM] = idx[0];
+  dk->avail->ring[dk->avail->idx % NUM] = head;
 
   __sync_synchronize();
 
   // tell the device another avail ring entry is available.
-  disk.avail->idx += 1; // not % NUM ...
+  dk->avail->idx += 1; // not % NUM ...
 
   __sync_synchronize();
+  return 0;
+}
+
+// Tell disk n about the requests started so far; one
+// notification covers a batch.
+void
+virtio_disk_notify(int n)
+{
+  struct disk *d = &disk[n];
 
   *R(VIRTIO_MMIO_QUEUE_NOTIFY) = 0; // value is queue number
+}
 
-  // Wait for virtio_disk_intr() to say request has finished.
-  while(b->disk == 1) {
-    sleep(b, &disk.vdisk_lock);
-  }
+// Retire every request in the used ring.
+static void
+virtio_disk_complete(struct disk *d)
+{
+  while(d->used_idx != d->used->idx){
+    __sync_synchronize();
+    int id = d->used->ring[d->used_idx % NUM].id;
+
+    if(d->info[id].status != 0)
+      panic("virtio_disk_intr status");
 
-  disk.info[idx[0]].b = 0;
-  free_chain(idx[0]);
+    struct buf *b = d->info[id].b;
+    d->info[id].b = 0;
+    free_chain(d, id);
+    blkdone(b, d->info[id].n, d->info[id].write);
+
+    d->used_idx += 1;
+  }
+}
 
-  release(&disk.vdisk_lock);
+// Retire what the device has finished without waiting for its
+// interrupt, for a polled wait.  The interrupt may then find
+// nothing to do, which is harmless.  Caller holds the queue
+// lock.
+void
+virtio_disk_poll(int n)
+{
+  __sync_synchronize();
+  virtio_disk_complete(&disk[n]);
 }
 
+// Called by blkintr() in disk n's interrupt itself.
 void
-virtio_disk_intr()
+virtio_disk_ack(int n)
 {
-  acquire(&disk.vdisk_lock);
+  struct disk *d = &disk[n];
 
   // the device won't raise another interrupt until we tell it
   // we've seen this interrupt, which the following line does.
   // this may race with the device writing new entries to
   // the "used" ring, in which case we may process the new
-  // completion entries in this interrupt, and have nothing to do
-  // in the next interrupt, which is harmless.
+  // completion entries after this interrupt, and have nothing to
+  // do after the next, which is harmless.
   *R(VIRTIO_MMIO_INTERRUPT_ACK) = *R(VIRTIO_MMIO_INTERRUPT_STATUS) & 0x3;
+}
+
+// Called by blkcomplete() after an interrupt, which then starts
+// more requests in the descriptors this frees.  Caller holds
+// disk n's queue lock.
+void
+virtio_disk_intr(int n)
+{
+  struct disk *d = &disk[n];
 
   __sync_synchronize();
 
-  // the device increments disk.used->idx when it
+  // the device increments d->used->idx when it
   // adds an entry to the used ring.
-
-  while(disk.used_idx != disk.used->idx){
+  //
+  // coalesce: ask the device not to interrupt while we
+  // drain the ring, then look once more after re-enabling
+  // interrupts, so a burst of completions costs one interrupt.
+  for(;;){
+    d->avail->flags = VRING_AVAIL_F_NO_INTERRUPT;
     __sync_synchronize();
-    int id = disk.used->ring[disk.used_idx % NUM].id;
-
-    if(disk.info[id].status != 0)
-      panic("virtio_disk_intr status");
-
-    struct buf *b = disk.info[id].b;
-    b->disk = 0;   // disk is done with buf
-    wakeup(b);
-
-    disk.used_idx += 1;
+    virtio_disk_complete(d);
+    d->avail->flags = 0;
+    __sync_synchronize();
+    if(d->used_idx == d->used->idx)
+      break;
   }
-
-  release(&disk.vdisk_lock);
 }
@@ -5,6 +5,9 @@
 #include "riscv.h"
 #include "defs.h"
 #include "fs.h"
+#include "spinlock.h"
+#include "proc.h"
+#include "fcntl.h"
 
 /*
  * the kernel's page table.
@@ -15,6 +18,13 @@ extern char etext[];  // kernel.ld sets this to end of kernel code.
 
 extern char trampoline[]; // trampoline.S
 
+// A page of zeros that all reads of untouched heap share,
+// copy-on-write; it keeps the reference kvminit() took, so
+// uvmcow() always copies it.
+char *zeropage;
+
+static pte_t *walklevel(pagetable_t, uint64, int, int, int*);
+
 // Make a direct-map page table for the kernel.
 pagetable_t
 kvmmake(void)
@@ -28,11 +38,14 @@ kvmmake(void)
   kvmmap(kpgtbl, UART0, UART0, PGSIZE, PTE_R | PTE_W);
 
   // virtio mmio disk interface
-  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, PGSIZE, PTE_R | PTE_W);
+  kvmmap(kpgtbl, VIRTIO0, VIRTIO0, NDISK*PGSIZE, PTE_R | PTE_W);
 
   // PLIC
   kvmmap(kpgtbl, PLIC, PLIC, 0x400000, PTE_R | PTE_W);
 
+  // CLINT, for kick() to interrupt idle CPUs
+  kvmmap(kpgtbl, CLINT, CLINT, 0x10000, PTE_R | PTE_W);
+
   // map kernel text executable and read-only.
   kvmmap(kpgtbl, KERNBASE, KERNBASE, (uint64)etext-KERNBASE, PTE_R | PTE_X);
 
@@ -54,15 +67,84 @@ void
 kvminit(void)
 {
   kernel_pagetable = kvmmake();
+  zeropage = kalloc();
+  memset(zeropage, 0, PGSIZE);
 }
 
+// Address space identifiers for user page tables.  The
+// kernel's page table uses ASID 0 and user page tables get
+// 1 .. max, so entering and leaving the kernel needs no TLB
+// flush.  ASIDs are handed out in order and never reused
+// within a generation; when they run out, a new generation
+// starts, and each CPU flushes its whole TLB before it next
+// uses one.  With no ASIDs (max == 0) every page table is ASID
+// 0, and trampoline.S flushes on each switch as xv6 always did.
+static struct {
+  struct spinlock lock;
+  uint gen;                 // current generation, from 1
+  uint next;                // next ASID of this generation
+  uint max;                 // largest ASID the hardware keeps
+} asids;
+
 // Switch h/w page table register to the kernel's page table,
-// and enable paging.
+// and enable paging.  The first CPU also finds out how many
+// ASID bits satp has, by writing them all and reading back
+// those that stuck.
 void
 kvminithart()
 {
   w_satp(MAKE_SATP(kernel_pagetable));
   sfence_vma();
+  if(cpuid() == 0){
+    initlock(&asids.lock, "asid");
+    w_satp(MAKE_SATP(kernel_pagetable) | SATP_ASID(SATP_ASIDMASK));
+    asids.max = (r_satp() >> SATP_ASIDSHIFT) & SATP_ASIDMASK;
+    w_satp(MAKE_SATP(kernel_pagetable));
+    sfence_vma();
+    asids.gen = 1;
+    asids.next = 1;
+  }
+}
+
+// Make sure g's page table has an ASID of the current
+// generation, and that this CPU's TLB holds nothing stale
+// for it, before a return to user space.  Returns the ASID.
+// g->asid holds the generation above the ASID, so that one
+// load reads both.  Interrupts must be off.
+uint64
+uvmasid(struct proc *g)
+{
+  struct cpu *c = mycpu();
+  uint gen, bit = 1 << cpuid();
+  uint64 a;
+
+  if(asids.max == 0)
+    return 0;
+  a = __atomic_load_n(&g->asid, __ATOMIC_ACQUIRE);
+  if(a >> 32 != __atomic_load_n(&asids.gen, __ATOMIC_ACQUIRE)){
+    acquire(&asids.lock);
+    if((a = g->asid) >> 32 != asids.gen){
+      if(asids.next > asids.max){
+        asids.gen++;
+        asids.next = 1;
+      }
+      // no CPU has entries for a new ASID in this generation.
+      a = (uint64)asids.gen << 32 | asids.next++;
+      g->tlbstale = 0;
+      __atomic_store_n(&g->asid, a, __ATOMIC_RELEASE);
+    }
+    release(&asids.lock);
+  }
+  gen = a >> 32;
+  if(c->asidgen != gen){
+    __sync_fetch_and_and(&g->tlbstale, ~bit);
+    sfence_vma();
+    c->asidgen = gen;
+  } else if(g->tlbstale & bit){
+    __sync_fetch_and_and(&g->tlbstale, ~bit);
+    sfence_vma_asid(a & SATP_ASIDMASK);
+  }
+  return a & SATP_ASIDMASK;
 }
 
 // Return the address of the PTE in page table pagetable
@@ -77,15 +159,34 @@ kvminithart()
 //   21..29 -- 9 bits of level-1 index.
 //   12..20 -- 9 bits of level-0 index.
 //    0..11 -- 12 bits of byte offset within the page.
+// A leaf PTE in a level-1 page-table page maps a whole
+// 2MB megapage; walk() returns such a PTE if it finds one.
 pte_t *
 walk(pagetable_t pagetable, uint64 va, int alloc)
 {
+  return walklevel(pagetable, va, alloc, 0, 0);
+}
+
+// Like walk(), but return the PTE at level target (for
+// mapping a megapage at level 1), or the superpage leaf
+// above it.  Sets *levelp, if not 0, to the level of the
+// PTE returned.
+static pte_t *
+walklevel(pagetable_t pagetable, uint64 va, int alloc, int target, int *levelp)
+{
+  int level;
+
   if(va >= MAXVA)
     panic("walk");
 
-  for(int level = 2; level > 0; level--) {
+  for(level = 2; level > target; level--) {
     pte_t *pte = &pagetable[PX(level, va)];
     if(*pte & PTE_V) {
+      if(PTE_LEAF(*pte)){
+        if(levelp)
+          *levelp = level;
+        return pte;
+      }
       pagetable = (pagetable_t)PTE2PA(*pte);
     } else {
       if(!alloc || (pagetable = (pde_t*)kalloc()) == 0)
@@ -94,7 +195,9 @@ walk(pagetable_t pagetable, uint64 va, int alloc)
       *pte = PA2PTE(pagetable) | PTE_V;
     }
   }
-  return &pagetable[PX(0, va)];
+  if(levelp)
+    *levelp = target;
+  return &pagetable[PX(target, va)];
 }
 
 // Look up a virtual address, return the physical address,
@@ -105,18 +208,20 @@ walkaddr(pagetable_t pagetable, uint64 va)
 {
   pte_t *pte;
   uint64 pa;
+  int level;
 
   if(va >= MAXVA)
     return 0;
 
-  pte = walk(pagetable, va, 0);
+  pte = walklevel(pagetable, va, 0, 0, &level);
   if(pte == 0)
     return 0;
   if((*pte & PTE_V) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
-  pa = PTE2PA(*pte);
+  // the page within a superpage.
+  pa = PTE2PA(*pte) + (PGROUNDDOWN(va) & (LEVELSIZE(level) - 1));
   return pa;
 }
 
@@ -134,10 +239,14 @@ kvmmap(pagetable_t kpgtbl, uint64 va, uint64 pa, uint64 sz, int perm)
 // physical addresses starting at pa. va and size might not
 // be page-aligned. Returns 0 on success, -1 if walk() couldn't
 // allocate a needed page-table page.
+// Kernel mappings use a 2MB megapage wherever va and pa are
+// both aligned to one and the range covers it, which saves
+// page-table pages and TLB entries for the direct map.  User
+// memory is always managed in PGSIZE pages.
 int
 mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
 {
-  uint64 a, last;
+  uint64 a, last, step;
   pte_t *pte;
 
   if(size == 0)
@@ -146,44 +255,99 @@ mappages(pagetable_t pagetable, uint64 va, uint64 size, uint64 pa, int perm)
   a = PGROUNDDOWN(va);
   last = PGROUNDDOWN(va + size - 1);
   for(;;){
-    if((pte = walk(pagetable, a, 1)) == 0)
+    if((perm & PTE_U) == 0 && a % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       last - a >= SUPERPGSIZE - PGSIZE){
+      step = SUPERPGSIZE;
+      pte = walklevel(pagetable, a, 1, 1, 0);
+    } else {
+      step = PGSIZE;
+      pte = walk(pagetable, a, 1);
+    }
+    if(pte == 0)
       return -1;
     if(*pte & PTE_V)
       panic("mappages: remap");
     *pte = PA2PTE(pa) | perm | PTE_V;
-    if(a == last)
+    if(last - a < step)
       break;
-    a += PGSIZE;
-    pa += PGSIZE;
+    a += step;
+    pa += step;
   }
   return 0;
 }
 
+// Pages to be freed together by kfreen().
+#define NFREEBATCH 32
+
+struct freebatch {
+  void *pa[NFREEBATCH];
+  int n;
+};
+
+static void
+fbflush(struct freebatch *fb)
+{
+  if(fb->n > 0)
+    kfreen(fb->pa, fb->n);
+  fb->n = 0;
+}
+
+static void
+fbadd(struct freebatch *fb, void *pa)
+{
+  fb->pa[fb->n++] = pa;
+  if(fb->n == NFREEBATCH)
+    fbflush(fb);
+}
+
 // Remove npages of mappings starting from va. va must be
-// page-aligned. The mappings must exist.
+// page-aligned. Pages that were never mapped (e.g. lazily
+// allocated heap pages that were never touched) are skipped.
 // Optionally free the physical memory.
+// Walks down to each level-0 page table once, not once per
+// page, and frees a level-0 table whose whole 2MB span is
+// removed.
 void
 uvmunmap(pagetable_t pagetable, uint64 va, uint64 npages, int do_free)
 {
-  uint64 a;
-  pte_t *pte;
+  uint64 a, end, next;
+  pte_t *pde, *pte;
+  pagetable_t pt;
+  struct freebatch fb;
 
   if((va % PGSIZE) != 0)
     panic("uvmunmap: not aligned");
 
-  for(a = va; a < va + npages*PGSIZE; a += PGSIZE){
-    if((pte = walk(pagetable, a, 0)) == 0)
-      panic("uvmunmap: walk");
-    if((*pte & PTE_V) == 0)
-      panic("uvmunmap: not mapped");
-    if(PTE_FLAGS(*pte) == PTE_V)
-      panic("uvmunmap: not a leaf");
-    if(do_free){
-      uint64 pa = PTE2PA(*pte);
-      kfree((void*)pa);
+  fb.n = 0;
+  end = va + npages*PGSIZE;
+  for(a = va; a < end; a = next){
+    next = (a + SUPERPGSIZE) & ~(SUPERPGSIZE - 1);
+    if((pde = walklevel(pagetable, a, 0, 1, 0)) == 0 || (*pde & PTE_V) == 0)
+      continue;
+    if(PTE_LEAF(*pde))
+      panic("uvmunmap: superpage");
+    pt = (pagetable_t)PTE2PA(*pde);
+    for(; a < next && a < end; a += PGSIZE){
+      pte = &pt[PX(0, a)];
+      if((*pte & PTE_V) == 0){
+        if(*pte & PTE_SWAP)
+          swapfree(PTE2SLOT(*pte));
+        *pte = 0;
+        continue;
+      }
+      if(PTE_FLAGS(*pte) == PTE_V)
+        panic("uvmunmap: not a leaf");
+      if(do_free)
+        fbadd(&fb, (void*)PTE2PA(*pte));
+      *pte = 0;
+    }
+    if(a == next && next - SUPERPGSIZE >= va){
+      // every PTE in pt was removed.
+      *pde = 0;
+      fbadd(&fb, pt);
     }
-    *pte = 0;
   }
+  fbflush(&fb);
 }
 
 // create an empty user page table.
@@ -215,6 +379,17 @@ uvminit(pagetable_t pagetable, uchar *src, uint sz)
   memmove(mem, src, sz);
 }
 
+// kalloc() found no free page: unless the caller holds a
+// spinlock, and so can't wait for the disk, reclaim some.
+// Returns 0 if the caller should try again.
+static int
+uvmnomem(void)
+{
+  if(holdingany() || kfreepages() > 0)
+    return -1;
+  return reclaim(NRECLAIM) > 0 ? 0 : -1;
+}
+
 // Allocate PTEs and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 uint64
@@ -228,7 +403,8 @@ uvmalloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
 
   oldsz = PGROUNDUP(oldsz);
   for(a = oldsz; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    if((mem = kalloc()) == 0 && uvmnomem() == 0)
+      mem = kalloc();
     if(mem == 0){
       uvmdealloc(pagetable, a, oldsz);
       return 0;
@@ -261,64 +437,80 @@ uvmdealloc(pagetable_t pagetable, uint64 oldsz, uint64 newsz)
   return newsz;
 }
 
-// Recursively free page-table pages.
-// All leaf mappings must already have been removed.
-void
-freewalk(pagetable_t pagetable)
+// Recursively free the page-table page pagetable at level,
+// which maps virtual addresses from va, and the user pages
+// it maps.  They must all be below sz, or be mmap() regions.
+static void
+freewalk(pagetable_t pagetable, int level, uint64 va, uint64 sz, struct freebatch *fb)
 {
   // there are 2^9 = 512 PTEs in a page table.
   for(int i = 0; i < 512; i++){
     pte_t pte = pagetable[i];
-    if((pte & PTE_V) && (pte & (PTE_R|PTE_W|PTE_X)) == 0){
-      // this PTE points to a lower-level page table.
-      uint64 child = PTE2PA(pte);
-      freewalk((pagetable_t)child);
+    uint64 a = va + i * LEVELSIZE(level);
+    if((pte & PTE_V) == 0){
+      if(pte & PTE_SWAP)
+        swapfree(PTE2SLOT(pte));
       pagetable[i] = 0;
-    } else if(pte & PTE_V){
+      continue;
+    }
+    if(PTE_LEAF(pte) == 0){
+      // this PTE points to a lower-level page table.
+      freewalk((pagetable_t)PTE2PA(pte), level - 1, a, sz, fb);
+    } else if(level > 0 || (a >= sz && a < MMAPBASE)){
       panic("freewalk: leaf");
+    } else {
+      fbadd(fb, (void*)PTE2PA(pte));
     }
+    pagetable[i] = 0;
   }
-  kfree((void*)pagetable);
+  fbadd(fb, pagetable);
 }
 
-// Free user memory pages,
-// then free page-table pages.
+// Free user memory pages and page-table pages, in one
+// pass over the page table.
 void
 uvmfree(pagetable_t pagetable, uint64 sz)
 {
-  if(sz > 0)
-    uvmunmap(pagetable, 0, PGROUNDUP(sz)/PGSIZE, 1);
-  freewalk(pagetable);
+  struct freebatch fb;
+
+  fb.n = 0;
+  freewalk(pagetable, 2, 0, PGROUNDUP(sz), &fb);
+  fbflush(&fb);
 }
 
-// Given a parent process's page table, copy
-// its memory into a child's page table.
-// Copies both the page table and the
-// physical memory.
+// Given a parent process's page table, make the
+// child share its memory.  Writable pages become
+// read-only copy-on-write pages in both page tables,
+// and each shared page gains a reference; a swapped-out
+// page's slot does likewise.
 // returns 0 on success, -1 on failure.
 // frees any allocated pages on failure.
 int
 uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
 {
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint64 pa, i;
   uint flags;
-  char *mem;
 
   for(i = 0; i < sz; i += PGSIZE){
     if((pte = walk(old, i, 0)) == 0)
-      panic("uvmcopy: pte should exist");
-    if((*pte & PTE_V) == 0)
-      panic("uvmcopy: page not present");
+      continue;   // never touched lazily allocated page
+    if((*pte & PTE_V) == 0){
+      if(*pte & PTE_SWAP){
+        if((npte = walk(new, i, 1)) == 0)
+          goto err;
+        *npte = *pte;
+        swapdup(PTE2SLOT(*pte));
+      }
+      continue;
+    }
+    if(*pte & PTE_W)
+      *pte = (*pte & ~PTE_W) | PTE_COW;
     pa = PTE2PA(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
-      goto err;
-    memmove(mem, (char*)pa, PGSIZE);
-    if(mappages(new, i, PGSIZE, (uint64)mem, flags) != 0){
-      kfree(mem);
+    if(mappages(new, i, PGSIZE, pa, flags) != 0)
       goto err;
-    }
+    kincref((void*)pa);
   }
   return 0;
 
@@ -327,6 +519,321 @@ uvmcopy(pagetable_t old, pagetable_t new, uint64 sz)
   return -1;
 }
 
+// Give the process a private, writable copy of the
+// copy-on-write page containing va.  If no one else
+// shares the page, just make it writable again.
+// Returns 0 on success, -1 if va is not a COW page
+// or memory is exhausted.
+int
+uvmcow(pagetable_t pagetable, uint64 va)
+{
+  pte_t *pte;
+  uint64 pa;
+  uint flags;
+  char *mem;
+
+  if(va >= MAXVA)
+    return -1;
+  pte = walk(pagetable, va, 0);
+  if(pte == 0)
+    return -1;
+  if((*pte & (PTE_V|PTE_U|PTE_COW)) != (PTE_V|PTE_U|PTE_COW))
+    return -1;
+  pa = PTE2PA(*pte);
+  flags = (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  if(kgetref((void*)pa) == 1){
+    *pte = PA2PTE(pa) | flags;
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memmove(mem, (char*)pa, PGSIZE);
+  *pte = PA2PTE(mem) | flags;
+  kfree((void*)pa);
+  return 0;
+}
+
+// Map a zeroed page at va if va lies below sz, the process
+// size, but was never mapped: sbrk() grows the heap without
+// allocating memory.  A read gets the shared zero page,
+// copy-on-write; only a write allocates.  Returns 0 on
+// success, -1 if va is not a lazily allocated address or
+// memory is exhausted.
+int
+uvmlazy(pagetable_t pagetable, uint64 va, uint64 sz, int write)
+{
+  pte_t *pte;
+  char *mem;
+
+  if(va >= sz || va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  pte = walk(pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_SWAP)))
+    return -1;
+  if(!write){
+    if(mappages(pagetable, va, PGSIZE, (uint64)zeropage, PTE_COW|PTE_X|PTE_R|PTE_U) != 0)
+      return -1;
+    kincref(zeropage);
+    return 0;
+  }
+  if((mem = kalloc()) == 0)
+    return -1;
+  memset(mem, 0, PGSIZE);
+  if(mappages(pagetable, va, PGSIZE, (uint64)mem, PTE_W|PTE_X|PTE_R|PTE_U) != 0){
+    kfree(mem);
+    return -1;
+  }
+  return 0;
+}
+
+// Return p's vma containing va, or 0.
+struct vma*
+vmafind(struct proc *p, uint64 va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->end && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Map the page at va of one of p's vmas on first touch.
+// p is a group leader; see uvmfault().
+// Pages wholly inside the file's part of the vma are the
+// page cache's.  A MAP_SHARED vma maps them as they are, so
+// stores reach the cache page that munmap() writes back;
+// otherwise they are read-only, and copy-on-write if the vma
+// is writable.  A page that holds the end of the file's
+// part, or none of it, is private.  Returns 0 on success,
+// -1 if va is in no vma, is already mapped, or memory is
+// exhausted.
+int
+uvmfile(struct proc *p, uint64 va)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint64 a;
+  uint n;
+  char *mem;
+  int perm;
+
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  if((v = vmafind(p, va)) == 0)
+    return -1;
+  // PROT_NONE: never mapped, since a PTE with none of R, W, X
+  // would point to another level of page table.
+  if((v->perm & (PTE_R|PTE_W|PTE_X)) == 0)
+    return -1;
+  pte = walk(p->pagetable, va, 0);
+  if(pte && (*pte & (PTE_V|PTE_SWAP)))
+    return -1;
+
+  perm = v->perm | PTE_U;
+  a = va - v->start;
+  if(v->ip && a + PGSIZE <= v->filesz){
+    mem = (v->flags & MAP_SHARED) ? pcgetshared(v->ip, v->off + a) :
+                                    pcget(v->ip, v->off + a);
+    if(mem == 0)
+      return -1;
+    if((perm & PTE_W) && (v->flags & MAP_SHARED) == 0)
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    if(v->ip && a < v->filesz){
+      n = v->filesz - a;
+      if(pcread(v->ip, mem, v->off + a, n) != n){
+        kfree(mem);
+        return -1;
+      }
+    }
+  }
+  // another thread may have mapped va while we slept.
+  acquire(&p->slock);
+  pte = walk(p->pagetable, va, 0);
+  if((pte && (*pte & (PTE_V|PTE_SWAP))) ||
+     mappages(p->pagetable, va, PGSIZE, (uint64)mem, perm) != 0){
+    release(&p->slock);
+    kfree(mem);
+    return pte && (*pte & (PTE_V|PTE_SWAP)) ? 0 : -1;
+  }
+  release(&p->slock);
+  return 0;
+}
+
+// Handle a page fault of p at va, with scause cause (12
+// fetch, 13 load, 15 store): give it a copy of a copy-on-write
+// page, bring back a swapped-out page, map a page of a vma, or
+// a page of lazily allocated heap.  Others of p's threads may
+// be faulting too, so a page that is already mapped as needed
+// counts as handled.  If memory runs out, reclaims some and
+// lets p retry.  A caller holding a spinlock, as copyin() and
+// copyout() may be, can't wait to read a page of a file, so
+// such a fault fails.
+// Returns 0 if p can retry the access, -1 if it is bad.
+int
+uvmfault(struct proc *p, uint64 va, int cause)
+{
+  struct proc *g = p->group;
+  struct vma *v;
+  pte_t *pte;
+  int r, need, swapped;
+
+  p->nfault++;
+  if(va >= MAXVA)
+    return -1;
+  va = PGROUNDDOWN(va);
+  need = PTE_V | PTE_U | (cause == 12 ? PTE_X : cause == 13 ? PTE_R : PTE_W);
+  acquire(&g->slock);
+  pte = walk(g->pagetable, va, 0);
+  if(pte && (*pte & need) == need){
+    // this CPU may hold an old entry for va.
+    sfence_vma_page(va, g->asid & SATP_ASIDMASK);
+    release(&g->slock);
+    return 0;
+  }
+  if(cause == 15 && pte && (*pte & PTE_COW)){
+    // others' entries for va still lead to the shared page.
+    if((r = uvmcow(g->pagetable, va)) == 0)
+      tlbshootdown(g, va, PGSIZE);
+    release(&g->slock);
+    return r == 0 ? 0 : uvmnomem();
+  }
+  if(pte && (*pte & PTE_V)){
+    // mapped, but not for this access.
+    release(&g->slock);
+    return -1;
+  }
+  swapped = pte && (*pte & PTE_SWAP);
+  release(&g->slock);
+
+  if(swapped)
+    r = swapin(g, va);
+  else if((v = vmafind(g, va)) != 0){
+    if(v->ip && holdingany())
+      return -1;
+    r = uvmfile(g, va);
+  }
+  else if(cause == 12 || va >= g->sz)
+    return -1;
+  else {
+    acquire(&g->slock);
+    pte = walk(g->pagetable, va, 0);
+    if(pte && (*pte & (PTE_V|PTE_SWAP)))
+      r = 0;  // another thread got here first
+    else
+      r = uvmlazy(g->pagetable, va, g->sz, cause == 15);
+    release(&g->slock);
+  }
+  return r == 0 ? 0 : uvmnomem();
+}
+
+// Give child references to each of parent's vmas.
+void
+vmadup(struct vma *child, struct vma *parent)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    child[i] = parent[i];
+    if(child[i].ip)
+      idup(child[i].ip);
+  }
+}
+
+// Drop a vma.  Must be called inside a transaction,
+// since iput() might free a file unlinked while it was mapped.
+void
+vmaclear(struct vma *v)
+{
+  if(v->ip)
+    iput(v->ip);
+  v->ip = 0;
+  v->start = v->end = 0;
+}
+
+// Drop a process's vmas.  Must be called inside a transaction.
+void
+vmaput(struct vma *vma)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++)
+    vmaclear(&vma[i]);
+}
+
+// Like walkaddr(), but first maps a file-backed, swapped-out
+// or lazily allocated page of the current process at va if
+// needed, as a fault with scause cause would.
+static uint64
+uvmaddr(pagetable_t pagetable, uint64 va, int cause)
+{
+  struct proc *p = myproc();
+  uint64 pa;
+
+  while((pa = walkaddr(pagetable, va)) == 0){
+    if(pagetable != p->pagetable || uvmfault(p, va, cause) != 0)
+      return 0;
+  }
+  return pa;
+}
+
+// Fault in the current process's pages in [va, va+n), to be
+// written if write, ahead of a copyin() or copyout() made
+// holding a spinlock, which can't wait for a file's page.
+// Stops at the first page that can't be, leaving the copy to
+// fail there.  Caller must hold no spinlock.
+void
+uvmprefault(uint64 va, int n, int write)
+{
+  struct proc *p = myproc();
+  uint64 a, end;
+  pte_t *pte;
+  int need;
+
+  if(n <= 0)
+    return;
+  end = va + n;
+  if(end < va || end > MAXVA)
+    end = MAXVA;
+  need = PTE_V | PTE_U | (write ? PTE_W : PTE_R);
+  for(a = PGROUNDDOWN(va); a < end; a += PGSIZE){
+    pte = walk(p->pagetable, a, 0);
+    if(pte && (*pte & need) == need)
+      continue;
+    if(uvmfault(p, a, write ? 15 : 13) != 0)
+      return;
+  }
+}
+
+// The kernel is about to use the current process's pages in
+// pagetable by physical address: keep reclaim() from swapping
+// them out meanwhile (see swap.c).  Returns what to pass to
+// uvmunpin().
+static struct proc*
+uvmpin(pagetable_t pagetable)
+{
+  struct proc *p = myproc();
+
+  if(p == 0 || pagetable != p->pagetable)
+    return 0;
+  // a full barrier, before the PTEs are read.
+  __sync_fetch_and_add(&p->group->npinned, 1);
+  return p->group;
+}
+
+static void
+uvmunpin(struct proc *g)
+{
+  if(g)
+    __sync_fetch_and_sub(&g->npinned, 1);
+}
+
 // mark a PTE invalid for user access.
 // used by exec for the user stack guard page.
 void
@@ -347,12 +854,29 @@ int
 copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
 {
   uint64 n, va0, pa0;
+  pte_t *pte;
+  struct proc *g;
 
+  g = uvmpin(pagetable);
   while(len > 0){
     va0 = PGROUNDDOWN(dstva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
-      return -1;
+    if(va0 >= MAXVA)
+      goto bad;
+    pte = walk(pagetable, va0, 0);
+    if(pte == 0 || (*pte & (PTE_V|PTE_U|PTE_W)) != (PTE_V|PTE_U|PTE_W)){
+      // not mapped yet, or copy-on-write.
+      if(uvmaddr(pagetable, va0, 15) == 0)
+        goto bad;
+      pte = walk(pagetable, va0, 0);
+      if(*pte & PTE_COW){
+        if(pagetable != myproc()->pagetable || uvmfault(myproc(), va0, 15) < 0)
+          goto bad;
+      }
+      if((*pte & PTE_W) == 0)
+        goto bad;  // such as the USYSCALL and USHARED pages
+    }
+    pa0 = PTE2PA(*pte);
+    *pte |= PTE_D;  // for munmap() of a MAP_SHARED page
     n = PGSIZE - (dstva - va0);
     if(n > len)
       n = len;
@@ -362,7 +886,12 @@ copyout(pagetable_t pagetable, uint64 dstva, char *src, uint64 len)
     src += n;
     dstva = va0 + PGSIZE;
   }
+  uvmunpin(g);
   return 0;
+
+ bad:
+  uvmunpin(g);
+  return -1;
 }
 
 // Copy from user to kernel.
@@ -372,12 +901,16 @@ int
 copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 {
   uint64 n, va0, pa0;
+  struct proc *g;
 
+  g = uvmpin(pagetable);
   while(len > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
-    if(pa0 == 0)
+    pa0 = uvmaddr(pagetable, va0, 13);
+    if(pa0 == 0){
+      uvmunpin(g);
       return -1;
+    }
     n = PGSIZE - (srcva - va0);
     if(n > len)
       n = len;
@@ -387,6 +920,7 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
     dst += n;
     srcva = va0 + PGSIZE;
   }
+  uvmunpin(g);
   return 0;
 }
 
@@ -397,35 +931,33 @@ copyin(pagetable_t pagetable, char *dst, uint64 srcva, uint64 len)
 int
 copyinstr(pagetable_t pagetable, char *dst, uint64 srcva, uint64 max)
 {
-  uint64 n, va0, pa0;
+  uint64 n, len, va0, pa0;
   int got_null = 0;
+  struct proc *g;
 
+  g = uvmpin(pagetable);
   while(got_null == 0 && max > 0){
     va0 = PGROUNDDOWN(srcva);
-    pa0 = walkaddr(pagetable, va0);
+    pa0 = uvmaddr(pagetable, va0, 13);
     if(pa0 == 0)
-      return -1;
+      break;
     n = PGSIZE - (srcva - va0);
     if(n > max)
       n = max;
 
     char *p = (char *) (pa0 + (srcva - va0));
-    while(n > 0){
-      if(*p == '\0'){
-        *dst = '\0';
-        got_null = 1;
-        break;
-      } else {
-        *dst = *p;
-      }
-      --n;
-      --max;
-      p++;
-      dst++;
+    len = strnlen(p, n);
+    if(len < n){
+      len++;  // and the '\0'
+      got_null = 1;
     }
+    memmove(dst, p, len);
+    max -= len;
+    dst += len;
 
     srcva = va0 + PGSIZE;
   }
+  uvmunpin(g);
   if(got_null){
     return 0;
   } else {
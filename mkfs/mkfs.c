@@ -4,6 +4,7 @@
 #include <string.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <sys/mman.h>
 
 #define stat xv6_stat  // avoid clash with host struct stat
 #include "kernel/types.h"
@@ -18,19 +19,29 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
-
-int nbitmap = FSSIZE/(BSIZE*8) + 1;
-int ninodeblocks = NINODES / IPB + 1;
+// [ boot block | sb block | log | inode blocks | free bit map | swap | data blocks ]
+//
+// The image is built in memory, in a shared mapping of the
+// image file, which starts out as a hole of zeros.  Each file
+// copied in has its data blocks reserved up front in one run,
+// with its indirect blocks after them, so that the kernel
+// reads it sequentially.
+
+uint fssize = FSSIZE;      // -s; at most FSSIZE, what the kernel takes
+uint ninodes = NINODES;    // -i
+int nbitmap;
+int ninodeblocks;
 int nlog = LOGSIZE;
-int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
+int nswap = SWAPSIZE;
+int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap, swap)
 int nblocks;  // Number of data blocks
 
 int fsfd;
+char *img;
 struct superblock sb;
-char zeroes[BSIZE];
 uint freeinode = 1;
 uint freeblock;
+uint datanext, dataend;    // the run iappend()'s data goes in
 
 
 void balloc(int);
@@ -40,6 +51,8 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void ireserve(uint size);
+void mkroot(uint rootino, struct dirent *de, int n, int index);
 void die(const char *);
 
 // convert to intel byte order
@@ -68,51 +81,99 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
-  uint rootino, inum, off;
+  int i, cc, fd, a, nent;
+  uint rootino, inum, logmode, features;
   struct dirent de;
-  char buf[BSIZE];
   struct dinode din;
+  struct dirent *ents;
+  char buf[BSIZE];
+  off_t size;
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  a = 1;
+  logmode = LOG_ORDERED;
+  features = FS_DIRINDEX|FS_INLINE;
+  for(; a < argc && argv[a][0] == '-'; a++){
+    if(strcmp(argv[a], "-l") == 0){
+      features &= ~FS_DIRINDEX;
+    } else if(strcmp(argv[a], "-b") == 0){
+      features &= ~FS_INLINE;
+    } else if(strcmp(argv[a], "-s") == 0 && a + 1 < argc){
+      fssize = atoi(argv[++a]);
+    } else if(strcmp(argv[a], "-i") == 0 && a + 1 < argc){
+      ninodes = atoi(argv[++a]);
+    } else if(strcmp(argv[a], "-j") == 0 && a + 1 < argc){
+      a++;
+      if(strcmp(argv[a], "ordered") == 0)
+        logmode = LOG_ORDERED;
+      else if(strcmp(argv[a], "data") == 0)
+        logmode = LOG_DATA;
+      else if(strcmp(argv[a], "writeback") == 0)
+        logmode = LOG_WRITEBACK;
+      else
+        argc = 0;
+    } else {
+      argc = 0;
+    }
+  }
+  if(argc < a + 1){
+    fprintf(stderr, "Usage: mkfs [-j ordered|data|writeback] [-l] [-b] [-s blocks] [-i inodes] fs.img files...\n");
+    exit(1);
+  }
+  if(fssize > FSSIZE || ninodes < ROOTINO + 2 || ninodes > 65535){
+    fprintf(stderr, "mkfs: at most %d blocks and 65535 inodes\n", FSSIZE);
     exit(1);
   }
 
+  assert(BSIZE >= SBOFF && BSIZE <= 4096 && (BSIZE & (BSIZE-1)) == 0);
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
 
-  fsfd = open(argv[1], O_RDWR|O_CREAT|O_TRUNC, 0666);
-  if(fsfd < 0)
-    die(argv[1]);
-
   // 1 fs block = 1 disk sector
-  nmeta = 2 + nlog + ninodeblocks + nbitmap;
-  nblocks = FSSIZE - nmeta;
+  nbitmap = fssize/BPB + 1;
+  ninodeblocks = ninodes / IPB + 1;
+  nmeta = 2 + nlog + ninodeblocks + nbitmap + nswap;
+  if(fssize <= nmeta){
+    fprintf(stderr, "mkfs: %d blocks leave no room for data\n", fssize);
+    exit(1);
+  }
+  nblocks = fssize - nmeta;
+
+  fsfd = open(argv[a], O_RDWR|O_CREAT|O_TRUNC, 0666);
+  if(fsfd < 0)
+    die(argv[a]);
+  if(ftruncate(fsfd, (off_t)fssize * BSIZE) < 0)
+    die("ftruncate");
+  img = mmap(0, (size_t)fssize * BSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fsfd, 0);
+  if(img == MAP_FAILED)
+    die("mmap");
+  if((ents = calloc(ninodes, sizeof(ents[0]))) == 0)
+    die("calloc");
 
   sb.magic = FSMAGIC;
-  sb.size = xint(FSSIZE);
+  sb.size = xint(fssize);
   sb.nblocks = xint(nblocks);
-  sb.ninodes = xint(NINODES);
+  sb.ninodes = xint(ninodes);
   sb.nlog = xint(nlog);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.logmode = xint(logmode);
+  sb.features = xint(features);
+  sb.bsize = xint(BSIZE);
+  sb.swapstart = xint(2+nlog+ninodeblocks+nbitmap);
+  sb.nswap = xint(nswap);
 
-  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
-         nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
+  printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u, swap blocks %u) blocks %d total %d\n",
+         nmeta, nlog, ninodeblocks, nbitmap, nswap, nblocks, fssize);
 
   freeblock = nmeta;     // the first free block that we can allocate
 
-  for(i = 0; i < FSSIZE; i++)
-    wsect(i, zeroes);
-
   memset(buf, 0, sizeof(buf));
-  memmove(buf, &sb, sizeof(sb));
-  wsect(1, buf);
+  memmove(buf + SBOFF % BSIZE, &sb, sizeof(sb));
+  wsect(SBOFF / BSIZE, buf);
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
@@ -127,11 +188,14 @@ main(int argc, char *argv[])
   strcpy(de.name, "..");
   iappend(rootino, &de, sizeof(de));
 
-  for(i = 2; i < argc; i++){
-    // get rid of "user/"
+  nent = 0;
+  for(i = a + 1; i < argc; i++){
+    // get rid of "user/" or "kernel/"
     char *shortname;
     if(strncmp(argv[i], "user/", 5) == 0)
       shortname = argv[i] + 5;
+    else if(strncmp(argv[i], "kernel/", 7) == 0)
+      shortname = argv[i] + 7;
     else
       shortname = argv[i];
     
@@ -149,36 +213,56 @@ main(int argc, char *argv[])
 
     inum = ialloc(T_FILE);
 
-    bzero(&de, sizeof(de));
-    de.inum = xshort(inum);
-    strncpy(de.name, shortname, DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    assert(nent < ninodes);
+    bzero(&ents[nent], sizeof(ents[nent]));
+    ents[nent].inum = xshort(inum);
+    strncpy(ents[nent].name, shortname, DIRSIZ);
+    nent++;
 
+    if((size = lseek(fd, 0, SEEK_END)) < 0 || lseek(fd, 0, SEEK_SET) < 0)
+      die(argv[i]);
+    if(size > NINLINE || !(features & FS_INLINE))
+      ireserve(size);
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
+    assert(datanext == dataend);
 
     close(fd);
   }
 
-  // fix size of root inode dir
+  // an empty /tmp, for the kernel to mount tmpfs on.
+  inum = ialloc(T_DIR);
+  bzero(&de, sizeof(de));
+  de.inum = xshort(inum);
+  strcpy(de.name, ".");
+  iappend(inum, &de, sizeof(de));
+  bzero(&de, sizeof(de));
+  de.inum = xshort(rootino);
+  strcpy(de.name, "..");
+  iappend(inum, &de, sizeof(de));
   rinode(rootino, &din);
-  off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
+  din.nlink = xshort(xshort(din.nlink) + 1);
   winode(rootino, &din);
+  assert(nent < ninodes);
+  bzero(&ents[nent], sizeof(ents[nent]));
+  ents[nent].inum = xshort(inum);
+  strcpy(ents[nent].name, "tmp");
+  nent++;
+
+  mkroot(rootino, ents, nent, (features & FS_DIRINDEX) != 0);
 
   balloc(freeblock);
 
+  if(munmap(img, (size_t)fssize * BSIZE) < 0 || close(fsfd) < 0)
+    die(argv[a]);
   exit(0);
 }
 
 void
 wsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(write(fsfd, buf, BSIZE) != BSIZE)
-    die("write");
+  assert(sec < fssize);
+  memmove(img + (size_t)sec * BSIZE, buf, BSIZE);
 }
 
 void
@@ -211,10 +295,8 @@ rinode(uint inum, struct dinode *ip)
 void
 rsect(uint sec, void *buf)
 {
-  if(lseek(fsfd, sec * BSIZE, 0) != sec * BSIZE)
-    die("lseek");
-  if(read(fsfd, buf, BSIZE) != BSIZE)
-    die("read");
+  assert(sec < fssize);
+  memmove(buf, img + (size_t)sec * BSIZE, BSIZE);
 }
 
 uint
@@ -223,6 +305,7 @@ ialloc(ushort type)
   uint inum = freeinode++;
   struct dinode din;
 
+  assert(inum < ninodes);
   bzero(&din, sizeof(din));
   din.type = xshort(type);
   din.nlink = xshort(1);
@@ -235,20 +318,84 @@ void
 balloc(int used)
 {
   uchar buf[BSIZE];
-  int i;
+  int i, b;
 
   printf("balloc: first %d blocks have been allocated\n", used);
-  assert(used < BSIZE*8);
-  bzero(buf, BSIZE);
-  for(i = 0; i < used; i++){
-    buf[i/8] = buf[i/8] | (0x1 << (i%8));
+  assert(used < nbitmap*BPB);
+  for(b = 0; b*BPB < used; b++){
+    bzero(buf, BSIZE);
+    for(i = 0; i < BPB && b*BPB + i < used; i++){
+      buf[i/8] = buf[i/8] | (0x1 << (i%8));
+    }
+    printf("balloc: write bitmap block at sector %d\n", sb.bmapstart + b);
+    wsect(sb.bmapstart + b, buf);
   }
-  printf("balloc: write bitmap block at sector %d\n", sb.bmapstart);
-  wsect(sb.bmapstart, buf);
 }
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Set aside the next run of blocks for the data of a file of
+// size bytes, about to be appended.
+void
+ireserve(uint size)
+{
+  datanext = freeblock;
+  dataend = freeblock + (size + BSIZE - 1) / BSIZE;
+  freeblock = dataend;
+  assert(freeblock <= fssize);
+}
+
+// A block for file data: the next of the reserved run, if
+// there is one left.
+uint
+dalloc(void)
+{
+  if(datanext < dataend)
+    return datanext++;
+  return freeblock++;
+}
+
+// Return the block holding block fbn of din,
+// allocating it and any indirect blocks on the way.
+uint
+bmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint x, level, n;
+
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(dalloc());
+    }
+    return xint(din->addrs[fbn]);
+  }
+  fbn -= NDIRECT;
+
+  for(level = 0, n = 1; level < NLEVEL; level++, n *= NINDIRECT){
+    if(fbn < n * NINDIRECT)
+      break;
+    fbn -= n * NINDIRECT;
+  }
+  assert(level < NLEVEL);
+
+  if(xint(din->addrs[NDIRECT+level]) == 0){
+    din->addrs[NDIRECT+level] = xint(freeblock++);
+  }
+  x = xint(din->addrs[NDIRECT+level]);
+  for(;;){
+    rsect(x, (char*)indirect);
+    if(indirect[fbn / n] == 0){
+      indirect[fbn / n] = xint(n == 1 ? dalloc() : freeblock++);
+      wsect(x, (char*)indirect);
+    }
+    x = xint(indirect[fbn / n]);
+    if(n == 1)
+      return x;
+    fbn %= n;
+    n /= NINDIRECT;
+  }
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -256,31 +403,36 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
-  uint x;
+  uint x, type;
 
   rinode(inum, &din);
   off = xint(din.size);
+  type = xshort(din.type);
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
+  // a small plain file keeps its data in addrs[] until it
+  // outgrows them, as writeblk() in kernel/fs.c does.
+  if((sb.features & xint(FS_INLINE)) && off + n <= NINLINE &&
+     (type == (T_FILE|DI_INLINE) || (type == T_FILE && off == 0))){
+    bcopy(p, (char*)din.addrs + off, n);
+    din.type = xshort(T_FILE | DI_INLINE);
+    din.size = xint(off + n);
+    winode(inum, &din);
+    return;
+  }
+  if(type & DI_INLINE){
+    bcopy(din.addrs, buf, off);
+    bzero(din.addrs, sizeof(din.addrs));
+    din.type = xshort(type & ~DI_INLINE);
+    din.size = xint(0);
+    winode(inum, &din);
+    iappend(inum, buf, off);
+    rinode(inum, &din);
+  }
+
   while(n > 0){
     fbn = off / BSIZE;
     assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = bmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -293,6 +445,85 @@ iappend(uint inum, void *xp, int n)
   winode(inum, &din);
 }
 
+// Same as dxhash() in kernel/fs.c.
+uint
+dxhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 2166136261;
+  for(i = 0; i < DIRSIZ && name[i]; i++){
+    h ^= (uchar)name[i];
+    h *= 16777619;
+  }
+  return h;
+}
+
+int
+dxcmp(const void *a, const void *b)
+{
+  uint ha = dxhash(((struct dirent*)a)->name);
+  uint hb = dxhash(((struct dirent*)b)->name);
+
+  return ha < hb ? -1 : ha > hb;
+}
+
+// Add the n entries de to the root directory, which holds
+// just "." and "..".  If they don't fit in one block and
+// index is set, give it an index, filling each leaf three
+// quarters full so that the kernel need not split them soon.
+void
+mkroot(uint rootino, struct dirent *de, int n, int index)
+{
+  struct dinode din;
+  struct dxindex dx;
+  struct dirent leaf[DPB];
+  int i, k, cap, nleaf;
+  uint off;
+
+  if(!index || 2 + n <= DPB){
+    for(i = 0; i < n; i++)
+      iappend(rootino, &de[i], sizeof(de[i]));
+
+    // fix size of root inode dir
+    rinode(rootino, &din);
+    off = xint(din.size);
+    off = ((off/BSIZE) + 1) * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+    return;
+  }
+
+  qsort(de, n, sizeof(de[0]), dxcmp);
+  bzero(&dx, sizeof(dx));
+  for(nleaf = 0, i = 0; i < n; nleaf++){
+    assert(nleaf < NDXENTRY);
+    cap = DPB*3/4 - (nleaf == 0 ? 2 : 0);
+    if(i + cap >= n)
+      k = n - i;
+    else
+      for(k = cap; k > 0 && dxhash(de[i+k].name) == dxhash(de[i+k-1].name); k--)
+        ;
+    assert(k > 0);
+    dx.e[nleaf].hash = xint(nleaf == 0 ? 0 : dxhash(de[i].name));
+    dx.e[nleaf].blk = xint(nleaf);
+    bzero(leaf, sizeof(leaf));
+    memmove(leaf, &de[i], k * sizeof(de[0]));
+    if(nleaf == 0)
+      iappend(rootino, leaf, BSIZE - 2*sizeof(de[0]));
+    else
+      iappend(rootino, leaf, BSIZE);
+    i += k;
+  }
+  dx.n = xint(nleaf);
+
+  rinode(rootino, &din);
+  din.addrs[DXADDR] = xint(freeblock++);
+  wsect(xint(din.addrs[DXADDR]), &dx);
+  winode(rootino, &din);
+}
+
 void
 die(const char *s)
 {
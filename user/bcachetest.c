@@ -0,0 +1,192 @@
+// Buffer cache contention benchmark.
+//
+// Several processes read their own files in parallel.  Each
+// process mostly touches its own blocks, so with a per-bucket
+// locked cache the bcache locks should see few failed
+// test-and-set attempts.  The report shows the bcache lock
+// counters before and after the run.
+
+#include "kernel/fcntl.h"
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/fs.h"
+#include "user/user.h"
+
+#define SZ 4096
+char buf[SZ];
+
+// Return the total number of failed test-and-set attempts on
+// the bcache and kmem locks, printing the report if asked.
+int
+ntas(int print)
+{
+  int n;
+  char *c;
+
+  n = statistics(buf, SZ-1);
+  if(n <= 0) {
+    fprintf(2, "ntas: no stats\n");
+    return 0;
+  }
+  buf[n] = '\0';
+  // The only '=' in the report is in the "tot= " line.
+  c = strchr(buf, '=');
+  if(print)
+    printf("%s", buf);
+  if(c == 0)
+    return 0;
+  return atoi(c+2);
+}
+
+void
+createfile(char *file, int nblock)
+{
+  char blk[BSIZE];
+  int fd, i;
+
+  fd = open(file, O_CREATE | O_RDWR);
+  if(fd < 0){
+    printf("createfile %s failed\n", file);
+    exit(1);
+  }
+  for(i = 0; i < nblock; i++) {
+    memset(blk, i, sizeof(blk));
+    if(write(fd, blk, sizeof(blk)) != sizeof(blk)) {
+      printf("write %s failed\n", file);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+void
+readfile(char *file, int nbytes, int inc)
+{
+  char blk[BSIZE];
+  int fd, i;
+
+  if(inc > BSIZE) {
+    printf("readfile: inc too large\n");
+    exit(1);
+  }
+  if((fd = open(file, O_RDONLY)) < 0) {
+    printf("readfile open %s failed\n", file);
+    exit(1);
+  }
+  for(i = 0; i < nbytes; i += inc) {
+    if(read(fd, blk, inc) != inc) {
+      printf("read %s failed for block %d (%d)\n", file, i, nbytes);
+      exit(1);
+    }
+  }
+  close(fd);
+}
+
+// Parallel reads of private files that fit in the cache.
+void
+test0(void)
+{
+  enum { N = 10, NCHILD = 3 };
+  char file[2] = "F";
+  char dir[2] = "0";
+  int i, m, n, pid, t0;
+
+  printf("start test0\n");
+  for(i = 0; i < NCHILD; i++){
+    dir[0] = '0' + i;
+    mkdir(dir);
+    if(chdir(dir) < 0) {
+      printf("chdir failed\n");
+      exit(1);
+    }
+    unlink(file);
+    createfile(file, N);
+    if(chdir("..") < 0) {
+      printf("chdir failed\n");
+      exit(1);
+    }
+  }
+  m = ntas(0);
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    dir[0] = '0' + i;
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed");
+      exit(1);
+    }
+    if(pid == 0){
+      if(chdir(dir) < 0) {
+        printf("chdir failed\n");
+        exit(1);
+      }
+      readfile(file, N*BSIZE, 1);
+      readfile(file, N*BSIZE, 1);
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  printf("test0 results:\n");
+  n = ntas(1);
+  printf("test0: %d contended test-and-sets, %d ticks\n", n - m, uptime() - t0);
+  if(n - m < 500)
+    printf("test0: OK\n");
+  else
+    printf("test0: FAIL\n");
+}
+
+// Many processes read files larger than the cache, forcing
+// buffers to move between buckets.
+void
+test1(void)
+{
+  enum { N = 200, BIG = 100, NCHILD = 2 };
+  char file[3] = "B";
+  int i, j, pid;
+
+  printf("start test1\n");
+  file[0] = 'B';
+  file[2] = '\0';
+  for(i = 0; i < NCHILD; i++){
+    file[1] = '0' + i;
+    unlink(file);
+    if(i == 0)
+      createfile(file, BIG);
+    else
+      createfile(file, 1);
+  }
+  for(i = 0; i < NCHILD; i++){
+    file[1] = '0' + i;
+    pid = fork();
+    if(pid < 0){
+      printf("fork failed");
+      exit(1);
+    }
+    if(pid == 0){
+      if(i == 0){
+        for(j = 0; j < N; j++)
+          readfile(file, BIG*BSIZE, BSIZE);
+        unlink(file);
+      } else {
+        for(j = 0; j < N*20; j++)
+          readfile(file, 1, 1);
+        unlink(file);
+      }
+      exit(0);
+    }
+  }
+  for(i = 0; i < NCHILD; i++)
+    wait(0);
+  printf("test1 OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test0();
+  test1();
+  exit(0);
+}
@@ -0,0 +1,372 @@
+// Microbenchmarks of the paths the kernel's scaling work is
+// about.
+//
+//   bench [-n nworker] [name...]
+//
+// Each benchmark runs in nworker processes (1 by default; make
+// bench passes the number of CPUs) that start together and each
+// do a fixed number of operations, so that reports from one
+// build to the next compare.  It prints a line of the table
+//
+//   name  workers  ops  ms  ops/s  ns/op  ipc
+//
+// where ops is the total, ms the wall time from the start to
+// when the last worker is done, ops/s the total over that,
+// ns/op the workers' mean time for one operation, and ipc the
+// instructions they retired per cycle, from perfread(), in
+// the kernel as well as in user space.  Lines that
+// start with # are comments; the first is the kernel's boot
+// trace, from the statistics device.
+//
+// An operation is one fork and exit, fork and exec or spawn()
+// of a program that exits at once, one round trip over a pair
+// of pipes, one getpid system call, one create and unlink, one
+// open and close by full path name, one KB written or read
+// sequentially, or one page fault on memory from sbrk().
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/perf.h"
+#include "user/user.h"
+
+#define FILEKB 1024  // size of the read and write benchmarks' files
+#define CHUNK  8192  // bytes per read and write
+
+#define NELEM(x) (sizeof(x)/sizeof((x)[0]))
+
+char *exitargv[] = { "bench", "-x", 0 };
+char buf[CHUNK];
+char name[16];
+int ping[2], pong[2];
+
+void
+fail(char *what)
+{
+  fprintf(2, "bench: %s failed\n", what);
+  exit(1);
+}
+
+void
+forkexit(int n)
+{
+  int pid;
+
+  while(n-- > 0){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0)
+      _exit(0);
+    wait(0);
+  }
+}
+
+void
+forkexec(int n)
+{
+  int pid;
+
+  while(n-- > 0){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      exec(exitargv[0], exitargv);
+      fail("exec");
+    }
+    wait(0);
+  }
+}
+
+void
+spawnexit(int n)
+{
+  while(n-- > 0){
+    if(spawn(exitargv[0], exitargv, 0, 0) < 0)
+      fail("spawn");
+    wait(0);
+  }
+}
+
+// A child that sends back each byte it gets.
+void
+pipesetup(int id, int n)
+{
+  char c;
+  int pid;
+
+  if(pipe(ping) < 0 || pipe(pong) < 0)
+    fail("pipe");
+  if((pid = fork()) < 0)
+    fail("fork");
+  if(pid == 0){
+    close(ping[1]);
+    close(pong[0]);
+    while(read(ping[0], &c, 1) == 1)
+      if(write(pong[1], &c, 1) != 1)
+        break;
+    exit(0);
+  }
+  close(ping[0]);
+  close(pong[1]);
+}
+
+void
+pingpong(int n)
+{
+  char c = 'x';
+
+  while(n-- > 0){
+    if(write(ping[1], &c, 1) != 1 || read(pong[0], &c, 1) != 1)
+      fail("pipe round trip");
+  }
+}
+
+void
+pipedone(int id, int n)
+{
+  close(ping[1]);
+  close(pong[0]);
+  wait(0);
+}
+
+void
+getpidloop(int n)
+{
+  while(n-- > 0)
+    _getpid();
+}
+
+void
+filename(int id, int n)
+{
+  strcpy(name, "benchf");
+  name[6] = 'a' + id;
+  name[7] = 0;
+}
+
+void
+createunlink(int n)
+{
+  int fd;
+
+  while(n-- > 0){
+    if((fd = open(name, O_CREATE|O_RDWR)) < 0)
+      fail("create");
+    close(fd);
+    if(unlink(name) < 0)
+      fail("unlink");
+  }
+}
+
+void
+openclose(int n)
+{
+  int fd;
+
+  while(n-- > 0){
+    if((fd = open("/bench", O_RDONLY)) < 0)
+      fail("open");
+    close(fd);
+  }
+}
+
+void
+writefile(int n)
+{
+  int fd;
+
+  if((fd = open(name, O_CREATE|O_WRONLY|O_TRUNC)) < 0)
+    fail("create");
+  for(; n > 0; n -= CHUNK/1024){
+    if(write(fd, buf, CHUNK) != CHUNK)
+      fail("write");
+  }
+  close(fd);
+}
+
+void
+readsetup(int id, int n)
+{
+  filename(id, n);
+  writefile(n);
+}
+
+void
+readfile(int n)
+{
+  int fd;
+
+  if((fd = open(name, O_RDONLY)) < 0)
+    fail("open");
+  for(; n > 0; n -= CHUNK/1024){
+    if(read(fd, buf, CHUNK) != CHUNK)
+      fail("read");
+  }
+  close(fd);
+}
+
+void
+removefile(int id, int n)
+{
+  unlink(name);
+}
+
+void
+sbrkfault(int n)
+{
+  char *p;
+  int i;
+
+  if((p = sbrk(n * PGSIZE)) == (char*)-1)
+    fail("sbrk");
+  for(i = 0; i < n; i++)
+    p[i * PGSIZE] = i;
+  sbrk(-n * PGSIZE);
+}
+
+// Print the statistics device's boot line as a comment.
+void
+printboot(void)
+{
+  static char stats[8192];
+  char *p, *e;
+  int fd, n, m;
+
+  if((fd = open("statistics", O_RDONLY)) < 0)
+    return;
+  for(n = 0; n < sizeof(stats) - 1 && (m = read(fd, stats + n, sizeof(stats) - 1 - n)) > 0; n += m)
+    ;
+  close(fd);
+  stats[n] = 0;
+  for(p = stats; *p; p = e){
+    for(e = p; *e && *e != '\n'; e++)
+      ;
+    if(*e)
+      *e++ = 0;
+    if(memcmp(p, "boot:", 5) == 0)
+      printf("# %s\n", p);
+  }
+}
+
+struct bench {
+  char *name;
+  int ops;                     // per worker
+  void (*setup)(int id, int ops);
+  void (*run)(int ops);        // timed
+  void (*done)(int id, int ops);
+} benches[] = {
+  { "forkexit", 200,    0,          forkexit,     0 },
+  { "forkexec", 50,     0,          forkexec,     0 },
+  { "spawn",    50,     0,          spawnexit,    0 },
+  { "pipe",     2000,   pipesetup,  pingpong,     pipedone },
+  { "getpid",   100000, 0,          getpidloop,   0 },
+  { "create",   100,    filename,   createunlink, 0 },
+  { "open",     2000,   0,          openclose,    0 },
+  { "write",    FILEKB, filename,   writefile,    removefile },
+  { "read",     FILEKB, readsetup,  readfile,     removefile },
+  { "sbrk",     1024,   0,          sbrkfault,    0 },
+};
+
+// Run b in nworker processes and print its line.
+void
+runbench(struct bench *b, int nworker)
+{
+  int go[2], res[2], i, pid, xst, failed;
+  uint64 t0, wall, t, sum, r[1 + NPERF], cycles, instret, ipc;
+  char c;
+
+  // or the workers would print what is buffered too.
+  fflush(stdout);
+  if(pipe(go) < 0 || pipe(res) < 0)
+    fail("pipe");
+  for(i = 0; i < nworker; i++){
+    if((pid = fork()) < 0)
+      fail("fork");
+    if(pid == 0){
+      close(go[1]);
+      close(res[0]);
+      if(b->setup)
+        b->setup(i, b->ops);
+      if(read(go[0], &c, 1) != 1)
+        exit(1);
+      perfopen();
+      r[0] = rdtime();
+      b->run(b->ops);
+      r[0] = rdtime() - r[0];
+      if(perfread(r + 1, NPERF) != NPERF)
+        memset(r + 1, 0, NPERF * sizeof(r[0]));
+      if(b->done)
+        b->done(i, b->ops);
+      write(res[1], r, sizeof(r));
+      exit(0);
+    }
+  }
+  close(go[0]);
+  close(res[1]);
+
+  // start them all at once.
+  t0 = rdtime();
+  for(i = 0; i < nworker; i++)
+    write(go[1], "g", 1);
+  failed = 0;
+  for(i = 0; i < nworker; i++){
+    if(wait(&xst) < 0 || xst != 0)
+      failed = 1;
+  }
+  wall = rdtime() - t0;
+  sum = cycles = instret = 0;
+  while(read(res[0], r, sizeof(r)) == sizeof(r)){
+    sum += r[0];
+    cycles += r[1 + PERF_CYCLES];
+    instret += r[1 + PERF_INSTRET];
+  }
+  close(go[1]);
+  close(res[0]);
+
+  if(failed){
+    printf("# %s failed\n", b->name);
+    return;
+  }
+  t = (uint64)b->ops * nworker;
+  ipc = cycles ? instret * 100 / cycles : 0;  // in hundredths
+  printf("%s\t%d\t%d\t%d\t%d\t%d\t%d.%d%d\n", b->name, nworker, (int)t,
+         (int)(wall * 1000 / TIMEFREQ), (int)(t * TIMEFREQ / wall),
+         (int)(sum * (1000000000 / TIMEFREQ) / t),
+         (int)(ipc / 100), (int)(ipc / 10 % 10), (int)(ipc % 10));
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, k, nworker, any;
+
+  if(argc > 1 && strcmp(argv[1], "-x") == 0)
+    exit(0);  // the program forkexec and spawn run
+
+  nworker = 1;
+  i = 1;
+  if(argc > 2 && strcmp(argv[1], "-n") == 0){
+    nworker = atoi(argv[2]);
+    i = 3;
+  }
+  if(nworker < 1 || nworker > 26){
+    fprintf(2, "Usage: bench [-n nworker] [name...]\n");
+    exit(1);
+  }
+
+  memset(buf, 'b', sizeof(buf));
+  printboot();
+  printf("# name\tworkers\tops\tms\tops/s\tns/op\tipc\n");
+  for(j = 0; j < NELEM(benches); j++){
+    any = i == argc;
+    for(k = i; k < argc; k++)
+      if(strcmp(argv[k], benches[j].name) == 0)
+        any = 1;
+    if(any)
+      runbench(&benches[j], nworker);
+  }
+  printf("# done\n");
+  exit(0);
+}
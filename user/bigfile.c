@@ -0,0 +1,66 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+#include "kernel/fcntl.h"
+#include "kernel/fs.h"
+
+// write a file that reaches into the triply-indirect
+// blocks, then read it back.
+#define NBLOCKS (NDIRECT + NINDIRECT + NDINDIRECT + NINDIRECT)
+
+int
+main()
+{
+  char buf[BSIZE];
+  int fd, i, n;
+
+  fd = open("big.file", O_CREATE | O_WRONLY);
+  if(fd < 0){
+    printf("bigfile: cannot open big.file for writing\n");
+    exit(-1);
+  }
+
+  for(i = 0; i < NBLOCKS; i++){
+    memset(buf, 0, sizeof(buf));
+    *(int*)buf = i;
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf("bigfile: write failed at block %d\n", i);
+      exit(-1);
+    }
+    if(i % 1000 == 0)
+      printf(".");
+  }
+  printf("\nwrote %d blocks\n", i);
+  close(fd);
+
+  fd = open("big.file", O_RDONLY);
+  if(fd < 0){
+    printf("bigfile: cannot re-open big.file for reading\n");
+    exit(-1);
+  }
+  for(i = 0; i < NBLOCKS; i++){
+    n = read(fd, buf, sizeof(buf));
+    if(n != sizeof(buf)){
+      printf("bigfile: read error at block %d\n", i);
+      exit(-1);
+    }
+    if(*(int*)buf != i){
+      printf("bigfile: read the wrong data (%d) for block %d\n",
+             *(int*)buf, i);
+      exit(-1);
+    }
+  }
+  if(read(fd, buf, sizeof(buf)) != 0){
+    printf("bigfile: file longer than written\n");
+    exit(-1);
+  }
+  close(fd);
+
+  if(unlink("big.file") < 0){
+    printf("bigfile: unlink failed\n");
+    exit(-1);
+  }
+
+  printf("bigfile done; ok\n");
+  exit(0);
+}
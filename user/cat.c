@@ -9,8 +9,15 @@ cat(int fd)
 {
   int n;
 
+  // if stdout is a pipe or a file, let the kernel move
+  // the file into it directly.
+  while((n = splice(fd, 1, 64*1024)) > 0)
+    ;
+  if(n == 0)
+    return;
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
-    if (write(1, buf, n) != n) {
+    if (fwrite(buf, n, stdout) != n) {
       fprintf(2, "cat: write error\n");
       exit(1);
     }
@@ -1,52 +1,307 @@
 // Simple grep.  Only supports ^ . * $ operators.
+//
+// The pattern is compiled once.  A pattern with no operators
+// is found with Boyer-Moore-Horspool across the whole buffer,
+// not line by line; any other goes through a DFA built lazily
+// from the pattern's NFA, so each byte of the input costs a
+// table lookup, however many ways .* could match.  Files are
+// mmap()ed whole; pipes and devices are read in large blocks.
 
 #include "kernel/types.h"
 #include "kernel/stat.h"
+#include "kernel/fcntl.h"
 #include "user/user.h"
 
-char buf[1024];
+#define NITEM   63       // pattern items the NFA has room for
+#define NDSTATE 32       // DFA states cached at once
+#define BLOCK   (64*1024)
+
+#define ANY 256          // an item that matches any byte
+
+// The compiled pattern: items, each a byte or ANY, that may be
+// starred, between the optional anchors.
+struct {
+  int n;
+  int c[NITEM];
+  int star[NITEM];
+  int bol, eol;          // ^ and $
+  int literal;           // no operators at all
+  char *re;              // the pattern, for the rest
+  int relen;
+  int skip[256];         // Horspool's shift for each byte
+  int items;             // the NFA is usable
+} pat;
+
+// The DFA: each state is a set of NFA states, one bit for each
+// item still to match and bit n for the match.  next[s][c] is
+// the state after c, or -1 if it hasn't been worked out.
+struct {
+  int n;
+  uint64 set[NDSTATE];
+  short next[NDSTATE][256];
+  int start;
+} dfa;
+
+char *buf;
+int bufsz;
+
 int match(char*, char*);
 
+// NFA states reachable from i with no input: past starred
+// items, which can match nothing.
+uint64
+closure(int i)
+{
+  uint64 s = 0;
+
+  for(; i < pat.n && pat.star[i]; i++)
+    s |= 1ULL << i;
+  return s | (1ULL << i);
+}
+
 void
-grep(char *pattern, int fd)
+compile(char *re)
 {
-  int n, m;
+  int i;
+
+  pat.re = re;
+  pat.relen = strlen(re);
+  pat.literal = 1;
+  for(i = 0; re[i]; i++)
+    if(strchr("^.*$", re[i]))
+      pat.literal = 0;
+  if(pat.literal && pat.relen > 0){
+    for(i = 0; i < 256; i++)
+      pat.skip[i] = pat.relen;
+    for(i = 0; i < pat.relen - 1; i++)
+      pat.skip[(uchar)re[i]] = pat.relen - 1 - i;
+    return;
+  }
+
+  // the same reading of the pattern as matchhere().
+  if(*re == '^'){
+    pat.bol = 1;
+    re++;
+  }
+  pat.n = 0;
+  while(*re){
+    if(re[0] == '$' && re[1] == '\0'){
+      pat.eol = 1;
+      break;
+    }
+    if(pat.n == NITEM)
+      return;  // too long: match() does it
+    pat.c[pat.n] = *re == '.' ? ANY : (uchar)*re;
+    pat.star[pat.n] = re[1] == '*';
+    re += pat.star[pat.n] ? 2 : 1;
+    pat.n++;
+  }
+  pat.items = 1;
+}
+
+// The DFA state for set, adding it if it is new.  When the
+// cache is full it starts again from empty.
+int
+dstate(uint64 set)
+{
+  int s;
+
+  for(s = 0; s < dfa.n; s++)
+    if(dfa.set[s] == set)
+      return s;
+  if(dfa.n == NDSTATE){
+    dfa.n = 0;
+    dfa.start = -1;
+  }
+  s = dfa.n++;
+  dfa.set[s] = set;
+  memset(dfa.next[s], 0xff, sizeof(dfa.next[s]));
+  return s;
+}
+
+// Work out the state that s goes to on byte c.
+int
+step(int s, int c)
+{
+  uint64 set, next;
+  int i, t;
+
+  set = dfa.set[s];
+  next = 0;
+  for(i = 0; i < pat.n; i++){
+    if((set & (1ULL << i)) == 0 || (pat.c[i] != ANY && pat.c[i] != c))
+      continue;
+    next |= pat.star[i] ? closure(i) : closure(i+1);
+  }
+  if(!pat.bol)
+    next |= closure(0);  // a match may start anywhere
+  t = dstate(next);
+  if(dfa.n > s && dfa.set[s] == set)
+    dfa.next[s][c] = t;  // unless the cache was just emptied
+  return t;
+}
+
+int
+startstate(void)
+{
+  if(dfa.start < 0)
+    dfa.start = dstate(closure(0));
+  return dfa.start;
+}
+
+// Does line p, n bytes, match?
+int
+matchline(char *p, int n)
+{
+  uint64 accept;
+  int s, t, c;
+  char *line;
+
+  if(!pat.items){
+    // p may be a read-only mapping, with no room for the '\0'.
+    if((line = malloc(n + 1)) == 0){
+      fprintf(2, "grep: out of memory\n");
+      exit(1);
+    }
+    memmove(line, p, n);
+    line[n] = '\0';
+    c = match(pat.re, line);
+    free(line);
+    return c;
+  }
+  accept = 1ULL << pat.n;
+  s = startstate();
+  if(!pat.eol && (dfa.set[s] & accept))
+    return 1;
+  while(n-- > 0){
+    c = (uchar)*p++;
+    if((t = dfa.next[s][c]) < 0)
+      t = step(s, c);
+    s = t;
+    if(!pat.eol && (dfa.set[s] & accept))
+      return 1;
+  }
+  return (dfa.set[s] & accept) != 0;
+}
+
+// The first place the literal pattern occurs in p[0..n), or 0.
+char*
+horspool(char *p, int n)
+{
+  int m = pat.relen;
+  char *e = p + n - m, last = pat.re[m-1];
+
+  while(p <= e){
+    if(p[m-1] == last && memcmp(p, pat.re, m-1) == 0)
+      return p;
+    p += pat.skip[(uchar)p[m-1]];
+  }
+  return 0;
+}
+
+char*
+linestart(char *p, char *base)
+{
+  while(p > base && p[-1] != '\n')
+    p--;
+  return p;
+}
+
+char*
+lineend(char *p, char *e)
+{
+  while(p < e && *p != '\n')
+    p++;
+  return p;
+}
+
+void
+printline(char *p, char *q, char *e)
+{
+  fwrite(p, q - p, stdout);
+  if(q < e)
+    fwrite(q, 1, stdout);
+  else
+    fputc('\n', stdout);  // the last line had none
+}
+
+// Print the lines of p[0..n) that match.  Lines are ended by
+// '\n', or by the end of the buffer.
+void
+grepbuf(char *p, int n)
+{
+  char *e = p + n, *q, *m;
+
+  if(pat.literal && pat.relen > 0){
+    while(p < e && (m = horspool(p, e - p)) != 0){
+      q = lineend(m, e);
+      printline(linestart(m, p), q, e);
+      p = q + 1;
+    }
+    return;
+  }
+  for(; p < e; p = q + 1){
+    q = lineend(p, e);
+    if(matchline(p, q - p))
+      printline(p, q, e);
+  }
+}
+
+void
+grep(int fd)
+{
+  struct stat st;
   char *p, *q;
+  int n, m;
+
+  if(fstat(fd, &st) == 0 && st.type == T_FILE && st.size > 0){
+    p = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if(p != (char*)-1){
+      grepbuf(p, st.size);
+      munmap(p, st.size);
+      return;
+    }
+  }
 
+  // a block at a time, keeping any line not yet complete.
   m = 0;
-  while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
-    m += n;
-    buf[m] = '\0';
-    p = buf;
-    while((q = strchr(p, '\n')) != 0){
-      *q = 0;
-      if(match(pattern, p)){
-        *q = '\n';
-        write(1, p, q+1 - p);
+  for(;;){
+    if(bufsz - m < BLOCK){
+      bufsz = bufsz ? 2*bufsz : 2*BLOCK;
+      if((p = malloc(bufsz)) == 0){
+        fprintf(2, "grep: out of memory\n");
+        exit(1);
       }
-      p = q+1;
-    }
-    if(m > 0){
-      m -= p - buf;
-      memmove(buf, p, m);
+      memmove(p, buf, m);
+      free(buf);
+      buf = p;
     }
+    if((n = read(fd, buf + m, bufsz - m)) <= 0)
+      break;
+    m += n;
+    for(q = buf + m; q > buf && q[-1] != '\n'; q--)
+      ;
+    grepbuf(buf, q - buf);
+    m -= q - buf;
+    memmove(buf, q, m);
   }
+  grepbuf(buf, m);
 }
 
 int
 main(int argc, char *argv[])
 {
   int fd, i;
-  char *pattern;
 
   if(argc <= 1){
     fprintf(2, "usage: grep pattern [file ...]\n");
     exit(1);
   }
-  pattern = argv[1];
+  compile(argv[1]);
+  dfa.start = -1;
 
   if(argc <= 2){
-    grep(pattern, 0);
+    grep(0);
     exit(0);
   }
 
@@ -55,14 +310,15 @@ main(int argc, char *argv[])
       printf("grep: cannot open %s\n", argv[i]);
       exit(1);
     }
-    grep(pattern, fd);
+    grep(fd);
     close(fd);
   }
   exit(0);
 }
 
 // Regexp matcher from Kernighan & Pike,
-// The Practice of Programming, Chapter 9.
+// The Practice of Programming, Chapter 9, for patterns too
+// long for the DFA.
 
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
@@ -102,4 +358,3 @@ int matchstar(int c, char *re, char *text)
   }while(*text!='\0' && (*text++==c || c=='.'));
   return 0;
 }
-
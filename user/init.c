@@ -23,6 +23,12 @@ main(void)
   dup(0);  // stdout
   dup(0);  // stderr
 
+  // kernel counters, per-process ones and the profiler;
+  // fail harmlessly if they already exist.
+  mknod("statistics", STATS, 0);
+  mknod("procs", PROCS, 0);
+  mknod("prof", PROF, 0);
+
   for(;;){
     printf("init: starting sh\n");
     pid = fork();
@@ -0,0 +1,136 @@
+// Page allocator stress test.
+//
+// test1 has several processes grow and shrink their heaps with
+// sbrk() in parallel and reports the kmem lock contention that
+// caused.  test2 checks that stealing between per-CPU free lists
+// still lets one process allocate all of free memory.
+
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+#define NCHILD 2
+#define N 100000
+#define SZ 4096
+
+char buf[SZ];
+
+// Total failed test-and-sets on the kmem and bcache locks.
+int
+ntas(int print)
+{
+  int n;
+  char *c;
+
+  n = statistics(buf, SZ-1);
+  if(n <= 0) {
+    fprintf(2, "ntas: no stats\n");
+    return 0;
+  }
+  buf[n] = '\0';
+  c = strchr(buf, '=');
+  if(print)
+    printf("%s", buf);
+  if(c == 0)
+    return 0;
+  return atoi(c+2);
+}
+
+void
+test1(void)
+{
+  void *a, *a1;
+  int i, j, m, n, t0;
+
+  printf("start test1\n");
+  m = ntas(0);
+  t0 = uptime();
+  for(i = 0; i < NCHILD; i++){
+    int pid = fork();
+    if(pid < 0){
+      printf("fork failed");
+      exit(1);
+    }
+    if(pid == 0){
+      for(j = 0; j < N; j++) {
+        a = sbrk(4096);
+        *(int *)(a+4) = 1;
+        a1 = sbrk(-4096);
+        if (a1 != a + 4096) {
+          printf("wrong sbrk\n");
+          exit(1);
+        }
+      }
+      exit(0);
+    }
+  }
+
+  for(i = 0; i < NCHILD; i++){
+    wait(0);
+  }
+  printf("test1 results:\n");
+  n = ntas(1);
+  printf("test1: %d contended test-and-sets, %d ticks\n", n - m, uptime() - t0);
+  if(n - m < 10)
+    printf("test1 OK\n");
+  else
+    printf("test1 FAIL\n");
+}
+
+// Allocate pages until sbrk() fails; return how many.
+int
+countfree(void)
+{
+  uint64 sz0 = (uint64)sbrk(0);
+  int n = 0;
+
+  while(1){
+    char *a = sbrk(PGSIZE);
+    if(a == (char*)0xffffffffffffffffL)
+      break;
+    // touch the page so that it is really allocated.
+    *(a + PGSIZE - 1) = 1;
+    n++;
+  }
+  sbrk(-((uint64)sbrk(0) - sz0));
+  return n;
+}
+
+// Stealing must make every CPU's pages reachable, and none
+// may leak.
+void
+test2(void)
+{
+  int free0, n, i;
+
+  printf("start test2\n");
+  free0 = countfree();
+  printf("total free number of pages: %d (out of %d)\n", free0,
+         (PHYSTOP - KERNBASE) / PGSIZE);
+  if(free0 < 1000){
+    printf("test2 FAIL: too few free pages\n");
+    exit(1);
+  }
+  for(i = 0; i < 50; i++){
+    n = countfree();
+    if(i % 10 == 9)
+      printf(".");
+    if(n != free0){
+      printf("test2 FAIL: lost %d pages\n", free0 - n);
+      exit(1);
+    }
+  }
+  printf("\ntest2 OK\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  test1();
+  test2();
+  exit(0);
+}
@@ -0,0 +1,108 @@
+// Time malloc() and free() on a few allocation patterns
+// and report how far each moves the break.
+//
+//  small:  random sizes up to 256 bytes, allocated and freed
+//          in random order over NSLOT live blocks.
+//  mem:    a chain of 10001-byte blocks, as usertests' mem
+//          test builds, then freed.
+//  large:  128 KB blocks allocated and freed in turn.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define NSLOT 512
+#define NOPS  200000
+
+char *slot[NSLOT];
+uint seed = 1;
+
+uint
+rnd(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return seed >> 8;
+}
+
+void
+small(void)
+{
+  int i, k;
+
+  for(k = 0; k < NOPS; k++){
+    i = rnd() % NSLOT;
+    if(slot[i]){
+      free(slot[i]);
+      slot[i] = 0;
+    } else if((slot[i] = malloc(1 + rnd() % 256)) == 0){
+      printf("mallocbench: small: out of memory\n");
+      exit(1);
+    }
+  }
+  for(i = 0; i < NSLOT; i++){
+    free(slot[i]);
+    slot[i] = 0;
+  }
+}
+
+void
+mem(void)
+{
+  void *m1, *m2;
+  int k, i;
+
+  for(k = 0; k < 20; k++){
+    m1 = 0;
+    for(i = 0; i < 500; i++){
+      if((m2 = malloc(10001)) == 0){
+        printf("mallocbench: mem: out of memory\n");
+        exit(1);
+      }
+      *(char**)m2 = m1;
+      m1 = m2;
+    }
+    while(m1){
+      m2 = *(char**)m1;
+      free(m1);
+      m1 = m2;
+    }
+  }
+}
+
+void
+large(void)
+{
+  char *p;
+  int k;
+
+  for(k = 0; k < 2000; k++){
+    if((p = malloc(128*1024)) == 0){
+      printf("mallocbench: large: out of memory\n");
+      exit(1);
+    }
+    p[0] = p[128*1024-1] = k;
+    free(p);
+  }
+}
+
+void
+run(char *name, void (*f)(void))
+{
+  char *brk0;
+  int t0;
+
+  brk0 = sbrk(0);
+  t0 = uptime();
+  f();
+  printf("%s\t%d ticks\t%d KB more heap\n", name, uptime() - t0,
+         (int)(sbrk(0) - brk0) / 1024);
+}
+
+int
+main(int argc, char *argv[])
+{
+  run("small", small);
+  run("mem", mem);
+  run("large", large);
+  exit(0);
+}
@@ -0,0 +1,81 @@
+// Time the word-at-a-time memmove, memset and memcmp
+// in ulib.c against byte-at-a-time loops, for sizes
+// from 8 bytes to 4KB.  Each entry is the number of
+// ticks taken to process TOTAL bytes.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+#define TOTAL (16*1024*1024)
+
+char a[4096+8], b[4096+8];
+volatile int sink;
+
+void
+bytemove(char *d, const char *s, int n)
+{
+  while(n-- > 0)
+    *d++ = *s++;
+}
+
+void
+byteset(char *d, int c, int n)
+{
+  while(n-- > 0)
+    *d++ = c;
+}
+
+int
+bytecmp(const char *p, const char *q, int n)
+{
+  while(n-- > 0){
+    if(*p != *q)
+      return *p - *q;
+    p++, q++;
+  }
+  return 0;
+}
+
+// ticks for TOTAL bytes of operation op at size n;
+// op 0-2 are the byte loops, 3-5 the ulib versions.
+int
+run(int op, int n, int off)
+{
+  int i, iters, t0;
+
+  iters = TOTAL / n;
+  t0 = uptime();
+  for(i = 0; i < iters; i++){
+    switch(op){
+    case 0: bytemove(a, b + off, n); break;
+    case 1: byteset(a, i, n); break;
+    case 2: sink = bytecmp(a, b, n); break;
+    case 3: memmove(a, b + off, n); break;
+    case 4: memset(a, i, n); break;
+    case 5: sink = memcmp(a, b, n); break;
+    }
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n, off;
+
+  // misaligned source for memmove with "membench 1".
+  off = argc > 1 ? atoi(argv[1]) & 7 : 0;
+
+  memset(b, 'x', sizeof(b));
+  printf("ticks per %d MB, byte loop / word loop\n", TOTAL/(1024*1024));
+  printf("size\tmemmove\t\tmemset\t\tmemcmp\n");
+  for(n = 8; n <= 4096; n *= 2){
+    memset(a, 'x', sizeof(a));
+    printf("%d\t%d / %d\t\t", n, run(0, n, off), run(3, n, off));
+    printf("%d / %d\t\t", run(1, n, off), run(4, n, off));
+    memset(a, 'x', sizeof(a));
+    printf("%d / %d\n", run(2, n, off), run(5, n, off));
+  }
+  exit(0);
+}
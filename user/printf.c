@@ -6,14 +6,32 @@
 
 static char digits[] = "0123456789ABCDEF";
 
+// Each call's output is collected here and written with as
+// few write()s as it takes, rather than one per character.
+struct pbuf {
+  int fd;
+  int n;
+  char buf[128];
+};
+
+static void
+pflush(struct pbuf *pb)
+{
+  if(pb->n > 0)
+    write(pb->fd, pb->buf, pb->n);
+  pb->n = 0;
+}
+
 static void
-putc(int fd, char c)
+putc(struct pbuf *pb, char c)
 {
-  write(fd, &c, 1);
+  if(pb->n == sizeof(pb->buf))
+    pflush(pb);
+  pb->buf[pb->n++] = c;
 }
 
 static void
-printint(int fd, int xx, int base, int sgn)
+printint(struct pbuf *pb, int xx, int base, int sgn)
 {
   char buf[16];
   int i, neg;
@@ -35,25 +53,31 @@ printint(int fd, int xx, int base, int sgn)
     buf[i++] = '-';
 
   while(--i >= 0)
-    putc(fd, buf[i]);
+    putc(pb, buf[i]);
 }
 
 static void
-printptr(int fd, uint64 x) {
+printptr(struct pbuf *pb, uint64 x) {
   int i;
-  putc(fd, '0');
-  putc(fd, 'x');
+  putc(pb, '0');
+  putc(pb, 'x');
   for (i = 0; i < (sizeof(uint64) * 2); i++, x <<= 4)
-    putc(fd, digits[x >> (sizeof(uint64) * 8 - 4)]);
+    putc(pb, digits[x >> (sizeof(uint64) * 8 - 4)]);
 }
 
 // Print to the given fd. Only understands %d, %x, %p, %s.
 void
 vprintf(int fd, const char *fmt, va_list ap)
 {
+  struct pbuf pb0, *pb = &pb0;
   char *s;
   int c, i, state;
 
+  // keep what went through stdout before this in order.
+  if(fd == 1)
+    fflush(stdout);
+  pb->fd = fd;
+  pb->n = 0;
   state = 0;
   for(i = 0; fmt[i]; i++){
     c = fmt[i] & 0xff;
@@ -61,37 +85,38 @@ vprintf(int fd, const char *fmt, va_list ap)
       if(c == '%'){
         state = '%';
       } else {
-        putc(fd, c);
+        putc(pb, c);
       }
     } else if(state == '%'){
       if(c == 'd'){
-        printint(fd, va_arg(ap, int), 10, 1);
+        printint(pb, va_arg(ap, int), 10, 1);
       } else if(c == 'l') {
-        printint(fd, va_arg(ap, uint64), 10, 0);
+        printint(pb, va_arg(ap, uint64), 10, 0);
       } else if(c == 'x') {
-        printint(fd, va_arg(ap, int), 16, 0);
+        printint(pb, va_arg(ap, int), 16, 0);
       } else if(c == 'p') {
-        printptr(fd, va_arg(ap, uint64));
+        printptr(pb, va_arg(ap, uint64));
       } else if(c == 's'){
         s = va_arg(ap, char*);
         if(s == 0)
           s = "(null)";
         while(*s != 0){
-          putc(fd, *s);
+          putc(pb, *s);
           s++;
         }
       } else if(c == 'c'){
-        putc(fd, va_arg(ap, uint));
+        putc(pb, va_arg(ap, uint));
       } else if(c == '%'){
-        putc(fd, c);
+        putc(pb, c);
       } else {
         // Unknown % sequence.  Print it to draw attention.
-        putc(fd, '%');
-        putc(fd, c);
+        putc(pb, '%');
+        putc(pb, c);
       }
       state = 0;
     }
   }
+  pflush(pb);
 }
 
 void
@@ -0,0 +1,284 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/fcntl.h"
+#include "kernel/prof.h"
+#include "user/user.h"
+
+// prof command [args...]
+// Run command with the kernel's sampling profiler on, then
+// report the functions the samples fell in, busiest first:
+// "self" counts samples taken in the function itself, "total"
+// also those with it further up the stack.  Every process is
+// sampled, not just command's; kernel functions are named from
+// kernel.sym and a program's from its name.sym.
+
+#define NSLOT 4096   // distinct pcs
+#define NSPACE 16    // programs with symbols loaded
+#define NTOP  25
+
+struct sym {
+  uint64 addr;
+  char *name;
+};
+
+// The symbols of the kernel or of one program.
+struct space {
+  char name[16];       // "" for the kernel
+  struct sym *syms;    // by address
+  int nsym;
+} spaces[NSPACE];
+int nspace;
+
+// Samples at one pc of one space.
+struct slot {
+  struct space *sp;
+  uint64 pc;
+  int self, total;
+} slots[NSLOT];
+int nslot;
+
+// Per-function totals for the report.
+struct func {
+  struct space *sp;
+  char *name;
+  int self, total;
+} funcs[NSLOT];
+int nfunc;
+
+struct profsample samples[64];
+
+uint64
+hex(char **ps)
+{
+  uint64 x = 0;
+  char *s = *ps;
+
+  for(;; s++){
+    if('0' <= *s && *s <= '9')
+      x = x*16 + *s - '0';
+    else if('a' <= *s && *s <= 'f')
+      x = x*16 + *s - 'a' + 10;
+    else
+      break;
+  }
+  *ps = s;
+  return x;
+}
+
+// Read file's "addr name" lines into sp, sorted by address.
+void
+loadsyms(struct space *sp, char *file)
+{
+  struct stat st;
+  struct sym t;
+  char *buf, *s, *e;
+  int fd, n, i, j, gap;
+
+  if((fd = open(file, O_RDONLY)) < 0)
+    return;
+  if(fstat(fd, &st) < 0 || (buf = malloc(st.size + 1)) == 0){
+    close(fd);
+    return;
+  }
+  n = read(fd, buf, st.size);
+  close(fd);
+  if(n < 0)
+    n = 0;
+  buf[n] = 0;
+  for(i = 0, s = buf; *s; s++)
+    if(*s == '\n')
+      i++;
+  if((sp->syms = malloc((i + 1) * sizeof(struct sym))) == 0)
+    return;
+  for(s = buf; *s; s = e){
+    for(e = s; *e && *e != '\n'; e++)
+      ;
+    if(*e)
+      *e++ = 0;
+    t.addr = hex(&s);
+    if(*s++ != ' ' || *s == 0 || *s == '.')
+      continue;  // not addr name, or a section
+    n = strlen(s);
+    if(n > 2 && s[n-2] == '.' && (s[n-1] == 'c' || s[n-1] == 'S'))
+      continue;  // a source file
+    t.name = s;
+    sp->syms[sp->nsym++] = t;
+  }
+  for(gap = sp->nsym/2; gap > 0; gap /= 2){
+    for(i = gap; i < sp->nsym; i++){
+      t = sp->syms[i];
+      for(j = i; j >= gap && sp->syms[j-gap].addr > t.addr; j -= gap)
+        sp->syms[j] = sp->syms[j-gap];
+      sp->syms[j] = t;
+    }
+  }
+}
+
+// The space of the kernel, or of program name.
+struct space*
+space(char *name)
+{
+  char file[32];
+  struct space *sp;
+  int i;
+
+  for(i = 0; i < nspace; i++)
+    if(strcmp(spaces[i].name, name) == 0)
+      return &spaces[i];
+  if(nspace == NSPACE)
+    return 0;
+  sp = &spaces[nspace++];
+  strcpy(sp->name, name);
+  if(name[0] == 0){
+    loadsyms(sp, "kernel.sym");
+  } else {
+    strcpy(file, name);
+    strcpy(file + strlen(file), ".sym");
+    loadsyms(sp, file);
+  }
+  return sp;
+}
+
+// The name of the function holding pc, or 0.
+char*
+symbolize(struct space *sp, uint64 pc)
+{
+  int lo, hi, mid;
+
+  lo = 0;
+  hi = sp->nsym;
+  while(lo < hi){
+    mid = (lo + hi) / 2;
+    if(sp->syms[mid].addr <= pc)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo > 0 ? sp->syms[lo-1].name : 0;
+}
+
+void
+count(struct space *sp, uint64 pc, int self)
+{
+  struct slot *s;
+  int i;
+
+  for(i = (pc >> 1) % NSLOT; ; i = (i + 1) % NSLOT){
+    s = &slots[i];
+    if(s->sp == 0){
+      if(nslot == NSLOT-1)
+        return;  // full; drop it
+      nslot++;
+      s->sp = sp;
+      s->pc = pc;
+      break;
+    }
+    if(s->sp == sp && s->pc == pc)
+      break;
+  }
+  s->self += self;
+  s->total++;
+}
+
+void
+tally(struct profsample *s)
+{
+  struct space *sp;
+  int i;
+
+  if((sp = space(s->user ? s->name : "")) == 0)
+    return;
+  for(i = 0; i < PROFDEPTH && s->pc[i]; i++){
+    // a return address is just past the call.
+    count(sp, i ? s->pc[i] - 1 : s->pc[i], i == 0);
+  }
+}
+
+void
+report(int nsample)
+{
+  struct slot *s;
+  struct func *f, t;
+  char *name;
+  int i, j;
+
+  for(s = slots; s < &slots[NSLOT]; s++){
+    if(s->sp == 0)
+      continue;
+    if((name = symbolize(s->sp, s->pc)) == 0)
+      name = "?";
+    for(f = funcs; f < &funcs[nfunc]; f++)
+      if(f->sp == s->sp && strcmp(f->name, name) == 0)
+        break;
+    if(f == &funcs[nfunc]){
+      nfunc++;
+      f->sp = s->sp;
+      f->name = name;
+    }
+    f->self += s->self;
+    f->total += s->total;
+  }
+  for(i = 1; i < nfunc; i++){
+    t = funcs[i];
+    for(j = i; j > 0 && funcs[j-1].self < t.self; j--)
+      funcs[j] = funcs[j-1];
+    funcs[j] = t;
+  }
+
+  printf("%d samples\n", nsample);
+  printf(" self total  function\n");
+  for(i = 0; i < nfunc && i < NTOP; i++){
+    f = &funcs[i];
+    printf("%d %d  %s:%s\n", f->self, f->total,
+           f->sp->name[0] ? f->sp->name : "kernel", f->name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int fd, pid, n, i, nsample;
+
+  if(argc < 2){
+    fprintf(2, "Usage: prof command [args...]\n");
+    exit(1);
+  }
+  if((fd = open("prof", O_RDWR)) < 0){
+    fprintf(2, "prof: cannot open prof\n");
+    exit(1);
+  }
+  if(write(fd, "1", 1) != 1){
+    fprintf(2, "prof: cannot start the profiler\n");
+    exit(1);
+  }
+
+  // a child waits for command and stops the profiler, while
+  // we read samples until it has.
+  if((pid = fork()) < 0){
+    fprintf(2, "prof: fork failed\n");
+    exit(1);
+  }
+  if(pid == 0){
+    if((pid = fork()) == 0){
+      close(fd);
+      exec(argv[1], argv+1);
+      fprintf(2, "prof: exec %s failed\n", argv[1]);
+      exit(1);
+    }
+    if(pid > 0)
+      wait(0);
+    write(fd, "0", 1);
+    exit(0);
+  }
+
+  nsample = 0;
+  while((n = read(fd, samples, sizeof(samples))) > 0){
+    for(i = 0; i < n / sizeof(samples[0]); i++){
+      tally(&samples[i]);
+      nsample++;
+    }
+  }
+  wait(0);
+  report(nsample);
+  exit(0);
+}
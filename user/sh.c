@@ -1,6 +1,7 @@
 // Shell.
 
 #include "kernel/types.h"
+#include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fcntl.h"
 
@@ -52,6 +53,87 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
+
+int stdfds[3] = {0, 1, 2};
+
+// Whether cmd is only programs, redirections and pipes, which
+// spawncmd() can start without a copy of the shell.
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start cmd, which spawnable() has passed, with fd[0], fd[1]
+// and fd[2] as its standard input, output and error.  Returns
+// how many processes it started.
+int
+spawncmd(struct cmd *cmd, int *fd)
+{
+  int p[2], nfd[3], n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  memmove(nfd, fd, sizeof(nfd));
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fd, 3) < 0){
+      fprintf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((nfd[rcmd->fd] = open(rcmd->file, rcmd->mode)) < 0){
+      fprintf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    n = spawncmd(rcmd->cmd, nfd);
+    close(nfd[rcmd->fd]);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      fprintf(2, "pipe failed\n");
+      return 0;
+    }
+    nfd[1] = p[1];
+    n = spawncmd(pcmd->left, nfd);
+    nfd[0] = p[0];
+    nfd[1] = fd[1];
+    n += spawncmd(pcmd->right, nfd);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
+// Run cmd, which spawnable() has passed, to completion.
+void
+spawnwait(struct cmd *cmd)
+{
+  int n;
+
+  for(n = spawncmd(cmd, stdfds); n > 0; n--)
+    wait(0);
+}
 
 // Execute cmd.  Never returns.
 void
@@ -91,14 +173,22 @@ runcmd(struct cmd *cmd)
 
   case LIST:
     lcmd = (struct listcmd*)cmd;
-    if(fork1() == 0)
-      runcmd(lcmd->left);
-    wait(0);
+    if(spawnable(lcmd->left)){
+      spawnwait(lcmd->left);
+    } else {
+      if(fork1() == 0)
+        runcmd(lcmd->left);
+      wait(0);
+    }
     runcmd(lcmd->right);
     break;
 
   case PIPE:
     pcmd = (struct pipecmd*)cmd;
+    if(spawnable(cmd)){
+      spawnwait(cmd);
+      break;
+    }
     if(pipe(p) < 0)
       panic("pipe");
     if(fork1() == 0){
@@ -123,7 +213,9 @@ runcmd(struct cmd *cmd)
 
   case BACK:
     bcmd = (struct backcmd*)cmd;
-    if(fork1() == 0)
+    if(spawnable(bcmd->cmd))
+      spawncmd(bcmd->cmd, stdfds);
+    else if(fork1() == 0)
       runcmd(bcmd->cmd);
     break;
   }
@@ -145,6 +237,8 @@ int
 main(void)
 {
   static char buf[100];
+  struct stat st;
+  struct cmd *cmd;
   int fd;
 
   // Ensure that three file descriptors are open.
@@ -155,6 +249,11 @@ main(void)
     }
   }
 
+  // The console returns a line per read, but reading ahead
+  // in a script would take input meant for the commands.
+  if(fstat(0, &st) < 0 || st.type != T_DEVICE)
+    setvbuf(stdin, _IONBF);
+
   // Read and run input commands.
   while(getcmd(buf, sizeof(buf)) >= 0){
     if(buf[0] == 'c' && buf[1] == 'd' && buf[2] == ' '){
@@ -164,9 +263,18 @@ main(void)
         fprintf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait(0);
+    // parse here, so that simple commands and pipelines can be
+    // spawned without copying the shell first.
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd)){
+      spawnwait(cmd);
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait(0);
+    }
+    freecmd(cmd);
   }
   exit(0);
 }
@@ -324,18 +432,36 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell itself parses, so a syntax error mustn't exit:
+// the parser notes the first one here and carries on.
+char *parseerr;
+
+void
+syntax(char *s)
+{
+  if(parseerr == 0)
+    parseerr = s;
+}
+
+// Parse s, or print the syntax error and return 0.
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && parseerr == 0){
     fprintf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    fprintf(2, "%s\n", parseerr);
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -380,7 +506,7 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
     if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+      syntax("missing file for redirection");
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -406,7 +532,7 @@ parseblock(char **ps, char *es)
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
   if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+    syntax("syntax - missing )");
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -432,12 +558,14 @@ parseexec(char **ps, char *es)
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
     if(tok != 'a')
-      panic("syntax");
+      syntax("syntax");
+    if(argc == MAXARGS - 1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -491,3 +619,29 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free cmd's nodes; the strings are in the shell's buffer.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+  case LIST:
+    // struct listcmd is laid out as struct pipecmd.
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
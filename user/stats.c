@@ -0,0 +1,20 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// Print the kernel's statistics report: lock contention,
+// log commits and system call counts and latencies.
+
+#define SZ 8192
+
+char buf[SZ];
+
+int
+main(void)
+{
+  int n;
+
+  n = statistics(buf, SZ);
+  write(1, buf, n);
+  exit(0);
+}
@@ -0,0 +1,153 @@
+// Buffered streams on file descriptors.
+//
+// stdin, stdout and stderr collect bytes in a buffer and move
+// them with one read() or write() per buffer, or per line on
+// the console, rather than a system call per character.  A
+// stream is either read or written, not both.  A stream whose
+// mode has not been set picks one on first use: by line for
+// the console, fully buffered for files and pipes.  stderr is
+// unbuffered: each call writes what it was given at once.
+//
+// exit() flushes stdout and stderr.  A program that forks or
+// execs with output pending must fflush() first, or the output
+// is written twice or not at all.
+
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+static FILE streams[3] = {
+  { 0, -1 },
+  { 1, -1 },
+  { 2, _IONBF },
+};
+
+FILE *stdin = &streams[0];
+FILE *stdout = &streams[1];
+FILE *stderr = &streams[2];
+
+static void
+setup(FILE *f)
+{
+  struct stat st;
+
+  if(f->mode >= 0)
+    return;
+  if(fstat(f->fd, &st) == 0 && st.type == T_DEVICE)
+    f->mode = _IOLBF;
+  else
+    f->mode = _IOFBF;
+}
+
+// Set f's buffering mode, before f is first used.
+void
+setvbuf(FILE *f, int mode)
+{
+  f->mode = mode;
+}
+
+// Write out f's buffer.  Returns 0, or -1 on error.
+int
+fflush(FILE *f)
+{
+  int off, n;
+
+  for(off = 0; off < f->n; off += n){
+    if((n = write(f->fd, f->buf + off, f->n - off)) <= 0){
+      f->n = 0;
+      return -1;
+    }
+  }
+  f->n = 0;
+  return 0;
+}
+
+// Returns n, or -1 on error.
+int
+fwrite(const void *p, int n, FILE *f)
+{
+  const char *s = p;
+  int i;
+
+  setup(f);
+  // a full buffer's worth goes straight out.
+  if(f->mode == _IOFBF && n >= BUFSIZ){
+    if(fflush(f) < 0 || write(f->fd, s, n) != n)
+      return -1;
+    return n;
+  }
+  for(i = 0; i < n; i++){
+    f->buf[f->n++] = s[i];
+    if(f->n == BUFSIZ || (f->mode == _IOLBF && s[i] == '\n')){
+      if(fflush(f) < 0)
+        return -1;
+    }
+  }
+  if(f->mode == _IONBF && fflush(f) < 0)
+    return -1;
+  return n;
+}
+
+int
+fputc(int c, FILE *f)
+{
+  char ch = c;
+
+  return fwrite(&ch, 1, f) == 1 ? (uchar)ch : -1;
+}
+
+int
+fputs(const char *s, FILE *f)
+{
+  return fwrite(s, strlen(s), f);
+}
+
+// Returns the next byte of f, or -1 at end of file or on
+// error.  An unbuffered stream reads one byte at a time, so
+// that it never takes input meant for someone else.
+int
+fgetc(FILE *f)
+{
+  int n;
+
+  setup(f);
+  if(f->pos == f->n){
+    f->pos = f->n = 0;
+    if((n = read(f->fd, f->buf, f->mode == _IONBF ? 1 : BUFSIZ)) <= 0)
+      return -1;
+    f->n = n;
+  }
+  return (uchar)f->buf[f->pos++];
+}
+
+// Read a line of at most max-1 bytes, including the newline,
+// into buf.  Returns buf, with buf[0] == 0 at end of file.
+char*
+fgets(char *buf, int max, FILE *f)
+{
+  int i, c;
+
+  for(i=0; i+1 < max; ){
+    if((c = fgetc(f)) < 0)
+      break;
+    buf[i++] = c;
+    if(c == '\n' || c == '\r')
+      break;
+  }
+  buf[i] = '\0';
+  return buf;
+}
+
+char*
+gets(char *buf, int max)
+{
+  return fgets(buf, max, stdin);
+}
+
+int
+exit(int status)
+{
+  fflush(stdout);
+  fflush(stderr);
+  _exit(status);
+}
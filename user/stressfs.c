@@ -7,12 +7,76 @@
 //    for (i = 0; i < 40000; i++)
 //      asm volatile("");
 
+//
+// "stressfs nproc [kb]" instead times nproc processes each
+// writing kb KB (default 1024) to a file of its own, and reports
+// the total throughput; run it with different CPUS= to see how
+// file system writes scale.
+
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/fs.h"
 #include "kernel/fcntl.h"
 
+#define CHUNK 4096
+
+char buf[CHUNK];
+
+void
+writer(int i, int kb)
+{
+  char path[] = "stressfsb0";
+  int fd, n;
+
+  path[9] += i;
+  unlink(path);
+  if((fd = open(path, O_CREATE | O_WRONLY)) < 0){
+    printf("stressfs: cannot create %s\n", path);
+    exit(1);
+  }
+  for(n = 0; n < kb * 1024; n += CHUNK){
+    if(write(fd, buf, CHUNK) != CHUNK){
+      printf("stressfs: write %s failed\n", path);
+      exit(1);
+    }
+  }
+  close(fd);
+  unlink(path);
+  exit(0);
+}
+
+void
+bench(int nproc, int kb)
+{
+  int i, t0, t, status, ok;
+  uint kbps;
+
+  memset(buf, 'b', sizeof(buf));
+  t0 = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0)
+      writer(i, kb);
+  }
+  ok = 1;
+  for(i = 0; i < nproc; i++){
+    wait(&status);
+    if(status != 0)
+      ok = 0;
+  }
+  t = uptime() - t0;
+  if(t == 0)
+    t = 1;
+  if(!ok){
+    printf("stressfs: a writer failed\n");
+    exit(1);
+  }
+  // uptime() ticks ten times a second.
+  kbps = (uint)nproc * kb * 10 / t;
+  printf("%d writers, %d KB each: %d.%d MB/s\n", nproc, kb,
+         kbps / 1024, kbps % 1024 * 10 / 1024);
+}
+
 int
 main(int argc, char *argv[])
 {
@@ -20,6 +84,16 @@ main(int argc, char *argv[])
   char path[] = "stressfs0";
   char data[512];
 
+  if(argc > 1){
+    i = atoi(argv[1]);
+    if(i < 1 || i > 10){
+      printf("usage: stressfs [nproc [kb]], nproc from 1 to 10\n");
+      exit(1);
+    }
+    bench(i, argc > 2 ? atoi(argv[2]) : 1024);
+    exit(0);
+  }
+
   printf("stressfs starting\n");
   memset(data, 'a', sizeof(data));
 
@@ -0,0 +1,195 @@
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "user/user.h"
+
+// top [-n count] [-d ticks]
+// Read the procs device twice, ticks apart (10, a second, by
+// default), and list the processes that used the most CPU time
+// in between, after the memory, buffer cache and log counters.
+// Repeat count times (once by default).
+
+#define NTOP 20
+#define BUFSZ (NPROC*128)
+
+struct ent {
+  int pid, ppid, tgid;
+  char state[8];
+  int prio, cpu;
+  int user, sys;         // ms
+  int nswtch, nfault, nread, nwrite, nsyscall, kb;
+  char name[16];
+  int used;              // ms of CPU since the last sample
+};
+
+struct ent old[NPROC], cur[NPROC];
+int nold, ncur;
+char buf[BUFSZ];
+char global[512];        // the counters before the process table
+
+int
+number(char **ps)
+{
+  char *s = *ps;
+  int n = 0, neg = 0;
+
+  while(*s == ' ')
+    s++;
+  if(*s == '-'){
+    neg = 1;
+    s++;
+  }
+  while('0' <= *s && *s <= '9')
+    n = n*10 + *s++ - '0';
+  *ps = s;
+  return neg ? -n : n;
+}
+
+void
+word(char **ps, char *w, int max)
+{
+  char *s = *ps;
+  int i = 0;
+
+  while(*s == ' ')
+    s++;
+  for(; *s && *s != ' ' && *s != '\n'; s++)
+    if(i < max - 1)
+      w[i++] = *s;
+  w[i] = 0;
+  *ps = s;
+}
+
+// Read the procs device into cur[] and global[].
+void
+sample(void)
+{
+  struct ent *e;
+  char *s, *e0;
+  int fd, n, m, table;
+
+  if((fd = open("procs", O_RDONLY)) < 0){
+    fprintf(2, "top: cannot open procs\n");
+    exit(1);
+  }
+  for(n = 0; n < BUFSZ - 1 && (m = read(fd, buf + n, BUFSZ - 1 - n)) > 0; n += m)
+    ;
+  close(fd);
+  buf[n] = 0;
+
+  ncur = 0;
+  global[0] = 0;
+  table = 0;
+  for(s = buf; *s; s = e0){
+    for(e0 = s; *e0 && *e0 != '\n'; e0++)
+      ;
+    if(*e0)
+      *e0++ = 0;
+    if(!table){
+      if(memcmp(s, "pid ", 4) == 0){
+        table = 1;
+      } else if(strlen(global) + strlen(s) + 2 < sizeof(global)){
+        strcpy(global + strlen(global), s);
+        strcpy(global + strlen(global), "\n");
+      }
+      continue;
+    }
+    if(ncur == NPROC)
+      break;
+    e = &cur[ncur++];
+    e->pid = number(&s);
+    e->ppid = number(&s);
+    e->tgid = number(&s);
+    word(&s, e->state, sizeof(e->state));
+    e->prio = number(&s);
+    e->cpu = number(&s);
+    e->user = number(&s);
+    e->sys = number(&s);
+    e->nswtch = number(&s);
+    e->nfault = number(&s);
+    e->nread = number(&s);
+    e->nwrite = number(&s);
+    e->nsyscall = number(&s);
+    e->kb = number(&s);
+    word(&s, e->name, sizeof(e->name));
+  }
+}
+
+// Work out each of cur[]'s use since old[].
+void
+delta(void)
+{
+  int i, j;
+
+  for(i = 0; i < ncur; i++){
+    cur[i].used = cur[i].user + cur[i].sys;
+    for(j = 0; j < nold; j++){
+      if(old[j].pid == cur[i].pid){
+        cur[i].used -= old[j].user + old[j].sys;
+        break;
+      }
+    }
+  }
+}
+
+void
+report(int ms)
+{
+  struct ent t, *e;
+  int i, j;
+
+  // busiest first.
+  for(i = 1; i < ncur; i++){
+    t = cur[i];
+    for(j = i; j > 0 && cur[j-1].used < t.used; j--)
+      cur[j] = cur[j-1];
+    cur[j] = t;
+  }
+
+  printf("%s", global);
+  printf("pid\ttgid\tstate\t%%cpu\tuser\tsys\tfaults\treads\twrites\tsyscalls\tkb\tname\n");
+  for(i = 0; i < ncur && i < NTOP; i++){
+    e = &cur[i];
+    printf("%d\t%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%s\n",
+           e->pid, e->tgid, e->state, ms ? e->used * 100 / ms : 0,
+           e->user, e->sys, e->nfault, e->nread, e->nwrite, e->nsyscall,
+           e->kb, e->name);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, count, ticks, ms;
+  uint64 t0;
+
+  count = 1;
+  ticks = 10;
+  for(i = 1; i + 1 < argc; i += 2){
+    if(strcmp(argv[i], "-n") == 0)
+      count = atoi(argv[i+1]);
+    else if(strcmp(argv[i], "-d") == 0)
+      ticks = atoi(argv[i+1]);
+    else
+      break;
+  }
+  if(i < argc || count < 1 || ticks < 1){
+    fprintf(2, "Usage: top [-n count] [-d ticks]\n");
+    exit(1);
+  }
+
+  sample();
+  t0 = rdtime();
+  while(count-- > 0){
+    memmove(old, cur, sizeof(cur[0]) * ncur);
+    nold = ncur;
+    sleep(ticks);
+    sample();
+    ms = (rdtime() - t0) * 1000 / TIMEFREQ;
+    t0 = rdtime();
+    delta();
+    report(ms);
+  }
+  exit(0);
+}
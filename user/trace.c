@@ -0,0 +1,44 @@
+#include "kernel/param.h"
+#include "kernel/types.h"
+#include "kernel/stat.h"
+#include "user/user.h"
+
+// trace mask command [args...]
+// Run command, printing each system call in mask (1L<<SYS_x)
+// that it and its children make.  The mask is 64 bits wide,
+// too wide for atoi().
+
+// Parse s, all decimal digits, into *n.  Returns -1 if s
+// is empty or has anything else.
+static int
+atou64(const char *s, uint64 *n)
+{
+  if(*s == '\0')
+    return -1;
+  for(*n = 0; *s; s++){
+    if(*s < '0' || *s > '9')
+      return -1;
+    *n = *n*10 + *s - '0';
+  }
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  uint64 mask;
+
+  if(argc < 3 || atou64(argv[1], &mask) < 0){
+    fprintf(2, "Usage: %s mask command\n", argv[0]);
+    exit(1);
+  }
+
+  if(trace(mask) < 0){
+    fprintf(2, "%s: trace failed\n", argv[0]);
+    exit(1);
+  }
+
+  exec(argv[2], argv + 2);
+  fprintf(2, "%s: exec %s failed\n", argv[0], argv[2]);
+  exit(1);
+}
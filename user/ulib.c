@@ -1,6 +1,8 @@
 #include "kernel/types.h"
 #include "kernel/stat.h"
 #include "kernel/fcntl.h"
+#include "kernel/riscv.h"
+#include "kernel/memlayout.h"
 #include "user/user.h"
 
 char*
@@ -32,14 +34,32 @@ strlen(const char *s)
   return n;
 }
 
+// memset, memmove and memcmp work a word at a time
+// when the addresses allow aligned accesses, as in the
+// kernel's string.c.
+typedef uint64 __attribute__((__may_alias__)) word;
+
+#define WSIZE sizeof(word)
+#define WALIGNED(p) (((uint64)(p) & (WSIZE-1)) == 0)
+
 void*
 memset(void *dst, int c, uint n)
 {
   char *cdst = (char *) dst;
-  int i;
-  for(i = 0; i < n; i++){
-    cdst[i] = c;
+  word w;
+
+  if(n >= 2*WSIZE){
+    for(; !WALIGNED(cdst); n--)
+      *cdst++ = c;
+    w = (uchar)c;
+    w |= w << 8;
+    w |= w << 16;
+    w |= w << 32;
+    for(; n >= WSIZE; n -= WSIZE, cdst += WSIZE)
+      *(word*)cdst = w;
   }
+  while(n-- > 0)
+    *cdst++ = c;
   return dst;
 }
 
@@ -52,24 +72,6 @@ strchr(const char *s, char c)
   return 0;
 }
 
-char*
-gets(char *buf, int max)
-{
-  int i, cc;
-  char c;
-
-  for(i=0; i+1 < max; ){
-    cc = read(0, &c, 1);
-    if(cc < 1)
-      break;
-    buf[i++] = c;
-    if(c == '\n' || c == '\r')
-      break;
-  }
-  buf[i] = '\0';
-  return buf;
-}
-
 int
 stat(const char *n, struct stat *st)
 {
@@ -100,15 +102,49 @@ memmove(void *vdst, const void *vsrc, int n)
 {
   char *dst;
   const char *src;
+  const word *sw;
+  word lo, hi;
+  int sh;
 
+  // n is signed: the word loops below compare it unsigned.
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
   if (src > dst) {
+    if(n >= 2*WSIZE){
+      for(; !WALIGNED(dst); n--)
+        *dst++ = *src++;
+      if(WALIGNED(src)){
+        for(; n >= WSIZE; n -= WSIZE, dst += WSIZE, src += WSIZE)
+          *(word*)dst = *(word*)src;
+      } else {
+        // build each word from the two aligned words
+        // that src straddles.
+        sh = ((uint64)src & (WSIZE-1)) * 8;
+        sw = (const word*)(src - sh/8);
+        lo = *sw++;
+        for(; n >= WSIZE; n -= WSIZE, dst += WSIZE, src += WSIZE){
+          hi = *sw++;
+          *(word*)dst = (lo >> sh) | (hi << (64 - sh));
+          lo = hi;
+        }
+      }
+    }
     while(n-- > 0)
       *dst++ = *src++;
   } else {
     dst += n;
     src += n;
+    if(n >= 2*WSIZE && ((uint64)src & (WSIZE-1)) == ((uint64)dst & (WSIZE-1))){
+      for(; !WALIGNED(dst); n--)
+        *--dst = *--src;
+      for(; n >= WSIZE; n -= WSIZE){
+        src -= WSIZE;
+        dst -= WSIZE;
+        *(word*)dst = *(word*)src;
+      }
+    }
     while(n-- > 0)
       *--dst = *--src;
   }
@@ -119,6 +155,15 @@ int
 memcmp(const void *s1, const void *s2, uint n)
 {
   const char *p1 = s1, *p2 = s2;
+
+  if(n >= 2*WSIZE && ((uint64)p1 & (WSIZE-1)) == ((uint64)p2 & (WSIZE-1))){
+    for(; !WALIGNED(p1); n--, p1++, p2++)
+      if(*p1 != *p2)
+        return *p1 - *p2;
+    // skip equal words; the byte loop finds the difference.
+    for(; n >= WSIZE && *(word*)p1 == *(word*)p2; n -= WSIZE)
+      p1 += WSIZE, p2 += WSIZE;
+  }
   while (n-- > 0) {
     if (*p1 != *p2) {
       return *p1 - *p2;
@@ -134,3 +179,109 @@ memcpy(void *dst, const void *src, uint n)
 {
   return memmove(dst, src, n);
 }
+
+// getpid() and uptime() read pages that the kernel maps
+// read-only into every process, instead of trapping;
+// _getpid() and _uptime() are the system calls.
+int
+getpid(void)
+{
+  return ((struct usyscall *)USYSCALL)->pid;
+}
+
+int
+uptime(void)
+{
+  return ((volatile struct ushared *)USHARED)->ticks;
+}
+
+// The time counter, which counts TIMEFREQ a second: finer
+// than uptime()'s ticks, for timing short operations.
+uint64
+rdtime(void)
+{
+  uint64 x;
+
+  asm volatile("rdtime %0" : "=r" (x));
+  return x;
+}
+
+
+// Start a thread running fn(arg) on the size-byte stack at
+// stack, and return its id for join().  The thread exits with
+// status 0 when fn returns.  malloc() and the stdio streams
+// don't lock, so only one thread at a time may use them.
+static void
+threadstart(void *top)
+{
+  void (*fn)(void*) = ((void**)top)[0];
+
+  fn(((void**)top)[1]);
+  exit(0);
+}
+
+int
+thread_create(void (*fn)(void*), void *arg, void *stack, int size)
+{
+  void **top;
+
+  top = (void**)(((uint64)stack + size - 2*sizeof(void*)) & ~15);
+  top[0] = fn;
+  top[1] = arg;
+  return clone(threadstart, top, top);
+}
+
+// Mutexes and condition variables for threads.  A mutex's
+// state is 0 if unlocked, 1 if locked, 2 if locked and some
+// thread may be asleep on it, so locking and unlocking one that
+// no other thread wants take no system call.  A condition
+// variable is a counter that signals bump, for a waiter to
+// sleep on with futex_wait() once it has let go of the mutex.
+void
+mutex_lock(mutex_t *m)
+{
+  int c;
+
+  if((c = __sync_val_compare_and_swap(&m->state, 0, 1)) == 0)
+    return;
+  if(c != 2)
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  while(c != 0){
+    futex_wait(&m->state, 2);
+    c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+  }
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2)
+    futex_wake(&m->state, 1);
+}
+
+// Wait for a signal on c, letting go of m meanwhile.  May
+// return without one, so the caller must check its condition
+// again.
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  int seq = __atomic_load_n(&c->seq, __ATOMIC_RELAXED);
+
+  mutex_unlock(m);
+  futex_wait(&c->seq, seq);
+  mutex_lock(m);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  __atomic_add_fetch(&c->seq, 1, __ATOMIC_RELEASE);
+  futex_wake(&c->seq, 0x7fffffff);
+}
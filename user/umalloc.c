@@ -2,89 +2,237 @@
 #include "kernel/stat.h"
 #include "user/user.h"
 #include "kernel/param.h"
+#include "kernel/fcntl.h"
+#include "kernel/riscv.h"
 
-// Memory allocator by Kernighan and Ritchie,
-// The C programming Language, 2nd ed.  Section 8.7.
+// Memory allocator with size classes.
+//
+// Memory comes from sbrk() a run of whole pages at a time,
+// and every run starts with a struct page, so free() finds
+// the header of any block by rounding its address down to a
+// page boundary.
+//
+// Requests up to MAXSMALL bytes are rounded up to a power of
+// two and carved from slab pages that hold blocks of just
+// that size.  Each slab page keeps its own free list, and the
+// slab pages of a class that have free blocks are kept on a
+// list, so malloc() and free() of small blocks take constant
+// time.  A slab page whose blocks are all free goes back to
+// the pool of free pages.
+//
+// Larger requests get a run of pages of their own: from
+// mmap() if they are at least MMAPMIN bytes, so free() can
+// give the memory back, and otherwise, or if mmap() fails,
+// from the pool of free runs, which is kept in address order
+// and coalesced.
 
-typedef long Align;
+#define MINSHIFT 4                    // smallest class is 16 bytes
+#define NCLASS   7                    // 16 .. 1024 bytes
+#define MAXSMALL (1 << (MINSHIFT + NCLASS - 1))
+#define MMAPMIN  (64*1024)
 
-union header {
-  struct {
-    union header *ptr;
-    uint size;
-  } s;
-  Align x;
+#define LARGE    -1                   // page.class of a run from the pool
+#define MAPPED   -2                   // page.class of a run from mmap()
+
+struct block {
+  struct block *next;
 };
 
-typedef union header Header;
+struct page {
+  int class;               // size class, LARGE or MAPPED
+  int npages;              // pages in this run
+  int nfree;               // slab: free blocks
+  struct block *free;      // slab: its free blocks
+  struct page *next;       // slab: on its class's partial list
+  struct page *prev;
+};
 
-static Header base;
-static Header *freep;
+// What precedes the first block of a page, keeping blocks
+// 16-byte aligned.
+#define HDRSIZE ((sizeof(struct page) + 15) & ~15)
 
-void
-free(void *ap)
+// A run of free pages in the pool.
+struct run {
+  int npages;
+  struct run *next;
+};
+
+static struct page *partial[NCLASS];  // slab pages with free blocks
+static struct run *pool;              // free runs, in address order
+
+static int
+classof(uint nbytes)
+{
+  int c;
+
+  for(c = 0; (1 << (MINSHIFT + c)) < nbytes; c++)
+    ;
+  return c;
+}
+
+// Return n pages to the pool, merging them with their neighbors.
+static void
+putpages(void *p, int n)
 {
-  Header *bp, *p;
-
-  bp = (Header*)ap - 1;
-  for(p = freep; !(bp > p && bp < p->s.ptr); p = p->s.ptr)
-    if(p >= p->s.ptr && (bp > p || bp < p->s.ptr))
-      break;
-  if(bp + bp->s.size == p->s.ptr){
-    bp->s.size += p->s.ptr->s.size;
-    bp->s.ptr = p->s.ptr->s.ptr;
-  } else
-    bp->s.ptr = p->s.ptr;
-  if(p + p->s.size == bp){
-    p->s.size += bp->s.size;
-    p->s.ptr = bp->s.ptr;
-  } else
-    p->s.ptr = bp;
-  freep = p;
+  struct run *r = p, **rp, *prev;
+
+  prev = 0;
+  for(rp = &pool; *rp && *rp < r; rp = &(*rp)->next)
+    prev = *rp;
+  r->npages = n;
+  r->next = *rp;
+  *rp = r;
+  if(r->next && (char*)r + r->npages*PGSIZE == (char*)r->next){
+    r->npages += r->next->npages;
+    r->next = r->next->next;
+  }
+  if(prev && (char*)prev + prev->npages*PGSIZE == (char*)r){
+    prev->npages += r->npages;
+    prev->next = r->next;
+  }
 }
 
-static Header*
-morecore(uint nu)
+// Take a run of n pages from the pool, or else from sbrk().
+static void*
+getpages(int n)
 {
+  struct run *r, **rp;
+  uint64 brk;
   char *p;
-  Header *hp;
 
-  if(nu < 4096)
-    nu = 4096;
-  p = sbrk(nu * sizeof(Header));
-  if(p == (char*)-1)
+  for(rp = &pool; (r = *rp) != 0; rp = &r->next){
+    if(r->npages == n){
+      *rp = r->next;
+      return r;
+    }
+    if(r->npages > n){
+      // take the tail, leaving r where it is in the list.
+      r->npages -= n;
+      return (char*)r + r->npages*PGSIZE;
+    }
+  }
+
+  // Someone else may have moved the break off a page boundary.
+  brk = (uint64)sbrk(0);
+  if(brk % PGSIZE != 0 && sbrk(PGSIZE - brk % PGSIZE) == (char*)-1)
     return 0;
-  hp = (Header*)p;
-  hp->s.size = nu;
-  free((void*)(hp + 1));
-  return freep;
+  if((p = sbrk(n * PGSIZE)) == (char*)-1)
+    return 0;
+  return p;
 }
 
-void*
-malloc(uint nbytes)
+static void*
+smallalloc(int c)
 {
-  Header *p, *prevp;
-  uint nunits;
+  struct page *pg;
+  struct block *b;
+  int size, i;
 
-  nunits = (nbytes + sizeof(Header) - 1)/sizeof(Header) + 1;
-  if((prevp = freep) == 0){
-    base.s.ptr = freep = prevp = &base;
-    base.s.size = 0;
-  }
-  for(p = prevp->s.ptr; ; prevp = p, p = p->s.ptr){
-    if(p->s.size >= nunits){
-      if(p->s.size == nunits)
-        prevp->s.ptr = p->s.ptr;
-      else {
-        p->s.size -= nunits;
-        p += p->s.size;
-        p->s.size = nunits;
-      }
-      freep = prevp;
-      return (void*)(p + 1);
+  if((pg = partial[c]) == 0){
+    if((pg = getpages(1)) == 0)
+      return 0;
+    size = 1 << (MINSHIFT + c);
+    pg->class = c;
+    pg->npages = 1;
+    pg->nfree = 0;
+    pg->free = 0;
+    for(i = (PGSIZE - HDRSIZE) / size - 1; i >= 0; i--){
+      b = (struct block*)((char*)pg + HDRSIZE + i*size);
+      b->next = pg->free;
+      pg->free = b;
+      pg->nfree++;
     }
-    if(p == freep)
-      if((p = morecore(nunits)) == 0)
-        return 0;
+    pg->prev = 0;
+    pg->next = 0;
+    partial[c] = pg;
+  }
+
+  b = pg->free;
+  pg->free = b->next;
+  if(--pg->nfree == 0){
+    // full; off the partial list.
+    partial[c] = pg->next;
+    if(pg->next)
+      pg->next->prev = 0;
   }
+  return b;
+}
+
+static void
+smallfree(struct page *pg, struct block *b)
+{
+  int c = pg->class;
+
+  b->next = pg->free;
+  pg->free = b;
+  if(pg->nfree++ == 0){
+    // was full; back on the partial list.
+    pg->prev = 0;
+    pg->next = partial[c];
+    if(pg->next)
+      pg->next->prev = pg;
+    partial[c] = pg;
+  }
+  if(pg->nfree == (PGSIZE - HDRSIZE) >> (MINSHIFT + c) &&
+     (pg->prev || pg->next)){
+    // all free, and not the class's only partial page.
+    if(pg->prev)
+      pg->prev->next = pg->next;
+    else
+      partial[c] = pg->next;
+    if(pg->next)
+      pg->next->prev = pg->prev;
+    putpages(pg, 1);
+  }
+}
+
+static void*
+largealloc(uint nbytes)
+{
+  struct page *pg;
+  int n;
+
+  n = (nbytes + HDRSIZE + PGSIZE - 1) / PGSIZE;
+  pg = 0;
+  if(nbytes >= MMAPMIN){
+    pg = mmap(0, (uint64)n*PGSIZE, PROT_READ|PROT_WRITE,
+              MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    if(pg == (struct page*)-1)
+      pg = 0;
+    else
+      pg->class = MAPPED;
+  }
+  if(pg == 0){
+    if((pg = getpages(n)) == 0)
+      return 0;
+    pg->class = LARGE;
+  }
+  pg->npages = n;
+  return (char*)pg + HDRSIZE;
+}
+
+void
+free(void *ap)
+{
+  struct page *pg;
+
+  if(ap == 0)
+    return;
+  pg = (struct page*)PGROUNDDOWN((uint64)ap);
+  if(pg->class == MAPPED)
+    munmap(pg, (uint64)pg->npages*PGSIZE);
+  else if(pg->class == LARGE)
+    putpages(pg, pg->npages);
+  else
+    smallfree(pg, ap);
+}
+
+void*
+malloc(uint nbytes)
+{
+  if(nbytes <= MAXSMALL)
+    return smallalloc(classof(nbytes));
+  if(nbytes > 0x7fffffff - HDRSIZE - PGSIZE)
+    return 0;
+  return largealloc(nbytes);
 }
@@ -1,9 +1,11 @@
 struct stat;
 struct rtcdate;
+struct iovec;
+struct pollfd;
 
 // system calls
 int fork(void);
-int exit(int) __attribute__((noreturn));
+int _exit(int) __attribute__((noreturn));
 int wait(int*);
 int pipe(int*);
 int write(int, const void*, int);
@@ -19,12 +21,36 @@ int link(const char*, const char*);
 int mkdir(const char*);
 int chdir(const char*);
 int dup(int);
-int getpid(void);
+int _getpid(void);
 char* sbrk(int);
 int sleep(int);
-int uptime(void);
+int _uptime(void);
 int sigalarm(int ticks, void (*handler)());
 int sigreturn(void);
+int splice(int, int, int);
+int trace(uint64);
+int usleep(int);
+void *mmap(void*, uint64, int, int, int, int);
+int munmap(void*, uint64);
+int readv(int, const struct iovec*, int);
+int writev(int, const struct iovec*, int);
+int pread(int, void*, int, int);
+int pwrite(int, const void*, int, int);
+int fcntl(int, int, int);
+int poll(struct pollfd*, int, int);
+int clone(void(*)(void*), void*, void*);
+int join(int, int*);
+int futex_wait(int*, int);
+int futex_wake(int*, int);
+int setaffinity(int, int);
+int spawn(char*, char**, int*, int);
+int vfork(void);
+int sync(void);
+int fsync(int);
+int mount(char*, int);
+int execve(char*, char**, char**);
+int perfopen(void);
+int perfread(uint64*, int);
 
 // ulib.c
 int stat(const char*, struct stat*);
@@ -34,7 +60,6 @@ char* strchr(const char*, char c);
 int strcmp(const char*, const char*);
 void fprintf(int, const char*, ...);
 void printf(const char*, ...);
-char* gets(char*, int max);
 uint strlen(const char*);
 void* memset(void*, int, uint);
 void* malloc(uint);
@@ -42,3 +67,42 @@ void free(void*);
 int atoi(const char*);
 int memcmp(const void *, const void *, uint);
 void *memcpy(void *, const void *, uint);
+int getpid(void);
+int uptime(void);
+uint64 rdtime(void);
+int thread_create(void(*)(void*), void*, void*, int);
+typedef struct { int state; } mutex_t;  // initially { 0 }
+typedef struct { int seq; } cond_t;     // initially { 0 }
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
+
+// stdio.c
+#define BUFSIZ 512
+#define _IONBF 0  // unbuffered
+#define _IOLBF 1  // flushed at each newline
+#define _IOFBF 2  // flushed when full
+
+typedef struct {
+  int fd;
+  int mode;         // _IONBF, _IOLBF or _IOFBF; -1 until first use
+  int n;            // bytes in buf
+  int pos;          // next byte of buf to read
+  char buf[BUFSIZ];
+} FILE;
+
+extern FILE *stdin, *stdout, *stderr;
+int exit(int) __attribute__((noreturn));
+void setvbuf(FILE*, int);
+int fflush(FILE*);
+int fwrite(const void*, int, FILE*);
+int fputc(int, FILE*);
+int fputs(const char*, FILE*);
+int fgetc(FILE*);
+char* fgets(char*, int, FILE*);
+char* gets(char*, int max);
+
+// statistics.c
+int statistics(void*, int);
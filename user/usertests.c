@@ -7,6 +7,7 @@
 #include "kernel/syscall.h"
 #include "kernel/memlayout.h"
 #include "kernel/riscv.h"
+#include "kernel/perf.h"
 
 //
 // Tests xv6 system calls.  usertests without arguments runs them all
@@ -569,217 +570,1782 @@ writetest(char *s)
   }
 }
 
+// enough blocks to reach into the doubly-indirect tree.
+#define NBIG (NDIRECT + NINDIRECT + NINDIRECT)
+
+void
+writebig(char *s)
+{
+  int i, fd, n;
+
+  fd = open("big", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: error: creat big failed!\n", s);
+    exit(1);
+  }
+
+  for(i = 0; i < NBIG; i++){
+    ((int*)buf)[0] = i;
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf("%s: error: write big file failed\n", s, i);
+      exit(1);
+    }
+  }
+
+  close(fd);
+
+  fd = open("big", O_RDONLY);
+  if(fd < 0){
+    printf("%s: error: open big failed!\n", s);
+    exit(1);
+  }
+
+  n = 0;
+  for(;;){
+    i = read(fd, buf, BSIZE);
+    if(i == 0){
+      if(n == NBIG - 1){
+        printf("%s: read only %d blocks from big", s, n);
+        exit(1);
+      }
+      break;
+    } else if(i != BSIZE){
+      printf("%s: read failed %d\n", s, i);
+      exit(1);
+    }
+    if(((int*)buf)[0] != n){
+      printf("%s: read content of block %d is %d\n", s,
+             n, ((int*)buf)[0]);
+      exit(1);
+    }
+    n++;
+  }
+  close(fd);
+  if(unlink("big") < 0){
+    printf("%s: unlink big failed\n", s);
+    exit(1);
+  }
+}
+
+// many creates, followed by unlink test
+void
+createtest(char *s)
+{
+  int i, fd;
+  enum { N=52 };
+
+  char name[3];
+  name[0] = 'a';
+  name[2] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i;
+    fd = open(name, O_CREATE|O_RDWR);
+    close(fd);
+  }
+  name[0] = 'a';
+  name[2] = '\0';
+  for(i = 0; i < N; i++){
+    name[1] = '0' + i;
+    unlink(name);
+  }
+}
+
+void dirtest(char *s)
+{
+  if(mkdir("dir0") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+
+  if(chdir("dir0") < 0){
+    printf("%s: chdir dir0 failed\n", s);
+    exit(1);
+  }
+
+  if(chdir("..") < 0){
+    printf("%s: chdir .. failed\n", s);
+    exit(1);
+  }
+
+  if(unlink("dir0") < 0){
+    printf("%s: unlink dir0 failed\n", s);
+    exit(1);
+  }
+}
+
+void
+exectest(char *s)
+{
+  int fd, xstatus, pid;
+  char *echoargv[] = { "echo", "OK", 0 };
+  char buf[3];
+
+  unlink("echo-ok");
+  pid = fork();
+  if(pid < 0) {
+     printf("%s: fork failed\n", s);
+     exit(1);
+  }
+  if(pid == 0) {
+    close(1);
+    fd = open("echo-ok", O_CREATE|O_WRONLY);
+    if(fd < 0) {
+      printf("%s: create failed\n", s);
+      exit(1);
+    }
+    if(fd != 1) {
+      printf("%s: wrong fd\n", s);
+      exit(1);
+    }
+    if(exec("echo", echoargv) < 0){
+      printf("%s: exec echo failed\n", s);
+      exit(1);
+    }
+    // won't get to here
+  }
+  if (wait(&xstatus) != pid) {
+    printf("%s: wait failed!\n", s);
+  }
+  if(xstatus != 0)
+    exit(xstatus);
+
+  fd = open("echo-ok", O_RDONLY);
+  if(fd < 0) {
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if (read(fd, buf, 2) != 2) {
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  unlink("echo-ok");
+  if(buf[0] == 'O' && buf[1] == 'K')
+    exit(0);
+  else {
+    printf("%s: wrong output\n", s);
+    exit(1);
+  }
+
+}
+
+// more arguments than exec() used to allow, short enough to
+// fit in the stack page, and an environment.  The child is
+// usertests -e, which checks what it got.
+#define NEXECARG 100
+char *execenv[] = { "HOME=/", "X=1", 0 };
+
+void
+execvetest(char *s)
+{
+  static char *args[NEXECARG + 3];
+  int i, pid, xstatus;
+
+  args[0] = "usertests";
+  args[1] = "-e";
+  for(i = 0; i < NEXECARG; i++)
+    args[i + 2] = "a";
+  args[i + 2] = 0;
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    execve("usertests", args, execenv);
+    printf("%s: execve failed\n", s);
+    exit(1);
+  }
+  wait(&xstatus);
+  if(xstatus != 0){
+    printf("%s: wrong arguments or environment\n", s);
+    exit(1);
+  }
+}
+
+// usertests -e: did execvetest() pass what it meant to?
+int
+execvecheck(int argc, char *argv[], char *envp[])
+{
+  int i;
+
+  if(argc != NEXECARG + 2)
+    return 1;
+  for(i = 2; i < argc; i++)
+    if(strcmp(argv[i], "a") != 0)
+      return 1;
+  if(argv[argc] != 0)
+    return 1;
+  for(i = 0; execenv[i]; i++)
+    if(envp[i] == 0 || strcmp(envp[i], execenv[i]) != 0)
+      return 1;
+  return envp[i] != 0;
+}
+
+// simple fork and pipe read/write
+
+void
+pipe1(char *s)
+{
+  int fds[2], pid, xstatus;
+  int seq, i, n, cc, total;
+  enum { N=5, SZ=1033 };
+  
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  seq = 0;
+  if(pid == 0){
+    close(fds[0]);
+    for(n = 0; n < N; n++){
+      for(i = 0; i < SZ; i++)
+        buf[i] = seq++;
+      if(write(fds[1], buf, SZ) != SZ){
+        printf("%s: pipe1 oops 1\n", s);
+        exit(1);
+      }
+    }
+    exit(0);
+  } else if(pid > 0){
+    close(fds[1]);
+    total = 0;
+    cc = 1;
+    while((n = read(fds[0], buf, cc)) > 0){
+      for(i = 0; i < n; i++){
+        if((buf[i] & 0xff) != (seq++ & 0xff)){
+          printf("%s: pipe1 oops 2\n", s);
+          return;
+        }
+      }
+      total += n;
+      cc = cc * 2;
+      if(cc > sizeof(buf))
+        cc = sizeof(buf);
+    }
+    if(total != N * SZ){
+      printf("%s: pipe1 oops 3 total %d\n", total);
+      exit(1);
+    }
+    close(fds[0]);
+    wait(&xstatus);
+    exit(xstatus);
+  } else {
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+}
+
+// move a file through a pipe and into another file
+// with splice(), never touching the data in user space.
+void
+splicetest(char *s)
+{
+  int fds[2], fd, pid, xstatus;
+  int i, n, seq, total;
+  enum { N=7, SZ=5011 };
+
+  fd = open("splice.in", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create splice.in failed\n", s);
+    exit(1);
+  }
+  seq = 0;
+  for(n = 0; n < N; n++){
+    for(i = 0; i < SZ; i++)
+      buf[i] = seq++;
+    if(write(fd, buf, SZ) != SZ){
+      printf("%s: write splice.in failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork() failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice.in", O_RDONLY);
+    while((n = splice(fd, fds[1], 3000)) > 0)
+      ;
+    exit(n < 0);
+  }
+
+  close(fds[1]);
+  fd = open("splice.out", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create splice.out failed\n", s);
+    exit(1);
+  }
+  total = 0;
+  while((n = splice(fds[0], fd, 10000)) > 0)
+    total += n;
+  close(fd);
+  close(fds[0]);
+  wait(&xstatus);
+  if(n < 0 || xstatus != 0 || total != N * SZ){
+    printf("%s: spliced %d bytes, status %d\n", s, total, xstatus);
+    exit(1);
+  }
+
+  fd = open("splice.out", O_RDONLY);
+  seq = 0;
+  while((n = read(fd, buf, SZ)) > 0){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (seq++ & 0xff)){
+        printf("%s: wrong data at %d\n", s, seq - 1);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(seq != N * SZ){
+    printf("%s: splice.out has %d bytes\n", s, seq);
+    exit(1);
+  }
+  if(splice(fds[0], 1, 1) >= 0){
+    printf("%s: splice on a closed fd succeeded\n", s);
+    exit(1);
+  }
+  unlink("splice.in");
+  unlink("splice.out");
+}
+
+// A reader that comes to a pipe while a splice() is draining
+// it, its writer gone, must see the end of the data once the
+// splice is done, not sleep on.  Racy, so tried many times.
+void
+splicereadtest(char *s)
+{
+  int fds[2], fd, i, n, pid, xstatus;
+  enum { TRIES=20 };
+
+  for(i = 0; i < TRIES; i++){
+    if(pipe(fds) != 0){
+      printf("%s: pipe() failed\n", s);
+      exit(1);
+    }
+    memset(buf, 'x', PGSIZE);
+    if(write(fds[1], buf, PGSIZE) != PGSIZE){
+      printf("%s: write to pipe failed\n", s);
+      exit(1);
+    }
+    close(fds[1]);
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork() failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      n = 0;
+      while((xstatus = read(fds[0], buf, 100)) > 0)
+        n += xstatus;
+      exit(n);
+    }
+    fd = open("splice.out", O_CREATE|O_WRONLY|O_TRUNC);
+    if(fd < 0){
+      printf("%s: create splice.out failed\n", s);
+      exit(1);
+    }
+    n = splice(fds[0], fd, PGSIZE);
+    close(fd);
+    close(fds[0]);
+    wait(&xstatus);
+    if(n < 0 || n + xstatus != PGSIZE){
+      printf("%s: spliced %d and read %d of %d bytes\n", s, n, xstatus, PGSIZE);
+      exit(1);
+    }
+  }
+  unlink("splice.out");
+}
+
+// splice() from one file to another, across pages and
+// transactions.
+void
+splicefiletest(char *s)
+{
+  int fd, in, out, i, n, total;
+  enum { SZ=70001 };
+
+  fd = open("splicef.in", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf("%s: create splicef.in failed\n", s);
+    exit(1);
+  }
+  for(total = 0; total < SZ; total += n){
+    n = SZ - total < 3001 ? SZ - total : 3001;
+    for(i = 0; i < n; i++)
+      buf[i] = (total + i) % 251;
+    if(write(fd, buf, n) != n){
+      printf("%s: write splicef.in failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  in = open("splicef.in", O_RDONLY);
+  out = open("splicef.out", O_CREATE|O_WRONLY);
+  if(in < 0 || out < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  if(read(in, buf, 100) != 100 || write(out, buf, 100) != 100){
+    printf("%s: read or write failed\n", s);
+    exit(1);
+  }
+  for(total = 100; (n = splice(in, out, 20000)) > 0; total += n)
+    ;
+  close(in);
+  close(out);
+  if(n < 0 || total != SZ){
+    printf("%s: spliced %d bytes\n", s, total);
+    exit(1);
+  }
+
+  // one open file has one offset to read and write at.
+  fd = open("splicef.out", O_RDWR);
+  if(fd < 0 || splice(fd, fd, 10) >= 0){
+    printf("%s: splice of a file to itself succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("splicef.out", O_RDONLY);
+  for(total = 0; (n = read(fd, buf, 3001)) > 0; total += n){
+    for(i = 0; i < n; i++){
+      if((buf[i] & 0xff) != (total + i) % 251){
+        printf("%s: wrong data at %d\n", s, total + i);
+        exit(1);
+      }
+    }
+  }
+  close(fd);
+  if(total != SZ){
+    printf("%s: splicef.out has %d bytes\n", s, total);
+    exit(1);
+  }
+  unlink("splicef.in");
+  unlink("splicef.out");
+}
+
+// getpid() and uptime() read pages shared with the kernel;
+// they must agree with the system calls, and user code must
+// not be able to write them.
+void
+ushared(char *s)
+{
+  int pid, xstatus, fds[2];
+
+  if(getpid() != _getpid()){
+    printf("%s: getpid %d, _getpid %d\n", s, getpid(), _getpid());
+    exit(1);
+  }
+  if(uptime() > _uptime() || uptime() + 1 < _uptime()){
+    printf("%s: uptime %d, _uptime %d\n", s, uptime(), _uptime());
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    if(getpid() != _getpid())
+      exit(1);
+    *(int*)USYSCALL = 0;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: child could write USYSCALL\n", s);
+    exit(1);
+  }
+
+  // nor through a system call.
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], (char*)USHARED, 1) != -1){
+    printf("%s: read into USHARED succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+}
+
+// sleeps shorter than a tick, and a long sleep cut short by kill().
+void
+usleeptest(char *s)
+{
+  int i, pid, t0, xstatus;
+
+  t0 = _uptime();
+  for(i = 0; i < 50; i++){
+    if(usleep(1000) < 0){
+      printf("%s: usleep failed\n", s);
+      exit(1);
+    }
+  }
+  if(_uptime() - t0 > 5){
+    printf("%s: 50 1ms sleeps took %d ticks\n", s, _uptime() - t0);
+    exit(1);
+  }
+
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    sleep(1000000);
+    exit(0);
+  }
+  sleep(1);
+  kill(pid);
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: sleeping child not killed\n", s);
+    exit(1);
+  }
+}
+
+// mmap() of a file, private and shared, of shared anonymous
+// memory across fork(), and of memory that can't be touched.
+void
+mmaptest(char *s)
+{
+  enum { N = 2*PGSIZE + 100 };
+  char *buf, *p;
+  int fd, i, pid, xstatus, fds[2];
+
+  buf = malloc(N);
+  for(i = 0; i < N; i++)
+    buf[i] = 'a' + i % 23;
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, N) != N){
+    printf("%s: write mmapfile failed\n", s);
+    exit(1);
+  }
+
+  // private: we see the file, past its end zeros, and our
+  // stores stay ours.
+  p = mmap(0, 3*PGSIZE, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap private failed\n", s);
+    exit(1);
+  }
+  if(memcmp(p, buf, N) != 0 || p[N] != 0 || p[3*PGSIZE-1] != 0){
+    printf("%s: private mapping has wrong contents\n", s);
+    exit(1);
+  }
+  p[0] = 'Z';
+  if(munmap(p + PGSIZE, PGSIZE) == 0){
+    printf("%s: munmap of the middle of a mapping succeeded\n", s);
+    exit(1);
+  }
+  if(munmap(p, 3*PGSIZE) < 0){
+    printf("%s: munmap failed\n", s);
+    exit(1);
+  }
+
+  // shared: stores reach the file on munmap.
+  p = mmap(0, N, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == (char*)-1 || p[0] != 'a'){
+    printf("%s: mmap shared failed\n", s);
+    exit(1);
+  }
+  p[1] = 'Y';
+  p[N-1] = 'X';
+  // write() and read() see the same page as the mapping.
+  if(pwrite(fd, "W", 1, 2) != 1 || p[2] != 'W'){
+    printf("%s: write not seen by shared mapping\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 2, 0) != 2 || buf[1] != 'Y'){
+    printf("%s: shared store not seen by read\n", s);
+    exit(1);
+  }
+  if(munmap(p, PGSIZE) < 0 || munmap(p + PGSIZE, N - PGSIZE) < 0){
+    printf("%s: munmap shared failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, N) != N || buf[0] != 'a' || buf[1] != 'Y' ||
+     buf[2] != 'W' || buf[N-1] != 'X'){
+    printf("%s: shared stores not written back\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("mmapfile");
+
+  // shared anonymous memory is shared with children.
+  p = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap anonymous failed\n", s);
+    exit(1);
+  }
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    p[10] = 42;
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != 0 || p[10] != 42){
+    printf("%s: anonymous memory not shared\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+
+  // PROT_NONE: the kernel can't reach it either.
+  p = mmap(0, PGSIZE, PROT_NONE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == (char*)-1){
+    printf("%s: mmap PROT_NONE failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  write(fds[1], "x", 1);
+  if(read(fds[0], p, 1) > 0){
+    printf("%s: read into PROT_NONE memory succeeded\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    xstatus = p[0];
+    exit(0);
+  }
+  wait(&xstatus);
+  if(xstatus != -1){
+    printf("%s: load from PROT_NONE memory succeeded\n", s);
+    exit(1);
+  }
+  munmap(p, PGSIZE);
+  free(buf);
+}
+
+// write() a mapping of a file not yet touched into a pipe, and
+// read() it back into another: the page faults in pipewrite()
+// and piperead() can't wait for the disk with the pipe locked.
+void
+mmappipetest(char *s)
+{
+  char *buf, *p, *q;
+  int fd, fds[2], i;
+
+  buf = malloc(2*PGSIZE);
+  for(i = 0; i < 2*PGSIZE; i++)
+    buf[i] = 'a' + i % 29;
+  unlink("mmappipe");
+  fd = open("mmappipe", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, buf, 2*PGSIZE) != 2*PGSIZE){
+    printf("%s: write mmappipe failed\n", s);
+    exit(1);
+  }
+  p = mmap(0, PGSIZE, PROT_READ, MAP_PRIVATE, fd, 0);
+  q = mmap(0, PGSIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, PGSIZE);
+  if(p == (char*)-1 || q == (char*)-1){
+    printf("%s: mmap failed\n", s);
+    exit(1);
+  }
+  if(pipe(fds) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(write(fds[1], p, PGSIZE) != PGSIZE){
+    printf("%s: write of mapping into pipe failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], q, PGSIZE) != PGSIZE){
+    printf("%s: read from pipe into mapping failed\n", s);
+    exit(1);
+  }
+  if(memcmp(q, buf, PGSIZE) != 0){
+    printf("%s: wrong data through pipe\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+  close(fds[1]);
+  munmap(p, PGSIZE);
+  munmap(q, PGSIZE);
+  close(fd);
+  unlink("mmappipe");
+  free(buf);
+}
+
+// writev() across several transactions, then readv(), pread()
+// and pwrite(), which must leave the file offset alone.
+void
+iovtest(char *s)
+{
+  enum { N = 3*MAXOPBLOCKS*BSIZE };
+  static char big[N];
+  char buf[8];
+  struct iovec iov[3];
+  int fd, i;
+
+  for(i = 0; i < N; i++)
+    big[i] = 'a' + i % 23;
+  unlink("iovfile");
+  fd = open("iovfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create iovfile failed\n", s);
+    exit(1);
+  }
+  iov[0].iov_base = "head";
+  iov[0].iov_len = 4;
+  iov[1].iov_base = 0;
+  iov[1].iov_len = 0;
+  iov[2].iov_base = big;
+  iov[2].iov_len = N;
+  if(writev(fd, iov, 3) != 4 + N){
+    printf("%s: writev failed\n", s);
+    exit(1);
+  }
+
+  if(pwrite(fd, "XY", 2, 1) != 2 || pread(fd, buf, 4, 0) != 4 ||
+     memcmp(buf, "hXYd", 4) != 0){
+    printf("%s: pwrite/pread wrong\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 2, 4 + N - 1) != 1 || buf[0] != big[N-1]){
+    printf("%s: pread at the end wrong\n", s);
+    exit(1);
+  }
+  if(read(fd, buf, 1) != 0){
+    printf("%s: pread/pwrite moved the offset\n", s);
+    exit(1);
+  }
+  close(fd);
+
+  fd = open("iovfile", O_RDONLY);
+  iov[0].iov_base = buf;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = buf + 3;
+  iov[1].iov_len = 3;
+  if(readv(fd, iov, 2) != 6 || memcmp(buf, "hXYdab", 6) != 0){
+    printf("%s: readv wrong\n", s);
+    exit(1);
+  }
+  if(pread(fd, buf, 1, -1) != -1){
+    printf("%s: pread at a negative offset succeeded\n", s);
+    exit(1);
+  }
+  close(fd);
+  unlink("iovfile");
+}
+
+// O_NONBLOCK pipes and poll().
+void
+polltest(char *s)
+{
+  int fds[2], pid, t0, xst;
+  struct pollfd pfd[3];
+  char buf[4];
+
+  if(pipe(fds) != 0){
+    printf("%s: pipe() failed\n", s);
+    exit(1);
+  }
+  if(fcntl(fds[0], F_SETFL, O_NONBLOCK) != 0 ||
+     fcntl(fds[0], F_GETFL, 0) != (O_RDONLY|O_NONBLOCK)){
+    printf("%s: fcntl failed\n", s);
+    exit(1);
+  }
+  if(read(fds[0], buf, 1) != -1){
+    printf("%s: non-blocking read of an empty pipe didn't fail\n", s);
+    exit(1);
+  }
+
+  pfd[0].fd = fds[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = fds[1];
+  pfd[1].events = POLLOUT;
+  pfd[2].fd = NOFILE - 1;  // not open
+  pfd[2].events = POLLIN;
+  if(poll(pfd, 3, 0) != 2 || pfd[0].revents != 0 ||
+     pfd[1].revents != POLLOUT || pfd[2].revents != POLLNVAL){
+    printf("%s: poll of an empty pipe wrong\n", s);
+    exit(1);
+  }
+
+  // a timeout expires.
+  t0 = uptime();
+  if(poll(pfd, 1, 200) != 0 || pfd[0].revents != 0 || uptime() - t0 < 1){
+    printf("%s: poll timeout wrong\n", s);
+    exit(1);
+  }
+
+  // a writer wakes a poll() that waits.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(fds[0]);
+    usleep(100000);
+    write(fds[1], "x", 1);
+    exit(0);
+  }
+  close(fds[1]);
+  if(poll(pfd, 1, -1) != 1 || pfd[0].revents != POLLIN ||
+     read(fds[0], buf, sizeof(buf)) != 1 || buf[0] != 'x'){
+    printf("%s: poll didn't see the write\n", s);
+    exit(1);
+  }
+  wait(&xst);
+
+  // the writer has exited.
+  if(poll(pfd, 1, -1) != 1 || (pfd[0].revents & POLLHUP) == 0 ||
+     read(fds[0], buf, 1) != 0){
+    printf("%s: poll didn't see the pipe close\n", s);
+    exit(1);
+  }
+  close(fds[0]);
+}
+
+// threads from clone(): a shared counter behind a mutex,
+// join() statuses, shared files, and exit() of the
+// first thread taking the others with it.
+#define NCLONE 4
+char clonestack[NCLONE][4096] __attribute__((aligned(16)));
+mutex_t clonelock;
+int clonecount, clonefd;
+
+void
+clonework(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&clonelock);
+    clonecount++;
+    mutex_unlock(&clonelock);
+  }
+  if(arg)
+    exit((uint64)arg);
+}
+
+void
+clonefile(void *arg)
+{
+  clonefd = open("clonefile", O_CREATE|O_RDWR);
+}
+
+void
+clonesleep(void *arg)
+{
+  int zero = 0;
+
+  for(;;)
+    futex_wait(&zero, 0);
+}
+
+void
+clonetest(char *s)
+{
+  int tids[NCLONE], i, xst, pid;
+
+  for(i = 0; i < NCLONE; i++){
+    tids[i] = thread_create(clonework, (void*)(uint64)i, clonestack[i], sizeof(clonestack[i]));
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++){
+    if(join(tids[i], &xst) != tids[i] || xst != i){
+      printf("%s: join of thread %d wrong, status %d\n", s, i, xst);
+      exit(1);
+    }
+  }
+  if(clonecount != NCLONE*1000){
+    printf("%s: count %d, not %d\n", s, clonecount, NCLONE*1000);
+    exit(1);
+  }
+  if(join(tids[0], 0) != -1){
+    printf("%s: second join of a thread didn't fail\n", s);
+    exit(1);
+  }
+
+  // a file one thread opens is open in the others.
+  clonefd = -1;
+  if(join(thread_create(clonefile, 0, clonestack[0], sizeof(clonestack[0])), 0) < 0 ||
+     clonefd < 0 || write(clonefd, "x", 1) != 1 || close(clonefd) != 0){
+    printf("%s: file opened by a thread not shared\n", s);
+    exit(1);
+  }
+  unlink("clonefile");
+
+  // exit() of the first thread ends a process whose other
+  // threads are asleep.
+  pid = fork();
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    for(i = 0; i < NCLONE; i++)
+      thread_create(clonesleep, 0, clonestack[i], sizeof(clonestack[i]));
+    exit(0);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: process with threads didn't exit\n", s);
+    exit(1);
+  }
+}
+
+// fork() of a process whose other threads keep writing: the
+// child's copy must not change, so the threads' CPUs must have
+// dropped their writable TLB entries when fork() made the
+// pages copy-on-write.
+volatile int shootcount, shootstop;
+
+void
+shootwork(void *arg)
+{
+  while(!shootstop)
+    shootcount++;
+}
+
+void
+shootdowntest(char *s)
+{
+  int tids[NCLONE], i, n, pid, xst, a;
+
+  shootstop = 0;
+  for(i = 0; i < NCLONE; i++){
+    tids[i] = thread_create(shootwork, 0, clonestack[i], sizeof(clonestack[i]));
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(n = 0; n < 20; n++){
+    pid = fork();
+    if(pid < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      a = shootcount;
+      sleep(1);
+      exit(shootcount == a ? 0 : 1);
+    }
+    if(wait(&xst) != pid || xst != 0){
+      printf("%s: child's copy changed after fork\n", s);
+      exit(1);
+    }
+  }
+  shootstop = 1;
+  for(i = 0; i < NCLONE; i++)
+    join(tids[i], 0);
+}
+
+// files in the tmpfs on /tmp: a device of their own, data that
+// reads back across pages, and ".." back out to /.
+void
+tmpfstest(char *s)
+{
+  struct stat rst, st;
+  char b[64];
+  int fd, i, n;
+
+  if(stat("/", &rst) < 0 || stat("/tmp", &st) < 0){
+    printf("%s: stat failed\n", s);
+    exit(1);
+  }
+  if(st.type != T_DIR || st.dev == rst.dev){
+    printf("%s: /tmp is not a tmpfs directory\n", s);
+    exit(1);
+  }
+  if(mkdir("/tmp/tmpfsd") < 0){
+    printf("%s: mkdir failed\n", s);
+    exit(1);
+  }
+  fd = open("/tmp/tmpfsd/f", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++)
+    b[i] = i;
+  for(n = 0; n < 200; n++){
+    if(write(fd, b, sizeof(b)) != sizeof(b)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+  if(stat("/tmp/tmpfsd/f", &st) < 0 || st.size != 200*sizeof(b)){
+    printf("%s: wrong size\n", s);
+    exit(1);
+  }
+  fd = open("/tmp/tmpfsd/f", O_RDONLY);
+  if(pread(fd, b, sizeof(b), 3*4096 - 10) != sizeof(b)){
+    printf("%s: read failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < sizeof(b); i++){
+    if(b[i] != (3*4096 - 10 + i) % sizeof(b)){
+      printf("%s: wrong data across pages\n", s);
+      exit(1);
+    }
+  }
+  close(fd);
+
+  if(link("/tmp/tmpfsd/f", "/tmpfslink") == 0){
+    printf("%s: link across file systems succeeded\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp") == 0){
+    printf("%s: unlinked the mount point\n", s);
+    exit(1);
+  }
+  if(chdir("/tmp/tmpfsd") < 0 || chdir("../..") < 0 ||
+     stat(".", &st) < 0 || st.dev != rst.dev || st.ino != rst.ino){
+    printf("%s: .. did not lead back to /\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tmpfsd") == 0){
+    printf("%s: unlinked a non-empty directory\n", s);
+    exit(1);
+  }
+  if(unlink("/tmp/tmpfsd/f") < 0 || unlink("/tmp/tmpfsd") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+  if(open("/tmp/tmpfsd/f", O_RDONLY) >= 0){
+    printf("%s: open of unlinked file succeeded\n", s);
+    exit(1);
+  }
+}
+
+// the second disk, mounted on /mnt.  A mount lasts until the
+// machine stops, so a second run finds it there already.
+void
+mounttest(char *s)
+{
+  struct stat rst, st;
+  int fd;
+
+  mkdir("/mnt");
+  if(stat("/", &rst) < 0 || stat("/mnt", &st) < 0){
+    printf("%s: stat failed\n", s);
+    exit(1);
+  }
+  if(st.dev != ROOTDEV+1 && mount("/mnt", ROOTDEV+1) < 0){
+    printf("%s: mount failed\n", s);
+    exit(1);
+  }
+  // neither a mount point nor a mounted root goes twice.
+  mkdir("/mnt2");
+  if(mount("/mnt", ROOTDEV+1) == 0 || mount("/", ROOTDEV+1) == 0 ||
+     mount("/mnt2", ROOTDEV+1) == 0){
+    printf("%s: mounted twice\n", s);
+    exit(1);
+  }
+  unlink("/mnt2");
+  fd = open("/mnt/mountf", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "mount", 5) != 5){
+    printf("%s: write failed\n", s);
+    exit(1);
+  }
+  if(fstat(fd, &st) < 0 || st.dev != ROOTDEV+1){
+    printf("%s: file is on dev %d\n", s, st.dev);
+    exit(1);
+  }
+  if(fsync(fd) < 0){
+    printf("%s: fsync failed\n", s);
+    exit(1);
+  }
+  close(fd);
+  if(unlink("/mnt") == 0){
+    printf("%s: unlinked the mount point\n", s);
+    exit(1);
+  }
+  if(chdir("/mnt") < 0 || chdir("..") < 0 ||
+     stat(".", &st) < 0 || st.dev != rst.dev || st.ino != rst.ino){
+    printf("%s: .. did not lead back to /\n", s);
+    exit(1);
+  }
+  if(unlink("/mnt/mountf") < 0){
+    printf("%s: unlink failed\n", s);
+    exit(1);
+  }
+}
+
+// perfopen() and perfread(): the calling thread's cycles and
+// instructions, from zero, going up as it runs and sleeps.
+void
+perftest(char *s)
+{
+  uint64 v[NPERF], w[NPERF];
+  volatile int i, x;
+
+  if(perfopen() != NPERF){
+    printf("%s: perfopen failed\n", s);
+    exit(1);
+  }
+  for(i = x = 0; i < 100000; i++)
+    x += i;
+  if(perfread(v, NPERF) != NPERF || v[PERF_CYCLES] == 0 ||
+     v[PERF_INSTRET] < 100000){
+    printf("%s: counted %d cycles %d instructions\n", s,
+           (int)v[PERF_CYCLES], (int)v[PERF_INSTRET]);
+    exit(1);
+  }
+  sleep(2);
+  if(perfread(w, 2) != 2 || w[PERF_CYCLES] <= v[PERF_CYCLES] ||
+     w[PERF_INSTRET] <= v[PERF_INSTRET]){
+    printf("%s: counts did not go up\n", s);
+    exit(1);
+  }
+  perfopen();
+  if(perfread(w, 2) != 2 || w[PERF_INSTRET] >= v[PERF_INSTRET]){
+    printf("%s: perfopen did not start from zero\n", s);
+    exit(1);
+  }
+  if(perfread((uint64*)0xffffffffffffull, NPERF) >= 0){
+    printf("%s: perfread to a bad address succeeded\n", s);
+    exit(1);
+  }
+}
+
+// condition variables and futex_wake()'s count: threads
+// pass a token round a ring, each waiting for its turn.
+#define NTURN 200
+mutex_t condlock;
+cond_t condturn;
+int condnext;
+
+void
+condwork(void *arg)
+{
+  int me = (uint64)arg, i;
+
+  for(i = 0; i < NTURN; i++){
+    mutex_lock(&condlock);
+    while(condnext % NCLONE != me)
+      cond_wait(&condturn, &condlock);
+    condnext++;
+    cond_broadcast(&condturn);
+    mutex_unlock(&condlock);
+  }
+}
+
+void
+condtest(char *s)
+{
+  int tids[NCLONE], i, word = 0;
+
+  for(i = 0; i < NCLONE; i++){
+    tids[i] = thread_create(condwork, (void*)(uint64)i, clonestack[i], sizeof(clonestack[i]));
+    if(tids[i] < 0){
+      printf("%s: thread_create failed\n", s);
+      exit(1);
+    }
+  }
+  for(i = 0; i < NCLONE; i++)
+    join(tids[i], 0);
+  if(condnext != NCLONE*NTURN){
+    printf("%s: %d turns, not %d\n", s, condnext, NCLONE*NTURN);
+    exit(1);
+  }
+
+  if(futex_wait(&word, 1) != 0 || futex_wake(&word, 1) != 0 ||
+     futex_wait((int*)1, 0) != -1){
+    printf("%s: futex of a word no one waits on wrong\n", s);
+    exit(1);
+  }
+}
+
+// setaffinity(): bad requests fail, and processes pinned to
+// one CPU, as children inherit, still all get to run.
+void
+affinitytest(char *s)
+{
+  int i, pid, xst;
+  volatile int n;
+
+  if(setaffinity(0, 0) != -1 || setaffinity(-1, 1) != -1){
+    printf("%s: bad setaffinity didn't fail\n", s);
+    exit(1);
+  }
+  if(setaffinity(0, 1) != 0){
+    printf("%s: setaffinity failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < 4; i++){
+    if((pid = fork()) < 0){
+      printf("%s: fork failed\n", s);
+      exit(1);
+    }
+    if(pid == 0){
+      for(n = 0; n < 10000000; n++)
+        ;
+      exit(0);
+    }
+  }
+  for(i = 0; i < 4; i++){
+    if(wait(&xst) < 0 || xst != 0){
+      printf("%s: pinned child failed\n", s);
+      exit(1);
+    }
+  }
+  setaffinity(0, -1);
+}
+
+// spawn() a child with its output on a pipe.
+void
+spawntest(char *s)
+{
+  char *args[] = { "echo", "spawned", 0 };
+  char buf[32];
+  int fds[3], p[2], n, xst;
+
+  if(spawn("nonexistent", args, 0, 0) != -1){
+    printf("%s: spawn of nonexistent succeeded\n", s);
+    exit(1);
+  }
+  fds[0] = 0;
+  fds[1] = 42;
+  fds[2] = 2;
+  if(spawn("echo", args, fds, 3) != -1){
+    printf("%s: spawn with a bad fd succeeded\n", s);
+    exit(1);
+  }
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  fds[1] = p[1];
+  if(spawn("echo", args, fds, 3) < 0){
+    printf("%s: spawn failed\n", s);
+    exit(1);
+  }
+  close(p[1]);
+  n = read(p[0], buf, sizeof(buf) - 1);
+  close(p[0]);
+  if(n != 8 || memcmp(buf, "spawned\n", 8) != 0){
+    printf("%s: wrong output from spawned echo\n", s);
+    exit(1);
+  }
+  if(wait(&xst) < 0 || xst != 0){
+    printf("%s: spawned echo failed\n", s);
+    exit(1);
+  }
+}
+
+volatile int vforkseen;
+
+// a vfork() child runs in its parent's memory, but has its
+// own descriptors.
+void
+vforktest(char *s)
+{
+  char *args[] = { "echo", "vforked", 0 };
+  char buf[32];
+  int pid, p[2], n, xst;
+
+  vforkseen = 0;
+  if((pid = vfork()) < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    vforkseen = sbrk(PGSIZE) == (char*)-1 ? 1 : 2;
+    _exit(7);
+  }
+  if(vforkseen != 1){
+    printf("%s: vfork child's memory wasn't the parent's\n", s);
+    exit(1);
+  }
+  if(wait(&xst) != pid || xst != 7){
+    printf("%s: wrong status from vfork child\n", s);
+    exit(1);
+  }
+
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if((pid = vfork()) < 0){
+    printf("%s: vfork failed\n", s);
+    exit(1);
+  }
+  if(pid == 0){
+    close(1);
+    dup(p[1]);
+    close(p[0]);
+    close(p[1]);
+    exec("echo", args);
+    _exit(1);
+  }
+  close(p[1]);
+  n = read(p[0], buf, sizeof(buf) - 1);
+  close(p[0]);
+  if(n != 8 || memcmp(buf, "vforked\n", 8) != 0){
+    printf("%s: wrong output from vfork child\n", s);
+    exit(1);
+  }
+  if(wait(&xst) != pid || xst != 0){
+    printf("%s: vfork child's exec failed\n", s);
+    exit(1);
+  }
+}
+
+// the procs device lists this process, with a nonzero
+// system call count once it has made some.
+void
+procstest(char *s)
+{
+  static char buf[NPROC*128];
+  char *p;
+  int fd, n, m, i;
+
+  if((fd = open("procs", O_RDONLY)) < 0){
+    printf("%s: open procs failed\n", s);
+    exit(1);
+  }
+  for(n = 0; n < sizeof(buf) - 1 && (m = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0; n += m)
+    ;
+  close(fd);
+  buf[n] = 0;
+
+  // "pid ppid tgid state prio cpu user sys switches faults reads
+  // writes syscalls ...": find our line and its syscalls field.
+  for(p = buf; *p; p++){
+    if((p == buf || p[-1] == '\n') && atoi(p) == _getpid())
+      break;
+  }
+  if(*p == 0){
+    printf("%s: no line for pid %d\n", s, _getpid());
+    exit(1);
+  }
+  for(i = 0; i < 12; i++){
+    while(*p != ' ')
+      p++;
+    p++;
+  }
+  if(atoi(p) <= 0){
+    printf("%s: no system calls counted\n", s);
+    exit(1);
+  }
+}
+
+// Read a file of more pages than the buffer cache has blocks a
+// second time, which the page cache should answer without the
+// disk, and check that reads see the writes and truncation
+// that follow.
+#define PCPAGES 300
+
+int
+pcachecheck(char *s, int fd, int size, int over)
+{
+  static char pg[4096];
+  int off, n, i;
+
+  for(off = 0; off < size; off += n){
+    n = size - off < sizeof(pg) ? size - off : sizeof(pg);
+    if(read(fd, pg, n) != n){
+      printf("%s: short read at %d\n", s, off);
+      return -1;
+    }
+    for(i = 0; i < n; i++){
+      if(pg[i] != (off + i < over ? 'Z' : 'a' + (off + i) / 4096 % 26)){
+        printf("%s: wrong byte at %d\n", s, off + i);
+        return -1;
+      }
+    }
+  }
+  if(read(fd, pg, 1) != 0){
+    printf("%s: read past the end\n", s);
+    return -1;
+  }
+  return 0;
+}
+
 void
-writebig(char *s)
+pcachetest(char *s)
 {
-  int i, fd, n;
+  static char pg[4096];
+  static char procs[NPROC*128];
+  int fd, i, n, m, pid, xst, size;
+  char *p;
 
-  fd = open("big", O_CREATE|O_RDWR);
-  if(fd < 0){
-    printf("%s: error: creat big failed!\n", s);
+  size = PCPAGES*4096 + 100;
+  if((fd = open("pcache", O_CREATE|O_RDWR|O_TRUNC)) < 0){
+    printf("%s: create failed\n", s);
     exit(1);
   }
-
-  for(i = 0; i < MAXFILE; i++){
-    ((int*)buf)[0] = i;
-    if(write(fd, buf, BSIZE) != BSIZE){
-      printf("%s: error: write big file failed\n", s, i);
+  for(i = 0; i * 4096 < size; i++){
+    memset(pg, 'a' + i % 26, sizeof(pg));
+    n = size - i*4096 < sizeof(pg) ? size - i*4096 : sizeof(pg);
+    if(write(fd, pg, n) != n){
+      printf("%s: write failed\n", s);
       exit(1);
     }
   }
+  close(fd);
 
+  if((fd = open("pcache", O_RDONLY)) < 0 || pcachecheck(s, fd, size, 0) < 0)
+    exit(1);
   close(fd);
 
-  fd = open("big", O_RDONLY);
-  if(fd < 0){
-    printf("%s: error: open big failed!\n", s);
+  // again, in a child so that the procs device's reads are
+  // only this read's.
+  if((pid = fork()) < 0){
+    printf("%s: fork failed\n", s);
     exit(1);
   }
-
-  n = 0;
-  for(;;){
-    i = read(fd, buf, BSIZE);
-    if(i == 0){
-      if(n == MAXFILE - 1){
-        printf("%s: read only %d blocks from big", s, n);
-        exit(1);
-      }
-      break;
-    } else if(i != BSIZE){
-      printf("%s: read failed %d\n", s, i);
+  if(pid == 0){
+    if((fd = open("pcache", O_RDONLY)) < 0 || pcachecheck(s, fd, size, 0) < 0)
+      exit(1);
+    close(fd);
+    if((fd = open("procs", O_RDONLY)) < 0){
+      printf("%s: open procs failed\n", s);
       exit(1);
     }
-    if(((int*)buf)[0] != n){
-      printf("%s: read content of block %d is %d\n", s,
-             n, ((int*)buf)[0]);
+    for(n = 0; n < sizeof(procs) - 1 && (m = read(fd, procs + n, sizeof(procs) - 1 - n)) > 0; n += m)
+      ;
+    close(fd);
+    procs[n] = 0;
+    for(p = procs; *p; p++){
+      if((p == procs || p[-1] == '\n') && atoi(p) == _getpid())
+        break;
+    }
+    if(*p == 0){
+      printf("%s: no line for pid %d\n", s, _getpid());
       exit(1);
     }
-    n++;
+    // pid ppid tgid state prio cpu user sys switches faults reads
+    for(i = 0; i < 10; i++){
+      while(*p != ' ')
+        p++;
+      p++;
+    }
+    if(atoi(p) > PCPAGES / 10){
+      printf("%s: read it again from the disk, %d blocks\n", s, atoi(p));
+      exit(1);
+    }
+    exit(0);
   }
-  close(fd);
-  if(unlink("big") < 0){
-    printf("%s: unlink big failed\n", s);
+  wait(&xst);
+  if(xst != 0)
     exit(1);
-  }
-}
 
-// many creates, followed by unlink test
-void
-createtest(char *s)
-{
-  int i, fd;
-  enum { N=52 };
-
-  char name[3];
-  name[0] = 'a';
-  name[2] = '\0';
-  for(i = 0; i < N; i++){
-    name[1] = '0' + i;
-    fd = open(name, O_CREATE|O_RDWR);
-    close(fd);
+  // overwrite the start, ending in the middle of a page.
+  if((fd = open("pcache", O_RDWR)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
   }
-  name[0] = 'a';
-  name[2] = '\0';
-  for(i = 0; i < N; i++){
-    name[1] = '0' + i;
-    unlink(name);
+  memset(pg, 'Z', sizeof(pg));
+  for(i = 0; i < 2; i++){
+    if(write(fd, pg, sizeof(pg)) != sizeof(pg) || write(fd, pg, 1000) != 1000){
+      printf("%s: overwrite failed\n", s);
+      exit(1);
+    }
   }
-}
-
-void dirtest(char *s)
-{
-  if(mkdir("dir0") < 0){
-    printf("%s: mkdir failed\n", s);
+  close(fd);
+  if((fd = open("pcache", O_RDONLY)) < 0 || pcachecheck(s, fd, size, 2*(4096+1000)) < 0)
     exit(1);
-  }
+  close(fd);
 
-  if(chdir("dir0") < 0){
-    printf("%s: chdir dir0 failed\n", s);
+  if((fd = open("pcache", O_RDWR|O_TRUNC)) < 0 || write(fd, "Z", 1) != 1){
+    printf("%s: truncate failed\n", s);
     exit(1);
   }
+  close(fd);
+  if((fd = open("pcache", O_RDONLY)) < 0 || pcachecheck(s, fd, 1, 1) < 0)
+    exit(1);
+  close(fd);
+  unlink("pcache");
+}
 
-  if(chdir("..") < 0){
-    printf("%s: chdir .. failed\n", s);
+// The i'th number (from 0) on the statistics device's line
+// that starts with name, such as "disk: ".
+int
+statsfield(char *s, char *name, int i)
+{
+  static char stats[8192];
+  char *p;
+  int fd, n, m;
+
+  if((fd = open("statistics", O_RDONLY)) < 0){
+    printf("%s: open statistics failed\n", s);
     exit(1);
   }
-
-  if(unlink("dir0") < 0){
-    printf("%s: unlink dir0 failed\n", s);
+  for(n = 0; n < sizeof(stats) - 1 && (m = read(fd, stats + n, sizeof(stats) - 1 - n)) > 0; n += m)
+    ;
+  close(fd);
+  stats[n] = 0;
+  // "name N things, N things, ..."
+  for(p = stats; *p; p++)
+    if((p == stats || p[-1] == '\n') && memcmp(p, name, strlen(name)) == 0)
+      break;
+  if(*p)
+    p += strlen(name) - 2;
+  for(; *p && i >= 0; i--){
+    while(*p && *p != ',' && *p != ':')
+      p++;
+    if(*p)
+      p += 2;
+  }
+  if(*p == 0){
+    printf("%s: no %s line in statistics\n", s, name);
     exit(1);
   }
+  return atoi(p);
+}
+
+// The number of blocks written to the disk.
+int
+diskwrites(char *s)
+{
+  return statsfield(s, "disk: ", 1);
 }
 
+// Data written to a file waits in the page cache, so a
+// temporary file removed before the flusher gets to it costs
+// the disk none of its blocks, while fsync() writes a file's
+// data home at once.
+#define DAPAGES 200
+
 void
-exectest(char *s)
+delalloctest(char *s)
 {
-  int fd, xstatus, pid;
-  char *echoargv[] = { "echo", "OK", 0 };
-  char buf[3];
+  static char pg[4096];
+  int fd, i, j, w0, w1, p[2];
 
-  unlink("echo-ok");
-  pid = fork();
-  if(pid < 0) {
-     printf("%s: fork failed\n", s);
-     exit(1);
+  sync();
+  w0 = diskwrites(s);
+  if((fd = open("delalloc", O_CREATE|O_RDWR|O_TRUNC)) < 0){
+    printf("%s: create failed\n", s);
+    exit(1);
   }
-  if(pid == 0) {
-    close(1);
-    fd = open("echo-ok", O_CREATE|O_WRONLY);
-    if(fd < 0) {
-      printf("%s: create failed\n", s);
+  for(i = 0; i < DAPAGES; i++){
+    memset(pg, 'a' + i % 26, sizeof(pg));
+    if(write(fd, pg, sizeof(pg)) != sizeof(pg)){
+      printf("%s: write failed\n", s);
       exit(1);
     }
-    if(fd != 1) {
-      printf("%s: wrong fd\n", s);
+  }
+  close(fd);
+  if((fd = open("delalloc", O_RDONLY)) < 0){
+    printf("%s: open failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < DAPAGES; i++){
+    if(read(fd, pg, sizeof(pg)) != sizeof(pg)){
+      printf("%s: read failed\n", s);
       exit(1);
     }
-    if(exec("echo", echoargv) < 0){
-      printf("%s: exec echo failed\n", s);
-      exit(1);
+    for(j = 0; j < sizeof(pg); j++){
+      if(pg[j] != 'a' + i % 26){
+        printf("%s: wrong byte at %d\n", s, i*4096 + j);
+        exit(1);
+      }
     }
-    // won't get to here
   }
-  if (wait(&xstatus) != pid) {
-    printf("%s: wait failed!\n", s);
+  close(fd);
+  unlink("delalloc");
+  w1 = diskwrites(s);
+  if(w1 - w0 > DAPAGES){
+    printf("%s: %d blocks written for a file already gone\n", s, w1 - w0);
+    exit(1);
   }
-  if(xstatus != 0)
-    exit(xstatus);
 
-  fd = open("echo-ok", O_RDONLY);
-  if(fd < 0) {
-    printf("%s: open failed\n", s);
+  if((fd = open("delalloc", O_CREATE|O_RDWR)) < 0){
+    printf("%s: create failed\n", s);
     exit(1);
   }
-  if (read(fd, buf, 2) != 2) {
-    printf("%s: read failed\n", s);
+  memset(pg, 'f', sizeof(pg));
+  for(i = 0; i < 10; i++){
+    if(write(fd, pg, sizeof(pg)) != sizeof(pg)){
+      printf("%s: write failed\n", s);
+      exit(1);
+    }
+  }
+  w0 = diskwrites(s);
+  if(fsync(fd) != 0){
+    printf("%s: fsync failed\n", s);
     exit(1);
   }
-  unlink("echo-ok");
-  if(buf[0] == 'O' && buf[1] == 'K')
-    exit(0);
-  else {
-    printf("%s: wrong output\n", s);
+  w1 = diskwrites(s);
+  if(w1 - w0 < 10*4096/BSIZE){
+    printf("%s: fsync wrote only %d blocks\n", s, w1 - w0);
     exit(1);
   }
+  close(fd);
+  unlink("delalloc");
 
+  if(pipe(p) < 0){
+    printf("%s: pipe failed\n", s);
+    exit(1);
+  }
+  if(fsync(p[0]) != -1){
+    printf("%s: fsync of a pipe succeeded\n", s);
+    exit(1);
+  }
+  close(p[0]);
+  close(p[1]);
+  if(sync() != 0){
+    printf("%s: sync failed\n", s);
+    exit(1);
+  }
 }
 
-// simple fork and pipe read/write
+// A file that starts small enough to keep its data in the
+// inode, then outgrows it and shrinks again, each step written
+// home with fsync().
+void
+inlinetest(char *s)
+{
+  static char data[2000], got[2000];
+  int fd, i, n, sizes[] = { 20, 52, 53, 2000, 0, 7 };
+
+  for(i = 0; i < sizeof(data); i++)
+    data[i] = 'A' + i % 37;
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++){
+    n = sizes[i];
+    // grow by writing on past the end, shrink by truncating.
+    if(i > 0 && n > sizes[i-1]){
+      fd = open("inline", O_WRONLY);
+      if(fd >= 0 && (write(fd, data, sizes[i-1]) != sizes[i-1] ||
+                     write(fd, data + sizes[i-1], n - sizes[i-1]) != n - sizes[i-1])){
+        printf("%s: append to %d failed\n", s, n);
+        exit(1);
+      }
+    } else {
+      fd = open("inline", O_CREATE|O_WRONLY|O_TRUNC);
+      if(fd >= 0 && write(fd, data, n) != n){
+        printf("%s: write of %d failed\n", s, n);
+        exit(1);
+      }
+    }
+    if(fd < 0 || fsync(fd) != 0){
+      printf("%s: open or fsync at %d failed\n", s, n);
+      exit(1);
+    }
+    close(fd);
+    if((fd = open("inline", O_RDONLY)) < 0){
+      printf("%s: open failed\n", s);
+      exit(1);
+    }
+    if(read(fd, got, sizeof(got)) != n || memcmp(got, data, n) != 0){
+      printf("%s: wrong contents at size %d\n", s, n);
+      exit(1);
+    }
+    close(fd);
+  }
+  unlink("inline");
+}
 
+// A process that uses more memory than is free gets by with
+// its least used pages in the swap area, and finds its data
+// intact when it touches them again.
 void
-pipe1(char *s)
+swaptest(char *s)
 {
-  int fds[2], pid, xstatus;
-  int seq, i, n, cc, total;
-  enum { N=5, SZ=1033 };
-  
-  if(pipe(fds) != 0){
-    printf("%s: pipe() failed\n", s);
-    exit(1);
+  int i, n, pid, xst, out0;
+  char *a;
+
+  if(statsfield(s, "swap: ", 0) < 512){
+    printf("%s: swap area too small, skipping\n", s);
+    return;
   }
+  sync();
+  n = statsfield(s, "mem: ", 0) + statsfield(s, "pcache: ", 0) + 256;
+  out0 = statsfield(s, "swap: ", 2);
   pid = fork();
-  seq = 0;
+  if(pid < 0){
+    printf("%s: fork failed\n", s);
+    exit(1);
+  }
   if(pid == 0){
-    close(fds[0]);
-    for(n = 0; n < N; n++){
-      for(i = 0; i < SZ; i++)
-        buf[i] = seq++;
-      if(write(fds[1], buf, SZ) != SZ){
-        printf("%s: pipe1 oops 1\n", s);
+    if((a = sbrk(n * PGSIZE)) == (char*)-1){
+      printf("%s: sbrk failed\n", s);
+      exit(1);
+    }
+    for(i = 0; i < n; i++)
+      *(int*)(a + i*PGSIZE) = i;
+    for(i = 0; i < n; i++){
+      if(*(int*)(a + i*PGSIZE) != i){
+        printf("%s: page %d has %d\n", s, i, *(int*)(a + i*PGSIZE));
         exit(1);
       }
     }
     exit(0);
-  } else if(pid > 0){
-    close(fds[1]);
-    total = 0;
-    cc = 1;
-    while((n = read(fds[0], buf, cc)) > 0){
-      for(i = 0; i < n; i++){
-        if((buf[i] & 0xff) != (seq++ & 0xff)){
-          printf("%s: pipe1 oops 2\n", s);
-          return;
-        }
-      }
-      total += n;
-      cc = cc * 2;
-      if(cc > sizeof(buf))
-        cc = sizeof(buf);
-    }
-    if(total != N * SZ){
-      printf("%s: pipe1 oops 3 total %d\n", total);
+  }
+  wait(&xst);
+  if(xst != 0)
+    exit(1);
+  if(statsfield(s, "swap: ", 2) == out0){
+    printf("%s: nothing was swapped out\n", s);
+    exit(1);
+  }
+}
+
+// Reads of untouched heap all see the one zero page, so they
+// cost no memory; a write gets the page its own copy.
+void
+zeropagetest(char *s)
+{
+  int i, n, free0;
+  char *a;
+
+  n = 1024;
+  free0 = statsfield(s, "mem: ", 0);
+  if((a = sbrk(n * PGSIZE)) == (char*)-1){
+    printf("%s: sbrk failed\n", s);
+    exit(1);
+  }
+  for(i = 0; i < n; i++){
+    if(a[i * PGSIZE + i % PGSIZE] != 0){
+      printf("%s: page %d isn't zero\n", s, i);
       exit(1);
     }
-    close(fds[0]);
-    wait(&xstatus);
-    exit(xstatus);
-  } else {
-    printf("%s: fork() failed\n", s);
+  }
+  if(free0 - statsfield(s, "mem: ", 0) > n / 2){
+    printf("%s: reads took %d pages\n", s, free0 - statsfield(s, "mem: ", 0));
     exit(1);
   }
+  for(i = 0; i < n; i += 2)
+    a[i * PGSIZE] = 1;
+  for(i = 0; i < n; i++){
+    if(a[i * PGSIZE] != (i % 2 == 0) || a[i * PGSIZE + 1] != 0){
+      printf("%s: page %d is wrong after writes\n", s, i);
+      exit(1);
+    }
+  }
+  sbrk(-n * PGSIZE);
 }
 
-
 // test if child is killed (status = -1)
 void
 killstatus(char *s)
@@ -1866,49 +3432,49 @@ bigfile(char *s)
 }
 
 void
-fourteen(char *s)
+thirty(char *s)
 {
   int fd;
 
-  // DIRSIZ is 14.
+  // DIRSIZ is 30.
 
-  if(mkdir("12345678901234") != 0){
-    printf("%s: mkdir 12345678901234 failed\n", s);
+  if(mkdir("123456789012345678901234567890") != 0){
+    printf("%s: mkdir 123456789012345678901234567890 failed\n", s);
     exit(1);
   }
-  if(mkdir("12345678901234/123456789012345") != 0){
-    printf("%s: mkdir 12345678901234/123456789012345 failed\n", s);
+  if(mkdir("123456789012345678901234567890/1234567890123456789012345678901") != 0){
+    printf("%s: mkdir 123456789012345678901234567890/1234567890123456789012345678901 failed\n", s);
     exit(1);
   }
-  fd = open("123456789012345/123456789012345/123456789012345", O_CREATE);
+  fd = open("1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901", O_CREATE);
   if(fd < 0){
-    printf("%s: create 123456789012345/123456789012345/123456789012345 failed\n", s);
+    printf("%s: create 1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901 failed\n", s);
     exit(1);
   }
   close(fd);
-  fd = open("12345678901234/12345678901234/12345678901234", 0);
+  fd = open("123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890", 0);
   if(fd < 0){
-    printf("%s: open 12345678901234/12345678901234/12345678901234 failed\n", s);
+    printf("%s: open 123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890 failed\n", s);
     exit(1);
   }
   close(fd);
 
-  if(mkdir("12345678901234/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/12345678901234 succeeded!\n", s);
+  if(mkdir("123456789012345678901234567890/123456789012345678901234567890") == 0){
+    printf("%s: mkdir 123456789012345678901234567890/123456789012345678901234567890 succeeded!\n", s);
     exit(1);
   }
-  if(mkdir("123456789012345/12345678901234") == 0){
-    printf("%s: mkdir 12345678901234/123456789012345 succeeded!\n", s);
+  if(mkdir("1234567890123456789012345678901/123456789012345678901234567890") == 0){
+    printf("%s: mkdir 123456789012345678901234567890/1234567890123456789012345678901 succeeded!\n", s);
     exit(1);
   }
 
   // clean up
-  unlink("123456789012345/12345678901234");
-  unlink("12345678901234/12345678901234");
-  unlink("12345678901234/12345678901234/12345678901234");
-  unlink("123456789012345/123456789012345/123456789012345");
-  unlink("12345678901234/123456789012345");
-  unlink("12345678901234");
+  unlink("1234567890123456789012345678901/123456789012345678901234567890");
+  unlink("123456789012345678901234567890/123456789012345678901234567890");
+  unlink("123456789012345678901234567890/123456789012345678901234567890/123456789012345678901234567890");
+  unlink("1234567890123456789012345678901/1234567890123456789012345678901/1234567890123456789012345678901");
+  unlink("123456789012345678901234567890/1234567890123456789012345678901");
+  unlink("123456789012345678901234567890");
 }
 
 void
@@ -2004,13 +3570,16 @@ dirfile(char *s)
 }
 
 // test that iput() is called at the end of _namei().
-// also tests empty file names.
+// also tests empty file names.  NIREF is more inodes than
+// the kernel's inode table used to hold.
+#define NIREF 51
+
 void
 iref(char *s)
 {
   int i, fd;
 
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     if(mkdir("irefd") != 0){
       printf("%s: mkdir irefd failed\n", s);
       exit(1);
@@ -2032,7 +3601,7 @@ iref(char *s)
   }
 
   // clean up
-  for(i = 0; i < NINODE + 1; i++){
+  for(i = 0; i < NIREF; i++){
     chdir("..");
     unlink("irefd");
   }
@@ -2392,11 +3961,11 @@ bigargtest(char *s)
   unlink("bigarg-ok");
   pid = fork();
   if(pid == 0){
-    static char *args[MAXARG];
+    static char *args[32];
     int i;
-    for(i = 0; i < MAXARG-1; i++)
+    for(i = 0; i < 32-1; i++)
       args[i] = "bigargs test: failed\n                                                                                                                                                                                                       ";
-    args[MAXARG-1] = 0;
+    args[32-1] = 0;
     exec("echo", args);
     fd = open("bigarg-ok", O_CREATE);
     close(fd);
@@ -2711,12 +4280,15 @@ execout(char *s)
 // touches the pages to force allocation.
 // because out of memory with lazy allocation results in the process
 // taking a fault and being killed, fork and report back.
+// syncs first, since the page cache can't give up dirty pages.
 //
 int
 countfree()
 {
   int fds[2];
 
+  sync();
+
   if(pipe(fds) < 0){
     printf("pipe() failed in countfree()\n");
     exit(1);
@@ -2797,12 +4369,29 @@ run(void f(char *), char *s) {
   }
 }
 
+// exec() pages a program in as it runs.  Touch all of our own
+// pages up front, so that the free page counts taken before and
+// after the tests don't differ just because running the tests
+// paged in more of usertests.
+void
+pagein(void)
+{
+  uint64 a, end;
+
+  // stop below the stack's guard page.
+  end = (uint64) sbrk(0) - 2*PGSIZE;
+  for(a = 0; a < end; a += PGSIZE)
+    (void) *(volatile char *)a;
+}
+
 int
-main(int argc, char *argv[])
+main(int argc, char *argv[], char *envp[])
 {
   int continuous = 0;
   char *justone = 0;
 
+  if(argc > 1 && strcmp(argv[1], "-e") == 0)
+    exit(execvecheck(argc, argv, envp));
   if(argc == 2 && strcmp(argv[1], "-c") == 0){
     continuous = 1;
   } else if(argc == 2 && strcmp(argv[1], "-C") == 0){
@@ -2850,6 +4439,7 @@ main(int argc, char *argv[])
     {sharedfd, "sharedfd"},
     {dirtest, "dirtest"},
     {exectest, "exectest"},
+    {execvetest, "execve"},
     {bigargtest, "bigargtest"},
     {bigwrite, "bigwrite"},
     {bsstest, "bsstest"},
@@ -2871,11 +4461,35 @@ main(int argc, char *argv[])
     {iputtest, "iput"},
     {mem, "mem"},
     {pipe1, "pipe1"},
+    {splicetest, "splice"},
+    {splicereadtest, "spliceread"},
+    {splicefiletest, "splicefile"},
+    {ushared, "ushared"},
+    {usleeptest, "usleep"},
+    {mmaptest, "mmap"},
+    {mmappipetest, "mmappipe"},
+    {iovtest, "iov"},
+    {polltest, "poll"},
+    {clonetest, "clone"},
+    {condtest, "cond"},
+    {affinitytest, "affinity"},
+    {spawntest, "spawn"},
+    {vforktest, "vfork"},
+    {procstest, "procs"},
+    {pcachetest, "pcache"},
+    {delalloctest, "delalloc"},
+    {inlinetest, "inline"},
+    {swaptest, "swap"},
+    {zeropagetest, "zeropage"},
+    {shootdowntest, "shootdown"},
+    {tmpfstest, "tmpfs"},
+  {mounttest, "mount"},
+  {perftest, "perf"},
     {killstatus, "killstatus"},
     {preempt, "preempt"},
     {exitwait, "exitwait"},
     {rmdot, "rmdot"},
-    {fourteen, "fourteen"},
+    {thirty, "thirty"},
     {bigfile, "bigfile"},
     {dirfile, "dirfile"},
     {iref, "iref"},
@@ -2884,6 +4498,8 @@ main(int argc, char *argv[])
     { 0, 0},
   };
 
+  pagein();
+
   if(continuous){
     printf("continuous usertests starting\n");
     while(1){
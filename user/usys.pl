@@ -6,17 +6,20 @@ print "# generated by usys.pl - do not edit\n";
 
 print "#include \"kernel/syscall.h\"\n";
 
+# entry("x", "sym") names the stub sym instead of x, when
+# ulib.c provides x itself.
 sub entry {
     my $name = shift;
-    print ".global $name\n";
-    print "${name}:\n";
+    my $sym = shift || $name;
+    print ".global $sym\n";
+    print "${sym}:\n";
     print " li a7, SYS_${name}\n";
     print " ecall\n";
     print " ret\n";
 }
 	
 entry("fork");
-entry("exit");
+entry("exit", "_exit");
 entry("wait");
 entry("pipe");
 entry("read");
@@ -32,9 +35,33 @@ entry("link");
 entry("mkdir");
 entry("chdir");
 entry("dup");
-entry("getpid");
+entry("getpid", "_getpid");
 entry("sbrk");
 entry("sleep");
-entry("uptime");
+entry("uptime", "_uptime");
 entry("sigalarm");
 entry("sigreturn");
+entry("splice");
+entry("trace");
+entry("usleep");
+entry("mmap");
+entry("munmap");
+entry("readv");
+entry("writev");
+entry("pread");
+entry("pwrite");
+entry("fcntl");
+entry("poll");
+entry("clone");
+entry("join");
+entry("futex_wait");
+entry("futex_wake");
+entry("setaffinity");
+entry("spawn");
+entry("vfork");
+entry("sync");
+entry("fsync");
+entry("mount");
+entry("execve");
+entry("perfopen");
+entry("perfread");